@@ -0,0 +1,214 @@
+/*
+ * eolbench.c - how fast dopacket() splits a server burst into lines
+ *
+ * Build (from the top of the source tree, after ./Config):
+ *   gcc -O2 -fgnu89-inline -Iinclude -Iextras/regexp/include -Iextras/c-ares/include -o eolbench extras/bench/eolbench.c src/eol.c
+ *
+ * Usage: ./eolbench <burst file> [seconds per variant]
+ *
+ * The file should be a capture of what a server sends on a link when
+ * it connects (everything up to and including EOS), for example taken
+ * with tcpdump or by pointing a link block at "nc -l". burst.raw next
+ * to this file is one: irc.test.net with 951 local users in 237
+ * channels (with topics and bans) linking to a hub. The burst is read
+ * into memory as a whole and then fed to each variant in 8K reads, the
+ * way read_packet() hands it to dopacket(). Lines are copied into a
+ * 512 byte buffer just like dopacket() does, only they are counted
+ * instead of parsed. Each variant is run over the burst again and
+ * again for the given number of seconds (default 2) and the throughput
+ * printed in MB/s (10^6 bytes).
+ *
+ * "byte loop" is the loop dopacket() used before find_eol() came in,
+ * copying and checking one byte at a time. The others are the current
+ * dopacket() loop on top of each of the find_eol() versions in
+ * src/eol.c that the compiler and CPU support.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define EOL_SSE2
+#if (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define EOL_AVX2
+#endif
+#endif
+
+#define READSIZE	8192
+#define BUFSIZE		512
+
+#ifndef MIN
+#define MIN(a, b)	((a) < (b) ? (a) : (b))
+#endif
+
+extern char *find_eol_c(char *, int);
+#ifdef EOL_SSE2
+extern char *find_eol_sse2(char *, int);
+#endif
+#ifdef EOL_AVX2
+extern char *find_eol_avx2(char *, int);
+#endif
+
+typedef struct {
+	char buffer[BUFSIZE];
+	int  count;
+	long lines;
+	long bytes;
+} Conn;
+
+static void got_line(Conn *conn, char *end)
+{
+	conn->lines++;
+	conn->bytes += end - conn->buffer;
+}
+
+/* dopacket() as it was, one byte at a time */
+static void dopacket_byte(Conn *conn, char *buffer, int length)
+{
+	char *ch1 = conn->buffer + conn->count;
+	char *ch2 = buffer;
+
+	while (--length >= 0)
+	{
+		char g = (*ch1 = *ch2++);
+
+		if (g < '\16' && (g == '\n' || g == '\r'))
+		{
+			if (ch1 == conn->buffer)
+				continue;
+			*ch1 = '\0';
+			got_line(conn, ch1);
+			ch1 = conn->buffer;
+		}
+		else if (ch1 < conn->buffer + sizeof(conn->buffer) - 1)
+			ch1++;
+	}
+	conn->count = ch1 - conn->buffer;
+}
+
+/* dopacket() as it is now, on top of the given find_eol() */
+static void dopacket_eol(Conn *conn, char *buffer, int length,
+    char *(*find_eol)(char *, int))
+{
+	char *ch1 = conn->buffer + conn->count;
+	char *ch2 = buffer;
+
+	while (length > 0)
+	{
+		char *eol = find_eol(ch2, length);
+		int  n = eol ? eol - ch2 : length;
+		int  room = conn->buffer + sizeof(conn->buffer) - 1 - ch1;
+
+		memcpy(ch1, ch2, MIN(n, room));
+		ch1 += MIN(n, room);
+		ch2 += n;
+		length -= n;
+		if (!eol)
+			break;
+		ch2++;
+		length--;
+		if (ch1 == conn->buffer)
+			continue;
+		*ch1 = '\0';
+		got_line(conn, ch1);
+		ch1 = conn->buffer;
+	}
+	conn->count = ch1 - conn->buffer;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Feed the whole burst through once, in READSIZE pieces */
+static void one_pass(Conn *conn, char *burst, long size,
+    char *(*find_eol)(char *, int))
+{
+	char readbuf[READSIZE];
+	long off;
+	int  n;
+
+	conn->count = 0;
+	for (off = 0; off < size; off += n)
+	{
+		n = MIN(size - off, READSIZE);
+		/* like read(), the data lands in a buffer of its own */
+		memcpy(readbuf, burst + off, n);
+		if (find_eol)
+			dopacket_eol(conn, readbuf, n, find_eol);
+		else
+			dopacket_byte(conn, readbuf, n);
+	}
+}
+
+static void run(char *name, char *(*find_eol)(char *, int),
+    char *burst, long size, double seconds)
+{
+	Conn conn;
+	double start, elapsed;
+	long passes = 0;
+
+	memset(&conn, 0, sizeof(conn));
+	start = now();
+	do
+	{
+		one_pass(&conn, burst, size, find_eol);
+		passes++;
+		elapsed = now() - start;
+	} while (elapsed < seconds);
+
+	printf("%-10s %10.1f MB/s  (%ld lines, %ld bytes of text per pass)\n",
+	    name, (double)size * passes / elapsed / 1e6,
+	    conn.lines / passes, conn.bytes / passes);
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *fp;
+	char *burst;
+	long size;
+	double seconds = 2;
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s <burst file> [seconds]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2)
+		seconds = atof(argv[2]);
+	if (!(fp = fopen(argv[1], "rb")))
+	{
+		perror(argv[1]);
+		return 1;
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	rewind(fp);
+	if (size <= 0 || !(burst = malloc(size)) ||
+	    fread(burst, 1, size, fp) != (size_t)size)
+	{
+		fprintf(stderr, "%s: could not read the file\n", argv[1]);
+		return 1;
+	}
+	fclose(fp);
+	printf("%s: %ld bytes, fed in %d byte reads\n", argv[1], size, READSIZE);
+
+	run("byte loop", NULL, burst, size, seconds);
+	run("memchr", find_eol_c, burst, size, seconds);
+#ifdef EOL_SSE2
+	run("sse2", find_eol_sse2, burst, size, seconds);
+#endif
+#ifdef EOL_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		run("avx2", find_eol_avx2, burst, size, seconds);
+#endif
+	free(burst);
+	return 0;
+}
@@ -100,6 +100,7 @@ extern int match(const char *, const char *);
 #define mycmp(a,b) \
  ( (toupper(a[0])!=toupper(b[0])) || smycmp((a)+1,(b)+1) )
 extern int smycmp(const char *, const char *);
+extern unsigned int hash_name(const char *, int *);
 #ifndef GLIBC2_x
 extern int myncmp(const char *, const char *, int);
 #endif
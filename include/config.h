@@ -80,6 +80,17 @@
 #define USE_POLL
 #endif
 
+/*
+ * Defining this will make the IRCd use epoll() on Linux instead of poll().
+ * With epoll the kernel remembers which sockets we are interested in, so
+ * we no longer have to hand it every connection on each pass through the
+ * main loop and we only get to see the sockets that are actually ready.
+ * Undefine it to fall back to poll() (or select(), see above).
+ */
+#if defined(USE_POLL) && defined(__linux__)
+#define USE_EPOLL
+#endif
+
 /*
  * Defining this will allow all ircops to see people in +s channels
  * By default, only net/tech admins can see this
@@ -177,16 +188,22 @@
 #undef SOCALLEDSMARTBANNING
 
 /*
-** Freelinks garbage collector -Stskeeps
+** Garbage collector -Stskeeps
 **
-** GARBAGE_COLLECT_EVERY - how many seconds between every garbage collect
-** HOW_MANY_FREELINKS_ALLOWED - how many freelinks allowed
+** GARBAGE_COLLECT_EVERY - how many seconds between every garbage collect,
+**                         which gives the spare slab pages back to the OS
 */
 #ifndef GARBAGE_COLLECT_EVERY
 #define GARBAGE_COLLECT_EVERY 		600	/* default: 600 (10 mins) */
 #endif
 
-#define HOW_MANY_FREELINKS_ALLOWED 	200	/* default: 200 */
+/*
+** SLAB_PAGESIZE - clients, users, links, channel members and bans are
+** allocated in pages of this many bytes (a power of 2, and a multiple of
+** the system page size), see slab_alloc() in list.c. A page that is
+** completely free is given back to the OS.
+*/
+#define SLAB_PAGESIZE			65536	/* default: 65536 */
 
 /*
  * MAXUNKNOWNCONNECTIONSPERIP
@@ -325,6 +342,28 @@
 #define LISTEN_SIZE 5
 #endif
 
+/*
+ * Maximum number of connections accepted per pass through the main loop
+ * (over all listeners). A listener with more pending connections than this
+ * is simply picked up again on the next pass, so a connect storm can't
+ * starve the clients that are already connected.
+ */
+#define ACCEPTS_PER_LOOP 100
+
+/*
+ * Maximum value of listen::sockets, the number of SO_REUSEPORT sockets
+ * that are opened for a single listen block (Linux 3.9+ and some BSD's).
+ */
+#define MAXLISTENSOCKETS 16
+
+/*
+ * Channels with at least this many members, and users on at least this
+ * many channels, get a hash table on top of their member list so that
+ * finding a membership (for op/voice checks, KICK, MODE, ...) doesn't
+ * mean walking the whole list. It's dropped again below half of this.
+ */
+#define MEMBERHASH_MIN 32
+
 /*
  * Max amount of internal send buffering when socket is stuck (bytes)
  */
@@ -332,7 +371,8 @@
 #define MAXSENDQLENGTH 3000000
 #endif
 /*
- *  BUFFERPOOL is the maximum size of the total of all sendq's.
+ *  BUFFERPOOL is the default for set::buffer-pool, the maximum size of the
+ *  total of all sendq's.
  *  Recommended value is 2 * MAXSENDQLENGTH, for hubs, 5 *.
  */
 #ifndef BUFFERPOOL
@@ -495,15 +535,16 @@
  */
 #define JOINTHROTTLE
 
-/* Detect slow spamfilters? This requires a little more cpu time when processing
- * any spamfilter (like on text/connect/..) but will save you from slowing down
- * your IRCd to a near-halt (well, in most cases.. there are still cases like when
- * it goes into a loop that it will still stall completely... forever..).
- * This is kinda experimental, and requires getrusage.
+/* Detect slow spamfilters? This times every spamfilter run (like on
+ * text/connect/..) so it can warn about or remove spamfilters that slow
+ * down your IRCd to a near-halt (well, in most cases.. there are still cases
+ * like when it goes into a loop that it will still stall completely... forever..).
+ * The warn and remove limits (set::spamfilter::slowdetect-*) are about the
+ * CPU time a spamfilter used, so a busy host or a stalled VM does not get
+ * a harmless spamfilter removed. The timings shown per spamfilter in
+ * /STATS spamfilter are wall clock (monotonic clock) times.
  */
-#ifndef _WIN32
 #define SPAMFILTER_DETECTSLOW
-#endif
 
 /* ------------------------- END CONFIGURATION SECTION -------------------- */
 #define MOTD MPATH
@@ -49,16 +49,42 @@ typedef struct dbuf {
 ** And this 'dbufbuf' should never be referenced outside the
 ** implementation of 'dbuf'--would be "hidden" if C had such
 ** keyword...
-** If it was possible, this would compile to be exactly 1 memory
-** page in size. 2048 bytes seems to be the most common size, so
-** as long as a pointer is 4 bytes, we get 2032 bytes for buffer
-** data after we take away a bit for malloc to play with. -avalon
+** They come in two sizes: DBUF_SMALL_SIZE for short queues, which is
+** what most clients have, and DBUF_LARGE_SIZE once a queue builds up,
+** like it does on server links (see dbuf_put()).
 */
 typedef struct dbufbuf {
 	struct dbufbuf *next;	/* Next data buffer, NULL if this is last */
-	char data[2032];	/* Actual data stored here */
+	u_int len;		/* Number of bytes in this buffer */
+	u_int size;		/* Room for data, 0 for a shared block */
+	struct dbufshared *shared; /* If set, the data lives in this shared
+				    * block instead, and 'data' below is not
+				    * even allocated. */
+	char data[1];		/* Actual data stored here, 'size' bytes */
 } dbufbuf;
 
+#define DBUF_SMALL_SIZE	1024	/* Bytes per dbufbuf, including the header */
+#define DBUF_LARGE_SIZE	8192
+
+/*
+** A 'dbufshared' is a single (\r\n terminated) line which is queued
+** to many clients at once, like a message to a big channel. The line is
+** copied only once, into the block, after which each sendQ only gets a
+** (small) reference to it. The block is freed when the last reference
+** is gone.
+*/
+typedef struct dbufshared {
+	int refcnt;		/* Number of references to this block */
+	u_int len;		/* Length of the line */
+	char data[512];		/* The line, including \r\n */
+} dbufshared;
+
+/*
+** dbuf_init
+**	Set up the allocators, called once at startup.
+*/
+void dbuf_init(void);
+
 /*
 ** dbuf_put
 **	Append the number of bytes to the buffer, allocating more
@@ -73,6 +99,35 @@ int dbuf_put(dbuf *, char *, int);
 					/* Pointer to data to be stored */
 					/* Number of bytes to store */
 
+/*
+** dbuf_shared_new
+**	Create a shared block with a copy of the given line, with a
+**	reference count of 1 (the callers reference).
+**
+**	returns NULL if the line is too long or we are out of memory
+*/
+dbufshared *dbuf_shared_new(char *, int);
+					/* Pointer to the line */
+					/* Length of the line */
+
+/*
+** dbuf_shared_release
+**	Drop a reference to a shared block, freeing it if it was the
+**	last one.
+*/
+void dbuf_shared_release(dbufshared *);
+
+/*
+** dbuf_put_shared
+**	Append a shared block to the buffer. Nothing is copied, the
+**	buffer just keeps a reference to the block until the data has
+**	been deleted from it.
+**
+**	returns	> 0, if operation successfull
+**		0, if failed (due memory allocation problem)
+*/
+int dbuf_put_shared(dbuf *, dbufshared *);
+
 /*
 ** dbuf_get
 **	Remove number of bytes from the buffer, releasing dynamic
@@ -125,6 +180,27 @@ int dbuf_delete(dbuf *, int);
 					/* Dynamic buffer header */
 					/* Number of bytes to delete */
 
+/*
+** dbuf_mapv
+**	Like dbuf_map, but maps (up to 'maxiov') successive data
+**	buffers into an iovec array so they can be handed to writev()
+**	in one go. Returns the number of iovec entries filled in, the
+**	total number of bytes is placed into the indicated variable.
+**	The data is removed with dbuf_delete() as usual, which is fine
+**	with deleting a number of bytes spanning several buffers.
+*/
+#ifndef _WIN32
+struct iovec;
+int dbuf_mapv(dbuf *, struct iovec *, int, int *);
+					/* Dynamic buffer header */
+					/* iovec array to fill in */
+					/* Size of the iovec array */
+					/* Return number of bytes mapped */
+
+/* Number of dbuf buffers send_queued() hands to writev() at once */
+#define DBUF_IOV_MAX	128
+#endif
+
 /*
 ** DBufLength
 **	Return the current number of bytes stored into the buffer.
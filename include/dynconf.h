@@ -171,6 +171,7 @@ struct zConfiguration {
 	unsigned short default_ipv6_clone_mask;
 #endif /* INET6 */
 	int ping_cookie;
+	long buffer_pool;
 };
 
 #ifndef DYNCONF_C
@@ -295,6 +296,8 @@ extern MODVAR aConfiguration iConf;
 
 #define UHNAMES_ENABLED	iConf.uhnames
 
+#define BUFFER_POOL	iConf.buffer_pool
+
 /* Used for "is present?" and duplicate checking */
 struct SetCheck {
 	unsigned has_show_opermotd:1;
@@ -332,6 +335,7 @@ struct SetCheck {
 	unsigned has_pingpong_warning:1;
 	unsigned has_watch_away_notification:1;
 	unsigned has_uhnames:1;
+	unsigned has_buffer_pool:1;
 	unsigned has_oper_only_stats:1;
 	unsigned has_maxchannelsperuser:1;
 	unsigned has_maxdccallow:1;
@@ -35,19 +35,28 @@ extern MODVAR int tainted;
 extern char *getreply(int);
 #define rpl_str(x) getreply(x)
 #define err_str(x) getreply(x)
-extern MODVAR Member *freemember;
-extern MODVAR Membership *freemembership;
-extern MODVAR MembershipL *freemembershipL;
-extern MODVAR TS nextconnect, nextdnscheck, nextping;
+extern MODVAR aSlabPool *slabpools;
+extern MODVAR aSlabPool slab_member, slab_membership, slab_membershipL;
+extern MODVAR TS nextconnect, nextdnscheck;
 extern MODVAR aClient *client, me, *local[];
 extern MODVAR aChannel *channel;
 extern MODVAR struct stats *ircstp;
 extern MODVAR int bootopt;
 extern MODVAR time_t TSoffset;
 /* Prototype added to force errors -- Barubary */
-extern TS check_pings(TS now);
+extern void check_ping(void *data);
+extern void set_ping_timer(aClient *cptr, TS when);
 extern TS TS2ts(char *s);
 extern MODVAR time_t timeofday;
+extern MODVAR long long monotime_ms;
+extern void update_monotime(void);
+extern long long get_monotime_ns(void);
+extern long long get_cputime_ns(void);
+/* timer wheel, events.c */
+extern void timer_set(aTimer *t, long long expire);
+extern void timer_del(aTimer *t);
+extern void timer_run(void);
+extern long timer_next_delay(long maxdelay);
 /* newconf */
 #define get_sendq(x) ((x)->class ? (x)->class->sendq : MAXSENDQLENGTH) 
 /* get_recvq is only called in send.c for local connections */
@@ -91,6 +100,7 @@ extern MODVAR ConfigItem_ban		*conf_ban;
 extern MODVAR ConfigItem_badword	*conf_badword_channel;
 extern MODVAR ConfigItem_badword       *conf_badword_message;
 extern MODVAR ConfigItem_badword	*conf_badword_quit;
+extern MODVAR aACMatcher		badword_matcher;
 extern MODVAR ConfigItem_deny_dcc	*conf_deny_dcc;
 extern MODVAR ConfigItem_deny_channel  *conf_deny_channel;
 extern MODVAR ConfigItem_deny_link	*conf_deny_link;
@@ -140,6 +150,15 @@ int match_ip(struct IN_ADDR addr, char *uhost, char *mask, struct irc_netmask *n
 int match_ipv6(struct IN_ADDR *addr, struct IN_ADDR *mask, int bits);
 #endif
 ConfigItem_ban  *Find_ban_ip(aClient *sptr);
+extern int hosttrie_indexable(const char *mask);
+extern int hosttrie_add(aHostTrie *t, aHostEntry *e, const char *mask, void *item);
+extern void hosttrie_del(aHostTrie *t, aHostEntry *e);
+extern int hosttrie_find(aHostTrie *t, const char *host, int (*fn)(void *, void *), void *arg);
+extern void hosttrie_free(aHostTrie *t);
+extern void ac_add(aACMatcher *m, const char *pat, int len, void *data);
+extern int ac_del(aACMatcher *m, const char *pat, int len, void *data);
+extern int ac_scan(aACMatcher *m, const char *text, int len, int (*fn)(void *, int, int, void *), void *arg);
+extern void ac_free(aACMatcher *m);
 extern MODVAR Link	*Servers;
 void add_ListItem(ListStruct *, ListStruct **);
 ListStruct *del_ListItem(ListStruct *, ListStruct **);
@@ -172,6 +191,8 @@ extern aCommand *find_Command_simple(char *cmd);
 extern aChannel *find_channel(char *, aChannel *);
 extern Membership *find_membership_link(Membership *lp, aChannel *ptr);
 extern Member *find_member_link(Member *, aClient *);
+extern Membership *find_membership(aClient *, aChannel *);
+extern Member *find_member(aChannel *, aClient *);
 extern void remove_user_from_channel(aClient *, aChannel *);
 extern char *base64enc(long);
 extern long base64dec(char *);
@@ -239,11 +260,15 @@ extern MODVAR int dbufalloc, dbufblocks, debuglevel;
 #else
 extern int dbufalloc, dbufblocks, debuglevel, errno, h_errno;
 #endif
+extern MODVAR long dbufmem;
 extern MODVAR short LastSlot; /* last used index in local client array */
 extern MODVAR int OpenFiles;  /* number of files currently open */
 extern MODVAR int debuglevel, portnum, debugtty, maxusersperchannel;
 extern MODVAR int readcalls, udpfd, resfd;
-extern aClient *add_connection(aClient *, int);
+extern aClient *add_connection(aClient *, int, struct SOCKADDR_IN *);
+extern int listener_backlog(aClient *, int *);
+extern MODVAR int accept_rate, accept_rate_peak;
+extern MODVAR long accept_capped;
 extern int add_listener(aConfItem *);
 extern void add_local_domain(char *, int);
 extern int check_client(aClient *, char *);
@@ -261,10 +286,17 @@ extern void init_modef();
 extern int verify_hostname(char *name);
 
 #ifdef NO_FDLIST
-extern int read_message(time_t);
+extern int read_message(long);
 #else
-extern int read_message(time_t, fdlist *);
+extern int read_message(long, fdlist *);
 #endif
+#define IOEVENT_READ		0x1
+#define IOEVENT_WRITE		0x2
+#define IOEVENT_RESOLVER	-2
+extern void ioevent_set(int fd, int slot, int events);
+extern void ioevent_add(int fd, int slot, int events);
+extern void ioevent_update(aClient *cptr);
+extern void ioevent_resolver(int fd, int events);
 
 extern void report_error(char *, aClient *);
 extern void set_non_blocking(int, aClient *);
@@ -282,6 +314,7 @@ extern void terminate(), write_pidfile();
 extern void *MyMallocEx(size_t size);
 extern int advanced_check(char *userhost, int ipstat);
 extern int send_queued(aClient *);
+extern int sendq_shed(dbuf *, u_int);
 /* i know this is naughty but :P --stskeeps */
 extern void sendto_locfailops(char *pattern, ...) __attribute__((format(printf,1,2)));
 extern void sendto_connectnotice(char *nick, anUser *user, aClient *sptr, int disconnect, char *comment);
@@ -300,6 +333,8 @@ extern void sendto_channelprefix_butone(aClient *one, aClient *from, aChannel *c
     int prefix, char *pattern, ...) __attribute__((format(printf,5,6)));
 extern void sendto_channelprefix_butone_tok(aClient *one, aClient *from, aChannel *chptr,
     int prefix, char *cmd, char *tok, char *nick, char *text, char do_send_check);
+extern void sendto_channelprefix_butone_tok_len(aClient *one, aClient *from, aChannel *chptr,
+    int prefix, char *cmd, char *tok, char *nick, char *text, int textlen, char do_send_check);
 extern void sendto_channel_butone(aClient *, aClient *, aChannel *,
                                   char *, ...) __attribute__((format(printf,4,5)));
 extern void sendto_channel_butserv_butone(aChannel *chptr, aClient *from, aClient *one,
@@ -331,6 +366,9 @@ extern void sendto_snomask_normal_global(int snomask, char *pattern, ...) __attr
 extern void sendnotice(aClient *to, char *pattern, ...) __attribute__((format(printf,2,3)));
 extern MODVAR int writecalls, writeb[];
 extern int deliver_it(aClient *, char *, int);
+#ifndef _WIN32
+extern int deliver_itv(aClient *, struct iovec *, int);
+#endif
 extern int  check_for_chan_flood(aClient *cptr, aClient *sptr, aChannel *chptr);
 extern int  check_for_target_limit(aClient *sptr, void *target, const char *name);
 extern char *canonize(char *buffer);
@@ -386,6 +424,10 @@ extern void add_client_to_list(aClient *);
 extern void checklist();
 extern void remove_client_from_list(aClient *);
 extern void initlists();
+extern void slab_init(aSlabPool *, char *, unsigned int);
+extern void *slab_alloc(aSlabPool *);
+extern void slab_free(void *);
+extern int slab_release_spare(void);
 extern struct hostent *get_res(char *);
 extern struct hostent *gethost_byaddr(char *, Link *);
 extern struct hostent *gethost_byname(char *, Link *);
@@ -408,7 +450,9 @@ extern int hash_check_watch(aClient *, int);
 extern int hash_del_watch_list(aClient *);
 extern void count_watch_memory(int *, u_long *);
 extern aWatch *hash_get_watch(char *);
-extern aChannel *hash_get_chan_bucket(unsigned int);
+extern unsigned int hash_scan_channels(unsigned int, void (*)(aChannel *, void *), void *);
+extern MODVAR aHashTable clientHash, channelHash, watchHash;
+extern void hash_stats(aHashTable *, unsigned int *, unsigned int *);
 extern aClient *hash_find_client(char *, aClient *);
 extern aClient *hash_find_nickserver(char *, aClient *);
 extern aClient *hash_find_server(char *, aClient *);
@@ -487,6 +531,8 @@ size_t strlncat(char *dst, const char *src, size_t size, size_t n);
 
 
 extern int dopacket(aClient *, char *, int);
+extern int doline(aClient *, char *, char *, int);
+extern MODVAR char *(*find_eol)(char *, int);
 
 extern void debug(int, char *, ...);
 #if defined(DEBUGMODE)
@@ -515,6 +561,7 @@ char	*Inet_ia2pNB(struct IN_ADDR *ia, int compressed);
 extern MODVAR aCommand *CommandHash[256];
 extern MODVAR aCommand *TokenHash[256];
 extern void	init_CommandHash(void);
+extern void	cmdhash_changed(void);
 extern aCommand	*add_Command_backend(char *cmd, int (*func)(), unsigned char parameters, unsigned char token, int flags);
 extern void	add_Command(char *cmd, char *token, int (*func)(), unsigned char parameters);
 extern void	add_Command_to_list(aCommand *item, aCommand **list);
@@ -667,6 +714,11 @@ extern char banact_valtochar(int val);
 extern int spamfilter_gettargets(char *s, aClient *sptr);
 extern char *spamfilter_target_inttostring(int v);
 extern Spamfilter *unreal_buildspamfilter(char *s);
+extern void unreal_freespamfilter(Spamfilter *e);
+extern unsigned int spamfilter_prefilter(char *str, int type);
+extern void spamfilter_index_add(aTKline *tk);
+extern void spamfilter_index_del(aTKline *tk);
+extern aTKline **spamfilter_getlist(int type, int flags, int *num);
 extern char *our_strcasestr(char *haystack, char *needle);
 extern int spamfilter_getconftargets(char *s);
 extern void remove_oper_snomasks(aClient *sptr);
@@ -675,6 +727,7 @@ extern char *spamfilter_inttostring_long(int v);
 extern int check_channelmask(aClient *, aClient *, char *);
 extern aChannel *get_channel(aClient *cptr, char *chname, int flag);
 extern MODVAR char backupbuf[];
+extern int parv_len(char *parv[], int i);
 extern void add_invite(aClient *, aChannel *);
 extern void channel_modes(aClient *, char *, char *, aChannel *);
 extern MODVAR char modebuf[BUFSIZE], parabuf[BUFSIZE];
@@ -789,6 +842,7 @@ extern void inet6_to_inet4(const void *src, void *dst);
 extern void sendtxtnumeric(aClient *to, char *pattern, ...) __attribute__((format(printf,2,3)));;
 extern void unrealdns_gethostbyname_link(char *name, ConfigItem_link *conf);
 extern void unrealdns_delasyncconnects(void);
+extern long unrealdns_timeout(long maxdelay);
 extern int is_autojoin_chan(char *chname);
 extern void unreal_free_hostent(struct hostent *he);
 extern int match_esc(const char *mask, const char *name);
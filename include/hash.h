@@ -34,21 +34,25 @@ typedef struct hashentry {
 #define BITS_PER_COL_MASK 0x7
 #define MAX_SUB     (1<<BITS_PER_COL)
 
-/* Client hash table 
- * used in hash.c 
+/* Client, channel and watch hash tables, see hash.c. These grow and
+ * shrink with the number of entries, but never below these sizes
+ * (must be powers of 2).
  */
-
-#define U_MAX_INITIAL 2048
-#define U_MAX_INITIAL_MASK (U_MAX_INITIAL-1)
-#define U_MAX (U_MAX_INITIAL*MAX_SUB)
-
-/* Channel hash table 
- * used in hash.c 
- */
-
-#define CH_MAX_INITIAL  2048
-#define CH_MAX_INITIAL_MASK (CH_MAX_INITIAL-1)
-#define CH_MAX (CH_MAX_INITIAL*MAX_SUB)
+typedef struct hashtable {
+	void **tab[2];			/* [1] is only used while resizing */
+	unsigned int size[2];
+	unsigned int moved;		/* buckets of [0] moved to [1] so far */
+	unsigned int count;		/* number of entries */
+	unsigned int minsize;
+	int  nextoff;			/* where ->hnext, */
+	int  hashoff, lenoff;		/* ->hashv and ->namelen are */
+	unsigned long lookups, probes;	/* for /STATS Z */
+	unsigned long resizes;
+} aHashTable;
+
+#define HASH_CLIENT_MIN		2048
+#define HASH_CHANNEL_MIN	1024
+#define HASH_WATCH_MIN		1024
 
 /* Who was hash table 
  * used in whowas.c 
@@ -58,8 +62,6 @@ typedef struct hashentry {
 #define WW_MAX_INITIAL_MASK (WW_MAX_INITIAL-1)
 #define WW_MAX (WW_MAX_INITIAL*MAX_SUB)
 
-#define WATCHHASHSIZE  10007	/* prime number  */
-
 /*
  * Throttling
 */
@@ -469,12 +469,14 @@ struct _mod_symboltable
 struct _event {
 	Event   *prev, *next;
 	char    *name;
-	time_t  every;
+	long    every_ms;	/* interval in msec, 0 = every loop */
 	long    howmany;
 	vFP	event;
 	void    *data;
-	time_t  last;
+	long long last_ms;	/* monotime_ms of the last run */
 	Module *owner;
+	aTimer  timer;
+	Event   *loopnext;	/* next on the every-loop list */
 };
 
 #define EMOD_EVERY 0x0001
@@ -482,6 +484,7 @@ struct _event {
 #define EMOD_NAME 0x0004
 #define EMOD_EVENT 0x0008
 #define EMOD_DATA 0x0010
+#define EMOD_EVERY_MS 0x0020
 
 struct _eventinfo {
 	int flags;
@@ -490,6 +493,7 @@ struct _eventinfo {
 	char *name;
 	vFP event;
 	void *data;
+	long every_ms;
 };
 
 
@@ -498,6 +502,8 @@ struct _eventinfo {
 #define EventAdd(name, every, howmany, event, data) EventAddEx(NULL, name, every, howmany, event, data)
 Event   *EventAddEx(Module *, char *name, long every, long howmany,
                   vFP event, void *data);
+Event   *EventAddMs(Module *, char *name, long every_ms, long howmany,
+                  vFP event, void *data);
 Event   *EventDel(Event *event);
 Event   *EventMarkDel(Event *event);
 Event   *EventFind(char *name);
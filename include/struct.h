@@ -127,16 +127,25 @@ typedef struct liststruct ListStruct;
 
 typedef struct Watch aWatch;
 typedef struct Client aClient;
+typedef struct Conn aConn;
 typedef struct Channel aChannel;
 typedef struct User anUser;
 typedef struct Server aServer;
 typedef struct SLink Link;
 typedef struct SBan Ban;
+typedef struct SlabPool aSlabPool;
+typedef struct HostTrie aHostTrie;
+typedef struct HostNode aHostNode;
+typedef struct HostEntry aHostEntry;
+typedef struct ACMatcher aACMatcher;
+typedef struct ACNode ACNode;
+typedef struct ACOutput ACOutput;
 typedef struct SMode Mode;
 typedef struct SChanFloodProt ChanFloodProt;
 typedef struct SRemoveFld RemoveFld;
 typedef struct ListOptions LOpts;
 typedef struct FloodOpt aFloodOpt;
+typedef struct Timer aTimer;
 typedef struct Motd aMotdFile; /* represents a whole MOTD, including remote MOTD support info */
 typedef struct MotdItem aMotdLine; /* one line of a MOTD stored as a linked list */
 #ifdef USE_LIBCURL
@@ -147,6 +156,8 @@ typedef struct trecord aTrecord;
 typedef struct Command aCommand;
 typedef struct _cmdoverride Cmdoverride;
 typedef struct SMember Member;
+typedef struct SChanLink aChanLink;
+typedef struct SMemberHash aMemberHash;
 typedef struct SMembership Membership;
 typedef struct SMembershipL MembershipL;
 typedef struct JFlood aJFlood;
@@ -455,7 +466,7 @@ typedef unsigned int u_int32_t;	/* XXX Hope this works! */
 #ifdef USE_SSL
 #define IsSSL(x)		IsSecure(x)
 #endif
-#define	IsNotSpoof(x)		((x)->nospoof == 0)
+#define	IsNotSpoof(x)		((x)->conn->nospoof == 0)
 
 #define GetHost(x)			(IsHidden(x) ? (x)->user->virthost : (x)->user->realhost)
 #define GetIP(x)			((x->user && x->user->ip_str) ? x->user->ip_str : (MyConnect(x) ? Inet_ia2p(&x->ip) : NULL))
@@ -507,6 +518,10 @@ typedef unsigned int u_int32_t;	/* XXX Hope this works! */
 #define ClearBlocked(x)		((x)->flags &= ~FLAGS_BLOCKED)
 #define ClearHidden(x)          ((x)->umodes &= ~UMODE_HIDE)
 #define ClearHideOper(x)    ((x)->umodes &= ~UMODE_HIDEOPER)
+/* Call after changing the nick, ident or (virtual/cloaked) host of a user,
+ * it makes the cached ban results in the user's Memberships stale.
+ */
+#define UserIdentityChanged(x)	((x)->user->identgen++)
 
 #ifdef ZIP_LINKS
 #define SetZipped(x)        ((x)->flags |= FLAGS_ZIP)
@@ -721,6 +736,18 @@ struct FloodOpt {
 	TS   firstmsg;
 };
 
+/* A timer on the timer wheel (see events.c). Embed one in whatever needs
+ * a deadline, fill in func/data and use timer_set()/timer_del().
+ * 'expire' is in milliseconds of monotime_ms, not wall clock time.
+ */
+struct Timer {
+	aTimer *next, **pprev;	/* pprev is NULL when not queued */
+	long long expire;
+	void (*func)(void *);
+	void *data;
+	short level, slot;
+};
+
 #ifdef USE_LIBCURL
 struct Motd;
 struct MotdDownload
@@ -815,6 +842,8 @@ struct User {
 
 	signed char refcnt;	/* Number of times this block is referenced */
 	unsigned short joined;		/* number of channels joined */
+	aMemberHash *mhash;	/* aChannel -> Membership, see MEMBERHASH_MIN */
+	unsigned int identgen;	/* see UserIdentityChanged() */
 	char username[USERLEN + 1];
 	char realhost[HOSTLEN + 1];
 	char cloakedhost[HOSTLEN + 1]; /* cloaked host (masked host for caching). NOT NECESSARILY THE SAME AS virthost. */
@@ -870,6 +899,7 @@ struct Server {
 #define M_RESETIDLE		0x0040
 #define M_VIRUS			0x0080
 #define M_ANNOUNCE		0x0100
+#define M_BACKUPBUF		0x0200	/* wants the original line in backupbuf */
 
 
 /* tkl:
@@ -896,15 +926,76 @@ struct Server {
 #define SPAMF_USER			0x0080 /* u */
 #define SPAMF_AWAY			0x0100 /* a */
 #define SPAMF_TOPIC			0x0200 /* t */
+#define SPAMF_TYPES			10 /* number of the above */
 
 /* Other flags only for function calls: */
 #define SPAMFLAG_NOWARN		0x0001
 
+/* Latency histogram of a spamfilter: <1us, <4us, <16us .. <4ms, more */
+#define SPAMF_LATENCY_BUCKETS	8
+
 struct _spamfilter {
 	unsigned short action; /* see BAN_ACT* */
 	regex_t expr;
 	char *tkl_reason; /* spamfilter reason field [escaped by unreal_encodespace()!] */
 	TS tkl_duration;
+	char *literals; /* strings it can't match without, see spamfilter_prefilter() */
+	unsigned int hit;
+	/* Accounting, shown in /STATS spamfilter. Times are in nanoseconds. */
+	long evals;	/* times the regex was run */
+	long hits;	/* times it matched */
+	long long total_ns;
+	long max_ns;
+	long latency[SPAMF_LATENCY_BUCKETS];	/* see spamfilter_latency_bucket() */
+};
+
+/* Multi-pattern matcher, see src/acmatch.c */
+struct ACOutput {
+	ACOutput *next;
+	void *data;
+	int  len;
+};
+
+struct ACNode {
+	int  parent, child, sibling;	/* indexes in nodes[], -1 for none */
+	int  fail;
+	int  refs;	/* patterns through here, -1 if on the free list */
+	u_char c;
+	ACOutput *out;	/* patterns that end here */
+};
+
+struct ACMatcher {
+	ACNode *nodes;
+	int  nnodes, maxnodes, freenode;
+	int  patterns;
+	int  dirty;	/* changed since the last ac_scan() */
+	int  nclasses;
+	u_char classmap[256];
+	int  *delta;	/* nodes x classes transition table */
+	int  *dict;	/* next node on the failure chain with output */
+};
+
+/* Host suffix index, see src/hosttrie.c */
+struct HostTrie {
+	aHostNode **table;	/* all nodes, by parent and label */
+	int  size, count;
+};
+
+struct HostNode {
+	aHostNode *parent, *hnext;
+	aHostEntry *exact, *wild;	/* "label.parent" and "*.label.parent" */
+	int  children;
+	unsigned int hashv;
+	int  len;
+	char label[1];
+};
+
+/* Embedded in whatever is indexed */
+struct HostEntry {
+	aHostEntry *prev, *next;
+	aHostNode *node;	/* NULL if not in a trie */
+	void *item;
+	int  wild;
 };
 
 struct t_kline {
@@ -918,6 +1009,11 @@ struct t_kline {
 	char usermask[USERLEN + 3];
 	char *hostmask, *reason, *setby;
 	TS expire_at, set_at;
+	/* K/G/Z-lines and shuns only, see the IP index in m_tkl */
+	aTKline *iprev, *inext;
+	struct _tklnode *node;
+	aHostEntry hostidx;
+	u_int seq;
 };
 
 struct _spamexcept {
@@ -978,6 +1074,7 @@ typedef struct {
 #define LISTENER_MASK		0x000020
 #define LISTENER_SSL		0x000040
 #define LISTENER_BOUND		0x000080
+#define LISTENER_REUSEPORT	0x000100	/* one of several listen::sockets */
 
 #define IsServersOnlyListener(x)	((x) && ((x)->umodes & LISTENER_SERVERSONLY))
 
@@ -993,6 +1090,34 @@ typedef struct {
 #define SSLFLAG_DONOTACCEPTSELFSIGNED 0x4
 #define SSLFLAG_NOSTARTTLS	0x8
 
+/*
+ * The part of a local client that is rarely needed: the partial line
+ * buffer, ident and registration (password, SASL) state and the byte
+ * counters. It's allocated separately, see cptr->conn, so the fields
+ * every message to or from a client touches stay close together.
+ */
+struct Conn {
+	int  count;		/* Amount of data in buffer */
+	int  authfd;		/* fd for rfc931 authentication */
+	u_int32_t nospoof;	/* Anti-spoofing random number */
+	struct hostent *hostp;
+	char *passwd;
+	char *error_str;	/* Quit reason set by dead_link in case of socket/buffer error */
+	long sendK;		/* Statistics: total k-bytes send */
+	long receiveM;		/* Statistics: protocol messages received */
+	long receiveK;		/* Statistics: total k-bytes received */
+	u_short sendB;		/* counters to count upto 1-k lots of bytes */
+	u_short receiveB;	/* sent and received. */
+#ifdef DEBUGMODE
+	TS   cputime;
+#endif
+	char sasl_agent[NICKLEN + 1];
+	unsigned char sasl_out;
+	unsigned char sasl_complete;
+	u_short sasl_cookie;
+	char buffer[BUFSIZE];	/* Incoming message buffer */
+};
+
 struct Client {
 	struct Client *next, *prev, *hnext;
 	anUser *user;		/* ...defined, if this is a User */
@@ -1003,6 +1128,8 @@ struct Client {
 	aClient *from;		/* == self, if Local Client, *NEVER* NULL! */
 	int  fd;		/* >= 0, for local clients */
 	unsigned char hopcount;		/* number of servers to this 0 = local */
+	unsigned short namelen;	/* strlen(name), set with hashv */
+	unsigned int hashv;	/* hash_name(name) when added to the hash */
 	char name[HOSTLEN + 1];	/* Unique name of the client, nick or host */
 	char username[USERLEN + 1];	/* username here now for auth stuff */
 	char info[REALLEN + 1];	/* Free form additional client information */
@@ -1011,11 +1138,11 @@ struct Client {
 	/*
 	   ** The following fields are allocated only for local clients
 	   ** (directly connected to *this* server with a socket.
-	   ** The first of them *MUST* be the "count"--it is the field
+	   ** The first of them *MUST* be the "conn"--it is the field
 	   ** to which the allocation is tied to! *Never* refer to
 	   ** these fields, if (from != self).
 	 */
-	int  count;		/* Amount of data in buffer */
+	aConn *conn;		/* The rarely used part, see struct Conn */
 #if 1
 	int  oflag;		/* oper access flags (removed from anUser for mem considerations) */
 	TS   since;		/* time they will next be allowed to send something */
@@ -1025,16 +1152,13 @@ struct Client {
 	TS   nexttarget;	/* next time that a new target will be allowed (msg/notice/invite) */
  	TS   nextnick;		/* Time the next nick change will be allowed */
 	u_char targets[MAXTARGETS];	/* hash values of targets */
+	aTimer pingtimer;	/* ping/registration timeout, see check_ping() */
 #endif
-	char buffer[BUFSIZE];	/* Incoming message buffer */
 	short lastsq;		/* # of 2k blocks when sendqueued called last */
 	dbuf sendQ;		/* Outgoing message queue--if socket full */
 	dbuf recvQ;		/* Hold for data incoming yet to be parsed */
-	u_int32_t nospoof;	/* Anti-spoofing random number */
 	int proto;		/* ProtoCtl options */
 	long sendM;		/* Statistics: protocol messages send */
-	long sendK;		/* Statistics: total k-bytes send */
-	long receiveM;		/* Statistics: protocol messages received */
 #ifdef ZIP_LINKS
 	struct Zdata *zip;	/* zip data */
 #elif defined(_WIN32)
@@ -1049,37 +1173,22 @@ struct Client {
 	long lastrecvM;		/* to check for activity --Mika */
 	int  priority;
 #endif
-	long receiveK;		/* Statistics: total k-bytes received */
-	u_short sendB;		/* counters to count upto 1-k lots of bytes */
-	u_short receiveB;	/* sent and received. */
 	aClient *listener;
 	ConfigItem_class *class;		/* Configuration record associated */
-	int authfd;		/* fd for rfc931 authentication */
         short slot;         /* my offset in the local fd table */
 	struct IN_ADDR ip;	/* keep real ip# too */
 	u_short port;		/* and the remote port# too :-) */
-	struct hostent *hostp;
 	u_short watches;	/* Keep track of count of notifies */
 	Link *watch;		/* Links to clients notify-structures */
 	char sockhost[HOSTLEN + 1];	/* This is the host name from the socket
 					   ** and after which the connection was
 					   ** accepted.
 					 */
-	char *passwd;
-#ifdef DEBUGMODE
-	TS   cputime;
-#endif
-	char *error_str;	/* Quit reason set by dead_link in case of socket/buffer error */
-
-	char sasl_agent[NICKLEN + 1];
-	unsigned char sasl_out;
-	unsigned char sasl_complete;
-	u_short sasl_cookie;
 };
 
 
 #define	CLIENT_LOCAL_SIZE sizeof(aClient)
-#define	CLIENT_REMOTE_SIZE offsetof(aClient,count)
+#define	CLIENT_REMOTE_SIZE offsetof(aClient,conn)
 
 /*
  * conf2 stuff -stskeeps
@@ -1269,6 +1378,7 @@ struct _configitem_listen {
 	char		*ip;
 	int		port;
 	int		options, clients;
+	int		sockets;	/* # of SO_REUSEPORT sockets, 0 = just one */
 	aClient		*listener;
 };
 
@@ -1328,6 +1438,8 @@ struct _configitem_ban {
 	char			*mask, *reason;
 	struct irc_netmask	*netmask;
 	unsigned short action;
+	aHostEntry		hostidx;	/* user bans on *.suffix or a host name, see Find_ban() */
+	unsigned int		seq;
 };
 
 typedef struct _iplist IPList;
@@ -1345,6 +1457,11 @@ struct _iplist {
 #define BADW_TYPE_REGEX   0x8
 #endif
 
+/* Which list a badword is on, see badword_matcher */
+#define BADW_WHERE_CHANNEL	0x1
+#define BADW_WHERE_MESSAGE	0x2
+#define BADW_WHERE_QUIT		0x4
+
 #define BADWORD_REPLACE 1
 #define BADWORD_BLOCK 2
 
@@ -1354,6 +1471,8 @@ struct _configitem_badword {
 	char		*word, *replace;
 #ifdef FAST_BADWORD_REPLACE
 	unsigned short	type;
+	unsigned char	where;	/* BADW_WHERE_* */
+	unsigned int	seq;	/* newer ones win, like in the list */
 #endif
 	char		action;
 	regex_t 	expr;
@@ -1594,11 +1713,25 @@ struct SMode {
 
 struct Watch {
 	aWatch *hnext;
+	unsigned int hashv;	/* hash_name(nick) */
+	unsigned short namelen;	/* strlen(nick) */
 	TS   lasttime;
 	Link *watch;
 	char nick[1];
 };
 
+/* Objects of one type and size, see slab_alloc() in list.c */
+struct SlabPool {
+	aSlabPool *next;	/* all pools, for /STATS z */
+	char *name;
+	unsigned int size;	/* object size, rounded up */
+	unsigned int perpage;	/* objects per SLAB_PAGESIZE page */
+	struct SlabPage *partial;	/* pages with free objects */
+	struct SlabPage *spare;	/* one completely free page, or NULL */
+	unsigned long live;	/* objects handed out */
+	unsigned long pages;	/* pages allocated, spare included */
+};
+
 /* general link structure used for chains */
 
 struct SLink {
@@ -1624,10 +1757,31 @@ struct SMember
 	struct SMember *next;
 	aClient	      *cptr;
 	int		flags;
+	struct SMember *lnext;	/* next local member (chptr->lmembers) */
+};
+
+/* Member(ship) lookup table, see MEMBERHASH_MIN */
+struct SMemberHash
+{
+	unsigned int size;	/* power of 2 */
+	unsigned int count;
+	struct {
+		void *key;	/* aClient * or aChannel * */
+		void *val;	/* Member * or Membership * */
+	} ent[1];
+};
+
+/* A server link with members of the channel behind it */
+struct SChanLink
+{
+	aClient	*cptr;
+	int	users;
 };
 
 struct Channel {
 	struct Channel *nextch, *prevch, *hnextch;
+	unsigned int hashv;	/* hash_name(chname) */
+	unsigned short namelen;	/* strlen(chname) */
 	Mode mode;
 	TS   creationtime;
 	char *topic;
@@ -1635,10 +1789,15 @@ struct Channel {
 	TS   topic_time;
 	unsigned short users;
 	Member *members;
+	aMemberHash *mhash;	/* aClient -> Member, for big channels */
+	Member *lmembers;	/* members that are our clients, by ->lnext */
+	aChanLink *links;	/* server links to the remote members */
+	unsigned short nlinks, maxlinks;
 	Link *invites;
 	Ban *banlist;
 	Ban *exlist;		/* exceptions */
 	Ban *invexlist;         /* invite list */
+	unsigned int bangen;	/* bumped when banlist or exlist changes */
 #ifdef JOINTHROTTLE
 	aJFlood *jflood;
 #endif
@@ -1646,11 +1805,18 @@ struct Channel {
 	char chname[1];
 };
 
+/* Cached ban result in a Membership, see is_banned_msg() */
+#define BANCACHE_NONE		0
+#define BANCACHE_OK		1
+#define BANCACHE_BANNED		2
+
 struct SMembershipL
 {
 	struct SMembership 	*next;
 	struct Channel		*chptr;
 	int			flags;
+	unsigned char		bancache;	/* BANCACHE_* */
+	unsigned int		bangen, identgen; /* what bancache was worked out for */
 	aFloodOpt		flood;		
 };
 
@@ -1659,6 +1825,8 @@ struct SMembership
 	struct SMembership 	*next;
 	struct Channel		*chptr;
 	int			flags;
+	unsigned char		bancache;	/* BANCACHE_* */
+	unsigned int		bangen, identgen; /* what bancache was worked out for */
 };
 
 struct SBan {
@@ -1773,7 +1941,7 @@ struct liststruct {
 #define	IsChannelName(name) ((name) && (*(name) == '#'))
 
 #define IsMember(blah,chan) ((blah && blah->user && \
-                find_membership_link((blah->user)->channel, chan)) ? 1 : 0)
+                find_membership(blah, chan)) ? 1 : 0)
 
 
 /* Misc macros */
@@ -1860,9 +2028,11 @@ struct Command {
 	int			flags;
 	unsigned int    	count;
 	unsigned		parameters : 5;
+	unsigned		token : 1;	/* in TokenHash, not CommandHash */
 	unsigned long   	bytes;
 	Module 			*owner;
 	aCommand		*friend; /* cmd if token, token if cmd */
+	aCommand		*hnext;	/* same name (but case), see cmdhash_rebuild() */
 	Cmdoverride		*overriders;
 	Cmdoverride		*overridetail;
 #ifdef DEBUGMODE
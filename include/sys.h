@@ -87,6 +87,9 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 #endif
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
 #ifdef _WIN32
 #define _WIN32_WINNT 0x0501
 #include <winsock2.h>
@@ -0,0 +1,253 @@
+/***********************************************************************
+ *  Unreal Internet Relay Chat Daemon, src/acmatch.c
+ *
+ *  All parts of this program are Copyright(C) 2001(or later).
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * $Id$
+ */
+
+/*
+ * Multi-pattern matcher (Aho-Corasick).
+ * Finds all occurrences of a set of literal strings in a text in one
+ * pass, case insensitive (using our tolower() table).
+ * Patterns are added to and removed from the trie right away. The
+ * failure links are only worked out again (into a complete transition
+ * table) by the first ac_scan() after a change, so adding a whole list
+ * of patterns costs one rebuild. The transition table is indexed by
+ * character class, only the characters that occur in a pattern get
+ * their own class, which keeps it small.
+ */
+
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "h.h"
+#include <string.h>
+
+#define AC_ROOT	0
+
+static int ac_newnode(aACMatcher *m, int parent, u_char c)
+{
+	ACNode *n;
+	int  i;
+
+	if (m->freenode >= 0)
+	{
+		i = m->freenode;
+		m->freenode = m->nodes[i].sibling;
+	}
+	else
+	{
+		if (m->nnodes == m->maxnodes)
+		{
+			m->maxnodes = m->maxnodes ? m->maxnodes * 2 : 64;
+			m->nodes = (ACNode *)MyRealloc(m->nodes, sizeof(ACNode) * m->maxnodes);
+		}
+		i = m->nnodes++;
+	}
+	n = &m->nodes[i];
+	n->parent = parent;
+	n->c = c;
+	n->child = -1;
+	n->sibling = -1;
+	n->refs = 0;
+	n->out = NULL;
+	if (parent >= 0)
+	{
+		n->sibling = m->nodes[parent].child;
+		m->nodes[parent].child = i;
+	}
+	return i;
+}
+
+static int ac_child(aACMatcher *m, int node, u_char c)
+{
+	int  i;
+
+	for (i = m->nodes[node].child; i >= 0; i = m->nodes[i].sibling)
+		if (m->nodes[i].c == c)
+			return i;
+	return -1;
+}
+
+/* Adds 'pat' ('len' chars), ac_scan() reports it with 'data' */
+void ac_add(aACMatcher *m, const char *pat, int len, void *data)
+{
+	ACOutput *o;
+	int  node, next, i;
+
+	if (len <= 0)
+		return;
+	if (!m->nnodes)
+	{
+		m->freenode = -1;
+		ac_newnode(m, -1, 0);
+	}
+	node = AC_ROOT;
+	m->nodes[node].refs++;
+	for (i = 0; i < len; i++)
+	{
+		u_char c = tolower(pat[i]);
+		if ((next = ac_child(m, node, c)) < 0)
+			next = ac_newnode(m, node, c);
+		node = next;
+		m->nodes[node].refs++;
+	}
+	o = (ACOutput *)MyMalloc(sizeof(ACOutput));
+	o->data = data;
+	o->len = len;
+	o->next = m->nodes[node].out;
+	m->nodes[node].out = o;
+	m->patterns++;
+	m->dirty = 1;
+}
+
+/* Removes what ac_add(m, pat, len, data) added, returns 0 if not found */
+int ac_del(aACMatcher *m, const char *pat, int len, void *data)
+{
+	ACOutput **op, *o;
+	int  node, parent, i, *p;
+
+	if (!m->nnodes || (len <= 0))
+		return 0;
+	for (node = AC_ROOT, i = 0; (i < len) && (node >= 0); i++)
+		node = ac_child(m, node, tolower(pat[i]));
+	if (node < 0)
+		return 0;
+	for (op = &m->nodes[node].out; *op && ((*op)->data != data); op = &(*op)->next)
+		;
+	if (!(o = *op))
+		return 0;
+	*op = o->next;
+	MyFree(o);
+	m->patterns--;
+	m->dirty = 1;
+
+	/* Drop the nodes only this pattern used */
+	for (; node >= 0; node = parent)
+	{
+		parent = m->nodes[node].parent;
+		if (--m->nodes[node].refs > 0 || (parent < 0))
+			continue;
+		for (p = &m->nodes[parent].child; *p != node; p = &m->nodes[*p].sibling)
+			;
+		*p = m->nodes[node].sibling;
+		m->nodes[node].sibling = m->freenode;
+		m->freenode = node;
+		m->nodes[node].refs = -1;	/* free */
+	}
+	return 1;
+}
+
+/* Works out the character classes and the transition table */
+static void ac_compile(aACMatcher *m)
+{
+	int  i, c, cl, u, v, head, tail, *queue, *row;
+
+	m->dirty = 0;
+	memset(m->classmap, 0, sizeof(m->classmap));
+	m->nclasses = 1;
+	for (i = 1; i < m->nnodes; i++)
+		if ((m->nodes[i].refs > 0) && !m->classmap[m->nodes[i].c])
+			m->classmap[m->nodes[i].c] = m->nclasses++;
+	/* what tolower() folds must end up in the same class */
+	for (c = 0; c < 256; c++)
+		m->classmap[c] = m->classmap[(u_char)tolower(c)];
+
+	if (m->delta)
+		MyFree(m->delta);
+	if (m->dict)
+		MyFree(m->dict);
+	m->delta = (int *)MyMallocEx(sizeof(int) * m->nnodes * m->nclasses);
+	m->dict = (int *)MyMallocEx(sizeof(int) * m->nnodes);
+	queue = (int *)MyMalloc(sizeof(int) * m->nnodes);
+
+	/* Breadth first, so the failure target of a node is always done */
+	head = tail = 0;
+	for (v = m->nodes[AC_ROOT].child; v >= 0; v = m->nodes[v].sibling)
+	{
+		m->delta[AC_ROOT * m->nclasses + m->classmap[m->nodes[v].c]] = v;
+		m->nodes[v].fail = AC_ROOT;
+		queue[tail++] = v;
+	}
+	while (head < tail)
+	{
+		u = queue[head++];
+		row = &m->delta[u * m->nclasses];
+		bcopy(&m->delta[m->nodes[u].fail * m->nclasses], row, sizeof(int) * m->nclasses);
+		for (v = m->nodes[u].child; v >= 0; v = m->nodes[v].sibling)
+		{
+			cl = m->classmap[m->nodes[v].c];
+			m->nodes[v].fail = m->delta[m->nodes[u].fail * m->nclasses + cl];
+			row[cl] = v;
+			queue[tail++] = v;
+		}
+		/* nearest node on the failure chain that reports something */
+		i = m->nodes[u].fail;
+		m->dict[u] = m->nodes[i].out ? i : m->dict[i];
+	}
+	MyFree(queue);
+}
+
+/*
+ * Scans 'len' chars of 'text' (all of it if len < 0) and calls 'fn'
+ * for every occurrence of a pattern, in the order in which they end.
+ * 'start' and 'end' are offsets in 'text', 'end' is exclusive.
+ * Stops when 'fn' returns non-zero and returns that, 0 otherwise.
+ */
+int ac_scan(aACMatcher *m, const char *text, int len,
+    int (*fn)(void *data, int start, int end, void *arg), void *arg)
+{
+	ACOutput *o;
+	int  s = AC_ROOT, t, i, ret;
+	const u_char *p = (const u_char *)text;
+
+	if (!m->patterns)
+		return 0;
+	if (m->dirty)
+		ac_compile(m);
+	if (len < 0)
+		len = strlen(text);
+	for (i = 0; i < len; i++)
+	{
+		s = m->delta[s * m->nclasses + m->classmap[p[i]]];
+		for (t = m->nodes[s].out ? s : m->dict[s]; t != AC_ROOT; t = m->dict[t])
+			for (o = m->nodes[t].out; o; o = o->next)
+				if ((ret = fn(o->data, i + 1 - o->len, i + 1, arg)))
+					return ret;
+	}
+	return 0;
+}
+
+void ac_free(aACMatcher *m)
+{
+	ACOutput *o;
+	int  i;
+
+	for (i = 0; i < m->nnodes; i++)
+		if (m->nodes[i].refs >= 0)
+			while ((o = m->nodes[i].out))
+			{
+				m->nodes[i].out = o->next;
+				MyFree(o);
+			}
+	if (m->nodes)
+		MyFree(m->nodes);
+	if (m->delta)
+		MyFree(m->delta);
+	if (m->dict)
+		MyFree(m->dict);
+	memset(m, 0, sizeof(aACMatcher));
+}
@@ -28,19 +28,7 @@ char *cmdstr = NULL;
 
 int CommandExists(char *name)
 {
-	aCommand *p;
-	
-	for (p = CommandHash[toupper(*name)]; p; p = p->next)
-	{
-		if (!stricmp(p->cmd, name))
-			return 1;
-	}
-	for (p = TokenHash[*name]; p; p = p->next)
-	{
-		if (!strcmp(p->cmd, name))
-			return 1;
-	}
-	return 0;
+	return find_Command_simple(name) ? 1 : 0;
 }
 
 Command *CommandAdd(Module *module, char *cmd, char *tok, int (*func)(), unsigned char params, int flags) {
@@ -125,6 +113,7 @@ void CommandDel(Command *command) {
 	DelListItem(command->cmd, CommandHash[toupper(*command->cmd->cmd)]);
 	if (command->tok)
 		DelListItem(command->tok, TokenHash[*command->tok->cmd]);
+	cmdhash_changed();
 	if (command->cmd->owner) {
 		ModuleObject *cmdobj;
 		for (cmdobj = command->cmd->owner->objects; cmdobj; cmdobj = (ModuleObject *)cmdobj->next) {
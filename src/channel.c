@@ -210,40 +210,157 @@ Membership *find_membership_link(Membership *lp, aChannel *ptr)
 		}
 	return NULL;
 }
+
+/*
+ * Member hash tables: an open addressing (linear probing) table from
+ * aClient * to Member for channels with MEMBERHASH_MIN or more members,
+ * and from aChannel * to Membership for users on that many channels.
+ * Kept in sync by add_user_to_channel()/remove_user_from_channel().
+ */
+#define MHASH_SLOT(h, key) \
+	(((unsigned int)(((unsigned long)(key) >> 3) * 0x9E3779B1UL) >> 7) & ((h)->size - 1))
+
+static aMemberHash *mhash_new(unsigned int size)
+{
+	aMemberHash *h;
+
+	h = (aMemberHash *)MyMallocEx(sizeof(aMemberHash) + (size - 1) * sizeof(h->ent[0]));
+	h->size = size;
+	h->count = 0;
+	return h;
+}
+
+static void *mhash_get(aMemberHash *h, void *key)
+{
+	unsigned int i;
+
+	for (i = MHASH_SLOT(h, key); h->ent[i].key; i = (i + 1) & (h->size - 1))
+		if (h->ent[i].key == key)
+			return h->ent[i].val;
+	return NULL;
+}
+
+static void mhash_put(aMemberHash **hp, void *key, void *val)
+{
+	aMemberHash *h = *hp, *nh;
+	unsigned int i;
+
+	if ((h->count + 1) * 2 > h->size)
+	{
+		/* Keep it at most half full */
+		nh = mhash_new(h->size * 2);
+		for (i = 0; i < h->size; i++)
+			if (h->ent[i].key)
+				mhash_put(&nh, h->ent[i].key, h->ent[i].val);
+		MyFree(h);
+		*hp = h = nh;
+	}
+	for (i = MHASH_SLOT(h, key); h->ent[i].key; i = (i + 1) & (h->size - 1))
+		if (h->ent[i].key == key)
+		{
+			h->ent[i].val = val;
+			return;
+		}
+	h->ent[i].key = key;
+	h->ent[i].val = val;
+	h->count++;
+}
+
+static void mhash_del(aMemberHash **hp, void *key)
+{
+	aMemberHash *h = *hp;
+	unsigned int i, j, k, mask = h->size - 1;
+
+	for (i = MHASH_SLOT(h, key); h->ent[i].key; i = (i + 1) & mask)
+		if (h->ent[i].key == key)
+			break;
+	if (!h->ent[i].key)
+		return;
+	if (--h->count < MEMBERHASH_MIN / 2)
+	{
+		MyFree(h);
+		*hp = NULL;
+		return;
+	}
+	/* Move back any entries of the probe run after it (no tombstones) */
+	for (j = (i + 1) & mask; h->ent[j].key; j = (j + 1) & mask)
+	{
+		k = MHASH_SLOT(h, h->ent[j].key);
+		if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j)))
+		{
+			h->ent[i] = h->ent[j];
+			i = j;
+		}
+	}
+	h->ent[i].key = NULL;
+	h->ent[i].val = NULL;
+}
+
+static void member_hash_add(aChannel *chptr, Member *ptr, aClient *who, Membership *ptr2)
+{
+	Member *lp;
+	Membership *lp2;
+
+	if (chptr->mhash)
+		mhash_put(&chptr->mhash, who, ptr);
+	else if (chptr->users >= MEMBERHASH_MIN)
+	{
+		chptr->mhash = mhash_new(MEMBERHASH_MIN * 4);
+		for (lp = chptr->members; lp; lp = lp->next)
+			mhash_put(&chptr->mhash, lp->cptr, lp);
+	}
+	if (who->user->mhash)
+		mhash_put(&who->user->mhash, chptr, ptr2);
+	else if (who->user->joined >= MEMBERHASH_MIN)
+	{
+		who->user->mhash = mhash_new(MEMBERHASH_MIN * 4);
+		for (lp2 = who->user->channel; lp2; lp2 = lp2->next)
+			mhash_put(&who->user->mhash, lp2->chptr, lp2);
+	}
+}
+
+/*
+ * find_member / find_membership: find the Member entry of 'cptr' on
+ * 'chptr', or the Membership entry of 'chptr' for 'cptr' (which must be
+ * a user). These use the member hash tables when there are any, the
+ * find_member(ship)_link() functions walk a list.
+ */
+Member *find_member(aChannel *chptr, aClient *cptr)
+{
+	if (!cptr)
+		return NULL;
+	if (chptr->mhash)
+		return (Member *)mhash_get(chptr->mhash, cptr);
+	return find_member_link(chptr->members, cptr);
+}
+
+Membership *find_membership(aClient *cptr, aChannel *chptr)
+{
+	if (!chptr)
+		return NULL;
+	if (cptr->user->mhash)
+		return (Membership *)mhash_get(cptr->user->mhash, chptr);
+	return find_membership_link(cptr->user->channel, chptr);
+}
 /* 
  * Member functions
 */
 Member	*make_member(void)
 {
 	Member *lp;
-	unsigned int	i;
 
-	if (freemember == NULL)
-	{
-		for (i = 1; i <= (4072/sizeof(Member)); ++i)		
-		{
-			lp = (Member *)MyMalloc(sizeof(Member));
-			lp->cptr = NULL;
-			lp->flags = 0;
-			lp->next = freemember;
-			freemember = lp;
-		}
-	}
-	lp = freemember;
-	freemember = freemember->next;
+	lp = (Member *)slab_alloc(&slab_member);
+	lp->cptr = NULL;
+	lp->flags = 0;
 	lp->next = NULL;
+	lp->lnext = NULL;
 	return lp;
 }
 
 void	free_member(Member *lp)
 {
 	if (lp)
-	{
-		lp->next = freemember;
-		lp->cptr = NULL;
-		lp->flags = 0;
-		freemember = lp;
-	}
+		slab_free(lp);
 }
 
 /* 
@@ -251,56 +368,17 @@ void	free_member(Member *lp)
 */
 Membership	*make_membership(int local)
 {
-	Membership *lp = NULL;
-	MembershipL *lp2 = NULL;
-	unsigned int	i;
+	Membership *lp;
 
 	if (!local)
 	{
-		if (freemembership == NULL)
-		{
-			for (i = 1; i <= (4072/sizeof(Membership)); i++)
-			{
-				lp = (Membership *)MyMalloc(sizeof(Membership));
-				lp->next = freemembership;
-				freemembership = lp;
-			}
-			lp = freemembership;
-			freemembership = lp->next;
-		}
-		else
-		{
-			lp = freemembership;
-			freemembership = freemembership->next;
-		}
+		lp = (Membership *)slab_alloc(&slab_membership);
 		bzero(lp, sizeof(Membership));
 	}
 	else
 	{
-		if (freemembershipL == NULL)
-		{
-			for (i = 1; i <= (4072/sizeof(MembershipL)); i++)		
-			{
-				lp2 = (MembershipL *)MyMalloc(sizeof(MembershipL));
-				lp2->next = (Membership *) freemembershipL;
-				freemembershipL = lp2;
-			}
-			lp2 = freemembershipL;
-			freemembershipL = (MembershipL *) lp2->next;
-			Debug((DEBUG_ERROR, "floodmode::alloc gotone"));
-		}
-		else
-		{
-			lp2 = freemembershipL;
-			freemembershipL = (MembershipL *) freemembershipL->next;
-			Debug((DEBUG_ERROR, "floodmode::freelist gotone"));
-		}
-		Debug((DEBUG_ERROR, "floodmode:: bzeroing"));	
-		bzero(lp2, sizeof(MembershipL));
-	}
-	if (local)
-	{
-		return ((Membership *) lp2);
+		lp = (Membership *)slab_alloc(&slab_membershipL);
+		bzero(lp, sizeof(MembershipL));
 	}
 	return lp;
 }
@@ -308,18 +386,7 @@ Membership	*make_membership(int local)
 void	free_membership(Membership *lp, int local)
 {
 	if (lp)
-	{
-		if (!local)
-		{
-			lp->next = freemembership;
-			freemembership = lp;
-		}
-		else
-		{
-			lp->next = (Membership *) freemembershipL;
-			freemembershipL = (MembershipL *) lp;
-		}
-	}
+		slab_free(lp);
 }
 
 /*
@@ -409,6 +476,7 @@ int add_listmode(Ban **list, aClient *cptr, aChannel *chptr, char *banid)
 	(void)strcpy(ban->who, cptr->name);
 	ban->when = TStime();
 	*list = ban;
+	chptr->bangen++;
 	return 0;
 }
 /*
@@ -431,6 +499,7 @@ int del_listmode(Ban **list, aChannel *chptr, char *banid)
 			MyFree(tmp->banstr);
 			MyFree(tmp->who);
 			free_ban(tmp);
+			chptr->bangen++;
 			return 0;
 		}
 	}
@@ -447,6 +516,11 @@ int del_listmode(Ban **list, aChannel *chptr, char *banid)
  */
 char *ban_realhost = NULL, *ban_virthost = NULL, *ban_cloakhost = NULL, *ban_ip = NULL;
 
+/* Set by ban_check_mask() when the result depends on more than the
+ * nick!user@host of the user, see is_banned_msg().
+ */
+static int ban_nocache = 0;
+
 /** is_banned - Check if a user is banned on a channel.
  * @param sptr   Client to check (can be remote client)
  * @param chptr  Channel to check
@@ -482,6 +556,11 @@ inline int ban_check_mask(aClient *sptr, aChannel *chptr, char *banstr, int type
 		}
 		else
 		{
+			/* Only the ~q/~j/~n kind (which check a n!u@h mask, through
+			 * here) are known to depend on nothing else.
+			 */
+			if (!(extban->options & EXTBOPT_ACTMODIFIER))
+				ban_nocache = 1;
 			return extban->is_banned(sptr, chptr, banstr, type);
 		}
 	}
@@ -572,6 +651,36 @@ int extban_is_banned_helper(char *buf)
 	return 0;
 }
 
+/** is_banned_msg - Like is_banned(sptr, chptr, BANCHK_MSG), but remembers
+ * the result in the membership 'lp' of sptr in chptr (if not NULL).
+ * It is used again until the bans or excepts of the channel change
+ * (chptr->bangen) or the nick/ident/host of the user does (UserIdentityChanged()).
+ * Results that depended on an extban like ~c or ~r aren't remembered.
+ * @returns 1 if banned, 0 if not.
+ */
+static int is_banned_msg(aClient *sptr, aChannel *chptr, Membership *lp)
+{
+	int banned;
+
+	if (!lp)
+		return is_banned(sptr, chptr, BANCHK_MSG) ? 1 : 0;
+	if ((lp->bancache != BANCACHE_NONE) && (lp->bangen == chptr->bangen) &&
+	    (lp->identgen == sptr->user->identgen))
+		return (lp->bancache == BANCACHE_BANNED);
+
+	ban_nocache = 0;
+	banned = is_banned(sptr, chptr, BANCHK_MSG) ? 1 : 0;
+	if (ban_nocache)
+	{
+		lp->bancache = BANCACHE_NONE;
+	} else {
+		lp->bancache = banned ? BANCACHE_BANNED : BANCACHE_OK;
+		lp->bangen = chptr->bangen;
+		lp->identgen = sptr->user->identgen;
+	}
+	return banned;
+}
+
 /*
  * Checks if the "user" IRC is banned, used by +mu.
  */
@@ -593,6 +702,67 @@ static int is_irc_banned(aChannel *chptr)
 	return 0;
 }
 
+/*
+ * Besides the member list itself a channel keeps a list of its local
+ * members and, for the remote ones, the server links they are behind
+ * with a count per link. This way sending something to a channel
+ * doesn't have to walk all the remote members. These two are updated
+ * here, whenever a member is added to or removed from chptr->members.
+ */
+static void add_member_route(aChannel *chptr, Member *ptr)
+{
+	aClient *cptr = ptr->cptr->from;
+	int  i;
+
+	if (MyConnect(ptr->cptr))
+	{
+		ptr->lnext = chptr->lmembers;
+		chptr->lmembers = ptr;
+		return;
+	}
+	for (i = 0; i < chptr->nlinks; i++)
+		if (chptr->links[i].cptr == cptr)
+		{
+			chptr->links[i].users++;
+			return;
+		}
+	if (chptr->nlinks == chptr->maxlinks)
+	{
+		chptr->maxlinks = chptr->maxlinks ? chptr->maxlinks * 2 : 2;
+		chptr->links = (aChanLink *)MyRealloc(chptr->links,
+		    chptr->maxlinks * sizeof(aChanLink));
+	}
+	chptr->links[chptr->nlinks].cptr = cptr;
+	chptr->links[chptr->nlinks].users = 1;
+	chptr->nlinks++;
+}
+
+static void del_member_route(aChannel *chptr, Member *ptr)
+{
+	aClient *cptr = ptr->cptr->from;
+	Member **curr;
+	int  i;
+
+	if (MyConnect(ptr->cptr))
+	{
+		for (curr = &chptr->lmembers; *curr; curr = &(*curr)->lnext)
+			if (*curr == ptr)
+			{
+				*curr = ptr->lnext;
+				break;
+			}
+		ptr->lnext = NULL;
+		return;
+	}
+	for (i = 0; i < chptr->nlinks; i++)
+		if (chptr->links[i].cptr == cptr)
+		{
+			if (--chptr->links[i].users == 0)
+				chptr->links[i] = chptr->links[--chptr->nlinks];
+			return;
+		}
+}
+
 /*
  * adds a user to a channel by adding another link to the channels member
  * chain.
@@ -610,6 +780,7 @@ void add_user_to_channel(aChannel *chptr, aClient *who, int flags)
 		ptr->next = chptr->members;
 		chptr->members = ptr;
 		chptr->users++;
+		add_member_route(chptr, ptr);
 
 		ptr2 = make_membership(MyClient(who));
 		/* we should make this more efficient --stskeeps 
@@ -619,6 +790,7 @@ void add_user_to_channel(aChannel *chptr, aClient *who, int flags)
 		ptr2->flags = flags;
 		who->user->channel = ptr2;
 		who->user->joined++;
+		member_hash_add(chptr, ptr, who, ptr2);
 	}
 }
 
@@ -636,6 +808,9 @@ void remove_user_from_channel(aClient *sptr, aChannel *chptr)
 			if (tmp->cptr == sptr)
 			{
 				*curr = tmp->next;
+				del_member_route(chptr, tmp);
+				if (chptr->mhash)
+					mhash_del(&chptr->mhash, sptr);
 				free_member(tmp);
 				break;
 			}
@@ -643,6 +818,8 @@ void remove_user_from_channel(aClient *sptr, aChannel *chptr)
 			if (tmp2->chptr == chptr)
 			{
 				*curr2 = tmp2->next;
+				if (sptr->user->mhash)
+					mhash_del(&sptr->user->mhash, chptr);
 				free_membership(tmp2, MyClient(sptr));
 				break;
 			}
@@ -662,7 +839,7 @@ long get_access(aClient *cptr, aChannel *chptr)
 {
 	Membership *lp;
 	if (chptr)
-		if ((lp = find_membership_link(cptr->user->channel, chptr)))
+		if ((lp = find_membership(cptr, chptr)))
 			return lp->flags;
 	return 0;
 }
@@ -674,7 +851,7 @@ int  is_chan_op(aClient *cptr, aChannel *chptr)
 	if (IsServer(cptr))
 		return 1;
 	if (chptr)
-		if ((lp = find_membership_link(cptr->user->channel, chptr)))
+		if ((lp = find_membership(cptr, chptr)))
 #ifdef PREFIX_AQ
 			return ((lp->flags & (CHFL_CHANOP|CHFL_CHANPROT|CHFL_CHANOWNER)));
 #else
@@ -691,7 +868,7 @@ int  has_voice(aClient *cptr, aChannel *chptr)
 	if (IsServer(cptr))
 		return 1;
 	if (chptr)
-		if ((lp = find_membership_link(cptr->user->channel, chptr)))
+		if ((lp = find_membership(cptr, chptr)))
 			return (lp->flags & CHFL_VOICE);
 
 	return 0;
@@ -703,7 +880,7 @@ int  is_halfop(aClient *cptr, aChannel *chptr)
 	if (IsServer(cptr))
 		return 1;
 	if (chptr)
-		if ((lp = find_membership_link(cptr->user->channel, chptr)))
+		if ((lp = find_membership(cptr, chptr)))
 			if (!(lp->flags & CHFL_CHANOP))
 				return (lp->flags & CHFL_HALFOP);
 
@@ -717,7 +894,7 @@ int  is_chanowner(aClient *cptr, aChannel *chptr)
 	if (IsServer(cptr))
 		return 1;
 	if (chptr)
-		if ((lp = find_membership_link(cptr->user->channel, chptr)))
+		if ((lp = find_membership(cptr, chptr)))
 			return (lp->flags & CHFL_CHANOWNER);
 
 	return 0;
@@ -729,7 +906,7 @@ int is_chanownprotop(aClient *cptr, aChannel *chptr) {
 	if (IsServer(cptr))
 		return 1;
 	if (chptr)
-		if ((lp = find_membership_link(cptr->user->channel, chptr)))
+		if ((lp = find_membership(cptr, chptr)))
 			if (lp->flags & (CHFL_CHANOWNER|CHFL_CHANPROT|CHFL_CHANOP))
 				return 1;
 	return 0;
@@ -741,7 +918,7 @@ int is_skochanop(aClient *cptr, aChannel *chptr) {
 	if (IsServer(cptr))
 		return 1;
 	if (chptr)
-		if ((lp = find_membership_link(cptr->user->channel, chptr)))
+		if ((lp = find_membership(cptr, chptr)))
 #ifdef PREFIX_AQ
 			if (lp->flags & (CHFL_CHANOWNER|CHFL_CHANPROT|CHFL_CHANOP|CHFL_HALFOP))
 #else
@@ -756,7 +933,7 @@ int  is_chanprot(aClient *cptr, aChannel *chptr)
 	Membership *lp;
 
 	if (chptr)
-		if ((lp = find_membership_link(cptr->user->channel, chptr)))
+		if ((lp = find_membership(cptr, chptr)))
 			return (lp->flags & CHFL_CHANPROT);
 
 	return 0;
@@ -785,7 +962,7 @@ int  can_send(aClient *cptr, aChannel *chptr, char *msgtext, int notice)
 		{
 			/* channelmode +mu is a special case.. sux!. -- Syzop */		
 
-			lp = find_membership_link(cptr->user->channel, chptr);
+			lp = find_membership(cptr, chptr);
 			if ((chptr->mode.mode & MODE_MODERATED) && (chptr->mode.mode & MODE_AUDITORIUM) &&
 			    !IsOper(cptr) &&
 		        (!lp || !(lp->flags & (CHFL_CHANOP|CHFL_VOICE|CHFL_CHANOWNER|CHFL_HALFOP|CHFL_CHANPROT))) &&
@@ -812,7 +989,7 @@ int  can_send(aClient *cptr, aChannel *chptr, char *msgtext, int notice)
 	if (chptr->mode.mode & MODE_NOPRIVMSGS && !member)
 		return (CANNOT_SEND_NOPRIVMSGS);
 
-	lp = find_membership_link(cptr->user->channel, chptr);
+	lp = find_membership(cptr, chptr);
 	if ((chptr->mode.mode & MODE_MODREG) && !op_can_override(cptr) && !IsRegNick(cptr) && 
 	    (!lp
 	    || !(lp->flags & (CHFL_CHANOP | CHFL_VOICE | CHFL_CHANOWNER |
@@ -823,7 +1000,7 @@ int  can_send(aClient *cptr, aChannel *chptr, char *msgtext, int notice)
 	    || !(lp->flags & (CHFL_CHANOP | CHFL_VOICE | CHFL_CHANOWNER |
 	    CHFL_HALFOP | CHFL_CHANPROT))))
 	    {
-			if ((chptr->mode.mode & MODE_AUDITORIUM) && !is_irc_banned(chptr) && !is_banned(cptr, chptr, BANCHK_MSG))
+			if ((chptr->mode.mode & MODE_AUDITORIUM) && !is_irc_banned(chptr) && !is_banned_msg(cptr, chptr, lp))
 				sendto_chmodemucrap(cptr, chptr, msgtext);
 			return (CANNOT_SEND_MODERATED);
 	    }
@@ -848,7 +1025,7 @@ int  can_send(aClient *cptr, aChannel *chptr, char *msgtext, int notice)
 	if ((!lp
 	    || !(lp->flags & (CHFL_CHANOP | CHFL_VOICE | CHFL_CHANOWNER |
 	    CHFL_HALFOP | CHFL_CHANPROT))) && MyClient(cptr)
-	    && is_banned(cptr, chptr, BANCHK_MSG))
+	    && is_banned_msg(cptr, chptr, lp))
 		return (CANNOT_SEND_BAN);
 
 	return 0;
@@ -1422,6 +1599,10 @@ void sub1_from_channel(aChannel *chptr)
 			MyFree(chptr->topic);
 		if (chptr->topic_nick)
 			MyFree(chptr->topic_nick);
+		if (chptr->links)
+			MyFree(chptr->links);
+		if (chptr->mhash)
+			MyFree(chptr->mhash);
 		if (chptr->prevch)
 			chptr->prevch->nextch = chptr->nextch;
 		else
@@ -1447,7 +1628,7 @@ int  check_for_chan_flood(aClient *cptr, aClient *sptr, aChannel *chptr)
 	if (is_skochanop(sptr, chptr))
 		return 0;
 
-	if (!(lp = find_membership_link(sptr->user->channel, chptr)))
+	if (!(lp = find_membership(sptr, chptr)))
 		return 0;
 
 	lp2 = (MembershipL *) lp;
@@ -43,93 +43,115 @@
 #include "h.h"
 ID_Copyright("(C) 1990 Markku Savela");
 ID_Notes("2.17 1/30/94 (C) 1990 Markku Savela");
-#if !defined(VALLOC) && !defined(valloc) && !defined(USE_DMALLOC)
-# ifndef _WIN32
-#  define	valloc malloc
-# else
-#  define	valloc MyMalloc
-# endif
-#endif
 int  dbufalloc = 0, dbufblocks = 0;
-static dbufbuf *freelist = NULL;
+long dbufmem = 0;	/* bytes counted against set::buffer-pool */
 
-/* This is a dangerous define because a broken compiler will set DBUFSIZ
-** to 4, which will work but will be very inefficient. However, there
-** are other places where the code breaks badly if this is screwed
-** up, so... -- Wumpus
-*/
+static aSlabPool dbuf_small, dbuf_large, dbuf_ref, dbuf_shared;
+
+static int dbuf_malloc_error(dbuf *);
+
+#define DBUF_SMALL	(DBUF_SMALL_SIZE - offsetof(dbufbuf, data))
+#define DBUF_LARGE	(DBUF_LARGE_SIZE - offsetof(dbufbuf, data))
+
+/* Where the data of a dbufbuf is */
+#define DBUFDATA(d) ((d)->shared ? (d)->shared->data : (d)->data)
 
-#define DBUFSIZ sizeof(((dbufbuf *)0)->data)
+void dbuf_init(void)
+{
+	slab_init(&dbuf_shared, "dbuf (shared)", sizeof(dbufshared));
+	slab_init(&dbuf_ref, "dbuf (reference)", offsetof(dbufbuf, data));
+	slab_init(&dbuf_large, "dbuf (large)", DBUF_LARGE_SIZE);
+	slab_init(&dbuf_small, "dbuf (small)", DBUF_SMALL_SIZE);
+}
 
 /*
-** dbuf_alloc - allocates a dbufbuf structure either from freelist or
-** creates a new one.
+** dbuf_alloc - allocates a dbufbuf structure with room for 'size' bytes
+** (DBUF_SMALL or DBUF_LARGE). If that would go over set::buffer-pool
+** the clients with the biggest sendQ's are dropped first, see
+** sendq_shed().
 */
-static dbufbuf *dbuf_alloc(void)
+static dbufbuf *dbuf_alloc(dbuf *dyn, u_int size)
 {
-#if defined(VALLOC) && !defined(DEBUGMODE)
-	dbufbuf *dbptr, *db2ptr;
-	int  num;
-#else
 	dbufbuf *dbptr;
-#endif
 
-	dbufalloc++;
-	if ((dbptr = freelist))
-	{
-		freelist = freelist->next;
-		return dbptr;
-	}
-	if (dbufalloc * DBUFSIZ > BUFFERPOOL)
+	if ((dbufmem + size > BUFFER_POOL) && !sendq_shed(dyn, size))
 	{
-		dbufalloc--;
-		strcpy(trouble_info, "buffer allocation error! Increase BUFFERPOOL!");
+		if (!trouble_info[0])
+			strcpy(trouble_info, "buffer allocation error! Increase set::buffer-pool!");
 		return NULL;
 	}
+	dbptr = (dbufbuf *)slab_alloc(size == DBUF_LARGE ? &dbuf_large : &dbuf_small);
+	dbufalloc++;
+	dbufmem += size;
+	dbptr->next = NULL;
+	dbptr->len = 0;
+	dbptr->size = size;
+	dbptr->shared = NULL;
+	return dbptr;
+}
 
-#if defined(VALLOC) && !defined(DEBUGMODE)
-# if defined(_SOLARIS) || defined(_SC_PAGESIZE)
-	num = sysconf(_SC_PAGESIZE) / sizeof(dbufbuf);
-# else
-	num = getpagesize() / sizeof(dbufbuf);
-# endif
-	if (num < 0)
-		num = 1;
-
-	dbufblocks += num;
-
-	dbptr = (dbufbuf *)valloc(num * sizeof(dbufbuf));
-	if (!dbptr)
-	{
-		strcpy(trouble_info, "buffer allocation error! Out of memory! OUCH!!!");
-		return (dbufbuf *)NULL;
-	}
-
-	num--;
-	for (db2ptr = dbptr; num; num--)
+/*
+** dbuf_free - return a dbufbuf structure to its pool
+*/
+static void dbuf_free(dbufbuf *ptr)
+{
+	if (ptr->shared)
+		dbuf_shared_release(ptr->shared);
+	else
 	{
-		db2ptr = (dbufbuf *)((char *)db2ptr + sizeof(dbufbuf));
-		db2ptr->next = freelist;
-		freelist = db2ptr;
+		dbufalloc--;
+		dbufmem -= ptr->size;
 	}
-	return dbptr;
-#else
-	dbufblocks++;
-	dbptr = (dbufbuf *)MyMalloc(sizeof(dbufbuf));
-	if (!dbptr)
-		strcpy(trouble_info, "buffer allocation error! Out of memory! OUCH!!!");
-	return dbptr;
-#endif
+	slab_free(ptr);
 }
 
 /*
-** dbuf_free - return a dbufbuf structure to the freelist
+** Shared blocks, see dbuf.h
 */
-static void dbuf_free(dbufbuf *ptr)
+dbufshared *dbuf_shared_new(char *buf, int length)
+{
+	dbufshared *m;
+
+	if ((length <= 0) || (length > sizeof(m->data)))
+		return NULL;
+	m = (dbufshared *)slab_alloc(&dbuf_shared);
+	dbufblocks++;
+	dbufmem += sizeof(m->data);
+	m->refcnt = 1;
+	m->len = length;
+	bcopy(buf, m->data, length);
+	return m;
+}
+
+void dbuf_shared_release(dbufshared *m)
+{
+	if (--m->refcnt > 0)
+		return;
+	dbufblocks--;
+	dbufmem -= sizeof(m->data);
+	slab_free(m);
+}
+
+int  dbuf_put_shared(dbuf *dyn, dbufshared *m)
 {
-	dbufalloc--;
-	ptr->next = freelist;
-	freelist = ptr;
+	dbufbuf *d;
+
+	d = (dbufbuf *)slab_alloc(&dbuf_ref);
+	d->next = NULL;
+	d->len = m->len;
+	d->size = 0;
+	d->shared = m;
+	m->refcnt++;
+	if (dyn->head)
+		dyn->tail->next = d;
+	else
+	{
+		dyn->head = d;
+		dyn->offset = 0;
+	}
+	dyn->tail = d;
+	dyn->length += m->len;
+	return 1;
 }
 
 /*
@@ -156,51 +178,45 @@ static int dbuf_malloc_error(dbuf *dyn)
 
 int  dbuf_put(dbuf *dyn, char *buf, int length)
 {
-	dbufbuf **h, *d;
-	int  off;
+	dbufbuf *d;
 	int  chunk;
 
 	if (!length)
 		return 1;	/* Nothing to do */
 
-	off = (dyn->offset + dyn->length) % DBUFSIZ;
-	/*
-	   ** Locate the last non-empty buffer. If the last buffer is
-	   ** full, the loop will terminate with 'd==NULL'. This loop
-	   ** assumes that the 'dyn->length' field is correctly
-	   ** maintained, as it should--no other check really needed.
-	 */
-	if (!dyn->length)
-		h = &(dyn->head);
-	else
-	{
-		if (off)
-			h = &(dyn->tail);
-		else
-			h = &(dyn->tail->next);
-	}
 	/*
-	   ** Append users data to buffer, allocating buffers as needed
+	   ** Append users data to the last buffer as long as it has room
+	   ** (and isn't a shared block, those have no room), allocating
+	   ** buffers as needed. Small ones while everything that's queued
+	   ** fits in one, large ones once the queue builds up.
+	   ** This assumes that the 'dyn->head' field is NULL if there is
+	   ** no data, as it should.
 	 */
-	chunk = DBUFSIZ - off;
+	d = dyn->head ? dyn->tail : NULL;
 	dyn->length += length;
-	for (; length > 0; h = &(d->next))
+	while (length > 0)
 	{
-		if ((d = *h) == NULL)
+		if (!d || (d->len >= d->size))
 		{
-			if ((d = (dbufbuf *)dbuf_alloc()) == NULL)
+			if ((d = dbuf_alloc(dyn, (dyn->length > DBUF_SMALL) ?
+			    DBUF_LARGE : DBUF_SMALL)) == NULL)
 				return dbuf_malloc_error(dyn);
+			if (dyn->head)
+				dyn->tail->next = d;
+			else
+			{
+				dyn->head = d;
+				dyn->offset = 0;
+			}
 			dyn->tail = d;
-			*h = d;
-			d->next = NULL;
 		}
+		chunk = d->size - d->len;
 		if (chunk > length)
 			chunk = length;
-		bcopy(buf, d->data + off, chunk);
+		bcopy(buf, d->data + d->len, chunk);
+		d->len += chunk;
 		length -= chunk;
 		buf += chunk;
-		off = 0;
-		chunk = DBUFSIZ;
 	}
 	return 1;
 }
@@ -214,12 +230,41 @@ char *dbuf_map(dbuf *dyn, int *length)
 		*length = 0;
 		return NULL;
 	}
-	*length = DBUFSIZ - dyn->offset;
+	*length = dyn->head->len - dyn->offset;
 	if (*length > dyn->length)
 		*length = dyn->length;
-	return (dyn->head->data + dyn->offset);
+	return (DBUFDATA(dyn->head) + dyn->offset);
 }
 
+#ifndef _WIN32
+int  dbuf_mapv(dbuf *dyn, struct iovec *iov, int maxiov, int *length)
+{
+	dbufbuf *d;
+	int  n, chunk, left, off;
+
+	*length = 0;
+	if (dyn->head == NULL)
+	{
+		dyn->tail = NULL;
+		return 0;
+	}
+	left = dyn->length;
+	off = dyn->offset;
+	for (n = 0, d = dyn->head; d && (left > 0) && (n < maxiov); d = d->next, n++)
+	{
+		chunk = d->len - off;
+		if (chunk > left)
+			chunk = left;
+		iov[n].iov_base = DBUFDATA(d) + off;
+		iov[n].iov_len = chunk;
+		*length += chunk;
+		left -= chunk;
+		off = 0;
+	}
+	return n;
+}
+#endif
+
 int  dbuf_delete(dbuf *dyn, int length)
 {
 	dbufbuf *d;
@@ -227,22 +272,21 @@ int  dbuf_delete(dbuf *dyn, int length)
 
 	if (length > dyn->length)
 		length = dyn->length;
-	chunk = DBUFSIZ - dyn->offset;
 	while (length > 0)
 	{
+		d = dyn->head;
+		chunk = d->len - dyn->offset;
 		if (chunk > length)
 			chunk = length;
 		length -= chunk;
 		dyn->offset += chunk;
 		dyn->length -= chunk;
-		if (dyn->offset == DBUFSIZ || dyn->length == 0)
+		if (dyn->offset == d->len || dyn->length == 0)
 		{
-			d = dyn->head;
 			dyn->head = d->next;
 			dyn->offset = 0;
 			dbuf_free(d);
 		}
-		chunk = DBUFSIZ;
 	}
 	if (dyn->head == (dbufbuf *)NULL)
 	{
@@ -281,31 +325,32 @@ int  dbuf_get(dbuf *dyn, char *buf, int length)
 int  dbuf_getmsg(dbuf *dyn, char *buf, int length)
 {
 	dbufbuf *d;
-	char *s;
+	char *s, *eol;
 	int  dlen;
 	int  i;
 	int  copy;
 
+	length--;	/* room for the NUL */
       getmsg_init:
 	d = dyn->head;
 	dlen = dyn->length;
-	i = DBUFSIZ - dyn->offset;
-	if (i <= 0)
-		return -1;
 	copy = 0;
+	eol = NULL;
 	if (d && dlen)
-		s = dyn->offset + d->data;
+		s = dyn->offset + DBUFDATA(d);
 	else
 		return 0;
+	i = d->len - dyn->offset;
+	if (i <= 0)
+		return -1;
 
-	if (i > dlen)
-		i = dlen;
-	while (length > 0 && dlen > 0)
+	/* Scan one dbufbuf at a time, see find_eol() */
+	while (d && dlen > 0 && copy < length)
 	{
-		dlen--;
-		if (*s == '\n' || *s == '\r' )
+		i = MIN(MIN(i, dlen), length - copy);
+		if ((eol = find_eol(s, i)))
 		{
-			copy = dyn->length - dlen;
+			copy += eol - s + 1;
 			/*
 			   ** Shortcut this case here to save time elsewhere.
 			   ** -avalon
@@ -317,31 +362,22 @@ int  dbuf_getmsg(dbuf *dyn, char *buf, int length)
 			}
 			break;
 		}
-		length--;
-		if (!--i)
+		copy += i;
+		dlen -= i;
+		if ((d = d->next))
 		{
-			if ((d = d->next))
-			{
-				s = d->data;
-				i = MIN(DBUFSIZ, dlen);
-			}
+			s = DBUFDATA(d);
+			i = d->len;
 		}
-		else
-			s++;
 	}
 
-	if (copy <= 0)
+	if (!eol || (copy <= 0))
 		return 0;
 
 	/*
-	   ** copy as much of the message as wanted into parse buffer
-	 */
-	i = dbuf_get(dyn, buf, MIN(copy, length));
-	/*
-	   ** and delete the rest of it!
+	   ** copy the message into parse buffer
 	 */
-	if (copy - i > 0)
-		(void)dbuf_delete(dyn, copy - i);
+	i = dbuf_get(dyn, buf, copy);
 	if (i >= 0)
 		*(buf + i) = '\0';	/* mark end of messsage */
 
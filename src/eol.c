@@ -0,0 +1,115 @@
+/************************************************************************
+ *   Unreal Internet Relay Chat Daemon, src/eol.c
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 1, or (at your option)
+ *   any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "h.h"
+#include <string.h>
+#if defined(__GNUC__) && defined(__SSE2__)
+#define EOL_SSE2
+#include <emmintrin.h>
+#if (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define EOL_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+/*
+** find_eol
+**	Returns a pointer to the first CR or LF in the 'length' bytes
+**	at 'buffer', or NULL if there is none. This is where most of the
+**	time goes when a server link bursts, so on x86 it compares 16
+**	(SSE2) or 32 (AVX2) bytes at a time, elsewhere it leaves it to
+**	memchr(). Which version is used is decided on the first call.
+**	The versions themselves are not static so that the benchmark in
+**	extras/bench/ can call each of them directly.
+*/
+char *find_eol_c(char *buffer, int length)
+{
+	char *lf, *cr;
+
+	/* a CR, if any, is nearly always right in front of the LF */
+	lf = memchr(buffer, '\n', length);
+	cr = memchr(buffer, '\r', lf ? lf - buffer : length);
+	return cr ? cr : lf;
+}
+
+#ifdef EOL_SSE2
+char *find_eol_sse2(char *buffer, int length)
+{
+	__m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n'), v;
+	char *end = buffer + length;
+	int  m;
+
+	for (; end - buffer >= 16; buffer += 16)
+	{
+		v = _mm_loadu_si128((__m128i *)buffer);
+		m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr),
+		    _mm_cmpeq_epi8(v, lf)));
+		if (m)
+			return buffer + __builtin_ctz(m);
+	}
+	if ((length >= 16) && (buffer < end))
+	{
+		/* the last 16 bytes, overlapping what we already checked */
+		buffer = end - 16;
+		v = _mm_loadu_si128((__m128i *)buffer);
+		m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr),
+		    _mm_cmpeq_epi8(v, lf)));
+		return m ? buffer + __builtin_ctz(m) : NULL;
+	}
+	return find_eol_c(buffer, end - buffer);
+}
+#endif
+
+#ifdef EOL_AVX2
+__attribute__((target("avx2")))
+char *find_eol_avx2(char *buffer, int length)
+{
+	__m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n'), v;
+	char *end = buffer + length;
+	unsigned int m;
+
+	for (; end - buffer >= 32; buffer += 32)
+	{
+		v = _mm256_loadu_si256((__m256i *)buffer);
+		m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+		    _mm256_cmpeq_epi8(v, lf)));
+		if (m)
+			return buffer + __builtin_ctz(m);
+	}
+	return find_eol_sse2(buffer, end - buffer);
+}
+#endif
+
+static char *find_eol_init(char *buffer, int length)
+{
+	find_eol = find_eol_c;
+#ifdef EOL_SSE2
+	find_eol = find_eol_sse2;
+#endif
+#ifdef EOL_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		find_eol = find_eol_avx2;
+#endif
+	return find_eol(buffer, length);
+}
+
+MODVAR char *(*find_eol)(char *, int) = find_eol_init;
@@ -29,6 +29,7 @@
 #include "version.h"
 #include "proto.h"
 #include <time.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -44,12 +45,233 @@ ID_Copyright("(C) Carsten Munk 2001");
 
 
 MODVAR Event *events = NULL;
+static Event *loopevents = NULL;	/* events with an interval of 0, run every loop */
 
 #ifdef JOINTHROTTLE
 extern EVENT(cmodej_cleanup_structs);
 #endif
 extern EVENT(unrealdns_removeoldrecords);
 
+/*
+ * Hierarchical timer wheel.
+ *
+ * TW_LEVELS wheels of TW_SIZE slots each, level 0 has a granularity of
+ * 1 msec, level 1 of TW_SIZE msec, etc. A timer is put in the lowest
+ * level that can hold it and moved down a level ("cascaded") when the
+ * wheel below it wraps. Adding and removing a timer is O(1) and running
+ * them only touches the slots that are due, regardless of how many timers
+ * are pending. Anything beyond the range of the top level is parked in its
+ * last slot and re-examined when that slot is cascaded.
+ * timer_base is the first msec that has not been run yet.
+ */
+#define TW_BITS		6
+#define TW_SIZE		(1 << TW_BITS)
+#define TW_MASK		(TW_SIZE - 1)
+#define TW_LEVELS	4
+#define TW_RANGE(l)	(1LL << (TW_BITS * (l)))
+
+static aTimer *timer_wheel[TW_LEVELS][TW_SIZE];
+static unsigned long long timer_used[TW_LEVELS];	/* bitmap of non-empty slots */
+static long long timer_base = -1;
+static int timer_count = 0;
+
+/* index of the lowest bit set, m must not be 0 */
+static int timer_ffs(unsigned long long m)
+{
+#ifdef __GNUC__
+	return __builtin_ctzll(m);
+#else
+	int  i = 0;
+
+	while (!(m & 1))
+	{
+		m >>= 1;
+		i++;
+	}
+	return i;
+#endif
+}
+
+static void timer_insert(aTimer *t)
+{
+	long long when = t->expire, delta;
+	int  level, slot;
+
+	if (when < timer_base)
+		when = timer_base;	/* already due */
+	delta = when - timer_base;
+	for (level = 0; level < TW_LEVELS - 1; level++)
+		if (delta < TW_RANGE(level + 1))
+			break;
+	if (delta >= TW_RANGE(TW_LEVELS))
+		when = timer_base + TW_RANGE(TW_LEVELS) - 1;
+	slot = (when >> (TW_BITS * level)) & TW_MASK;
+
+	t->level = level;
+	t->slot = slot;
+	t->pprev = &timer_wheel[level][slot];
+	if ((t->next = timer_wheel[level][slot]))
+		t->next->pprev = &t->next;
+	timer_wheel[level][slot] = t;
+	timer_used[level] |= 1ULL << slot;
+}
+
+/*
+ * timer_del - take a timer off the wheel, harmless if it is not queued.
+ */
+void timer_del(aTimer *t)
+{
+	if (!t->pprev)
+		return;
+	if ((*t->pprev = t->next))
+		t->next->pprev = t->pprev;
+	if (!timer_wheel[t->level][t->slot])
+		timer_used[t->level] &= ~(1ULL << t->slot);
+	t->next = NULL;
+	t->pprev = NULL;
+	timer_count--;
+}
+
+/*
+ * timer_set - (re)schedule a timer to fire at 'expire' (monotime_ms).
+ * Times in the past fire on the next timer_run().
+ */
+void timer_set(aTimer *t, long long expire)
+{
+	if (timer_base < 0)
+		timer_base = monotime_ms;
+	timer_del(t);
+	t->expire = expire;
+	timer_insert(t);
+	timer_count++;
+}
+
+/* Move everything in slot 'slot' of 'level' down to where it belongs now */
+static void timer_cascade(int level, int slot)
+{
+	aTimer *t, *next;
+
+	t = timer_wheel[level][slot];
+	timer_wheel[level][slot] = NULL;
+	timer_used[level] &= ~(1ULL << slot);
+	for (; t; t = next)
+	{
+		next = t->next;
+		timer_insert(t);
+	}
+}
+
+/* Advance timer_base, cascading the upper levels when level 0 wraps */
+static void timer_advance(long long to)
+{
+	int  level;
+
+	timer_base = to;
+	if (timer_base & TW_MASK)
+		return;
+	for (level = 1; level < TW_LEVELS; level++)
+	{
+		timer_cascade(level, (timer_base >> (TW_BITS * level)) & TW_MASK);
+		if ((timer_base >> (TW_BITS * level)) & TW_MASK)
+			break;
+	}
+}
+
+/*
+ * timer_run - run every timer that is due. A callback may set or delete
+ * any timer, including its own.
+ */
+void timer_run(void)
+{
+	aTimer *t, *list;
+	unsigned long long m;
+	long long now = monotime_ms, to;
+	int  idx;
+
+	if (timer_base < 0)
+		timer_base = now;
+	while (timer_base <= now)
+	{
+		if (!timer_count)
+		{
+			/* nothing to cascade either, just catch up */
+			timer_base = now + 1;
+			break;
+		}
+		idx = timer_base & TW_MASK;
+		m = timer_used[0] >> idx;
+		if (!(m & 1))
+		{
+			/* skip ahead to the next used slot or the end of this round */
+			if (m)
+				to = timer_base + timer_ffs(m);
+			else
+				to = (timer_base | TW_MASK) + 1;
+			timer_advance(MIN(to, now + 1));
+			continue;
+		}
+		list = timer_wheel[0][idx];
+		timer_wheel[0][idx] = NULL;
+		timer_used[0] &= ~(1ULL << idx);
+		list->pprev = &list;
+		timer_advance(timer_base + 1);
+		while ((t = list))
+		{
+			timer_del(t);
+			if (t->func)
+				(*t->func)(t->data);
+		}
+	}
+}
+
+/*
+ * timer_next_delay - msec until the first timer is due, at most 'maxdelay'.
+ * For timers not in level 0 this is the start of their slot, which may
+ * be a bit early, but never late.
+ */
+long timer_next_delay(long maxdelay)
+{
+	long long when, best = -1;
+	unsigned long long m;
+	int  level, idx, d;
+
+	if (!timer_count || (timer_base < 0))
+		return maxdelay;
+	for (level = 0; level < TW_LEVELS; level++)
+	{
+		if (!(m = timer_used[level]))
+			continue;
+		idx = (timer_base >> (TW_BITS * level)) & TW_MASK;
+		if (level == 0)
+		{
+			if (m >> idx)
+				d = timer_ffs(m >> idx);
+			else
+				d = TW_SIZE - idx + timer_ffs(m);
+			when = timer_base + d;
+		}
+		else
+		{
+			/* the current slot of an upper level has already been
+			 * cascaded, so whatever is in it is one full round away
+			 */
+			if ((idx + 1 < TW_SIZE) && (m >> (idx + 1)))
+				d = 1 + timer_ffs(m >> (idx + 1));
+			else
+				d = TW_SIZE - idx + timer_ffs(m);
+			when = ((timer_base >> (TW_BITS * level)) + d) << (TW_BITS * level);
+		}
+		if ((best < 0) || (when < best))
+			best = when;
+	}
+	when = best - monotime_ms;
+	if (when < 0)
+		return 0;
+	if (when > maxdelay)
+		return maxdelay;
+	return (long)when;
+}
+
 void	LockEventSystem(void)
 {
 }
@@ -58,12 +280,37 @@ void	UnlockEventSystem(void)
 {
 }
 
+static void event_fire(void *data);
 
-Event	*EventAddEx(Module *module, char *name, long every, long howmany,
+/* Put the event on the loop list or on the timer wheel, depending on every_ms */
+static void event_schedule(Event *event)
+{
+	Event **pp;
+
+	for (pp = &loopevents; *pp; pp = &(*pp)->loopnext)
+		if (*pp == event)
+		{
+			*pp = event->loopnext;
+			break;
+		}
+	event->loopnext = NULL;
+	if (event->every_ms == 0)
+	{
+		timer_del(&event->timer);
+		event->loopnext = loopevents;
+		loopevents = event;
+		return;
+	}
+	event->timer.func = event_fire;
+	event->timer.data = event;
+	timer_set(&event->timer, event->last_ms + event->every_ms);
+}
+
+Event	*EventAddMs(Module *module, char *name, long every_ms, long howmany,
 		  vFP event, void *data)
 {
 	Event *newevent;
-	if (!name || (every < 0) || (howmany < 0) || !event)
+	if (!name || (every_ms < 0) || (howmany < 0) || !event)
 	{
 		if (module)
 			module->errorcode = MODERR_INVALID;
@@ -72,13 +319,15 @@ Event	*EventAddEx(Module *module, char *name, long every, long howmany,
 	newevent = (Event *) MyMallocEx(sizeof(Event));
 	newevent->name = strdup(name);
 	newevent->howmany = howmany;
-	newevent->every = every;
+	newevent->every_ms = every_ms;
 	newevent->event = event;
 	newevent->data = data;
 	/* We don't want a quick execution */
-	newevent->last = TStime();
+	update_monotime();
+	newevent->last_ms = monotime_ms;
 	newevent->owner = module;
 	AddListItem(newevent,events);
+	event_schedule(newevent);
 	if (module) {
 		ModuleObject *eventobj = (ModuleObject *)MyMallocEx(sizeof(ModuleObject));
 		eventobj->object.event = newevent;
@@ -90,18 +339,36 @@ Event	*EventAddEx(Module *module, char *name, long every, long howmany,
 	
 }
 
+Event	*EventAddEx(Module *module, char *name, long every, long howmany,
+		  vFP event, void *data)
+{
+	if (every > LONG_MAX / 1000)
+		every = LONG_MAX / 1000;
+	return EventAddMs(module, name, every * 1000, howmany, event, data);
+}
+
 Event	*EventMarkDel(Event *event)
 {
 	event->howmany = -1;
+	/* let the next DoEvents() get rid of it */
+	if (event->every_ms)
+		timer_set(&event->timer, 0);
 	return event;
 }
 
 Event	*EventDel(Event *event)
 {
-	Event *p, *q;
+	Event *p, *q, **pp;
 	for (p = events; p; p = p->next) {
 		if (p == event) {
 			q = p->next;
+			timer_del(&p->timer);
+			for (pp = &loopevents; *pp; pp = &(*pp)->loopnext)
+				if (*pp == p)
+				{
+					*pp = p->loopnext;
+					break;
+				}
 			MyFree(p->name);
 			DelListItem(p, events);
 			if (p->owner) {
@@ -140,7 +407,9 @@ int EventMod(Event *event, EventInfo *mods) {
 	}
 
 	if (mods->flags & EMOD_EVERY)
-		event->every = mods->every;
+		event->every_ms = mods->every * 1000;
+	if (mods->flags & EMOD_EVERY_MS)
+		event->every_ms = mods->every_ms;
 	if (mods->flags & EMOD_HOWMANY)
 		event->howmany = mods->howmany;
 	if (mods->flags & EMOD_NAME) {
@@ -151,47 +420,63 @@ int EventMod(Event *event, EventInfo *mods) {
 		event->event = mods->event;
 	if (mods->flags & EMOD_DATA)
 		event->data = mods->data;
+	if ((mods->flags & (EMOD_EVERY|EMOD_EVERY_MS)) && (event->howmany != -1))
+		event_schedule(event);
 	if (event->owner)
 		event->owner->errorcode = MODERR_NOERROR;
 	return 0;
 }
 
+/* Run an event, returns 0 if it is gone afterwards */
+static int event_run(Event *eventptr)
+{
+	if (eventptr->howmany == -1)
+	{
+		EventDel(eventptr);
+		return 0;
+	}
+	eventptr->last_ms = monotime_ms;
+	if (eventptr->every_ms)
+		timer_set(&eventptr->timer, eventptr->last_ms + eventptr->every_ms);
+	(*eventptr->event)(eventptr->data);
+	if (eventptr->howmany > 0)
+	{
+		eventptr->howmany--;
+		if (eventptr->howmany == 0)
+		{
+			EventDel(eventptr);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void event_fire(void *data)
+{
+	(void)event_run((Event *)data);
+}
+
 #ifndef _WIN32
 inline void	DoEvents(void)
 #else
 void DoEvents(void)
 #endif
 {
-	Event *eventptr;
-	Event temp;
+	Event *eventptr, *next;
 
-	for (eventptr = events; eventptr; eventptr = eventptr->next)
+	update_monotime();
+	timer_run();
+	for (eventptr = loopevents; eventptr; eventptr = next)
 	{
-		if (eventptr->howmany == -1)
-			goto freeit;
-		if ((eventptr->every == 0) || ((TStime() - eventptr->last) >= eventptr->every))
-		{
-			eventptr->last = TStime();
-			(*eventptr->event)(eventptr->data);
-			if (eventptr->howmany > 0)
-			{
-				eventptr->howmany--;
-				if (eventptr->howmany == 0)
-				{
-freeit:
-					temp.next = EventDel(eventptr);
-					eventptr = &temp;
-					continue;
-				}
-			}
-		}
+		next = eventptr->loopnext;
+		(void)event_run(eventptr);
 	}
 }
 
 void	EventStatus(aClient *sptr)
 {
 	Event *eventptr;
-	time_t now = TStime();
+	long long now = monotime_ms;
 	
 	if (!events)
 	{
@@ -201,9 +486,10 @@ void	EventStatus(aClient *sptr)
 	}
 	for (eventptr = events; eventptr; eventptr = eventptr->next)
 	{
-		sendto_one(sptr, ":%s NOTICE %s :*** Event %s: e/%ld h/%ld n/%ld l/%ld", me.name,
-			sptr->name, eventptr->name, eventptr->every, eventptr->howmany,
-				now - eventptr->last, (eventptr->last + eventptr->every) - now);
+		sendto_one(sptr, ":%s NOTICE %s :*** Event %s: e/%ldms h/%ld n/%ldms l/%ldms", me.name,
+			sptr->name, eventptr->name, eventptr->every_ms, eventptr->howmany,
+				(long)(now - eventptr->last_ms),
+				(long)((eventptr->last_ms + eventptr->every_ms) - now));
 	}
 }
 
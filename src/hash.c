@@ -30,9 +30,6 @@
 ID_Copyright("(C) 1991 Darren Reed");
 ID_Notes("2.10 7/3/93");
 
-static aHashEntry clientTable[U_MAX];
-static aHashEntry channelTable[CH_MAX];
-
 /*
  * look in whowas.c for the missing ...[WW_MAX]; entry - Dianora */
 /*
@@ -89,9 +86,10 @@ unsigned int hash_nn_name(const char *hname)
 }
 
 
-unsigned hash_nick_name(char *nname)
+unsigned int hash_whowas_name(char *name)
 {
-	unsigned hash = 0;
+	unsigned char *nname = (unsigned char *)name;
+	unsigned int hash = 0;
 	int  hash2 = 0;
 	int  ret;
 	char lower;
@@ -103,56 +101,250 @@ unsigned hash_nick_name(char *nname)
 		hash2 = (hash2 >> 1) + lower;
 		nname++;
 	}
-	ret = ((hash & U_MAX_INITIAL_MASK) << BITS_PER_COL) +
+	ret = ((hash & WW_MAX_INITIAL_MASK) << BITS_PER_COL) +
 	    (hash2 & BITS_PER_COL_MASK);
 	return ret;
 }
 /*
- * hash_channel_name
- * 
- * calculate a hash value on at most the first 30 characters of the
- * channel name. Most names are short than this or dissimilar in this
- * range. There is little or no point hashing on a full channel name
- * which maybe 255 chars long.
+ * The client, channel and watch tables are chained hash tables that grow
+ * (and shrink) with the number of entries in them. To avoid a long stop
+ * while everything is rehashed, a resize is done incrementally: a second,
+ * bigger (or smaller) bucket array is allocated and a few buckets of the
+ * old one are moved over on every add and delete. Until that is done a
+ * lookup goes to the new array if its bucket in the old one has already
+ * been moved, and to the old one otherwise, so it is still one chain.
+ * The chains are linked through the entries themselves (->hnext etc).
+ */
+MODVAR aHashTable clientHash, channelHash, watchHash;
+
+#define HNEXT(t, p)	(*(void **)((char *)(p) + (t)->nextoff))
+#define HHASH(t, p)	(*(unsigned int *)((char *)(p) + (t)->hashoff))
+#define HLEN(t, p)	(*(unsigned short *)((char *)(p) + (t)->lenoff))
+
+/* Buckets moved over per add/delete while resizing */
+#define HASH_STEP	4
+
+/*
+ * Every entry keeps the hash value (see hash_name() in match.c) and
+ * length of its name, set when it is added. The table size decides how
+ * many of the bits of the hash value are used. Moving an entry to another
+ * bucket array doesn't need the name, and lookups only compare names of
+ * entries with the same hash value and length.
  */
-unsigned int  hash_channel_name(char *name)
+static void hash_init(aHashTable *t, unsigned int minsize, int nextoff,
+    int hashoff, int lenoff)
 {
-	unsigned char *hname = (unsigned char *)name;
-	unsigned int hash = 0;
-	int  hash2 = 0;
-	char lower;
-	int  i = 30;
+	if (t->tab[0])
+		MyFree(t->tab[0]);
+	if (t->tab[1])
+		MyFree(t->tab[1]);
+	bzero(t, sizeof(aHashTable));
+	t->minsize = minsize;
+	t->nextoff = nextoff;
+	t->hashoff = hashoff;
+	t->lenoff = lenoff;
+	t->size[0] = minsize;
+	t->tab[0] = (void **)MyMallocEx(minsize * sizeof(void *));
+}
+
+/* The head of the chain that 'hashv' is (or would be) in */
+static void **hash_bucket(aHashTable *t, unsigned int hashv)
+{
+	unsigned int i = hashv & (t->size[0] - 1);
+
+	if (t->size[1] && (i < t->moved))
+		return &t->tab[1][hashv & (t->size[1] - 1)];
+	return &t->tab[0][i];
+}
+
+/* Move up to 'n' buckets over to the new array when resizing */
+static void hash_step(aHashTable *t, int n)
+{
+	void *p, *next, **bucket;
 
-	while (*hname && --i)
+	while (t->size[1] && (n-- > 0))
 	{
-		lower = tolower(*hname);
-		hash = (hash << 1) + lower;
-		hash2 = (hash2 >> 1) + lower;
-		hname++;
+		for (p = t->tab[0][t->moved]; p; p = next)
+		{
+			next = HNEXT(t, p);
+			bucket = &t->tab[1][HHASH(t, p) & (t->size[1] - 1)];
+			HNEXT(t, p) = *bucket;
+			*bucket = p;
+		}
+		t->tab[0][t->moved] = NULL;
+		if (++t->moved == t->size[0])
+		{
+			MyFree(t->tab[0]);
+			t->tab[0] = t->tab[1];
+			t->size[0] = t->size[1];
+			t->tab[1] = NULL;
+			t->size[1] = 0;
+			t->moved = 0;
+			t->resizes++;
+		}
 	}
-	return ((hash & CH_MAX_INITIAL_MASK) << BITS_PER_COL) +
-	    (hash2 & BITS_PER_COL_MASK);
 }
 
-unsigned int hash_whowas_name(char *name)
+/*
+ * Called after every add and delete: moves on with a resize in progress,
+ * or starts one when the table is more than full (on average more than
+ * one entry per chain) or less than 1/8th full.
+ */
+static void hash_resize(aHashTable *t)
 {
-	unsigned char *nname = (unsigned char *)name;
-	unsigned int hash = 0;
-	int  hash2 = 0;
-	int  ret;
-	char lower;
+	unsigned int size;
 
-	while (*nname)
+	if (t->size[1])
 	{
-		lower = tolower(*nname);
-		hash = (hash << 1) + lower;
-		hash2 = (hash2 >> 1) + lower;
-		nname++;
+		hash_step(t, HASH_STEP);
+		return;
 	}
-	ret = ((hash & WW_MAX_INITIAL_MASK) << BITS_PER_COL) +
-	    (hash2 & BITS_PER_COL_MASK);
-	return ret;
+	if (t->count > t->size[0])
+		size = t->size[0] * 2;
+	else if ((t->count < t->size[0] / 8) && (t->size[0] > t->minsize))
+		size = t->size[0] / 2;
+	else
+		return;
+	t->tab[1] = (void **)MyMallocEx(size * sizeof(void *));
+	t->size[1] = size;
+	t->moved = 0;
+	hash_step(t, HASH_STEP);
+}
+
+static void hash_add(aHashTable *t, char *name, void *p)
+{
+	void **bucket;
+	int  len;
+
+	HHASH(t, p) = hash_name(name, &len);
+	HLEN(t, p) = len;
+	bucket = hash_bucket(t, HHASH(t, p));
+	HNEXT(t, p) = *bucket;
+	*bucket = p;
+	t->count++;
+	hash_resize(t);
+}
+
+/* Delete 'p', it is in the bucket for the hash value it was added with */
+static int hash_del(aHashTable *t, void *p)
+{
+	void **bucket = hash_bucket(t, HHASH(t, p));
+
+	for (; *bucket; bucket = &HNEXT(t, *bucket))
+		if (*bucket == p)
+		{
+			*bucket = HNEXT(t, p);
+			HNEXT(t, p) = NULL;
+			t->count--;
+			hash_resize(t);
+			return 1;
+		}
+	return 0;
+}
+
+/*
+ * Chain for 'name', with its hash value and length in *hashv and *len.
+ * Counted as a lookup for the statistics.
+ */
+static void *hash_chain(aHashTable *t, char *name, unsigned int *hashv, int *len)
+{
+	t->lookups++;
+	*hashv = hash_name(name, len);
+	return *hash_bucket(t, *hashv);
+}
+
+/* Is 'p' (probably) the entry for the name with hash 'hashv' and length 'len'? */
+#define HASH_SAME(t, p, hashv, len) \
+	((t)->probes++, (HHASH(t, p) == (hashv)) && (HLEN(t, p) == (len)))
+
+static unsigned int rev_bits(unsigned int v)
+{
+	unsigned int r = 0;
+	int  i;
+
+	for (i = 0; i < sizeof(v) * CHAR_BIT; i++, v >>= 1)
+		r = (r << 1) | (v & 1);
+	return r;
 }
+
+/*
+ * hash_scan: call fn() for the entries in the bucket(s) at 'cursor' and
+ * return the next cursor, 0 when done. Start with a cursor of 0. The
+ * cursor is incremented in reversed bit order so that a table that is
+ * resized between two calls doesn't cause entries to be skipped (some
+ * may be returned twice though). Same trick as Redis' SCAN.
+ */
+static unsigned int hash_scan(aHashTable *t, unsigned int v,
+    void (*fn)(void *, void *), void *data)
+{
+	void **t0, **t1, *p, *next;
+	unsigned int m0, m1;
+
+	if (!t->size[1])
+	{
+		m0 = t->size[0] - 1;
+		for (p = t->tab[0][v & m0]; p; p = next)
+		{
+			next = HNEXT(t, p);
+			fn(p, data);
+		}
+		v |= ~m0;
+		return rev_bits(rev_bits(v) + 1);
+	}
+	/* Resizing: do the bucket in the smaller array, then the ones in the
+	 * bigger array that it expands to.
+	 */
+	if (t->size[0] <= t->size[1])
+	{
+		t0 = t->tab[0]; m0 = t->size[0] - 1;
+		t1 = t->tab[1]; m1 = t->size[1] - 1;
+	}
+	else
+	{
+		t0 = t->tab[1]; m0 = t->size[1] - 1;
+		t1 = t->tab[0]; m1 = t->size[0] - 1;
+	}
+	for (p = t0[v & m0]; p; p = next)
+	{
+		next = HNEXT(t, p);
+		fn(p, data);
+	}
+	do
+	{
+		for (p = t1[v & m1]; p; p = next)
+		{
+			next = HNEXT(t, p);
+			fn(p, data);
+		}
+		v |= ~m1;
+		v = rev_bits(rev_bits(v) + 1);
+	} while (v & (m0 ^ m1));
+	return v;
+}
+
+/*
+ * hash_stats: current figures of a table for /STATS Z. The chain
+ * lengths are found by walking the whole table, so only on request.
+ */
+void hash_stats(aHashTable *t, unsigned int *used, unsigned int *longest)
+{
+	unsigned int i, len;
+	int  n;
+	void *p;
+
+	*used = *longest = 0;
+	for (n = 0; n < 2; n++)
+		for (i = 0; i < t->size[n]; i++)
+		{
+			for (len = 0, p = t->tab[n][i]; p; p = HNEXT(t, p))
+				len++;
+			if (len)
+				(*used)++;
+			if (len > *longest)
+				*longest = len;
+		}
+}
+
 /*
  * clear_*_hash_table
  * 
@@ -160,12 +352,14 @@ unsigned int hash_whowas_name(char *name)
  */
 void clear_client_hash_table(void)
 {
-	memset((char *)clientTable, '\0', sizeof(aHashEntry) * U_MAX);
+	hash_init(&clientHash, HASH_CLIENT_MIN, offsetof(aClient, hnext),
+	    offsetof(aClient, hashv), offsetof(aClient, namelen));
 }
 
 void clear_channel_hash_table(void)
 {
-	memset((char *)channelTable, '\0', sizeof(aHashEntry) * CH_MAX);
+	hash_init(&channelHash, HASH_CHANNEL_MIN, offsetof(aChannel, hnextch),
+	    offsetof(aChannel, hashv), offsetof(aChannel, namelen));
 }
 
 
@@ -174,7 +368,6 @@ void clear_channel_hash_table(void)
  */
 int  add_to_client_hash_table(char *name, aClient *cptr)
 {
-	unsigned int  hashv;
 	/*
 	 * If you see this, you have probably found your way to why changing the 
 	 * base version made the IRCd become weird. This has been the case in all
@@ -190,11 +383,7 @@ int  add_to_client_hash_table(char *name, aClient *cptr)
 	*/
 	if (loop.tainted)
 		return 0;
-	hashv = hash_nick_name(name);
-	cptr->hnext = (aClient *)clientTable[hashv].list;
-	clientTable[hashv].list = (void *)cptr;
-	clientTable[hashv].links++;
-	clientTable[hashv].hits++;
+	hash_add(&clientHash, name, cptr);
 	return 0;
 }
 /*
@@ -202,13 +391,7 @@ int  add_to_client_hash_table(char *name, aClient *cptr)
  */
 int  add_to_channel_hash_table(char *name, aChannel *chptr)
 {
-	unsigned int  hashv;
-
-	hashv = hash_channel_name(name);
-	chptr->hnextch = (aChannel *)channelTable[hashv].list;
-	channelTable[hashv].list = (void *)chptr;
-	channelTable[hashv].links++;
-	channelTable[hashv].hits++;
+	hash_add(&channelHash, name, chptr);
 	return 0;
 }
 /*
@@ -216,65 +399,14 @@ int  add_to_channel_hash_table(char *name, aChannel *chptr)
  */
 int  del_from_client_hash_table(char *name, aClient *cptr)
 {
-	aClient *tmp, *prev = NULL;
-	unsigned int  hashv;
-
-	hashv = hash_nick_name(name);
-	for (tmp = (aClient *)clientTable[hashv].list; tmp; tmp = tmp->hnext)
-	{
-		if (tmp == cptr)
-		{
-			if (prev)
-				prev->hnext = tmp->hnext;
-			else
-				clientTable[hashv].list = (void *)tmp->hnext;
-			tmp->hnext = NULL;
-			if (clientTable[hashv].links > 0)
-			{
-				clientTable[hashv].links--;
-				return 1;
-			}
-			else
-				/*
-				 * Should never actually return from here and if we do it
-				 * is an error/inconsistency in the hash table.
-				 */
-				return -1;
-		}
-		prev = tmp;
-	}
-	return 0;
+	return hash_del(&clientHash, cptr);
 }
 /*
  * del_from_channel_hash_table
  */
 int  del_from_channel_hash_table(char *name, aChannel *chptr)
 {
-	aChannel *tmp, *prev = NULL;
-	unsigned int  hashv;
-
-	hashv = hash_channel_name(name);
-	for (tmp = (aChannel *)channelTable[hashv].list; tmp;
-	    tmp = tmp->hnextch)
-	{
-		if (tmp == chptr)
-		{
-			if (prev)
-				prev->hnextch = tmp->hnextch;
-			else
-				channelTable[hashv].list = (void *)tmp->hnextch;
-			tmp->hnextch = NULL;
-			if (channelTable[hashv].links > 0)
-			{
-				channelTable[hashv].links--;
-				return 1;
-			}
-			else
-				return -1;
-		}
-		prev = tmp;
-	}
-	return 0;
+	return hash_del(&channelHash, chptr);
 }
 
 /*
@@ -283,33 +415,15 @@ int  del_from_channel_hash_table(char *name, aChannel *chptr)
 aClient *hash_find_client(char *name, aClient *cptr)
 {
 	aClient *tmp;
-	aHashEntry *tmp3;
-	unsigned int  hashv;
+	unsigned int hashv;
+	int  len;
 
-	hashv = hash_nick_name(name);
-	tmp3 = &clientTable[hashv];
-	/*
-	 * Got the bucket, now search the chain.
-	 */
-	for (tmp = (aClient *)tmp3->list; tmp; tmp = tmp->hnext)
-		if (smycmp(name, tmp->name) == 0)
+	for (tmp = (aClient *)hash_chain(&clientHash, name, &hashv, &len); tmp; tmp = tmp->hnext)
+		if (HASH_SAME(&clientHash, tmp, hashv, len) && smycmp(name, tmp->name) == 0)
 		{
 			return (tmp);
 		}
 	return (cptr);
-	/*
-	 * If the member of the hashtable we found isnt at the top of its
-	 * chain, put it there.  This builds a most-frequently used order
-	 * into the chains of the hash table, giving speedier lookups on
-	 * those nicks which are being used currently.  This same block of
-	 * code is also used for channels and servers for the same
-	 * performance reasons.
-	 * 
-	 * I don't believe it does.. it only wastes CPU, lets try it and
-	 * see....
-	 * 
-	 * - Dianora
-	 */
 }
 
 /*
@@ -318,19 +432,18 @@ aClient *hash_find_client(char *name, aClient *cptr)
 aClient *hash_find_nickserver(char *name, aClient *cptr)
 {
 	aClient *tmp;
-	aHashEntry *tmp3;
-	unsigned int  hashv;
 	char *serv;
+	unsigned int hashv;
+	int  len;
 
 	serv = (char *)strchr(name, '@');
 	*serv++ = '\0';
-	hashv = hash_nick_name(name);
-	tmp3 = &clientTable[hashv];
 	/*
 	 * Got the bucket, now search the chain.
 	 */
-	for (tmp = (aClient *)tmp3->list; tmp; tmp = tmp->hnext)
-		if (smycmp(name, tmp->name) == 0 && tmp->user &&
+	for (tmp = (aClient *)hash_chain(&clientHash, name, &hashv, &len); tmp; tmp = tmp->hnext)
+		if (HASH_SAME(&clientHash, tmp, hashv, len) &&
+		    smycmp(name, tmp->name) == 0 && tmp->user &&
 		    smycmp(serv, tmp->user->server) == 0)
 		{
 			*--serv = '\0';
@@ -346,19 +459,13 @@ aClient *hash_find_nickserver(char *name, aClient *cptr)
 aClient *hash_find_server(char *server, aClient *cptr)
 {
 	aClient *tmp;
-#if 0
-	char *t;
-	char ch;
-#endif
-	aHashEntry *tmp3;
-
-	unsigned int  hashv;
-
-	hashv = hash_nick_name(server);
-	tmp3 = &clientTable[hashv];
+	unsigned int hashv;
+	int  len;
 
-	for (tmp = (aClient *)tmp3->list; tmp; tmp = tmp->hnext)
+	for (tmp = (aClient *)hash_chain(&clientHash, server, &hashv, &len); tmp; tmp = tmp->hnext)
 	{
+		if (!HASH_SAME(&clientHash, tmp, hashv, len))
+			continue;
 		if (!IsServer(tmp) && !IsMe(tmp))
 			continue;
 		if (smycmp(server, tmp->name) == 0)
@@ -366,43 +473,6 @@ aClient *hash_find_server(char *server, aClient *cptr)
 			return (tmp);
 		}
 	}
-
-	/*
-	 * Whats happening in this next loop ? Well, it takes a name like
-	 * foo.bar.edu and proceeds to earch for *.edu and then *.bar.edu.
-	 * This is for checking full server names against masks although it
-	 * isnt often done this way in lieu of using matches().
-	 */
-
-	/* why in god's name would we ever want to do something like this?
-	 * commented out, probably to be removed sooner or later - lucas 
-	 */
-
-#if 0
-	t = ((char *)server + strlen(server));
-
-	for (;;)
-	{
-		t--;
-		for (; t > server; t--)
-			if (*(t + 1) == '.')
-				break;
-		if (*t == '*' || t == server)
-			break;
-		ch = *t;
-		*t = '*';
-		/*
-		 * Dont need to check IsServer() here since nicknames cant have
-		 * *'s in them anyway.
-		 */
-		if (((tmp = hash_find_client(t, cptr))) != cptr)
-		{
-			*t = ch;
-			return (tmp);
-		}
-		*t = ch;
-	}
-#endif
 	return (cptr);
 }
 
@@ -411,25 +481,42 @@ aClient *hash_find_server(char *server, aClient *cptr)
  */
 aChannel *hash_find_channel(char *name, aChannel *chptr)
 {
-	unsigned int  hashv;
 	aChannel *tmp;
-	aHashEntry *tmp3;
+	unsigned int hashv;
+	int  len;
 
-	hashv = hash_channel_name(name);
-	tmp3 = &channelTable[hashv];
-
-	for (tmp = (aChannel *)tmp3->list; tmp; tmp = tmp->hnextch)
-		if (smycmp(name, tmp->chname) == 0)
+	for (tmp = (aChannel *)hash_chain(&channelHash, name, &hashv, &len); tmp; tmp = tmp->hnextch)
+		if (HASH_SAME(&channelHash, tmp, hashv, len) && smycmp(name, tmp->chname) == 0)
 		{
 			return (tmp);
 		}
 	return chptr;
 }
-aChannel *hash_get_chan_bucket(unsigned int hashv)
+
+/*
+ * hash_scan_channels: go through all channels, a few at a time. Calls
+ * fn() for the channels at 'cursor' and returns the cursor to continue
+ * with, or 0 when all have been done. See hash_scan().
+ */
+struct chanscan {
+	void (*fn)(aChannel *, void *);
+	void *data;
+};
+
+static void hash_scan_channel(void *p, void *data)
 {
-	if (hashv > CH_MAX)
-		return NULL;
-	return (aChannel *)channelTable[hashv].list;
+	struct chanscan *s = (struct chanscan *)data;
+
+	s->fn((aChannel *)p, s->data);
+}
+
+unsigned int hash_scan_channels(unsigned int cursor, void (*fn)(aChannel *, void *), void *data)
+{
+	struct chanscan s;
+
+	s.fn = fn;
+	s.data = data;
+	return hash_scan(&channelHash, cursor, hash_scan_channel, &s);
 }
 
 /*
@@ -451,27 +538,28 @@ aChannel *hash_get_chan_bucket(unsigned int hashv)
  * hash-get-notify:
  */
 
-static   aWatch  *watchTable[WATCHHASHSIZE];
-
 void  count_watch_memory(int *count, u_long *memory)
 {
-	int   i = WATCHHASHSIZE;
+	unsigned int i;
+	int   n;
 	aWatch  *anptr;
 	
 	
-	while (i--) {
-		anptr = watchTable[i];
-		while (anptr) {
-			(*count)++;
-			(*memory) += sizeof(aWatch)+strlen(anptr->nick);
-			anptr = anptr->hnext;
+	for (n = 0; n < 2; n++)
+		for (i = 0; i < watchHash.size[n]; i++) {
+			anptr = (aWatch *)watchHash.tab[n][i];
+			while (anptr) {
+				(*count)++;
+				(*memory) += sizeof(aWatch)+strlen(anptr->nick);
+				anptr = anptr->hnext;
+			}
 		}
-	}
 }
 extern char unreallogo[];
 void  clear_watch_hash_table(void)
 {
-	   memset((char *)watchTable, '\0', sizeof(watchTable));
+	   hash_init(&watchHash, HASH_WATCH_MIN, offsetof(aWatch, hnext),
+	       offsetof(aWatch, hashv), offsetof(aWatch, namelen));
 	   if (strcmp(BASE_VERSION, &unreallogo[337]))
 		loop.tainted = 1;
 }
@@ -482,18 +570,12 @@ void  clear_watch_hash_table(void)
  */
 int   add_to_watch_hash_table(char *nick, aClient *cptr, int awaynotify)
 {
-	unsigned int   hashv;
 	aWatch  *anptr;
 	Link  *lp;
 	
 	
-	/* Get the right bucket... */
-	hashv = hash_nick_name(nick)%WATCHHASHSIZE;
-	
-	/* Find the right nick (header) in the bucket, or NULL... */
-	if ((anptr = (aWatch *)watchTable[hashv]))
-	  while (anptr && mycmp(anptr->nick, nick))
-		 anptr = anptr->hnext;
+	/* Find the right nick (header), or NULL... */
+	anptr = hash_get_watch(nick);
 	
 	/* If found NULL (no header for this nick), make one... */
 	if (!anptr) {
@@ -503,8 +585,7 @@ int   add_to_watch_hash_table(char *nick, aClient *cptr, int awaynotify)
 		
 		anptr->watch = NULL;
 		
-		anptr->hnext = watchTable[hashv];
-		watchTable[hashv] = anptr;
+		hash_add(&watchHash, anptr->nick, anptr);
 	}
 	/* Is this client already on the watch-list? */
 	if ((lp = anptr->watch))
@@ -535,7 +616,6 @@ int   add_to_watch_hash_table(char *nick, aClient *cptr, int awaynotify)
  */
 int   hash_check_watch(aClient *cptr, int reply)
 {
-	unsigned int   hashv;
 	aWatch  *anptr;
 	Link  *lp;
 	int awaynotify = 0;
@@ -544,13 +624,19 @@ int   hash_check_watch(aClient *cptr, int reply)
 		awaynotify = 1;
 	
 	
-	/* Get us the right bucket */
-	hashv = hash_nick_name(cptr->name)%WATCHHASHSIZE;
-	
-	/* Find the right header in this bucket */
-	if ((anptr = (aWatch *)watchTable[hashv]))
-	  while (anptr && mycmp(anptr->nick, cptr->name))
-		 anptr = anptr->hnext;
+	/* Find the right header. The nick was (or still is) in the client
+	 * hash, so its hash value and length are known already.
+	 */
+	if (cptr->namelen)
+	{
+		watchHash.lookups++;
+		for (anptr = (aWatch *)*hash_bucket(&watchHash, cptr->hashv); anptr; anptr = anptr->hnext)
+			if (HASH_SAME(&watchHash, anptr, cptr->hashv, cptr->namelen) &&
+			    !mycmp(anptr->nick, cptr->name))
+				break;
+	}
+	else
+		anptr = hash_get_watch(cptr->name);
 	if (!anptr)
 	  return 0;   /* This nick isn't on watch */
 	
@@ -610,15 +696,14 @@ int   hash_check_watch(aClient *cptr, int reply)
  */
 aWatch  *hash_get_watch(char *name)
 {
-	unsigned int   hashv;
 	aWatch  *anptr;
+	unsigned int hashv;
+	int   len;
 	
 	
-	hashv = hash_nick_name(name)%WATCHHASHSIZE;
-	
-	if ((anptr = (aWatch *)watchTable[hashv]))
-	  while (anptr && mycmp(anptr->nick, name))
-		 anptr = anptr->hnext;
+	for (anptr = (aWatch *)hash_chain(&watchHash, name, &hashv, &len); anptr; anptr = anptr->hnext)
+		if (HASH_SAME(&watchHash, anptr, hashv, len) && !mycmp(anptr->nick, name))
+			break;
 	
 	return anptr;
 }
@@ -628,21 +713,12 @@ aWatch  *hash_get_watch(char *name)
  */
 int   del_from_watch_hash_table(char *nick, aClient *cptr)
 {
-	unsigned int   hashv;
-	aWatch  *anptr, *nlast = NULL;
+	aWatch  *anptr;
 	Link  *lp, *last = NULL;
 	
 	
-	/* Get the bucket for this nick... */
-	hashv = hash_nick_name(nick)%WATCHHASHSIZE;
-	
-	/* Find the right header, maintaining last-link pointer... */
-	if ((anptr = (aWatch *)watchTable[hashv]))
-	  while (anptr && mycmp(anptr->nick, nick)) {
-		  nlast = anptr;
-		  anptr = anptr->hnext;
-	  }
-	if (!anptr)
+	/* Find the right header... */
+	if (!(anptr = hash_get_watch(nick)))
 	  return 0;   /* No such watch */
 	
 	/* Find this client from the list of notifies... with last-ptr. */
@@ -687,10 +763,7 @@ int   del_from_watch_hash_table(char *nick, aClient *cptr)
 	}
 	/* In case this header is now empty of notices, remove it */
 	if (!anptr->watch) {
-		if (!nlast)
-		  watchTable[hashv] = anptr->hnext;
-		else
-		  nlast->hnext = anptr->hnext;
+		hash_del(&watchHash, anptr);
 		MyFree(anptr);
 	}
 	
@@ -705,7 +778,6 @@ int   del_from_watch_hash_table(char *nick, aClient *cptr)
  */
 int   hash_del_watch_list(aClient *cptr)
 {
-	unsigned int   hashv;
 	aWatch  *anptr;
 	Link  *np, *lp, *last;
 	
@@ -738,24 +810,10 @@ int   hash_del_watch_list(aClient *cptr)
 			
 			/*
 			 * If this leaves a header without notifies,
-			 * remove it. Need to find the last-pointer!
+			 * remove it.
 			 */
 			if (!anptr->watch) {
-				aWatch  *np2, *nl;
-				
-				hashv = hash_nick_name(anptr->nick)%WATCHHASHSIZE;
-				
-				nl = NULL;
-				np2 = watchTable[hashv];
-				while (np2 != anptr) {
-					nl = np2;
-					np2 = np2->hnext;
-				}
-				
-				if (nl)
-				  nl->hnext = anptr->hnext;
-				else
-				  watchTable[hashv] = anptr->hnext;
+				hash_del(&watchHash, anptr);
 				MyFree(anptr);
 			}
 		}
@@ -0,0 +1,266 @@
+/***********************************************************************
+ *  Unreal Internet Relay Chat Daemon, src/hosttrie.c
+ *
+ *  All parts of this program are Copyright(C) 2001(or later).
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ * $Id$
+ */
+
+/*
+ * Host suffix index.
+ * Host masks that are an exact name ("irc.example.net") or a plain
+ * suffix ("*.example.net") are stored in a trie on the reversed labels
+ * (net -> example -> irc), so finding the masks that match a host only
+ * takes one lookup per label of the host. Anything else needs match()
+ * and can't be put in here, see hosttrie_indexable().
+ * The children of all nodes are kept in one hash table per trie, keyed
+ * on the parent node and the label.
+ */
+
+#include "struct.h"
+#include "common.h"
+#include "sys.h"
+#include "h.h"
+#include <string.h>
+
+#define HOSTTRIE_INITSIZE	64
+
+static unsigned int hosttrie_hash(aHostNode *parent, const char *label, int len)
+{
+	unsigned int hashv = 2166136261u ^ (unsigned int)(size_t)parent;
+
+	while (len--)
+		hashv = (hashv ^ (u_char)tolower(*label++)) * 16777619;
+	return hashv;
+}
+
+static int hosttrie_labelcmp(const char *a, const char *b, int len)
+{
+	while (len--)
+		if (tolower(*a++) != tolower(*b++))
+			return 1;
+	return 0;
+}
+
+/* Returns the child 'label' (of 'len' chars) of 'parent', NULL is the root */
+static aHostNode *hosttrie_child(aHostTrie *t, aHostNode *parent, const char *label, int len)
+{
+	aHostNode *n;
+	unsigned int hashv;
+
+	if (!t->size)
+		return NULL;
+	hashv = hosttrie_hash(parent, label, len);
+	for (n = t->table[hashv & (t->size - 1)]; n; n = n->hnext)
+		if ((n->hashv == hashv) && (n->parent == parent) && (n->len == len) &&
+		    !hosttrie_labelcmp(n->label, label, len))
+			return n;
+	return NULL;
+}
+
+static void hosttrie_grow(aHostTrie *t)
+{
+	aHostNode **table, *n, *next;
+	int  size = t->size ? t->size * 2 : HOSTTRIE_INITSIZE, i;
+
+	table = (aHostNode **)MyMallocEx(sizeof(aHostNode *) * size);
+	for (i = 0; i < t->size; i++)
+		for (n = t->table[i]; n; n = next)
+		{
+			next = n->hnext;
+			n->hnext = table[n->hashv & (size - 1)];
+			table[n->hashv & (size - 1)] = n;
+		}
+	if (t->table)
+		MyFree(t->table);
+	t->table = table;
+	t->size = size;
+}
+
+static aHostNode *hosttrie_addchild(aHostTrie *t, aHostNode *parent, const char *label, int len)
+{
+	aHostNode *n;
+
+	if ((n = hosttrie_child(t, parent, label, len)))
+		return n;
+	if (t->count >= t->size)
+		hosttrie_grow(t);
+	n = (aHostNode *)MyMallocEx(sizeof(aHostNode) + len);
+	n->parent = parent;
+	n->len = len;
+	bcopy(label, n->label, len);
+	n->hashv = hosttrie_hash(parent, label, len);
+	n->hnext = t->table[n->hashv & (t->size - 1)];
+	t->table[n->hashv & (t->size - 1)] = n;
+	if (parent)
+		parent->children++;
+	t->count++;
+	return n;
+}
+
+static void hosttrie_delnode(aHostTrie *t, aHostNode *n)
+{
+	aHostNode **p;
+
+	for (p = &t->table[n->hashv & (t->size - 1)]; *p != n; p = &(*p)->hnext)
+		;
+	*p = n->hnext;
+	if (n->parent)
+		n->parent->children--;
+	t->count--;
+	MyFree(n);
+}
+
+/*
+ * Returns 1 if 'mask' is an exact host name or "*." followed by one,
+ * 2 for the latter. Returns 0 if the mask needs match().
+ */
+int hosttrie_indexable(const char *mask)
+{
+	int  wild = 0;
+	const char *p;
+
+	if ((mask[0] == '*') && (mask[1] == '.'))
+	{
+		mask += 2;
+		wild = 1;
+	}
+	if (!*mask)
+		return 0;
+	for (p = mask; *p; p++)
+		if ((*p == '*') || (*p == '?'))
+			return 0;
+	return wild + 1;
+}
+
+/*
+ * Adds 'item' under host mask 'mask' using 'e', which must stay around
+ * until hosttrie_del(). Returns 0 (and adds nothing) if the mask can't
+ * be indexed.
+ */
+int hosttrie_add(aHostTrie *t, aHostEntry *e, const char *mask, void *item)
+{
+	aHostNode *n = NULL;
+	const char *end, *p;
+	int  kind;
+
+	if (!(kind = hosttrie_indexable(mask)))
+		return 0;
+	if (kind == 2)
+		mask += 2;
+	for (end = mask + strlen(mask); ; end = p - 1)
+	{
+		for (p = end; (p > mask) && (p[-1] != '.'); p--)
+			;
+		n = hosttrie_addchild(t, n, p, end - p);
+		if (p == mask)
+			break;
+	}
+	e->item = item;
+	e->node = n;
+	e->wild = (kind == 2);
+	e->prev = NULL;
+	if (e->wild)
+	{
+		if ((e->next = n->wild))
+			e->next->prev = e;
+		n->wild = e;
+	}
+	else
+	{
+		if ((e->next = n->exact))
+			e->next->prev = e;
+		n->exact = e;
+	}
+	return 1;
+}
+
+void hosttrie_del(aHostTrie *t, aHostEntry *e)
+{
+	aHostNode *n = e->node, *parent;
+
+	if (!n)
+		return;
+	if (e->prev)
+		e->prev->next = e->next;
+	else if (e->wild)
+		n->wild = e->next;
+	else
+		n->exact = e->next;
+	if (e->next)
+		e->next->prev = e->prev;
+	e->node = NULL;
+	e->prev = e->next = NULL;
+
+	/* Drop the nodes nobody needs anymore */
+	while (n && !n->exact && !n->wild && !n->children)
+	{
+		parent = n->parent;
+		hosttrie_delnode(t, n);
+		n = parent;
+	}
+}
+
+/*
+ * Calls 'fn' for every item whose mask matches 'host', until it
+ * returns non-zero. The order is not defined.
+ * Returns what 'fn' returned to stop the search, or 0.
+ */
+int hosttrie_find(aHostTrie *t, const char *host, int (*fn)(void *item, void *arg), void *arg)
+{
+	aHostNode *n = NULL;
+	aHostEntry *e;
+	const char *end, *p;
+	int  ret;
+
+	if (!t->count || !*host)
+		return 0;
+	for (end = host + strlen(host); ; end = p - 1)
+	{
+		for (p = end; (p > host) && (p[-1] != '.'); p--)
+			;
+		if (!(n = hosttrie_child(t, n, p, end - p)))
+			return 0;
+		if (p == host)
+		{
+			for (e = n->exact; e; e = e->next)
+				if ((ret = fn(e->item, arg)))
+					return ret;
+			return 0;
+		}
+		/* "*.<what we have so far>" matches, the '*' takes the rest */
+		for (e = n->wild; e; e = e->next)
+			if ((ret = fn(e->item, arg)))
+				return ret;
+	}
+}
+
+/* Frees the trie itself, the entries are up to their owners */
+void hosttrie_free(aHostTrie *t)
+{
+	aHostNode *n, *next;
+	int  i;
+
+	for (i = 0; i < t->size; i++)
+		for (n = t->table[i]; n; n = next)
+		{
+			next = n->hnext;
+			MyFree(n);
+		}
+	if (t->table)
+		MyFree(t->table);
+	t->table = NULL;
+	t->size = t->count = 0;
+}
@@ -88,6 +88,7 @@ extern char unreallogo[];
 int  SVSNOOP = 0;
 extern MODVAR char *buildid;
 time_t timeofday = 0;
+long long monotime_ms = 0;
 int  tainted = 0;
 LoopStruct loop;
 MODVAR MemoryInfo StatsZ;
@@ -103,6 +104,7 @@ char REPORT_DO_DNS[256], REPORT_FIN_DNS[256], REPORT_FIN_DNSC[256],
     REPORT_FAIL_ID[256];
 extern ircstats IRCstats;
 aClient me;			/* That's me */
+static aConn meconn;
 MODVAR char *me_hash;
 aClient *client = &me;		/* Pointer to beginning of Client list */
 extern char backupbuf[8192];
@@ -180,10 +182,10 @@ int  bootopt = 0;		/* Server boot option flags */
 char *debugmode = "";		/*  -"-    -"-   -"-  */
 char *sbrk0;			/* initial sbrk(0) */
 static int dorehash = 0, dorestart = 0;
+static aTimer wakeup_timer;	/* nextconnect, see SocketLoop() */
 static char *dpath = DPATH;
 MODVAR int  booted = FALSE;
 MODVAR TS   nextconnect = 1;		/* time for next try_connections call */
-MODVAR TS   nextping = 1;		/* same as above for check_pings() */
 MODVAR TS   nextdnscheck = 0;		/* next time to poll dns to force timeouts */
 MODVAR TS   nextexpire = 1;		/* next expire run on the dns cache */
 MODVAR TS   lastlucheck = 0;
@@ -406,29 +408,15 @@ EVENT(loop_event)
 
 EVENT(garbage_collect)
 {
-	extern int freelinks;
-	extern Link *freelink;
-	Link p;
-	int  ii;
+	int  n;
 
 	if (loop.do_garbage_collect == 1)
 		sendto_realops("Doing garbage collection ..");
-	if (freelinks > HOW_MANY_FREELINKS_ALLOWED) {
-		ii = freelinks;
-		while (freelink && (freelinks > HOW_MANY_FREELINKS_ALLOWED)) {
-			freelinks--;
-			p.next = freelink;
-			freelink = freelink->next;
-			MyFree(p.next);
-		}
-		if (loop.do_garbage_collect == 1) {
-			loop.do_garbage_collect = 0;
-			sendto_realops
-			    ("Cleaned up %i garbage blocks", (ii - freelinks));
-		}
-	}
-	if (loop.do_garbage_collect == 1)
+	n = slab_release_spare();
+	if (loop.do_garbage_collect == 1) {
 		loop.do_garbage_collect = 0;
+		sendto_realops("Cleaned up %i garbage blocks", n);
+	}
 }
 
 /*
@@ -512,169 +500,256 @@ static TS try_connections(TS currenttime)
 
 
 
-extern TS check_pings(TS currenttime)
+/*
+ * Bans are checked in batches of this many slots per loop, so that adding
+ * a *LINE on a server with lots of clients does not stall everything.
+ */
+#define BANCHECK_BATCH	1000
+
+static aTimer bancheck_timer;
+static int bancheck_pos = -1;	/* next slot to check, -1 if not running */
+static char bancheck_klines, bancheck_spamf_user, bancheck_spamf_away;
+
+/*
+ * check_bans
+ *	Checks a local connection against the (new) set of *LINES, ban
+ *	blocks and 'u'/'a' spamfilters. Returns FLUSH_BUFFER if the client
+ *	was killed.
+ */
+static int check_bans(aClient *cptr)
 {
-	aClient *cptr = NULL;
 	ConfigItem_ban *bconf = NULL;
 	char killflag = 0;
-	int  i = 0;
 	char banbuf[1024];
-	char scratch[64];
-	int  ping = 0;
 
-	for (i = 0; i <= LastSlot; i++) {
-		/*
-		 * If something we should not touch .. 
-		 */
-		if (!(cptr = local[i]) || IsMe(cptr) || IsLog(cptr))
-			continue;
-
-		/*
-		 * ** Note: No need to notify opers here. It's
-		 * ** already done when "FLAGS_DEADSOCKET" is set.
-		 */
-		if (cptr->flags & FLAGS_DEADSOCKET) {
-			(void)exit_client(cptr, cptr, &me, cptr->error_str ? cptr->error_str : "Dead socket");
-			continue;
+	/*
+	 * Check if user is banned
+	 */
+	if (bancheck_klines) {
+		if (find_tkline_match(cptr, 0) < 0) {
+			/*
+			 * Client exited 
+			 */
+			return FLUSH_BUFFER;
 		}
-		killflag = 0;
-		/*
-		 * Check if user is banned
-		 */
-		if (loop.do_bancheck) {
-			if (find_tkline_match(cptr, 0) < 0) {
-				/*
-				 * Client exited 
-				 */
-				continue;
-			}
-			find_shun(cptr);
-			if (!killflag && IsPerson(cptr)) {
-				/*
-				 * If it's a user, we check for CONF_BAN_USER
-				 */
-				bconf =
-				    Find_ban(cptr, make_user_host(cptr->
-				    user ? cptr->user->username : cptr->
-				    username,
-				    cptr->user ? cptr->user->realhost : cptr->
-				    sockhost), CONF_BAN_USER);
-				if (bconf)
-					killflag++;
-
-				if (!killflag && !IsAnOper(cptr) &&
-				    (bconf =
-				    Find_ban(NULL, cptr->info, CONF_BAN_REALNAME))) {
-					killflag++;
-				}
-
-			}
+		find_shun(cptr);
+		if (!killflag && IsPerson(cptr)) {
 			/*
-			 * If no cookie, we search for Z:lines
+			 * If it's a user, we check for CONF_BAN_USER
 			 */
-			if (!killflag)
-				if ((bconf =
-				    Find_ban(cptr, Inet_ia2p(&cptr->ip),
-				    CONF_BAN_IP)))
-					killflag++;
-			if (killflag) {
-				if (IsPerson(cptr))
-					sendto_realops("Ban active for %s (%s)",
-					    get_client_name(cptr, FALSE),
-					    bconf->reason ? bconf->
-					    reason : "no reason");
-
-				if (IsServer(cptr))
-					sendto_realops
-					    ("Ban active for server %s (%s)",
-					    get_client_name(cptr, FALSE),
-					    bconf->reason ? bconf->
-					    reason : "no reason");
-				if (bconf->reason) {
-					if (IsPerson(cptr))
-						snprintf(banbuf, sizeof banbuf - 1,
-						         "User has been banned (%s)", bconf->reason);
-					else
-						snprintf(banbuf, sizeof banbuf - 1,
-						         "Banned (%s)", bconf->reason);
-					(void)exit_client(cptr, cptr, &me,
-					    banbuf);
-				} else {
-					if (IsPerson(cptr))
-						(void)exit_client(cptr, cptr,
-						    &me,
-						    "User has been banned");
-					else
-						(void)exit_client(cptr, cptr,
-						    &me, "Banned");
-				}
-				continue;
+			bconf =
+			    Find_ban(cptr, make_user_host(cptr->
+			    user ? cptr->user->username : cptr->
+			    username,
+			    cptr->user ? cptr->user->realhost : cptr->
+			    sockhost), CONF_BAN_USER);
+			if (bconf)
+				killflag++;
+
+			if (!killflag && !IsAnOper(cptr) &&
+			    (bconf =
+			    Find_ban(NULL, cptr->info, CONF_BAN_REALNAME))) {
+				killflag++;
 			}
 
 		}
-		/* Do spamfilter 'user' banchecks.. */
-		if (loop.do_bancheck_spamf_user && IsPerson(cptr))
-		{
-			if (find_spamfilter_user(cptr, SPAMFLAG_NOWARN) == FLUSH_BUFFER)
-				continue;
-		}
-		if (loop.do_bancheck_spamf_away && IsPerson(cptr) && cptr->user->away)
-		{
-			if (dospamfilter(cptr, cptr->user->away, SPAMF_AWAY, NULL, SPAMFLAG_NOWARN, NULL) == FLUSH_BUFFER)
-				continue;
-		}
 		/*
-		 * We go into ping phase 
+		 * If no cookie, we search for Z:lines
 		 */
-		ping =
-		    IsRegistered(cptr) ? (cptr->class ? cptr->
-		    class->pingfreq : CONNECTTIMEOUT) : CONNECTTIMEOUT;
-		Debug((DEBUG_DEBUG, "c(%s)=%d p %d k %d a %d", cptr->name,
-		    cptr->status, ping, killflag,
-		    currenttime - cptr->lasttime));
-		
-		/* If ping is less than or equal to the last time we received a command from them */
-		if (ping <= (currenttime - cptr->lasttime))
+		if (!killflag)
+			if ((bconf =
+			    Find_ban(cptr, Inet_ia2p(&cptr->ip),
+			    CONF_BAN_IP)))
+				killflag++;
+		if (killflag) {
+			if (IsPerson(cptr))
+				sendto_realops("Ban active for %s (%s)",
+				    get_client_name(cptr, FALSE),
+				    bconf->reason ? bconf->
+				    reason : "no reason");
+
+			if (IsServer(cptr))
+				sendto_realops
+				    ("Ban active for server %s (%s)",
+				    get_client_name(cptr, FALSE),
+				    bconf->reason ? bconf->
+				    reason : "no reason");
+			if (bconf->reason) {
+				if (IsPerson(cptr))
+					snprintf(banbuf, sizeof banbuf - 1,
+					         "User has been banned (%s)", bconf->reason);
+				else
+					snprintf(banbuf, sizeof banbuf - 1,
+					         "Banned (%s)", bconf->reason);
+				return exit_client(cptr, cptr, &me,
+				    banbuf);
+			} else {
+				if (IsPerson(cptr))
+					return exit_client(cptr, cptr,
+					    &me,
+					    "User has been banned");
+				else
+					return exit_client(cptr, cptr,
+					    &me, "Banned");
+			}
+		}
+
+	}
+	/* Do spamfilter 'user' banchecks.. */
+	if (bancheck_spamf_user && IsPerson(cptr))
+	{
+		if (find_spamfilter_user(cptr, SPAMFLAG_NOWARN) == FLUSH_BUFFER)
+			return FLUSH_BUFFER;
+	}
+	if (bancheck_spamf_away && IsPerson(cptr) && cptr->user->away)
+	{
+		if (dospamfilter(cptr, cptr->user->away, SPAMF_AWAY, NULL, SPAMFLAG_NOWARN, NULL) == FLUSH_BUFFER)
+			return FLUSH_BUFFER;
+	}
+	return 0;
+}
+
+/*
+ * run_bancheck
+ *	Timer callback that walks the next BANCHECK_BATCH slots of local[]
+ *	through check_bans(), and re-arms itself until all slots are done.
+ */
+static void run_bancheck(void *dummy)
+{
+	aClient *cptr;
+	int  end = bancheck_pos + BANCHECK_BATCH;
+
+	for (; (bancheck_pos <= LastSlot) && (bancheck_pos < end); bancheck_pos++)
+	{
+		if (!(cptr = local[bancheck_pos]) || IsMe(cptr) || IsLog(cptr) ||
+		    (cptr->flags & FLAGS_DEADSOCKET))
+			continue;
+		(void)check_bans(cptr);
+	}
+	if (bancheck_pos > LastSlot)
+	{
+		bancheck_pos = -1;
+		bancheck_klines = bancheck_spamf_user = bancheck_spamf_away = 0;
+		return;
+	}
+	timer_set(&bancheck_timer, monotime_ms + 1);
+}
+
+/*
+ * start_bancheck
+ *	Called when loop.do_bancheck* got set: (re)start checking all local
+ *	connections. If a check is already running it starts over, since the
+ *	slots it did already have not been checked against the new ban.
+ */
+static void start_bancheck(void)
+{
+	if (loop.do_bancheck)
+		bancheck_klines = 1;
+	if (loop.do_bancheck_spamf_user)
+		bancheck_spamf_user = 1;
+	if (loop.do_bancheck_spamf_away)
+		bancheck_spamf_away = 1;
+	loop.do_bancheck = loop.do_bancheck_spamf_user = loop.do_bancheck_spamf_away = 0;
+	bancheck_pos = 0;
+	bancheck_timer.func = run_bancheck;
+	run_bancheck(NULL);
+}
+
+/*
+ * set_ping_timer
+ *	Have check_ping() look at a local connection at time 'when' (or
+ *	right away if that is in the past).
+ */
+void set_ping_timer(aClient *cptr, TS when)
+{
+	cptr->pingtimer.func = check_ping;
+	cptr->pingtimer.data = cptr;
+	timer_set(&cptr->pingtimer, monotime_ms + (long long)(when - TStime()) * 1000);
+}
+
+/*
+ * check_ping
+ *	Ping and registration timeouts of one local connection. Every local
+ *	connection has its own pingtimer, so only the ones that are due get
+ *	looked at. The timer is not moved each time something is received,
+ *	instead we simply work out when something could time out next, based
+ *	on lasttime etc, and look again then.
+ */
+void check_ping(void *data)
+{
+	aClient *cptr = (aClient *)data;
+	TS   currenttime = TStime(), next;
+	char scratch[64];
+	int  ping = 0;
+
+	/*
+	 * If something we should not touch .. 
+	 */
+	if (IsMe(cptr) || IsLog(cptr))
+		return;
+
+	/*
+	 * ** Note: No need to notify opers here. It's
+	 * ** already done when "FLAGS_DEADSOCKET" is set.
+	 */
+	if (cptr->flags & FLAGS_DEADSOCKET) {
+		(void)exit_client(cptr, cptr, &me, cptr->conn->error_str ? cptr->conn->error_str : "Dead socket");
+		return;
+	}
+	/*
+	 * We go into ping phase 
+	 */
+	ping =
+	    IsRegistered(cptr) ? (cptr->class ? cptr->
+	    class->pingfreq : CONNECTTIMEOUT) : CONNECTTIMEOUT;
+	Debug((DEBUG_DEBUG, "c(%s)=%d p %d a %d", cptr->name,
+	    cptr->status, ping,
+	    currenttime - cptr->lasttime));
+	
+	/* If ping is less than or equal to the last time we received a command from them */
+	if (ping <= (currenttime - cptr->lasttime))
+	{
+		if (
+			/* If we have sent a ping */
+			((cptr->flags & FLAGS_PINGSENT)
+			/* And they had 2x ping frequency to respond */
+			&& ((currenttime - cptr->lasttime) >= (2 * ping)))
+			|| 
+			/* Or isn't registered and time spent is larger than ping .. */
+			(!IsRegistered(cptr) && (currenttime - cptr->since >= ping))
+			)
 		{
-			if (
-				/* If we have sent a ping */
-				((cptr->flags & FLAGS_PINGSENT)
-				/* And they had 2x ping frequency to respond */
-				&& ((currenttime - cptr->lasttime) >= (2 * ping)))
-				|| 
-				/* Or isn't registered and time spent is larger than ping .. */
-				(!IsRegistered(cptr) && (currenttime - cptr->since >= ping))
-				)
+			/* if it's registered and doing dns/auth, timeout */
+			if (!IsRegistered(cptr) && (DoingDNS(cptr) || DoingAuth(cptr)))
 			{
-				/* if it's registered and doing dns/auth, timeout */
-				if (!IsRegistered(cptr) && (DoingDNS(cptr) || DoingAuth(cptr)))
-				{
-					if (cptr->authfd >= 0) {
-						CLOSE_SOCK(cptr->authfd);
-						--OpenFiles;
-						cptr->authfd = -1;
-						cptr->count = 0;
-						*cptr->buffer = '\0';
-					}
-					if (SHOWCONNECTINFO && !cptr->serv) {
-						if (DoingDNS(cptr))
-							sendto_one(cptr,
-							    REPORT_FAIL_DNS);
-						else if (DoingAuth(cptr))
-							sendto_one(cptr,
-							    REPORT_FAIL_ID);
-					}
-					Debug((DEBUG_NOTICE,
-					    "DNS/AUTH timeout %s",
-					    get_client_name(cptr, TRUE)));
-					unrealdns_delreq_bycptr(cptr);
-					ClearAuth(cptr);
-					ClearDNS(cptr);
-					SetAccess(cptr);
-					cptr->firsttime = currenttime;
-					cptr->lasttime = currenttime;
-					continue;
+				if (cptr->conn->authfd >= 0) {
+					CLOSE_SOCK(cptr->conn->authfd);
+					--OpenFiles;
+					cptr->conn->authfd = -1;
+					cptr->conn->count = 0;
+					*cptr->conn->buffer = '\0';
 				}
+				if (SHOWCONNECTINFO && !cptr->serv) {
+					if (DoingDNS(cptr))
+						sendto_one(cptr,
+						    REPORT_FAIL_DNS);
+					else if (DoingAuth(cptr))
+						sendto_one(cptr,
+						    REPORT_FAIL_ID);
+				}
+				Debug((DEBUG_NOTICE,
+				    "DNS/AUTH timeout %s",
+				    get_client_name(cptr, TRUE)));
+				unrealdns_delreq_bycptr(cptr);
+				ClearAuth(cptr);
+				ClearDNS(cptr);
+				SetAccess(cptr);
+				ioevent_update(cptr);
+				cptr->firsttime = currenttime;
+				cptr->lasttime = currenttime;
+			}
+			else
+			{
 				if (IsServer(cptr) || IsConnecting(cptr) ||
 				    IsHandshake(cptr)
 #ifdef USE_SSL
@@ -697,60 +772,63 @@ extern TS check_pings(TS currenttime)
 				(void)ircsprintf(scratch, "Ping timeout: %ld seconds",
 					(long) (TStime() - cptr->lasttime));
 				exit_client(cptr, cptr, &me, scratch);
-				continue;
-				
-			}
-			else if (IsRegistered(cptr) &&
-			    ((cptr->flags & FLAGS_PINGSENT) == 0)) {
-				/*
-				 * if we havent PINGed the connection and we havent
-				 * heard from it in a while, PING it to make sure
-				 * it is still alive.
-				 */
-				cptr->flags |= FLAGS_PINGSENT;
-				/*
-				 * not nice but does the job 
-				 */
-				cptr->lasttime = currenttime - ping;
-				sendto_one(cptr, "%s :%s",
-				    IsToken(cptr) ? TOK_PING : MSG_PING,
-				    me.name);
+				return;
 			}
 		}
-		/*
-		 * Check UNKNOWN connections - if they have been in this state
-		 * for > 100s, close them.
-		 */
-		if (IsUnknown(cptr)
-#ifdef USE_SSL
-			|| (IsSSLAcceptHandshake(cptr) || IsSSLConnectHandshake(cptr))
-#endif		
-		)
-			if (cptr->firsttime ? ((currenttime - cptr->firsttime) >
-			    100) : 0)
-				(void)exit_client(cptr, cptr, &me,
-				    "Connection Timed Out");
+		else if (IsRegistered(cptr) &&
+		    ((cptr->flags & FLAGS_PINGSENT) == 0)) {
+			/*
+			 * if we havent PINGed the connection and we havent
+			 * heard from it in a while, PING it to make sure
+			 * it is still alive.
+			 */
+			cptr->flags |= FLAGS_PINGSENT;
+			/*
+			 * not nice but does the job 
+			 */
+			cptr->lasttime = currenttime - ping;
+			sendto_one(cptr, "%s :%s",
+			    IsToken(cptr) ? TOK_PING : MSG_PING,
+			    me.name);
+		}
 	}
 	/*
-	 * EXPLANATION
-	 * * on a server with a large volume of clients, at any given point
-	 * * there may be a client which needs to be pinged the next second,
-	 * * or even right away (a second may have passed while running
-	 * * check_pings). Preserving CPU time is more important than
-	 * * pinging clients out at exact times, IMO. Therefore, I am going to make
-	 * * check_pings always return currenttime + 9. This means that it may take
-	 * * a user up to 9 seconds more than pingfreq to timeout. Oh well.
-	 * * Plus, the number is 9 to 'stagger' our check_pings calls out over
-	 * * time, to avoid doing it and the other tasks ircd does at the same time
-	 * * all the time (which are usually done on intervals of 5 seconds or so). 
-	 * * - lucas
-	 * *
+	 * Check UNKNOWN connections - if they have been in this state
+	 * for > 100s, close them.
 	 */
-	loop.do_bancheck = loop.do_bancheck_spamf_user = loop.do_bancheck_spamf_away = 0;
-	Debug((DEBUG_NOTICE, "Next check_ping() call at: %s, %d %d %d",
-	    myctime(currenttime+9), ping, currenttime+9, currenttime));
+	if (IsUnknown(cptr)
+#ifdef USE_SSL
+		|| (IsSSLAcceptHandshake(cptr) || IsSSLConnectHandshake(cptr))
+#endif		
+	)
+		if (cptr->firsttime ? ((currenttime - cptr->firsttime) >
+		    100) : 0)
+		{
+			(void)exit_client(cptr, cptr, &me,
+			    "Connection Timed Out");
+			return;
+		}
 
-	return currenttime + 9;
+	/*
+	 * Work out when we need to look at it again: when it is time to
+	 * PING it, when the PING or registration times out, or when it
+	 * has been unknown for too long. Getting here early is harmless,
+	 * we will just re-arm the timer.
+	 */
+	next = cptr->lasttime + ping;
+	if (cptr->flags & FLAGS_PINGSENT)
+		next = cptr->lasttime + 2 * ping;
+	if (!IsRegistered(cptr) && (cptr->since + ping > next))
+		next = cptr->since + ping;
+	if ((IsUnknown(cptr)
+#ifdef USE_SSL
+		|| IsSSLAcceptHandshake(cptr) || IsSSLConnectHandshake(cptr)
+#endif
+	    ) && cptr->firsttime && (cptr->firsttime + 101 < next))
+		next = cptr->firsttime + 101;
+	if (next <= currenttime)
+		next = currenttime + 1;
+	set_ping_timer(cptr, next);
 }
 
 /*
@@ -793,7 +871,7 @@ inline TS check_fdlists(TS now)
 			continue;
 		}
 		pri = cptr->priority;
-		if (cptr->receiveM == cptr->lastrecvM)
+		if (cptr->conn->receiveM == cptr->lastrecvM)
 			pri += 2;	/* lower a bit */
 		else
 			pri -= 30;
@@ -801,7 +879,7 @@ inline TS check_fdlists(TS now)
 			pri = 0;
 		if (pri > 80)
 			pri = 80;
-		cptr->lastrecvM = cptr->receiveM;
+		cptr->lastrecvM = cptr->conn->receiveM;
 		cptr->priority = pri;
 		if ((pri < 10) || (!lifesux && (pri < 25)))
 			busycli_fdlist.entry[++j] = i;
@@ -912,6 +990,104 @@ extern int unreal_time_synch(int timeout);
 extern MODVAR Event *events;
 extern struct MODVAR ThrottlingBucket *ThrottlingHash[THROTTLING_HASH_SIZE+1];
 
+/** Updates monotime_ms, a millisecond clock for the timer wheel.
+ * Unlike timeofday it never jumps when the system clock is adjusted
+ * or TSoffset changes.
+ */
+void update_monotime(void)
+{
+#ifdef _WIN32
+	static DWORD lasttick = 0;
+	static long long wraps = 0;
+	DWORD tick = GetTickCount();
+
+	if (tick < lasttick)
+		wraps += 1LL << 32; /* every 49.7 days */
+	lasttick = tick;
+	monotime_ms = wraps + tick;
+#else
+	long long now;
+# ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+	{
+		monotime_ms = (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+		return;
+	}
+# endif
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		now = (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+		/* not monotonic, but at least don't go backwards */
+		if (now > monotime_ms)
+			monotime_ms = now;
+	}
+#endif
+}
+
+/** Returns a monotonic timestamp in nanoseconds, for timing short
+ * pieces of code. Only differences between two calls mean something.
+ */
+long long get_monotime_ns(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (long long)((double)now.QuadPart * 1000000000.0 / (double)freq.QuadPart);
+#else
+# ifdef CLOCK_MONOTONIC
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+# endif
+	{
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		return (long long)tv.tv_sec * 1000000000 + (long long)tv.tv_usec * 1000;
+	}
+#endif
+}
+
+/** Returns the CPU time used so far by this thread in nanoseconds
+ * (only the user time where that is all we can get). Unlike
+ * get_monotime_ns() this does not go on while we are not running,
+ * this is what the slow spamfilter detection limits are about.
+ */
+long long get_cputime_ns(void)
+{
+#ifdef _WIN32
+	FILETIME created, exited, kernel, user;
+
+	if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user))
+		return 0;
+	return ((((long long)user.dwHighDateTime) << 32) | user.dwLowDateTime) * 100;
+#else
+# ifdef CLOCK_THREAD_CPUTIME_ID
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+		return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+# endif
+	{
+		struct rusage ru;
+
+		if (getrusage(RUSAGE_SELF, &ru) == -1)
+			return 0;
+		return (long long)ru.ru_utime.tv_sec * 1000000000 +
+		    (long long)ru.ru_utime.tv_usec * 1000;
+	}
+#endif
+}
+
 /** This functions resets a couple of timers and does other things that
  * are absolutely cruicial when the clock is adjusted - particularly
  * when the clock goes backwards. -- Syzop
@@ -920,7 +1096,6 @@ void fix_timers(void)
 {
 int i, cnt;
 aClient *acptr;
-Event *e;
 struct ThrottlingBucket *n;
 struct ThrottlingBucket z = { NULL, NULL, {0}, 0, 0};
 
@@ -973,16 +1148,7 @@ struct ThrottlingBucket z = { NULL, NULL, {0}, 0, 0};
 		}
 	}
 
-	/* Reset all event timers */
-	for (e = events; e; e = e->next)
-	{
-		if (e->last > TStime())
-		{
-			Debug((DEBUG_DEBUG, "fix_timers(): %s: e->last %ld -> %ld",
-				e->name, e->last, TStime()-1));
-			e->last = TStime()-1;
-		}
-	}
+	/* Event timers run on monotime_ms, which is not affected */
 
 	/* Just flush all throttle stuff... */
 	cnt = 0;
@@ -996,9 +1162,9 @@ struct ThrottlingBucket z = { NULL, NULL, {0}, 0, 0};
 		}
 	Debug((DEBUG_DEBUG, "fix_timers(): removed %d throttling item(s)", cnt));
 	
-	Debug((DEBUG_DEBUG, "fix_timers(): updating nextping/nextconnect/nextdnscheck/nextexpire (%ld/%ld/%ld/%ld)",
-		nextping, nextconnect, nextdnscheck, nextexpire));	
-	nextping = nextconnect = nextdnscheck = nextexpire = 1;
+	Debug((DEBUG_DEBUG, "fix_timers(): updating nextconnect/nextdnscheck/nextexpire (%ld/%ld/%ld)",
+		nextconnect, nextdnscheck, nextexpire));	
+	nextconnect = nextdnscheck = nextexpire = 1;
 }
 
 
@@ -1210,6 +1376,8 @@ int InitwIRCD(int argc, char *argv[])
 	WSAStartup(wVersionRequested, &wsaData);
 #endif
 	bzero((char *)&me, sizeof(me));
+	bzero((char *)&meconn, sizeof(meconn));
+	me.conn = &meconn;
 	bzero(&StatsZ, sizeof(StatsZ));
 	setup_signals();
 	charsys_reset();
@@ -1339,6 +1507,8 @@ int InitwIRCD(int argc, char *argv[])
 			      (long)sizeof(struct ircstatsx));
 			  (void)printf("aClient remote == %ld\n",
 			      (long)CLIENT_REMOTE_SIZE);
+			  (void)printf("sizeof(aConn) == %ld\n",
+			      (long)sizeof(aConn));
 			  exit(0);
 			  break;
 #ifndef _WIN32
@@ -1462,6 +1632,7 @@ int InitwIRCD(int argc, char *argv[])
 	bzero(&loop, sizeof(loop));
 	init_CommandHash();
 	initlists();
+	dbuf_init();
 	initwhowas();
 	initstats();
 	DeleteTempModules();
@@ -1590,7 +1761,7 @@ int InitwIRCD(int argc, char *argv[])
 	if (me.name[0] == '\0')
 		strncpyzt(me.name, me.sockhost, sizeof(me.name));
 	me.hopcount = 0;
-	me.authfd = -1;
+	me.conn->authfd = -1;
 	me.next = NULL;
 	me.user = NULL;
 	me.from = &me;
@@ -1719,7 +1890,6 @@ void SocketLoop(void *dummy)
 	
 	while (1)
 #else
-	nextping = timeofday;
 	/*
 	 * Forever drunk .. forever drunk ..
 	 * * (Sorry Alphaville.)
@@ -1732,6 +1902,7 @@ void SocketLoop(void *dummy)
 #define POSITIVE_SHIFT_WARN	20
 
 		timeofday = time(NULL) + TSoffset;
+		update_monotime();
 		if (oldtimeofday == 0)
 			oldtimeofday = timeofday; /* pretend everything is ok the first time.. */
 		if (mytdiff(timeofday, oldtimeofday) < NEGATIVE_SHIFT_WARN) {
@@ -1799,8 +1970,8 @@ void SocketLoop(void *dummy)
 		 */
 
 #ifndef NO_FDLIST
-		lastrecvK = me.receiveK;
-		lastsendK = me.sendK;
+		lastrecvK = me.conn->receiveK;
+		lastsendK = me.conn->sendK;
 #endif
 		if (IRCstats.clients > IRCstats.global_max)
 			IRCstats.global_max = IRCstats.clients;
@@ -1816,46 +1987,42 @@ void SocketLoop(void *dummy)
 			nextconnect = try_connections(timeofday);
 
 		/*
-		 * ** take the smaller of the two 'timed' event times as
-		 * ** the time of next event (stops us being late :) - avalon
-		 * ** WARNING - nextconnect can return 0!
+		 * ** Sleep until the first timer on the timer wheel is due.
+		 * ** nextconnect is put on the wheel as well (WARNING -
+		 * ** nextconnect can be 0!) and c-ares gets a say
+		 * ** for its retransmits. Never sleep more than TIMESEC
+		 * ** seconds, things might need to be timed out that aren't
+		 * ** on the wheel. Delays are in msec from here on.
 		 */
+		update_monotime();
 		if (nextconnect)
-			delay = MIN(nextping, nextconnect);
+			timer_set(&wakeup_timer, monotime_ms + (long long)MAX(nextconnect - timeofday, 1) * 1000);
 		else
-			delay = nextping;
-		delay = MIN(nextdnscheck, delay);
-		delay = MIN(nextexpire, delay);
-		delay -= timeofday;
-		/*
-		 * ** Adjust delay to something reasonable [ad hoc values]
-		 * ** (one might think something more clever here... --msa)
-		 * ** We don't really need to check that often and as long
-		 * ** as we don't delay too long, everything should be ok.
-		 * ** waiting too long can cause things to timeout...
-		 * ** i.e. PINGS -> a disconnection :(
-		 * ** - avalon
-		 */
-		if (delay < 1)
-			delay = 1;
-		else
-			delay = MIN(delay, TIMESEC);
+			timer_del(&wakeup_timer);
+		delay = timer_next_delay(TIMESEC * 1000);
+		delay = unrealdns_timeout(delay);
 #ifdef NO_FDLIST
 		(void)read_message(delay);
 		timeofday = time(NULL) + TSoffset;
+#elif defined(USE_EPOLL)
+		/* epoll only hands us the busy sockets, so separate passes
+		 * for servers and busy clients would only cost extra syscalls.
+		 */
+		(void)read_message(delay, NULL);
+		timeofday = time(NULL) + TSoffset;
 #else
 		(void)read_message(0, &serv_fdlist);	/* servers */
-		(void)read_message(1, &busycli_fdlist);	/* busy clients */
+		(void)read_message(1000, &busycli_fdlist);	/* busy clients */
 		if (lifesux) {
 			static time_t alllasttime = 0;
 
-			(void)read_message(1, &serv_fdlist);
+			(void)read_message(1000, &serv_fdlist);
 			/*
 			 * read servs more often 
 			 */
 			if (lifesux > 9) {	/* life really sucks */
-				(void)read_message(1, &busycli_fdlist);
-				(void)read_message(1, &serv_fdlist);
+				(void)read_message(1000, &busycli_fdlist);
+				(void)read_message(1000, &serv_fdlist);
 			}
 			flush_fdlist_connections(&serv_fdlist);
 			timeofday = time(NULL) + TSoffset;
@@ -1880,12 +2047,12 @@ void SocketLoop(void *dummy)
 		 * ** time might be too far away... (similarly with
 		 * ** ping times) --msa
 		 */
-#ifdef NO_FDLIST
-		if (timeofday >= nextping || loop.do_bancheck)
-#else
-		if ((timeofday >= nextping && !lifesux) || loop.do_bancheck)
-#endif
-			nextping = check_pings(timeofday);
+		/*
+		 * Ping timeouts are handled by each connection's own timer
+		 * (check_ping()), only new bans need a walk over all clients.
+		 */
+		if (loop.do_bancheck || loop.do_bancheck_spamf_user || loop.do_bancheck_spamf_away)
+			start_bancheck();
 		if (dorehash) 
 		{
 			(void)rehash(&me, &me, 1);
@@ -46,6 +46,12 @@
 #include "malloc.h"
 #endif
 #include <string.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#if !defined(MAP_ANON) && defined(MAP_ANONYMOUS)
+#define MAP_ANON MAP_ANONYMOUS
+#endif
+#endif
 void free_link(Link *);
 Link *make_link();
 extern ircstats IRCstats;
@@ -63,16 +69,179 @@ static struct liststats {
 
 void outofmemory();
 
-MODVAR int  flinks = 0;
-MODVAR int  freelinks = 0;
-MODVAR Link *freelink = NULL;
-MODVAR Member *freemember = NULL;
-MODVAR Membership *freemembership = NULL;
-MODVAR MembershipL *freemembershipL = NULL;
 MODVAR int  numclients = 0;
 
+/*
+ * Slab allocator for the structures there are many of. Each type gets
+ * its own pool, which carves the objects out of SLAB_PAGESIZE pages
+ * that are aligned on their size, so the page of an object is found by
+ * masking its address. A pool keeps the pages that have free objects on
+ * a list, a page that becomes completely free goes back to the OS right
+ * away (one is kept as a spare until the next garbage_collect()).
+ */
+struct SlabPage {
+	struct SlabPage *prev, *next;	/* on pool->partial */
+	aSlabPool *pool;
+	void *freelist;		/* objects given back by slab_free() */
+	unsigned int inuse;
+	unsigned int fresh;	/* objects at the end never handed out */
+};
+
+#define SLAB_ALIGN	8
+#define SLAB_HDRSIZE	((sizeof(struct SlabPage) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1))
+#define SLAB_PAGE(p)	((struct SlabPage *)((size_t)(p) & ~((size_t)SLAB_PAGESIZE - 1)))
+#define SLAB_OBJ(pg, i)	((char *)(pg) + SLAB_HDRSIZE + (size_t)(i) * (pg)->pool->size)
+
+MODVAR aSlabPool *slabpools = NULL;
+static aSlabPool slab_lclient, slab_rclient, slab_conn, slab_user, slab_link, slab_ban;
+MODVAR aSlabPool slab_member, slab_membership, slab_membershipL;
+
+void slab_init(aSlabPool *pool, char *name, unsigned int size)
+{
+	bzero(pool, sizeof(aSlabPool));
+	pool->name = name;
+	pool->size = (size + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1);
+	pool->perpage = (SLAB_PAGESIZE - SLAB_HDRSIZE) / pool->size;
+	pool->next = slabpools;
+	slabpools = pool;
+}
+
+/* A new SLAB_PAGESIZE page, aligned on SLAB_PAGESIZE, straight from the OS */
+static struct SlabPage *slab_page_new(void)
+{
+#ifndef _WIN32
+	char *p, *aligned;
+	size_t skip;
+
+	/* Map twice the size and unmap what's around the aligned page */
+	p = mmap(NULL, 2 * SLAB_PAGESIZE, PROT_READ|PROT_WRITE,
+	    MAP_PRIVATE|MAP_ANON, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	skip = (SLAB_PAGESIZE - ((size_t)p & (SLAB_PAGESIZE - 1))) & (SLAB_PAGESIZE - 1);
+	aligned = p + skip;
+	if (skip)
+		munmap(p, skip);
+	munmap(aligned + SLAB_PAGESIZE, SLAB_PAGESIZE - skip);
+	return (struct SlabPage *)aligned;
+#else
+	/* VirtualAlloc() is always aligned on 64K */
+	return (struct SlabPage *)VirtualAlloc(NULL, SLAB_PAGESIZE,
+	    MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+#endif
+}
+
+static void slab_page_free(aSlabPool *pool, struct SlabPage *pg)
+{
+	pool->pages--;
+#ifndef _WIN32
+	munmap((char *)pg, SLAB_PAGESIZE);
+#else
+	VirtualFree(pg, 0, MEM_RELEASE);
+#endif
+}
+
+/*
+ * slab_alloc: an object from 'pool', its contents are undefined.
+ */
+void *slab_alloc(aSlabPool *pool)
+{
+	struct SlabPage *pg;
+	void *p;
+
+	if (!(pg = pool->partial))
+	{
+		if ((pg = pool->spare))
+			pool->spare = NULL;
+		else
+		{
+			if (!(pg = slab_page_new()))
+				outofmemory();
+			pg->pool = pool;
+			pg->freelist = NULL;
+			pg->inuse = 0;
+			pg->fresh = pool->perpage;
+			pool->pages++;
+		}
+		pg->prev = NULL;
+		pg->next = NULL;
+		pool->partial = pg;
+	}
+	if ((p = pg->freelist))
+		pg->freelist = *(void **)p;
+	else
+		p = SLAB_OBJ(pg, pool->perpage - pg->fresh--);
+	pool->live++;
+	if (++pg->inuse == pool->perpage)
+	{
+		/* Full, take it off the list until something is freed */
+		if ((pool->partial = pg->next))
+			pool->partial->prev = NULL;
+	}
+	return p;
+}
+
+void slab_free(void *p)
+{
+	struct SlabPage *pg = SLAB_PAGE(p);
+	aSlabPool *pool = pg->pool;
+
+	*(void **)p = pg->freelist;
+	pg->freelist = p;
+	pool->live--;
+	if (pg->inuse-- == pool->perpage)
+	{
+		/* Was full, has a free object again */
+		pg->prev = NULL;
+		if ((pg->next = pool->partial))
+			pg->next->prev = pg;
+		pool->partial = pg;
+	}
+	if (pg->inuse == 0)
+	{
+		if (pg->prev)
+			pg->prev->next = pg->next;
+		else
+			pool->partial = pg->next;
+		if (pg->next)
+			pg->next->prev = pg->prev;
+		/* Start over with a clean page, it's cheaper than a freelist */
+		pg->freelist = NULL;
+		pg->fresh = pool->perpage;
+		if (pool->spare)
+			slab_page_free(pool, pg);
+		else
+			pool->spare = pg;
+	}
+}
+
+/* Give the spare pages back to the OS, see garbage_collect() */
+int  slab_release_spare(void)
+{
+	aSlabPool *pool;
+	int  n = 0;
+
+	for (pool = slabpools; pool; pool = pool->next)
+		if (pool->spare)
+		{
+			slab_page_free(pool, pool->spare);
+			pool->spare = NULL;
+			n++;
+		}
+	return n;
+}
+
 void initlists(void)
 {
+	slab_init(&slab_ban, "ban", sizeof(Ban));
+	slab_init(&slab_link, "link", sizeof(Link));
+	slab_init(&slab_membershipL, "membership (local)", sizeof(MembershipL));
+	slab_init(&slab_membership, "membership", sizeof(Membership));
+	slab_init(&slab_member, "member", sizeof(Member));
+	slab_init(&slab_user, "user", sizeof(anUser));
+	slab_init(&slab_conn, "client (connection)", sizeof(aConn));
+	slab_init(&slab_rclient, "client (remote)", CLIENT_REMOTE_SIZE);
+	slab_init(&slab_lclient, "client (local)", CLIENT_LOCAL_SIZE);
 #ifdef	DEBUGMODE
 	bzero((char *)&cloc, sizeof(cloc));
 	bzero((char *)&crem, sizeof(crem));
@@ -112,8 +281,7 @@ aClient *make_client(aClient *from, aClient *servr)
 	if (!from)
 		size = CLIENT_LOCAL_SIZE;
 
-	if (!(cptr = (aClient *)MyMalloc(size)))
-		outofmemory();
+	cptr = (aClient *)slab_alloc(from ? &slab_rclient : &slab_lclient);
 	bzero((char *)cptr, (int)size);
 
 #ifdef	DEBUGMODE
@@ -136,13 +304,15 @@ aClient *make_client(aClient *from, aClient *servr)
 	(void)strcpy(cptr->username, "unknown");
 	if (size == CLIENT_LOCAL_SIZE)
 	{
+		cptr->conn = (aConn *)slab_alloc(&slab_conn);
+		bzero((char *)cptr->conn, sizeof(aConn));
 		cptr->since = cptr->lasttime =
 		    cptr->lastnick = cptr->firsttime = TStime();
 		cptr->class = NULL;
-		cptr->passwd = NULL;
+		cptr->conn->passwd = NULL;
 		cptr->sockhost[0] = '\0';
-		cptr->buffer[0] = '\0';
-		cptr->authfd = -1;
+		cptr->conn->buffer[0] = '\0';
+		cptr->conn->authfd = -1;
 		cptr->fd = -1;
 	} else {
 		cptr->fd = -256;
@@ -154,18 +324,20 @@ void free_client(aClient *cptr)
 {
 	if (MyConnect(cptr))
 	{
-		if (cptr->passwd)
-			MyFree((char *)cptr->passwd);
-		if (cptr->error_str)
-			MyFree(cptr->error_str);
+		timer_del(&cptr->pingtimer);
+		if (cptr->conn->passwd)
+			MyFree((char *)cptr->conn->passwd);
+		if (cptr->conn->error_str)
+			MyFree(cptr->conn->error_str);
 #ifdef ZIP_LINKS
 		if (cptr->zip)
 			zip_free(cptr);
 #endif
-		if (cptr->hostp)
-			unreal_free_hostent(cptr->hostp);
+		if (cptr->conn->hostp)
+			unreal_free_hostent(cptr->conn->hostp);
+		slab_free(cptr->conn);
 	}
-	MyFree((char *)cptr);
+	slab_free(cptr);
 }
 
 /*
@@ -179,7 +351,8 @@ anUser *make_user(aClient *cptr)
 	user = cptr->user;
 	if (!user)
 	{
-		user = (anUser *)MyMallocEx(sizeof(anUser));
+		user = (anUser *)slab_alloc(&slab_user);
+		bzero((char *)user, sizeof(anUser));
 #ifdef	DEBUGMODE
 		users.inuse++;
 #endif
@@ -247,6 +420,8 @@ void free_user(anUser *user, aClient *cptr)
 			MyFree(user->ip_str);
 		if (user->operlogin)
 			MyFree(user->operlogin);
+		if (user->mhash)
+			MyFree(user->mhash);
 		/*
 		 * sanity check
 		 */
@@ -257,7 +432,7 @@ void free_user(anUser *user, aClient *cptr)
 			    user->username, user->realhost, user,
 			    user->invited, user->channel, user->joined,
 			    user->refcnt);
-		MyFree(user);
+		slab_free(user);
 #ifdef	DEBUGMODE
 		users.inuse--;
 #endif
@@ -398,40 +573,11 @@ void free_str_list(Link *lp)
 }
 
 
-#define	LINKSIZE	(4072/sizeof(Link))
-
 Link *make_link(void)
 {
 	Link *lp;
-	int  i;
-
-	/* "caching" slab-allocator... ie. we're allocating one pages
-	   (hopefully - upped to the Linux default, not dbuf.c) worth of 
-	   link-structures at time to avoid all the malloc overhead.
-	   All links left free from this process or separately freed 
-	   by a call to free_link() are moved over to freelink-list.
-	   Impact? Let's see... -Donwulff */
-	/* Impact is a huge memory leak -Stskeeps
-	   hope this implementation works a little bit better */
-	if (freelink == NULL)
-	{
-		for (i = 1; i <= LINKSIZE; i++)
-		{
-			lp = (Link *)MyMalloc(sizeof(Link));
-			lp->next = freelink;
-			freelink = lp;
-		}
-		freelinks = freelinks + LINKSIZE;
-		lp = freelink;
-		freelink = lp->next;
-		freelinks--;
-	}
-	else
-	{
-		lp = freelink;
-		freelink = freelink->next;
-		freelinks--;
-	}
+
+	lp = (Link *)slab_alloc(&slab_link);
 #ifdef	DEBUGMODE
 	links.inuse++;
 #endif
@@ -440,9 +586,7 @@ Link *make_link(void)
 
 void free_link(Link *lp)
 {
-	lp->next = freelink;
-	freelink = lp;
-	freelinks++;
+	slab_free(lp);
 
 #ifdef	DEBUGMODE
 	links.inuse--;
@@ -453,7 +597,7 @@ Ban *make_ban(void)
 {
 	Ban *lp;
 
-	lp = (Ban *) MyMalloc(sizeof(Ban));
+	lp = (Ban *)slab_alloc(&slab_ban);
 #ifdef	DEBUGMODE
 	links.inuse++;
 #endif
@@ -462,7 +606,7 @@ Ban *make_ban(void)
 
 void free_ban(Ban *lp)
 {
-	MyFree((char *)lp);
+	slab_free(lp);
 #ifdef	DEBUGMODE
 	links.inuse--;
 #endif
@@ -229,14 +229,38 @@ int  smycmp(const char *s1, const char *s2)
 	str1 = (u_char *)s1;
 	str2 = (u_char *)s2;
 
-	while ((res = toupper(*str1) - toupper(*str2)) == 0)
+	for (;; str1++, str2++)
 	{
-		if (*str1 == '\0')
-			return 0;
-		str1++;
-		str2++;
+		/* Mostly the bytes are the same, skip the table then */
+		if (*str1 == *str2)
+		{
+			if (*str1 == '\0')
+				return 0;
+			continue;
+		}
+		if ((res = toupper(*str1) - toupper(*str2)) != 0)
+			return (res);
 	}
-	return (res);
+}
+
+/*
+ * hash_name: hash value of a name, case insensitive in the same way as
+ * smycmp() is (same toupper table), and its length in *len. Used for
+ * the client, channel and watch hash tables, which keep both on the
+ * entries so a lookup only calls smycmp() when these two match.
+ */
+unsigned int hash_name(const char *name, int *len)
+{
+	const u_char *p = (const u_char *)name;
+	unsigned int hashv = 2166136261U;	/* FNV-1a */
+
+	for (; *p; p++)
+	{
+		hashv ^= toupper(*p);
+		hashv *= 16777619U;
+	}
+	*len = p - (const u_char *)name;
+	return hashv;
 }
 
 
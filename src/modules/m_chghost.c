@@ -211,6 +211,7 @@ DLLFUNC int m_chghost(aClient *cptr, aClient *sptr, int parc, char *parv[])
 			acptr->user->virthost = 0;
 		}
 		acptr->user->virthost = strdup(parv[2]);
+		UserIdentityChanged(acptr);
 		if (UHOST_ALLOWED == UHALLOW_REJOIN)
 			rejoin_dojoinandmode(acptr, did_parts);
 		DYN_FREE(did_parts);
@@ -212,6 +212,7 @@ int  legalident = 1;
 		    MSG_CHGIDENT,
 		    TOK_CHGIDENT, "%s %s", acptr->name, parv[2]);
 		ircsprintf(acptr->user->username, "%s", parv[2]);
+		UserIdentityChanged(acptr);
 		if (UHOST_ALLOWED == UHALLOW_REJOIN)
 			rejoin_dojoinandmode(acptr, did_parts);
 		DYN_FREE(did_parts);
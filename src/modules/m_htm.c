@@ -298,7 +298,7 @@ EVENT(lcf_check)
 	static int lrv;
 
 	lrv = LRV * LCF;
-	if ((me.receiveK - lrv >= lastrecvK) || HTMLOCK == 1)
+	if ((me.conn->receiveK - lrv >= lastrecvK) || HTMLOCK == 1)
 	{
 		if (!lifesux)
 		{
@@ -370,10 +370,10 @@ EVENT(htm_calc)
 		return;
 		
 	currentrate =
-		   ((float)(me.receiveK -
+		   ((float)(me.conn->receiveK -
 		    lastrecvK)) / ((float)(timeofday - last));
 	currentrate2 =
-		   ((float)(me.sendK -
+		   ((float)(me.conn->sendK -
 			 lastsendK)) / ((float)(timeofday - last));
 	if (currentrate > highest_rate)
 			highest_rate = currentrate;
@@ -144,7 +144,7 @@ CMD_FUNC(m_kick)
 				continue;	/* No such user left! */
 			if (!who->user)
 				continue;
-			if ((lp = find_membership_link(who->user->channel, chptr)))
+			if ((lp = find_membership(who, chptr)))
 			{
 				if (IsULine(sptr) || IsServer(sptr))
 					goto attack;
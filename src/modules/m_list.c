@@ -314,26 +314,109 @@ DLLFUNC CMD_FUNC(m_list)
 
 	return 0;
 }
+/*
+ * Send the RPL_LIST line for one channel (called through
+ * hash_scan_channels() by send_list).
+ */
+struct list_state {
+	aClient *cptr;
+	int numsend;
+};
+
+static void send_list_channel(aChannel *chptr, void *data)
+{
+	struct list_state *ls = (struct list_state *)data;
+	aClient *cptr = ls->cptr;
+	LOpts *lopt = cptr->user->lopt;
+
+	if (SecretChannel(chptr)
+	    && !IsMember(cptr, chptr)
+	    && !OPCanSeeSecret(cptr))
+		return;
+
+	/* Much more readable like this -- codemastr */
+	if ((!lopt->showall))
+	{
+		/* User count must be in range */
+		if ((chptr->users < lopt->usermin) || 
+		    ((lopt->usermax >= 0) && (chptr->users > 
+		    lopt->usermax)))
+			return;
+
+		/* Creation time must be in range */
+		if ((chptr->creationtime && (chptr->creationtime <
+		    lopt->chantimemin)) || (chptr->creationtime >
+		    lopt->chantimemax))
+			return;
+
+		/* Topic time must be in range */
+		if ((chptr->topic_time < lopt->topictimemin) ||
+		    (chptr->topic_time > lopt->topictimemax))
+			return;
+
+		/* Must not be on nolist (if it exists) */
+		if (lopt->nolist && find_str_match_link(lopt->nolist,
+		    chptr->chname))
+			return;
+
+		/* Must be on yeslist (if it exists) */
+		if (lopt->yeslist && !find_str_match_link(lopt->yeslist,
+		    chptr->chname))
+			return;
+	}
+#ifdef LIST_SHOW_MODES
+	modebuf[0] = '[';
+	channel_modes(cptr, &modebuf[1], parabuf, chptr);
+	if (modebuf[2] == '\0')
+		modebuf[0] = '\0';
+	else
+		strlcat(modebuf, "]", sizeof modebuf);
+#endif
+	if (!OPCanSeeSecret(cptr))
+		sendto_one(cptr,
+		    rpl_str(RPL_LIST), me.name,
+		    cptr->name,
+		    ShowChannel(cptr,
+		    chptr) ? chptr->chname :
+		    "*", chptr->users,
+#ifdef LIST_SHOW_MODES
+		    ShowChannel(cptr, chptr) ?
+		    modebuf : "",
+#endif
+		    ShowChannel(cptr,
+		    chptr) ? (chptr->topic ?
+		    chptr->topic : "") : "");
+	else
+		sendto_one(cptr,
+		    rpl_str(RPL_LIST), me.name,
+		    cptr->name, chptr->chname,
+		    chptr->users,
+#ifdef LIST_SHOW_MODES
+		    modebuf,
+#endif					    
+		    (chptr->topic ? chptr->topic : ""));
+	ls->numsend--;
+}
+
 /*
  * The function which sends the actual channel list back to the user.
  * Operates by stepping through the hashtable, sending the entries back if
  * they match the criteria.
  * cptr = Local client to send the output back to.
  * numsend = Number (roughly) of lines to send back. Once this number has
- * been exceeded, send_list will finish with the current hash bucket,
- * and record that number as the number to start next time send_list
+ * been exceeded, send_list will finish with the current hash bucket(s),
+ * and record the scan cursor to continue from next time send_list
  * is called for this user. So, this function will almost always send
- * back more lines than specified by numsend (though not by much,
- * assuming CH_MAX is was well picked). So be conservative in your choice
- * of numsend. -Rak
+ * back more lines than specified by numsend (though not by much).
+ * So be conservative in your choice of numsend. -Rak
  */
 
 /* Taken from bahamut, modified for Unreal by codemastr */
 
 void _send_list(aClient *cptr, int numsend)
 {
-	aChannel *chptr;
 	LOpts *lopt = cptr->user->lopt;
+	struct list_state ls;
 	unsigned int  hashnum;
 
 	/* Begin of /list? then send official channels. */
@@ -355,87 +438,15 @@ void _send_list(aClient *cptr, int numsend)
 		}
 	}
 
-	for (hashnum = lopt->starthash; hashnum < CH_MAX; hashnum++)
-	{
-		if (numsend > 0)
-			for (chptr =
-			    (aChannel *)hash_get_chan_bucket(hashnum);
-			    chptr; chptr = chptr->hnextch)
-			{
-				if (SecretChannel(chptr)
-				    && !IsMember(cptr, chptr)
-				    && !OPCanSeeSecret(cptr))
-					continue;
-
-				/* Much more readable like this -- codemastr */
-				if ((!lopt->showall))
-				{
-					/* User count must be in range */
-					if ((chptr->users < lopt->usermin) || 
-					    ((lopt->usermax >= 0) && (chptr->users > 
-					    lopt->usermax)))
-						continue;
-
-					/* Creation time must be in range */
-					if ((chptr->creationtime && (chptr->creationtime <
-					    lopt->chantimemin)) || (chptr->creationtime >
-					    lopt->chantimemax))
-						continue;
-
-					/* Topic time must be in range */
-					if ((chptr->topic_time < lopt->topictimemin) ||
-					    (chptr->topic_time > lopt->topictimemax))
-						continue;
-
-					/* Must not be on nolist (if it exists) */
-					if (lopt->nolist && find_str_match_link(lopt->nolist,
-					    chptr->chname))
-						continue;
-
-					/* Must be on yeslist (if it exists) */
-					if (lopt->yeslist && !find_str_match_link(lopt->yeslist,
-					    chptr->chname))
-						continue;
-				}
-#ifdef LIST_SHOW_MODES
-				modebuf[0] = '[';
-				channel_modes(cptr, &modebuf[1], parabuf, chptr);
-				if (modebuf[2] == '\0')
-					modebuf[0] = '\0';
-				else
-					strlcat(modebuf, "]", sizeof modebuf);
-#endif
-				if (!OPCanSeeSecret(cptr))
-					sendto_one(cptr,
-					    rpl_str(RPL_LIST), me.name,
-					    cptr->name,
-					    ShowChannel(cptr,
-					    chptr) ? chptr->chname :
-					    "*", chptr->users,
-#ifdef LIST_SHOW_MODES
-					    ShowChannel(cptr, chptr) ?
-					    modebuf : "",
-#endif
-					    ShowChannel(cptr,
-					    chptr) ? (chptr->topic ?
-					    chptr->topic : "") : "");
-				else
-					sendto_one(cptr,
-					    rpl_str(RPL_LIST), me.name,
-					    cptr->name, chptr->chname,
-					    chptr->users,
-#ifdef LIST_SHOW_MODES
-					    modebuf,
-#endif					    
-					    (chptr->topic ? chptr->topic : ""));
-				numsend--;
-			}
-		else
-			break;
-	}
+	ls.cptr = cptr;
+	ls.numsend = numsend;
+	hashnum = lopt->starthash;
+	do
+		hashnum = hash_scan_channels(hashnum, send_list_channel, &ls);
+	while (hashnum && (ls.numsend > 0));
 
 	/* All done */
-	if (hashnum == CH_MAX)
+	if (!hashnum)
 	{
 		sendto_one(cptr, rpl_str(RPL_LISTEND), me.name, cptr->name);
 		free_str_list(cptr->user->lopt->yeslist);
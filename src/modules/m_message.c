@@ -306,7 +306,7 @@ DLLFUNC int m_message(aClient *cptr, aClient *sptr, int parc, char *parv[], int
 			if (!recursive_webtv)
 			{
 				recursive_webtv = 1;
-				ret = parse(sptr, parv[2], (parv[2] + strlen(parv[2])));
+				ret = parse(sptr, parv[2], (parv[2] + parv_len(parv, 2)));
 				recursive_webtv = 0;
 			}
 			return ret;
@@ -319,7 +319,7 @@ DLLFUNC int m_message(aClient *cptr, aClient *sptr, int parc, char *parv[], int
 				ret = webtv_parse(sptr, parv[2]);
 				if (ret == -99)
 				{
-					ret = parse(sptr, parv[2], (parv[2] + strlen(parv[2])));
+					ret = parse(sptr, parv[2], (parv[2] + parv_len(parv, 2)));
 				}
 				recursive_webtv = 0;
 				return ret;
@@ -390,7 +390,7 @@ DLLFUNC int m_message(aClient *cptr, aClient *sptr, int parc, char *parv[], int
 				{
 					if (MyClient(sptr) && !op_can_override(sptr))
 					{
-						Membership *lp = find_membership_link(sptr->user->channel, chptr);
+						Membership *lp = find_membership(sptr, chptr);
 						/* Check if user is allowed to send. RULES:
 						 * Need at least voice (+) in order to send to +,% or @
 						 * Need at least ops (@) in order to send to & or ~
@@ -512,12 +512,14 @@ DLLFUNC int m_message(aClient *cptr, aClient *sptr, int parc, char *parv[], int
 				if (!text)
 					continue;
 
-				sendto_channelprefix_butone_tok(cptr,
+				/* parse() may already know how long the text is */
+				sendto_channelprefix_butone_tok_len(cptr,
 				    sptr, chptr,
 				    prefix,
 				    notice ? MSG_NOTICE : MSG_PRIVATE,
 				    notice ? TOK_NOTICE : TOK_PRIVATE,
-				    nick, text, 1);
+				    nick, text,
+				    (text == parv[2]) ? parv_len(parv, 2) : strlen(text), 1);
 
 #ifdef NEWCHFLOODPROT
 				if (chptr->mode.floodprot && !is_skochanop(sptr, chptr) &&
@@ -936,123 +938,100 @@ int hlength = strlen (haystack);
 	}
   return NULL; /* not found */
 }
-inline int fast_badword_match(ConfigItem_badword *badword, char *line)
+
+/* State of a badword_matcher scan, see stripbadwords_fast() */
+struct badword_scan {
+	const char *text;
+	int  len, where;
+	int  tokstart, tokend;		/* the word we are in, tokend is -1 for none */
+	ConfigItem_badword *best;	/* what to replace that word with */
+	char *pnew, *c_eol;		/* output and its (cached) end */
+	int  copied;			/* text is copied to the output up to here */
+	int  cleaned;
+};
+
+/* Appends 'n' chars of 's' to the output, cut off at the end */
+static void badword_out(struct badword_scan *b, const char *s, int n)
 {
- 	char *p;
-	int bwlen = strlen(badword->word);
-	if ((badword->type & BADW_TYPE_FAST_L) && (badword->type & BADW_TYPE_FAST_R))
-		return (our_strcasestr(line, badword->word) ? 1 : 0);
+	if (b->pnew + n > b->c_eol)
+		n = b->c_eol - b->pnew;
+	memcpy(b->pnew, s, n);
+	b->pnew += n;
+}
 
-	p = line;
-	while((p = our_strcasestr(p, badword->word)))
+/* Done with the current word: replace it if a badword matched */
+static void badword_flush(struct badword_scan *b)
+{
+	if (!b->best)
+		return;
+	badword_out(b, b->text + b->copied, b->tokstart - b->copied);
+	if (b->best->replace)
+		badword_out(b, b->best->replace, strlen(b->best->replace));
+	else
+		badword_out(b, REPLACEWORD, sizeof(REPLACEWORD) - 1);
+	b->copied = b->tokend;
+	b->cleaned = 1;
+	b->best = NULL;
+}
+
+/* ac_scan() callback, 'data' is a ConfigItem_badword of type BADW_TYPE_FAST */
+static int badword_hit(void *data, int start, int end, void *arg)
+{
+	ConfigItem_badword *bw = (ConfigItem_badword *)data;
+	struct badword_scan *b = (struct badword_scan *)arg;
+
+	if (bw->where != b->where)
+		return 0;
+	/* Matches come in the order in which they end, so if this one
+	 * ends after the current word it is in the next one.
+	 */
+	if (end > b->tokend)
 	{
-		if (!(badword->type & BADW_TYPE_FAST_L))
-		{
-			if ((p != line) && !iswseperator(*(p - 1))) /* aaBLA but no *BLA */
-				goto next;
-		}
-		if (!(badword->type & BADW_TYPE_FAST_R))
-		{
-			if (!iswseperator(*(p + bwlen)))  /* BLAaa but no BLA* */
-				goto next;
-		}
-		/* Looks like it matched */
-		return 1;
-next:
-		p += bwlen;
+		badword_flush(b);
+		for (b->tokstart = start; (b->tokstart > 0) && !iswseperator(b->text[b->tokstart - 1]); b->tokstart--)
+			;
+		for (b->tokend = end; (b->tokend < b->len) && !iswseperator(b->text[b->tokend]); b->tokend++)
+			;
 	}
+	if (!(bw->type & BADW_TYPE_FAST_L) && (start != b->tokstart))
+		return 0; /* aaBLA but no *BLA */
+	if (!(bw->type & BADW_TYPE_FAST_R) && (end != b->tokend))
+		return 0; /* BLAaa but no BLA* */
+	if (bw->action == BADWORD_BLOCK)
+		return 1;
+	/* The whole word gets replaced, by the newest badword, like before */
+	if (!b->best || (bw->seq > b->best->seq))
+		b->best = bw;
 	return 0;
 }
-/* fast_badword_replace:
- * a fast replace routine written by Syzop used for replacing badwords.
- * searches in line for huntw and replaces it with replacew,
- * buf is used for the result and max is sizeof(buf).
- * (Internal assumptions: max > 0 AND max > strlen(line)+1)
+
+/*
+ * Looks for all 'fast' badwords of list 'where' in 'text' in one pass
+ * over badword_matcher, and writes 'text' with the words replaced to
+ * 'buf' (of 'max' bytes, cut off if needed).
+ * Returns -1 if a badword with action block was found, otherwise
+ * whether anything got replaced.
  */
-inline int fast_badword_replace(ConfigItem_badword *badword, char *line, char *buf, int max)
+static int stripbadwords_fast(const char *text, int where, char *buf, int max)
 {
-/* Some aliases ;P */
-char *replacew = badword->replace ? badword->replace : REPLACEWORD;
-char *pold = line, *pnew = buf; /* Pointers to old string and new string */
-char *poldx = line;
-int replacen = -1; /* Only calculated if needed. w00t! saves us a few nanosecs? lol */
-int searchn = -1;
-char *startw, *endw;
-char *c_eol = buf + max - 1; /* Cached end of (new) line */
-int run = 1;
-int cleaned = 0;
-
-	Debug((DEBUG_NOTICE, "replacing %s -> %s in '%s'", badword->word, replacew, line));
-
-	while(run) {
-		pold = our_strcasestr(pold, badword->word);
-		if (!pold)
-			break;
-		if (replacen == -1)
-			replacen = strlen(replacew);
-		if (searchn == -1)
-			searchn = strlen(badword->word);
-		/* Hunt for start of word */
- 		if (pold > line) {
-			for (startw = pold; (!iswseperator(*startw) && (startw != line)); startw--);
-			if (iswseperator(*startw))
-				startw++; /* Don't point at the space/seperator but at the word! */
-		} else {
-			startw = pold;
-		}
-
-		if (!(badword->type & BADW_TYPE_FAST_L) && (pold != startw)) {
-			/* not matched */
-			pold++;
-			continue;
-		}
-
-		/* Hunt for end of word */
-		for (endw = pold; ((*endw != '\0') && (!iswseperator(*endw))); endw++);
-
-		if (!(badword->type & BADW_TYPE_FAST_R) && (pold+searchn != endw)) {
-			/* not matched */
-			pold++;
-			continue;
-		}
-
-		cleaned = 1; /* still too soon? Syzop/20050227 */
-
-		/* Do we have any not-copied-yet data? */
-		if (poldx != startw) {
-			int tmp_n = startw - poldx;
-			if (pnew + tmp_n >= c_eol) {
-				/* Partial copy and return... */
-				memcpy(pnew, poldx, c_eol - pnew);
-				*c_eol = '\0';
-				return 1;
-			}
-
-			memcpy(pnew, poldx, tmp_n);
-			pnew += tmp_n;
-		}
-		/* Now update the word in buf (pnew is now something like startw-in-new-buffer */
-
-		if (replacen) {
-			if ((pnew + replacen) >= c_eol) {
-				/* Partial copy and return... */
-				memcpy(pnew, replacew, c_eol - pnew);
-				*c_eol = '\0';
-				return 1;
-			}
-			memcpy(pnew, replacew, replacen);
-			pnew += replacen;
-		}
-		poldx = pold = endw;
-	}
-	/* Copy the last part */
-	if (*poldx) {
-		strncpy(pnew, poldx, c_eol - pnew);
-		*(c_eol) = '\0';
-	} else {
-		*pnew = '\0';
-	}
-	return cleaned;
+	struct badword_scan b;
+
+	b.text = text;
+	b.len = strlen(text);
+	b.where = where;
+	b.tokstart = 0;
+	b.tokend = -1;
+	b.best = NULL;
+	b.pnew = buf;
+	b.c_eol = buf + max - 1;
+	b.copied = 0;
+	b.cleaned = 0;
+	if (ac_scan(&badword_matcher, text, b.len, badword_hit, &b))
+		return -1;
+	badword_flush(&b);
+	badword_out(&b, text + b.copied, b.len - b.copied);
+	*b.pnew = '\0';
+	return b.cleaned;
 }
 #endif
 
@@ -1060,9 +1039,11 @@ int cleaned = 0;
  * Returns a string, which has been filtered by the words loaded via
  * the loadbadwords() function.  It's primary use is to filter swearing
  * in both private and public messages
+ * With FAST_BADWORD_REPLACE all 'fast' badwords are done in one go by
+ * stripbadwords_fast(), only the regex ones are tried one by one after.
  */
 
-char *stripbadwords(char *str, ConfigItem_badword *start_bw, int *blocked)
+char *stripbadwords(char *str, ConfigItem_badword *start_bw, int where, int *blocked)
 {
 	regmatch_t pmatch[MAX_MATCH];
 	static char cleanstr[4096];
@@ -1079,78 +1060,65 @@ char *stripbadwords(char *str, ConfigItem_badword *start_bw, int *blocked)
 	/*
 	 * work on a copy
 	 */
+#ifdef FAST_BADWORD_REPLACE
+	/* stripbadwords_fast() does size checking so we can use 512 here instead of 4096 */
+	cleaned = stripbadwords_fast(StripControlCodes(str), where, cleanstr, 512);
+	if (cleaned < 0)
+	{
+		*blocked = 1;
+		return NULL;
+	}
+	stringlen = strlen(cleanstr);
+#else
 	stringlen = strlcpy(cleanstr, StripControlCodes(str), sizeof cleanstr);
+	cleaned = 0;
+#endif
 	memset(&pmatch, 0, sizeof pmatch);
 	matchlen = 0;
 	buf[0] = '\0';
-	cleaned = 0;
 
 	for (this_word = start_bw; this_word; this_word = (ConfigItem_badword *)this_word->next)
 	{
 #ifdef FAST_BADWORD_REPLACE
-		if (this_word->type & BADW_TYPE_FAST)
+		if (!(this_word->type & BADW_TYPE_REGEX))
+			continue; /* already done */
+#endif
+		if (this_word->action == BADWORD_BLOCK)
 		{
-			if (this_word->action == BADWORD_BLOCK)
-			{
-				if (fast_badword_match(this_word, cleanstr))
-				{
-					*blocked = 1;
-					return NULL;
-				}
-			}
-			else
+			if (!regexec(&this_word->expr, cleanstr, 0, NULL, 0))
 			{
-				int n;
-				/* fast_badword_replace() does size checking so we can use 512 here instead of 4096 */
-				n = fast_badword_replace(this_word, cleanstr, buf, 512);
-				if (!cleaned && n)
-					cleaned = n;
-				strcpy(cleanstr, buf);
-				memset(buf, 0, sizeof(buf)); /* regexp likes this somehow */
+				*blocked = 1;
+				return NULL;
 			}
-		} else
-		if (this_word->type & BADW_TYPE_REGEX)
+		}
+		else
 		{
-#endif
-			if (this_word->action == BADWORD_BLOCK)
+			ptr = cleanstr; /* set pointer to start of string */
+			while (regexec(&this_word->expr, ptr, MAX_MATCH, pmatch,0) != REG_NOMATCH)
 			{
-				if (!regexec(&this_word->expr, cleanstr, 0, NULL, 0))
-				{
-					*blocked = 1;
-					return NULL;
-				}
-			}
-			else
-			{
-				ptr = cleanstr; /* set pointer to start of string */
-				while (regexec(&this_word->expr, ptr, MAX_MATCH, pmatch,0) != REG_NOMATCH)
-				{
-					if (pmatch[0].rm_so == -1)
-						break;
-					m = pmatch[0].rm_eo - pmatch[0].rm_so;
-					if (m == 0)
-						break; /* anti-loop */
-					cleaned = 1;
-					matchlen += m;
-					strlncat(buf, ptr, sizeof buf, pmatch[0].rm_so);
-					if (this_word->replace)
-						strlcat(buf, this_word->replace, sizeof buf); 
-					else
-						strlcat(buf, REPLACEWORD, sizeof buf);
-					ptr += pmatch[0].rm_eo;	/* Set pointer after the match pos */
-					memset(&pmatch, 0, sizeof(pmatch));
-				}
-
-				/* All the better to eat you with! */
-				strlcat(buf, ptr, sizeof buf);	
-				memcpy(cleanstr, buf, sizeof cleanstr);
-				memset(buf, 0, sizeof(buf));
-				if (matchlen == stringlen)
+				if (pmatch[0].rm_so == -1)
 					break;
+				m = pmatch[0].rm_eo - pmatch[0].rm_so;
+				if (m == 0)
+					break; /* anti-loop */
+				cleaned = 1;
+				matchlen += m;
+				strlncat(buf, ptr, sizeof buf, pmatch[0].rm_so);
+				if (this_word->replace)
+					strlcat(buf, this_word->replace, sizeof buf); 
+				else
+					strlcat(buf, REPLACEWORD, sizeof buf);
+				ptr += pmatch[0].rm_eo;	/* Set pointer after the match pos */
+				memset(&pmatch, 0, sizeof(pmatch));
 			}
-#ifdef FAST_BADWORD_REPLACE
+
+			/* All the better to eat you with! */
+			strlcat(buf, ptr, sizeof buf);	
+			memcpy(cleanstr, buf, sizeof cleanstr);
+			memset(buf, 0, sizeof(buf));
+			if (matchlen == stringlen)
+				break;
 		}
-#endif
 	}
 
 	cleanstr[511] = '\0'; /* cutoff, just to be sure */
@@ -1161,16 +1129,16 @@ char *stripbadwords(char *str, ConfigItem_badword *start_bw, int *blocked)
 #ifdef STRIPBADWORDS
 char *_stripbadwords_channel(char *str, int *blocked)
 {
-	return stripbadwords(str, conf_badword_channel, blocked);
+	return stripbadwords(str, conf_badword_channel, BADW_WHERE_CHANNEL, blocked);
 }
 
 char *_stripbadwords_message(char *str, int *blocked)
 {
-	return stripbadwords(str, conf_badword_message, blocked);
+	return stripbadwords(str, conf_badword_message, BADW_WHERE_MESSAGE, blocked);
 }
 char *_stripbadwords_quit(char *str, int *blocked)
 {
-	return stripbadwords(str, conf_badword_quit, blocked);
+	return stripbadwords(str, conf_badword_quit, BADW_WHERE_QUIT, blocked);
 }
 #else
 char *_stripbadwords_channel(char *str, int *blocked)
@@ -387,14 +387,14 @@ int parc = *parc_out;
 	len = strlen(sptr->name) + strlen(sptr->user->username) + strlen(GetHost(sptr)) +
 	      strlen(chptr->chname) + 11;
 	
-	len += strlen(parv[2]);
+	len += strlen(parv[2]); /* mode_cutoff() may have shortened it */
 
 	if (*parv[2] != '+' && *parv[2] != '-')
 		len++;
 	
 	for (i = 3; parv[i]; i++)
 	{
-		len += strlen(parv[i]) + 1; /* (+1 for the space character) */
+		len += parv_len(parv, i) + 1; /* (+1 for the space character) */
 		/* +4 is another potential amplification (per-param).
 		 * If we were smart we would only check this for b/e/I and only for
 		 * relevant cases (not for all extended), but this routine is dumb,
@@ -415,7 +415,7 @@ int parc = *parc_out;
 	 */
 	for (i = parc-1; parv[i] && (i > 3); i--)
 	{
-		len -= strlen(parv[i]);
+		len -= parv_len(parv, i);
 		if (match("*!*@*", parv[i]))
 			len -= 4; /* must adjust accordingly.. */
 		parv[i] = NULL;
@@ -1011,13 +1011,13 @@ int  do_mode_char(aChannel *chptr, long modetype, char modechar, char *param,
 		  	break;
    		  /* codemastr: your patch is a good idea here, but look at the
    		     member->flags stuff longer down. this caused segfaults */
-   		  if (!(membership = find_membership_link(who->user->channel, chptr)))
+   		  if (!(membership = find_membership(who, chptr)))
 		  {
 			  sendto_one(cptr, err_str(ERR_USERNOTINCHANNEL),
 			      me.name, cptr->name, who->name, chptr->chname);
 			  break;
 		  }
-		  member = find_member_link(chptr->members, who);
+		  member = find_member(chptr, who);
 		  if (!member)
 		  {
 		  	/* should never happen */
@@ -2431,6 +2431,8 @@ DLLFUNC CMD_FUNC(_m_umode)
 		 */
 		sptr->user->virthost = strdup(sptr->user->cloakedhost);
 	}
+	if ((setflags ^ sptr->umodes) & (UMODE_HIDE|UMODE_SETHOST))
+		UserIdentityChanged(sptr);
 	/*
 	 * If I understand what this code is doing correctly...
 	 *   If the user WAS an operator and has now set themselves -o/-O
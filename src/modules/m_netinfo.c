@@ -152,8 +152,8 @@ DLLFUNC CMD_FUNC(m_netinfo)
 	}
 	sendto_realops
 	    ("Link %s -> %s is now synced [secs: %li recv: %ld.%hu sent: %ld.%hu]",
-	    cptr->name, me.name, (TStime() - endsync), sptr->receiveK,
-	    sptr->receiveB, sptr->sendK, sptr->sendB);
+	    cptr->name, me.name, (TStime() - endsync), cptr->conn->receiveK,
+	    cptr->conn->receiveB, cptr->conn->sendK, cptr->conn->sendB);
 #ifdef ZIP_LINKS
 	if ((MyConnect(cptr)) && (IsZipped(cptr)) && cptr->zip->in->total_out && cptr->zip->out->total_in) {
 		sendto_realops
@@ -168,8 +168,8 @@ DLLFUNC CMD_FUNC(m_netinfo)
 
 	sendto_serv_butone(&me,
 	    ":%s SMO o :\2(sync)\2 Link %s -> %s is now synced [secs: %li recv: %ld.%hu sent: %ld.%hu]",
-	    me.name, cptr->name, me.name, (TStime() - endsync), sptr->receiveK,
-	    sptr->receiveB, sptr->sendK, sptr->sendB);
+	    me.name, cptr->name, me.name, (TStime() - endsync), cptr->conn->receiveK,
+	    cptr->conn->receiveB, cptr->conn->sendK, cptr->conn->sendB);
 
 	if (!(strcmp(ircnetwork, parv[8]) == 0))
 	{
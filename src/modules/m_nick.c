@@ -68,7 +68,7 @@ DLLFUNC int MOD_TEST(m_nick)(ModuleInfo *modinfo)
 
 DLLFUNC int MOD_INIT(m_nick)(ModuleInfo *modinfo)
 {
-	CommandAdd(modinfo->handle, MSG_NICK, TOK_NICK, m_nick, MAXPARA, M_USER|M_SERVER|M_UNREGISTERED);
+	CommandAdd(modinfo->handle, MSG_NICK, TOK_NICK, m_nick, MAXPARA, M_USER|M_SERVER|M_UNREGISTERED|M_BACKUPBUF);
 	MARK_AS_OFFICIAL_MODULE(modinfo);
 	return MOD_SUCCESS;
 }
@@ -699,15 +699,15 @@ DLLFUNC CMD_FUNC(m_nick)
 			 *
 			 * Generate a random string for them to pong with.
 			 */
-			sptr->nospoof = getrandom32();
+			sptr->conn->nospoof = getrandom32();
 
 			if (PINGPONG_WARNING)
 				sendto_one(sptr, ":%s NOTICE %s :*** If you are having problems"
 				    " connecting due to ping timeouts, please"
 				    " type /quote pong %X or /raw pong %X now.",
-				    me.name, nick, sptr->nospoof, sptr->nospoof);
+				    me.name, nick, sptr->conn->nospoof, sptr->conn->nospoof);
 
-			sendto_one(sptr, "PING :%X", sptr->nospoof);
+			sendto_one(sptr, "PING :%X", sptr->conn->nospoof);
 		}
 
 #ifdef CONTACT_EMAIL
@@ -731,10 +731,10 @@ DLLFUNC CMD_FUNC(m_nick)
 		if ((parc > 2) && (strlen(parv[2]) <= PASSWDLEN)
 		    && !(sptr->listener->umodes & LISTENER_JAVACLIENT))
 		{
-			if (sptr->passwd)
-				MyFree(sptr->passwd);
-			sptr->passwd = MyMalloc(strlen(parv[2]) + 1);
-			(void)strcpy(sptr->passwd, parv[2]);
+			if (sptr->conn->passwd)
+				MyFree(sptr->conn->passwd);
+			sptr->conn->passwd = MyMalloc(strlen(parv[2]) + 1);
+			(void)strcpy(sptr->conn->passwd, parv[2]);
 		}
 		/* This had to be copied here to avoid problems.. */
 		(void)strcpy(sptr->name, nick);
@@ -772,6 +772,8 @@ DLLFUNC CMD_FUNC(m_nick)
 	}
 	(void)strcpy(sptr->name, nick);
 	(void)add_to_client_hash_table(nick, sptr);
+	if (sptr->user)
+		UserIdentityChanged(sptr);
 	if (IsServer(cptr) && parc > 7)
 	{
 		parv[3] = nick;
@@ -882,7 +884,7 @@ int _register_user(aClient *cptr, aClient *sptr, char *nick, char *username, cha
 			    "You are not authorized to connect to this server");
 		}
 
-		if (sptr->hostp)
+		if (sptr->conn->hostp)
 		{
 			/* reject ASCII < 32 and ASCII >= 127 (note: upper resolver might be even more strict). */
 			for (tmpstr = sptr->sockhost; *tmpstr > ' ' && *tmpstr < 127; tmpstr++);
@@ -1100,7 +1102,7 @@ int _register_user(aClient *cptr, aClient *sptr, char *nick, char *username, cha
 			sendto_one(sptr, err_str(ERR_HOSTILENAME), me.name,
 			    sptr->name, olduser, userbad, stripuser);
 #endif
-		nextping = TStime();
+		set_ping_timer(sptr, TStime()); /* pingfreq of the class applies now */
 		if (IsSecure(sptr))
 			sptr->umodes |= UMODE_SECURE;
 	}
@@ -1184,7 +1186,7 @@ int _register_user(aClient *cptr, aClient *sptr, char *nick, char *username, cha
 		 * if passwd given and if NickServ is online.
 		 * - by taz, modified by Wizzu
 		 */
-		if (sptr->passwd && (nsptr = find_person(NickServ, NULL)))
+		if (sptr->conn->passwd && (nsptr = find_person(NickServ, NULL)))
 		{
 			int do_identify = 1;
 			Hook *h;
@@ -1201,7 +1203,7 @@ int _register_user(aClient *cptr, aClient *sptr, char *nick, char *username, cha
 				sendto_one(nsptr, ":%s %s %s@%s :IDENTIFY %s",
 				    sptr->name,
 				    (IsToken(nsptr->from) ? TOK_PRIVATE : MSG_PRIVATE),
-				    NickServ, SERVICES_NAME, sptr->passwd);
+				    NickServ, SERVICES_NAME, sptr->conn->passwd);
 		}
 		if (buf[0] != '\0' && buf[1] != '\0')
 			sendto_one(cptr, ":%s MODE %s :%s", cptr->name,
@@ -1242,10 +1244,10 @@ int _register_user(aClient *cptr, aClient *sptr, char *nick, char *username, cha
 		/* NOTE: If you add something here.. be sure to check the 'if (savetkl)' note above */
 	}
 
-	if (MyConnect(sptr) && !BadPtr(sptr->passwd))
+	if (MyConnect(sptr) && !BadPtr(sptr->conn->passwd))
 	{
-		MyFree(sptr->passwd);
-		sptr->passwd = NULL;
+		MyFree(sptr->conn->passwd);
+		sptr->conn->passwd = NULL;
 	}
 	return 0;
 }
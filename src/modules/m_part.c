@@ -138,7 +138,7 @@ DLLFUNC CMD_FUNC(m_part)
 		 */
 		comment = commentx;
 
-		if (!(lp = find_membership_link(sptr->user->channel, chptr)))
+		if (!(lp = find_membership(sptr, chptr)))
 		{
 			/* Normal to get get when our client did a kick
 			   ** for a remote client (who sends back a PART),
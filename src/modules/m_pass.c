@@ -184,14 +184,14 @@ int docgiirc(aClient *cptr, char *ip, char *host)
 		
 	/* STEP 3: Update cptr->hostp */
 	/* (free old) */
-	if (cptr->hostp)
+	if (cptr->conn->hostp)
 	{
-		unreal_free_hostent(cptr->hostp);
-		cptr->hostp = NULL;
+		unreal_free_hostent(cptr->conn->hostp);
+		cptr->conn->hostp = NULL;
 	}
 	/* (create new) */
 	if (host && verify_hostname(host))
-		cptr->hostp = unreal_create_hostent(host, &cptr->ip);
+		cptr->conn->hostp = unreal_create_hostent(host, &cptr->ip);
 
 	/* STEP 4: Update sockhost
 	   Make sure that if this any IPv4 address is _not_ prefixed with
@@ -293,12 +293,12 @@ DLLFUNC CMD_FUNC(m_pass)
 
 	
 	PassLen = strlen(password);
-	if (cptr->passwd)
-		MyFree(cptr->passwd);
+	if (cptr->conn->passwd)
+		MyFree(cptr->conn->passwd);
 	if (PassLen > (PASSWDLEN))
 		PassLen = PASSWDLEN;
-	cptr->passwd = MyMalloc(PassLen + 1);
-	strncpyzt(cptr->passwd, password, PassLen + 1);
+	cptr->conn->passwd = MyMalloc(PassLen + 1);
+	strncpyzt(cptr->conn->passwd, password, PassLen + 1);
 
 	/* note: the original non-truncated password is supplied as 2nd parameter. */
 	RunHookReturnInt2(HOOKTYPE_LOCAL_PASS, sptr, password, !=0);
@@ -167,15 +167,15 @@ Debug((DEBUG_NOTICE, "NOSPOOF"));
 		goto temp;
 	result = strtoul(parv[1], NULL, 16);
 	/* Accept code in second parameter (ircserv) */
-	if (result != sptr->nospoof)
+	if (result != sptr->conn->nospoof)
 	{
 		if (BadPtr(parv[2]))
 			goto temp;
 		result = strtoul(parv[2], NULL, 16);
-		if (result != sptr->nospoof)
+		if (result != sptr->conn->nospoof)
 			goto temp;
 	}
-	sptr->nospoof = 0;
+	sptr->conn->nospoof = 0;
 	if (USE_BAN_VERSION && MyConnect(sptr))
 		sendto_one(sptr, ":IRC!IRC@%s PRIVMSG %s :\1VERSION\1",
 			   me.name, sptr->name);
@@ -187,7 +187,7 @@ Debug((DEBUG_NOTICE, "NOSPOOF"));
       temp:
 	/* Homer compatibility */
 	sendto_one(cptr, ":%X!nospoof@%s PRIVMSG %s :\1VERSION\1",
-	    cptr->nospoof, me.name, cptr->name);
+	    cptr->conn->nospoof, me.name, cptr->name);
 	return 0;
 }
 
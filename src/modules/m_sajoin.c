@@ -145,7 +145,7 @@ DLLFUNC CMD_FUNC(m_sajoin)
 			}
 
 			chptr = get_channel(acptr, name, 0);
-			if (!parted && chptr && (lp = find_membership_link(acptr->user->channel, chptr)))
+			if (!parted && chptr && (lp = find_membership(acptr, chptr)))
 			{
 				sendto_one(sptr, err_str(ERR_USERONCHANNEL), me.name, parv[0], 
 					   parv[1], name);
@@ -189,7 +189,7 @@ DLLFUNC CMD_FUNC(m_sajoin)
 			}
 			flags = (ChannelExists(name)) ? CHFL_DEOPPED : CHFL_CHANOP;
 			chptr = get_channel(acptr, name, CREATE);
-			if (chptr && (lp = find_membership_link(acptr->user->channel, chptr)))
+			if (chptr && (lp = find_membership(acptr, chptr)))
 				continue;
 			if ((chptr->mode.mode & MODE_ONLYSECURE) && !IsSecure(acptr))
 			{
@@ -133,7 +133,7 @@ DLLFUNC CMD_FUNC(m_sapart)
 					name);
 				continue;
 			}
-			if (!(lp = find_membership_link(acptr->user->channel, chptr)))
+			if (!(lp = find_membership(acptr, chptr)))
 			{
 				sendto_one(sptr, err_str(ERR_USERNOTINCHANNEL), me.name, parv[0],
 					parv[1], name);
@@ -117,7 +117,7 @@ static aClient *decode_puid(char *puid)
 
 	client = local[slot];
 
-	if (cookie && client->sasl_cookie != cookie)
+	if (cookie && client->conn->sasl_cookie != cookie)
 		return NULL;
 
 	return client;
@@ -133,10 +133,10 @@ static const char *encode_puid(aClient *client)
 	static char buf[HOSTLEN + 20];
 
 	/* create a cookie if necessary (and in case getrandom16 returns 0, then run again) */
-	while (!client->sasl_cookie)
-		client->sasl_cookie = getrandom16();
+	while (!client->conn->sasl_cookie)
+		client->conn->sasl_cookie = getrandom16();
 
-	snprintf(buf, sizeof buf, "%s!%d.%d", me.name, client->slot, client->sasl_cookie);
+	snprintf(buf, sizeof buf, "%s!%d.%d", me.name, client->slot, client->conn->sasl_cookie);
 
 	return buf;
 }
@@ -211,10 +211,10 @@ static int m_sasl(aClient *cptr, aClient *sptr, int parc, char *parv[])
 			make_user(target_p);
 
 		/* reject if another SASL agent is answering */
-		if (*target_p->sasl_agent && stricmp(parv[0], target_p->sasl_agent))
+		if (*target_p->conn->sasl_agent && stricmp(parv[0], target_p->conn->sasl_agent))
 			return 0;
 		else
-			strlcpy(target_p->sasl_agent, parv[0], sizeof(target_p->sasl_agent));
+			strlcpy(target_p->conn->sasl_agent, parv[0], sizeof(target_p->conn->sasl_agent));
 
 		if (*parv[3] == 'C')
 			sendto_one(target_p, "AUTHENTICATE %s", parv[4]);
@@ -224,11 +224,11 @@ static int m_sasl(aClient *cptr, aClient *sptr, int parc, char *parv[])
 				sendto_one(target_p, err_str(ERR_SASLFAIL), me.name, BadPtr(target_p->name) ? "*" : target_p->name);
 			else if (*parv[4] == 'S')
 			{
-				target_p->sasl_complete++;
+				target_p->conn->sasl_complete++;
 				sendto_one(target_p, err_str(RPL_SASLSUCCESS), me.name, BadPtr(target_p->name) ? "*" : target_p->name);
 			}
 
-			*target_p->sasl_agent = '\0';
+			*target_p->conn->sasl_agent = '\0';
 		}
 
 		return 0;
@@ -255,7 +255,7 @@ static int m_authenticate(aClient *cptr, aClient *sptr, int parc, char *parv[])
 	if (!SASL_SERVER || !MyConnect(sptr) || BadPtr(parv[1]) || !CHECKPROTO(sptr, PROTO_SASL))
 		return 0;
 
-	if (sptr->sasl_complete)
+	if (sptr->conn->sasl_complete)
 	{
 		sendto_one(sptr, err_str(ERR_SASLALREADY), me.name, BadPtr(sptr->name) ? "*" : sptr->name);
 		return 0;
@@ -267,8 +267,8 @@ static int m_authenticate(aClient *cptr, aClient *sptr, int parc, char *parv[])
 		return 0;
 	}
 
-	if (*sptr->sasl_agent)
-		agent_p = find_client(sptr->sasl_agent, NULL);
+	if (*sptr->conn->sasl_agent)
+		agent_p = find_client(sptr->conn->sasl_agent, NULL);
 
 	if (agent_p == NULL)
 		sendto_serv_butone_token(NULL, me.name, MSG_SASL, TOK_SASL, "%s %s S %s",
@@ -276,22 +276,22 @@ static int m_authenticate(aClient *cptr, aClient *sptr, int parc, char *parv[])
 	else
 		sendto_serv_butone_token(NULL, me.name, MSG_SASL, TOK_SASL, "%s %s C %s", agent_p->user->server, encode_puid(sptr), parv[1]);
 
-	sptr->sasl_out++;
+	sptr->conn->sasl_out++;
 
 	return 0;
 }
 
 static int abort_sasl(struct Client *cptr)
 {
-	if (cptr->sasl_out == 0 || cptr->sasl_complete)
+	if (cptr->conn->sasl_out == 0 || cptr->conn->sasl_complete)
 		return 0;
 
-	cptr->sasl_out = cptr->sasl_complete = 0;
+	cptr->conn->sasl_out = cptr->conn->sasl_complete = 0;
 	sendto_one(cptr, err_str(ERR_SASLABORTED), me.name, BadPtr(cptr->name) ? "*" : cptr->name);
 
-	if (*cptr->sasl_agent)
+	if (*cptr->conn->sasl_agent)
 	{
-		aClient *agent_p = find_client(cptr->sasl_agent, NULL);
+		aClient *agent_p = find_client(cptr->conn->sasl_agent, NULL);
 
 		if (agent_p != NULL)
 		{
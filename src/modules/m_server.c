@@ -169,7 +169,7 @@ ConfigItem_ban *bconf;
 	
 	strcpy(xerrmsg, "No matching link configuration");
 
-	if (!cptr->passwd)
+	if (!cptr->conn->passwd)
 	{
 		sendto_one(cptr, "ERROR :Missing password");
 		return exit_client(cptr, sptr, &me, "Missing password");
@@ -239,7 +239,7 @@ errlink:
 	}
 nohostcheck:
 	/* Now for checking passwords */
-	if (Auth_Check(cptr, link->recvauth, cptr->passwd) == -1)
+	if (Auth_Check(cptr, link->recvauth, cptr->conn->passwd) == -1)
 	{
 		sendto_one(cptr,
 		    "ERROR :Link denied (Authentication failed) %s",
@@ -371,7 +371,7 @@ DLLFUNC CMD_FUNC(m_server)
 		return exit_client(cptr, sptr, &me, "Bogus server name");
 	}
 
-	if ((IsUnknown(cptr) || IsHandshake(cptr)) && !cptr->passwd)
+	if ((IsUnknown(cptr) || IsHandshake(cptr)) && !cptr->conn->passwd)
 	{
 		sendto_one(sptr, "ERROR :Missing password");
 		return exit_client(cptr, sptr, &me, "Missing password");
@@ -703,10 +703,10 @@ int	m_server_synch(aClient *cptr, long numeric, ConfigItem_link *aconf)
 
 	ircd_log(LOG_SERVER, "SERVER %s", cptr->name);
 
-	if (cptr->passwd)
+	if (cptr->conn->passwd)
 	{
-		MyFree(cptr->passwd);
-		cptr->passwd = NULL;
+		MyFree(cptr->conn->passwd);
+		cptr->conn->passwd = NULL;
 	}
 	if (incoming)
 	{
@@ -761,7 +761,7 @@ int	m_server_synch(aClient *cptr, long numeric, ConfigItem_link *aconf)
 #endif
 	if ((Find_uline(cptr->name)))
 		cptr->flags |= FLAGS_ULINE;
-	nextping = TStime();
+	set_ping_timer(cptr, TStime()); /* pingfreq of the class applies now */
 	(void)find_or_add(cptr->name);
 #ifdef USE_SSL
 	if (IsSecure(cptr))
@@ -232,6 +232,7 @@ DLLFUNC int m_sethost(aClient *cptr, aClient *sptr, int parc, char *parv[])
 			sptr->user->virthost = NULL;
 		}
 		sptr->user->virthost = strdup(vhost);
+		UserIdentityChanged(sptr);
 		/* spread it out */
 		sendto_serv_butone_token(cptr, sptr->name, MSG_SETHOST, TOK_SETHOST,
 		    "%s", parv[1]);
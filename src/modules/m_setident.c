@@ -224,6 +224,7 @@ DLLFUNC int m_setident(aClient *cptr, aClient *sptr, int parc, char *parv[])
 
 		/* get it in */
 		ircsprintf(sptr->user->username, "%s", vident);
+		UserIdentityChanged(sptr);
 		/* spread it out */
 		sendto_serv_butone_token(cptr, sptr->name,
 		    MSG_SETIDENT, TOK_SETIDENT, "%s", parv[1]);
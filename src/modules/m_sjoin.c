@@ -60,7 +60,7 @@ ModuleHeader MOD_HEADER(m_sjoin)
 
 DLLFUNC int MOD_INIT(m_sjoin)(ModuleInfo *modinfo)
 {
-	add_Command(MSG_SJOIN, TOK_SJOIN, m_sjoin, MAXPARA);
+	add_CommandX(MSG_SJOIN, TOK_SJOIN, m_sjoin, MAXPARA, M_USER|M_SERVER|M_BACKUPBUF);
 	MARK_AS_OFFICIAL_MODULE(modinfo);
 	return MOD_SUCCESS;
 }
@@ -327,9 +327,10 @@ CMD_FUNC(m_sjoin)
 			MyFree(ban->who);
 			free_ban(ban);
 		}
+		chptr->bangen++;
 		for (lp = chptr->members; lp; lp = lp->next)
 		{
-			lp2 = find_membership_link(lp->cptr->user->channel, chptr);
+			lp2 = find_membership(lp->cptr, chptr);
 			if (!lp2)
 			{
 				sendto_realops("Oops! chptr->members && !find_membership_link");
@@ -671,12 +671,15 @@ static char buf[256];
 		strcat(buf, "java ");
 	if (listener->umodes & LISTENER_SSL)
 		strcat(buf, "SSL ");
+	if (listener->umodes & LISTENER_REUSEPORT)
+		strcat(buf, "reuseport ");
 	return buf;
 }
 
 int stats_port(aClient *sptr, char *para)
 {
-	int i;
+	int i, qlen, qmax;
+	char qbuf[64];
 	aClient *acptr;
 	for (i = 0; i <= LastSlot; i++)
 	{
@@ -684,14 +687,20 @@ int stats_port(aClient *sptr, char *para)
 			continue;
 	  	if (!IsListening(acptr))
 	  		continue;
-	  	sendto_one(sptr, ":%s %s %s :*** Listener on %s:%i, clients %i. is %s %s",
+		qbuf[0] = '\0';
+		if ((qlen = listener_backlog(acptr, &qmax)) >= 0)
+			ircsprintf(qbuf, " backlog %d/%d", qlen, qmax);
+	  	sendto_one(sptr, ":%s %s %s :*** Listener on %s:%i, clients %i. is %s %s(fd %d%s)",
 	  		me.name, IsWebTV(sptr) ? "PRIVMSG" : "NOTICE", sptr->name,
 	  		((ConfigItem_listen *)acptr->class)->ip,
 			((ConfigItem_listen *)acptr->class)->port,
 			((ConfigItem_listen *)acptr->class)->clients,
 			((ConfigItem_listen *)acptr->class)->flag.temporary ? "TEMPORARY" : "PERM",
-			stats_port_helper(acptr));
+			stats_port_helper(acptr), acptr->fd, qbuf);
 	}
+	sendto_one(sptr, ":%s %s %s :*** Accepted %u connections, %d/s (peak %d/s), accept cap of %d/loop hit %ld times",
+		me.name, IsWebTV(sptr) ? "PRIVMSG" : "NOTICE", sptr->name,
+		ircstp->is_ac, accept_rate, accept_rate_peak, ACCEPTS_PER_LOOP, accept_capped);
 	return 0;
 }
 
@@ -725,10 +734,10 @@ int stats_traffic(aClient *sptr, char *para)
 			continue;
 		if (IsServer(acptr))
 		{
-			sp->is_sbs += acptr->sendB;
-			sp->is_sbr += acptr->receiveB;
-			sp->is_sks += acptr->sendK;
-			sp->is_skr += acptr->receiveK;
+			sp->is_sbs += acptr->conn->sendB;
+			sp->is_sbr += acptr->conn->receiveB;
+			sp->is_sks += acptr->conn->sendK;
+			sp->is_skr += acptr->conn->receiveK;
 			sp->is_sti += now - acptr->firsttime;
 			sp->is_sv++;
 			if (sp->is_sbs > 1023)
@@ -744,10 +753,10 @@ int stats_traffic(aClient *sptr, char *para)
 		}
 		else if (IsClient(acptr))
 		{
-			sp->is_cbs += acptr->sendB;
-			sp->is_cbr += acptr->receiveB;
-			sp->is_cks += acptr->sendK;
-			sp->is_ckr += acptr->receiveK;
+			sp->is_cbs += acptr->conn->sendB;
+			sp->is_cbr += acptr->conn->receiveB;
+			sp->is_cks += acptr->conn->sendK;
+			sp->is_ckr += acptr->conn->receiveK;
 			sp->is_cti += now - acptr->firsttime;
 			sp->is_cl++;
 			if (sp->is_cbs > 1023)
@@ -822,16 +831,33 @@ int stats_vhost(aClient *sptr, char *para)
 	return 0;
 }
 
+/* Load factor and chain lengths of one of the hash tables, see hash.c */
+static void stats_hash(aClient *sptr, char *name, aHashTable *t)
+{
+	unsigned int used, longest, load, probes;
+	unsigned int size = t->size[1] ? t->size[1] : t->size[0];
+
+	hash_stats(t, &used, &longest);
+	load = (unsigned int)((t->count * 100UL) / size);
+	probes = t->lookups ? (unsigned int)((t->probes * 100) / t->lookups) : 0;
+	sendto_one(sptr, ":%s %d %s :Hash %s: %u entries, %u buckets (%u used, load %u.%02u, longest chain %u)",
+	    me.name, RPL_STATSDEBUG, sptr->name, name, t->count, size,
+	    used, load / 100, load % 100, longest);
+	sendto_one(sptr, ":%s %d %s :Hash %s: %ld lookups, %u.%02u probes avg, %ld resizes%s",
+	    me.name, RPL_STATSDEBUG, sptr->name, name, (long)t->lookups,
+	    probes / 100, probes % 100, (long)t->resizes,
+	    t->size[1] ? " (resizing now)" : "");
+}
+
 int stats_mem(aClient *sptr, char *para)
 {
-	extern MODVAR int flinks;
-	extern MODVAR Link *freelink;
 	extern MODVAR MemoryInfo StatsZ;
 
 	aClient *acptr;
 	Ban *ban;
 	Link *link;
 	aChannel *chptr;
+	aSlabPool *pool;
 
 	int  lc = 0,		/* local clients */
 	     ch = 0,		/* channels */
@@ -842,7 +868,6 @@ int stats_mem(aClient *sptr, char *para)
 	     chi = 0,		/* channel invites */
 	     chb = 0,		/* channel bans */
 	     wwu = 0,		/* whowas users */
-	     fl = 0,		/* free links */
 	     cl = 0,		/* classes */
 	     co = 0;		/* conf lines */
 
@@ -862,8 +887,10 @@ int stats_mem(aClient *sptr, char *para)
 	     wwm = 0,		/* whowas array memory used */
 	     com = 0,		/* memory used by conf lines */
 	     wlhm = 0,		/* watchlist memory used */
+	     hm = 0,		/* memory used by hash tables */
 	     db = 0,		/* memory used by dbufs */
 	     rm = 0,		/* res memory used */
+	     sfm = 0,		/* free slab memory */
 	     totcl = 0, totch = 0, totww = 0, tot = 0;
 
 	if (!IsAnOper(sptr))
@@ -905,7 +932,7 @@ int stats_mem(aClient *sptr, char *para)
 			}
 		}
 	}
-	lcm = lc * CLIENT_LOCAL_SIZE;
+	lcm = lc * (CLIENT_LOCAL_SIZE + sizeof(aConn));
 	rcm = rc * CLIENT_REMOTE_SIZE;
 
 	for (chptr = channel; chptr; chptr = chptr->nextch)
@@ -940,6 +967,9 @@ int stats_mem(aClient *sptr, char *para)
 
 	sendto_one(sptr, ":%s %d %s :Client Local %d(%ld) Remote %d(%ld)",
 	    me.name, RPL_STATSDEBUG, sptr->name, lc, lcm, rc, rcm);
+	sendto_one(sptr, ":%s %d %s :Client sizes: local %ld (+%ld rarely used) remote %ld",
+	    me.name, RPL_STATSDEBUG, sptr->name, (long)CLIENT_LOCAL_SIZE,
+	    (long)sizeof(aConn), (long)CLIENT_REMOTE_SIZE);
 	sendto_one(sptr, ":%s %d %s :Users %d(%ld) Invites %d(%ld)",
 	    me.name, RPL_STATSDEBUG, sptr->name, us, (long)(us * sizeof(anUser)),
 	    usi, (long)(usi * sizeof(Link)));
@@ -977,31 +1007,43 @@ int stats_mem(aClient *sptr, char *para)
 
 	totww = wwu * sizeof(anUser) + wwam + wwm;
 
+	hm = sizeof(void *) * (clientHash.size[0] + clientHash.size[1] +
+	    channelHash.size[0] + channelHash.size[1] +
+	    watchHash.size[0] + watchHash.size[1]);
 	sendto_one(sptr,
-	    ":%s %d %s :Hash: client %d(%ld) chan %d(%ld) watch %d(%ld)", me.name,
-	    RPL_STATSDEBUG, sptr->name, U_MAX,
-	    (long)(sizeof(aHashEntry) * U_MAX), CH_MAX,
-	    (long)(sizeof(aHashEntry) * CH_MAX), WATCHHASHSIZE,
-	    (long)(sizeof(aWatch *) * WATCHHASHSIZE));
-	db = dbufblocks * sizeof(dbufbuf);
-	sendto_one(sptr, ":%s %d %s :Dbuf blocks %d(%ld)",
-	    me.name, RPL_STATSDEBUG, sptr->name, dbufblocks, db);
-
-	for (link = freelink; link; link = link->next)
-		fl++;
-	sendto_one(sptr, ":%s %d %s :Link blocks free %d(%ld) total %d(%ld)",
-	    me.name, RPL_STATSDEBUG, sptr->name,
-	    fl, (long)(fl * sizeof(Link)),
-	    flinks, (long)(flinks * sizeof(Link)));
+	    ":%s %d %s :Hash: client %u(%ld) chan %u(%ld) watch %u(%ld)", me.name,
+	    RPL_STATSDEBUG, sptr->name, clientHash.size[0] + clientHash.size[1],
+	    (long)(sizeof(void *) * (clientHash.size[0] + clientHash.size[1])),
+	    channelHash.size[0] + channelHash.size[1],
+	    (long)(sizeof(void *) * (channelHash.size[0] + channelHash.size[1])),
+	    watchHash.size[0] + watchHash.size[1],
+	    (long)(sizeof(void *) * (watchHash.size[0] + watchHash.size[1])));
+	stats_hash(sptr, "client", &clientHash);
+	stats_hash(sptr, "chan", &channelHash);
+	stats_hash(sptr, "watch", &watchHash);
+	db = dbufmem;
+	sendto_one(sptr, ":%s %d %s :Dbuf blocks %d shared %d(%ld) buffer-pool %ld",
+	    me.name, RPL_STATSDEBUG, sptr->name, dbufalloc, dbufblocks, db,
+	    BUFFER_POOL);
+
+	for (pool = slabpools; pool; pool = pool->next)
+	{
+		unsigned long nfree = pool->pages * pool->perpage - pool->live;
+
+		sendto_one(sptr, ":%s %d %s :Slab %s: live %ld(%ld) free %ld(%ld) pages %ld(%ld)",
+		    me.name, RPL_STATSDEBUG, sptr->name, pool->name,
+		    (long)pool->live, (long)(pool->live * pool->size),
+		    (long)nfree, (long)(nfree * pool->size),
+		    (long)pool->pages, (long)(pool->pages * SLAB_PAGESIZE));
+		sfm += pool->pages * SLAB_PAGESIZE - pool->live * pool->size;
+	}
 
 /*	rm = cres_mem(sptr,sptr->name); */
 	rm = 0; /* syzop: todo ?????????? */
 
 	tot = totww + totch + totcl + com + cl * sizeof(aClass) + db + rm;
-	tot += fl * sizeof(Link);
-	tot += sizeof(aHashEntry) * U_MAX;
-	tot += sizeof(aHashEntry) * CH_MAX;
-	tot += sizeof(aWatch *) * WATCHHASHSIZE;
+	tot += sfm;
+	tot += hm;
 
 	sendto_one(sptr, ":%s %d %s :Total: ww %ld ch %ld cl %ld co %ld db %ld",
 	    me.name, RPL_STATSDEBUG, sptr->name, totww, totch, totcl, com, db);
@@ -1398,6 +1440,8 @@ int stats_set(aClient *sptr, char *para)
 			sptr->name, SPAMFILTER_EXCEPT);
 	sendto_one(sptr, ":%s %i %s :check-target-nick-bans: %s", me.name, RPL_TEXT,
 		sptr->name, CHECK_TARGET_NICK_BANS ? "yes" : "no");
+	sendto_one(sptr, ":%s %i %s :buffer-pool: %ldKB", me.name, RPL_TEXT,
+		sptr->name, BUFFER_POOL / 1024);
 	sendto_one(sptr, ":%s %i %s :hosts::global: %s", me.name, RPL_TEXT,
 	    sptr->name, oper_host);
 	sendto_one(sptr, ":%s %i %s :hosts::admin: %s", me.name, RPL_TEXT,
@@ -1593,9 +1637,9 @@ int stats_linkinfoint(aClient *sptr, char *para, int all)
 				(get_client_name(acptr, FALSE)),
 				get_cptr_status(acptr),
 				(int)DBufLength(&acptr->sendQ),
-				(int)acptr->sendM, (int)acptr->sendK,
-				(int)acptr->receiveM,
-				(int)acptr->receiveK,
+				(int)acptr->sendM, (int)acptr->conn->sendK,
+				(int)acptr->conn->receiveM,
+				(int)acptr->conn->receiveK,
 			 	TStime() - acptr->firsttime,
 #ifndef DEBUGMODE
 				(acptr->user && MyConnect(acptr)) ?
@@ -1618,9 +1662,9 @@ int stats_linkinfoint(aClient *sptr, char *para, int all)
 				get_client_name(acptr, FALSE),
 				get_cptr_status(acptr),
 				(int)DBufLength(&acptr->sendQ),
-				(int)acptr->sendM, (int)acptr->sendK,
-				(int)acptr->receiveM,
-				(int)acptr->receiveK,
+				(int)acptr->sendM, (int)acptr->conn->sendK,
+				(int)acptr->conn->receiveM,
+				(int)acptr->conn->receiveK,
 				TStime() - acptr->firsttime,
 #ifndef DEBUGMODE
 				(acptr->user && MyConnect(acptr)) ?
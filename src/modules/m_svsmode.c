@@ -237,8 +237,7 @@ int channel_svsmode(aClient *cptr, aClient *sptr, int parc, char *parv[])
 				for (cm = chptr->members; cm; cm = cm->next) {
 					if (cm->flags & CHFL_CHANOWNER) {
 						Membership *mb;
-						mb = find_membership_link(cm->cptr->user->channel,
-							chptr);
+						mb = find_membership(cm->cptr, chptr);
 						add_send_mode_param(chptr, sptr, '-', 'q', cm->cptr->name);
 						cm->flags &= ~CHFL_CHANOWNER;
 						if (mb)
@@ -252,8 +251,7 @@ int channel_svsmode(aClient *cptr, aClient *sptr, int parc, char *parv[])
 				for (cm = chptr->members; cm; cm = cm->next) {
 					if (cm->flags & CHFL_CHANPROT) {
 						Membership *mb;
-						mb = find_membership_link(cm->cptr->user->channel,
-							chptr);
+						mb = find_membership(cm->cptr, chptr);
 						add_send_mode_param(chptr, sptr, '-', 'a', cm->cptr->name);
 						cm->flags &= ~CHFL_CHANPROT;
 						if (mb)
@@ -267,8 +265,7 @@ int channel_svsmode(aClient *cptr, aClient *sptr, int parc, char *parv[])
 				for (cm = chptr->members; cm; cm = cm->next) {
 					if (cm->flags & CHFL_CHANOP) {
 						Membership *mb;
-						mb = find_membership_link(cm->cptr->user->channel,
-							chptr);
+						mb = find_membership(cm->cptr, chptr);
 						add_send_mode_param(chptr, sptr, '-', 'o', cm->cptr->name);
 						cm->flags &= ~CHFL_CHANOP;
 						if (mb)
@@ -282,8 +279,7 @@ int channel_svsmode(aClient *cptr, aClient *sptr, int parc, char *parv[])
 				for (cm = chptr->members; cm; cm = cm->next) {
 					if (cm->flags & CHFL_HALFOP) {
 						Membership *mb;
-						mb = find_membership_link(cm->cptr->user->channel,
-							chptr);
+						mb = find_membership(cm->cptr, chptr);
 						add_send_mode_param(chptr, sptr, '-', 'h', cm->cptr->name);
 						cm->flags &= ~CHFL_HALFOP;
 						if (mb)
@@ -297,8 +293,7 @@ int channel_svsmode(aClient *cptr, aClient *sptr, int parc, char *parv[])
 				for (cm = chptr->members; cm; cm = cm->next) {
 					if (cm->flags & CHFL_VOICE) {
 						Membership *mb;
-						mb = find_membership_link(cm->cptr->user->channel,
-							chptr);
+						mb = find_membership(cm->cptr, chptr);
 						add_send_mode_param(chptr, sptr, '-', 'v', cm->cptr->name);
 						cm->flags &= ~CHFL_VOICE;
 						if (mb)
@@ -587,6 +582,7 @@ char *xtok = show_change ? TOK_SVS2MODE : TOK_SVSMODE;
 	   set ones */
 	if (setflags != acptr->umodes)
 		RunHook3(HOOKTYPE_UMODE_CHANGE, sptr, setflags, acptr->umodes);
+	UserIdentityChanged(acptr); /* -x/-t or a new virthost */
 
 	if (show_change)
 	{
@@ -131,6 +131,7 @@ aClient *ocptr; /* Other client */
 
 	strlcpy(acptr->name, parv[2], sizeof acptr->name);
 	add_to_client_hash_table(parv[2], acptr);
+	UserIdentityChanged(acptr);
 	hash_check_watch(acptr, RPL_LOGON);
 
 	return 0;
@@ -48,24 +48,6 @@
 #ifdef _WIN32
 #include "version.h"
 #endif
-/* This is all for getrusage and friends.. taken from src/s_debug.c so should be safe. */
-#ifdef HPUX
-# include <sys/syscall.h>
-# define getrusage(a,b) syscall(SYS_GETRUSAGE, a, b)
-#endif
-#ifdef GETRUSAGE_2
-# ifdef _SOLARIS
-#  include <sys/time.h>
-#  ifdef RUSAGEH
-#   include <sys/rusage.h>
-#  endif
-# endif
-# include <sys/resource.h>
-#else
-#  ifdef TIMES_2
-#   include <sys/times.h>
-#  endif
-#endif
 
 DLLFUNC int m_gline(aClient *cptr, aClient *sptr, int parc, char *parv[]);
 DLLFUNC int m_shun(aClient *cptr, aClient *sptr, int parc, char *parv[]);
@@ -97,6 +79,8 @@ int _place_host_ban(aClient *sptr, int action, char *reason, long duration);
 int _dospamfilter(aClient *sptr, char *str_in, int type, char *target, int flags, aTKline **rettk);
 int _dospamfilter_viruschan(aClient *sptr, aTKline *tk, int type);
 void _spamfilter_build_user_string(char *buf, char *nick, aClient *acptr);
+static void tkl_index_rebuild(void);
+static void tkl_index_clear(void);
 
 extern MODVAR char zlinebuf[BUFSIZE];
 extern MODVAR aTKline *tklines[TKLISTLEN];
@@ -170,6 +154,7 @@ DLLFUNC int MOD_INIT(m_tkl)(ModuleInfo *modinfo)
 	add_Command(MSG_SPAMFILTER, TOK_NONE, m_spamfilter, 6);
 	add_Command(MSG_TKL, TOK_TKL, _m_tkl, MAXPARA);
 	MARK_AS_OFFICIAL_MODULE(modinfo);
+	tkl_index_rebuild();
 	return MOD_SUCCESS;
 }
 
@@ -196,6 +181,7 @@ DLLFUNC int MOD_UNLOAD(m_tkl)(int module_unload)
 		sendto_realops("Failed to delete commands when unloading %s",
 				MOD_HEADER(m_tkl).name);
 	}
+	tkl_index_clear();
 	return MOD_SUCCESS;
 }
 
@@ -928,6 +914,315 @@ char _tkl_typetochar(int type)
 	return 0;
 }
 
+/*
+ * IP index for K/G/Z-lines and shuns.
+ * Entries with an IP or CIDR hostmask (ptr.netmask) are kept in a radix
+ * tree per address family, with one node per prefix, so looking up a
+ * client only walks the bits of its address. Host masks that are a plain
+ * name or *.suffix go in tkl_hosttrie (see src/hosttrie.c). The rest
+ * (wildcard hosts) are in tkl_hostlist[], per tklines[] bucket and newest
+ * first like tklines[] itself, and still need a linear scan.
+ * The sequence number lets tkl_find_match() pick the same entry the
+ * old walk over tklines[] would have found first.
+ */
+typedef struct _tklnode TklNode;
+struct _tklnode {
+	TklNode *parent, *child[2];
+	aTKline *tkls;
+	int  bits;
+	u_char key[16];
+};
+
+#define TKL_INDEXED	(TKL_KILL|TKL_ZAP|TKL_SHUN)
+#define TKLTREE_V4	0
+#define TKLTREE_V6	1
+#define KEYBIT(k,n)	(((k)[(n) >> 3] >> (7 - ((n) & 7))) & 1)
+
+static TklNode *tkl_iptree[2];
+static aHostTrie tkl_hosttrie;
+static aTKline *tkl_hostlist[TKLISTLEN];
+static u_int tkl_seq = 0;
+
+/* Returns the number of leading bits 'a' and 'b' have in common, at most 'max' */
+static int tkl_keycmp(u_char *a, u_char *b, int max)
+{
+	int  n;
+	u_char x;
+
+	for (n = 0; n < max; n += 8)
+	{
+		if ((x = a[n >> 3] ^ b[n >> 3]))
+		{
+			for (; !(x & 0x80); x <<= 1)
+				n++;
+			return MIN(n, max);
+		}
+	}
+	return max;
+}
+
+/* Returns the tree an IP/CIDR mask belongs in, or NULL if it can't be indexed */
+static TklNode **tkl_netmask_key(struct irc_netmask *m, u_char **key, int *bits)
+{
+	*bits = m->bits;
+	if ((m->type == HM_IPV4) && (m->bits >= 0) && (m->bits <= 32))
+	{
+#ifndef INET6
+		*key = (u_char *)&m->mask.s_addr;
+#else
+		*key = &m->mask.s6_addr[12];
+#endif
+		return &tkl_iptree[TKLTREE_V4];
+	}
+#ifdef INET6
+	if ((m->type == HM_IPV6) && (m->bits >= 0) && (m->bits <= 128))
+	{
+		*key = m->mask.s6_addr;
+		return &tkl_iptree[TKLTREE_V6];
+	}
+#endif
+	return NULL;
+}
+
+static TklNode *tkl_node_new(TklNode *parent, u_char *key, int bits)
+{
+	TklNode *n = (TklNode *)MyMallocEx(sizeof(TklNode));
+
+	n->parent = parent;
+	n->bits = bits;
+	bcopy(key, n->key, (bits + 7) / 8);
+	return n;
+}
+
+/* Where the pointer to 'node' is stored */
+static TklNode **tkl_node_link(TklNode *node)
+{
+	if (node->parent)
+		return &node->parent->child[node->parent->child[1] == node];
+	return (tkl_iptree[TKLTREE_V4] == node) ? &tkl_iptree[TKLTREE_V4] : &tkl_iptree[TKLTREE_V6];
+}
+
+static void tkl_index_add(aTKline *tk)
+{
+	TklNode **link, *node, *parent = NULL, *n, *glue;
+	u_char *key;
+	int  bits, diff, index;
+
+	if (!(tk->type & TKL_INDEXED))
+		return;
+	tk->seq = ++tkl_seq;
+	tk->iprev = NULL;
+	tk->node = NULL;
+	tk->hostidx.node = NULL;
+	if (!tk->ptr.netmask && hosttrie_add(&tkl_hosttrie, &tk->hostidx, tk->hostmask, tk))
+		return;
+	if (!tk->ptr.netmask || !(link = tkl_netmask_key(tk->ptr.netmask, &key, &bits)))
+	{
+		index = tkl_hash(tkl_typetochar(tk->type));
+		if ((tk->inext = tkl_hostlist[index]))
+			tk->inext->iprev = tk;
+		tkl_hostlist[index] = tk;
+		return;
+	}
+
+	/* Walk down as long as the nodes are a prefix of the new one */
+	while ((node = *link) && (node->bits <= bits) &&
+	    (tkl_keycmp(node->key, key, node->bits) == node->bits))
+	{
+		if (node->bits == bits)
+			goto found;
+		parent = node;
+		link = &node->child[KEYBIT(key, node->bits)];
+	}
+	n = tkl_node_new(parent, key, bits);
+	if (node)
+	{
+		diff = tkl_keycmp(node->key, key, MIN(bits, node->bits));
+		if (diff == bits)
+		{
+			/* The new prefix covers 'node' */
+			n->child[KEYBIT(node->key, bits)] = node;
+			node->parent = n;
+		}
+		else
+		{
+			/* They split further up, put a node without entries there */
+			glue = tkl_node_new(parent, key, diff);
+			glue->child[KEYBIT(key, diff)] = n;
+			glue->child[KEYBIT(node->key, diff)] = node;
+			n->parent = node->parent = glue;
+			n = glue;
+		}
+	}
+	*link = n;
+	node = n->bits == bits ? n : n->child[KEYBIT(key, n->bits)];
+found:
+	if ((tk->inext = node->tkls))
+		tk->inext->iprev = tk;
+	node->tkls = tk;
+	tk->node = node;
+}
+
+static void tkl_index_del(aTKline *tk)
+{
+	TklNode *node = tk->node, *child, *parent;
+
+	if (!(tk->type & TKL_INDEXED))
+		return;
+	if (tk->hostidx.node)
+	{
+		hosttrie_del(&tkl_hosttrie, &tk->hostidx);
+		return;
+	}
+	if (tk->iprev)
+		tk->iprev->inext = tk->inext;
+	else if (node)
+		node->tkls = tk->inext;
+	else
+		tkl_hostlist[tkl_hash(tkl_typetochar(tk->type))] = tk->inext;
+	if (tk->inext)
+		tk->inext->iprev = tk->iprev;
+
+	/* Drop the nodes that are no longer needed on the way up */
+	while (node && !node->tkls && !(node->child[0] && node->child[1]))
+	{
+		child = node->child[0] ? node->child[0] : node->child[1];
+		parent = node->parent;
+		*tkl_node_link(node) = child;
+		MyFree(node);
+		if (child)
+		{
+			child->parent = parent;
+			break;
+		}
+		node = parent;
+	}
+}
+
+static void tkl_index_free(TklNode *node)
+{
+	if (!node)
+		return;
+	tkl_index_free(node->child[0]);
+	tkl_index_free(node->child[1]);
+	MyFree(node);
+}
+
+static void tkl_index_clear(void)
+{
+	tkl_index_free(tkl_iptree[TKLTREE_V4]);
+	tkl_index_free(tkl_iptree[TKLTREE_V6]);
+	tkl_iptree[TKLTREE_V4] = tkl_iptree[TKLTREE_V6] = NULL;
+	hosttrie_free(&tkl_hosttrie);
+	memset(tkl_hostlist, 0, sizeof(tkl_hostlist));
+}
+
+/* The index lives in the module, so rebuild it from tklines[] on (re)load */
+static void tkl_index_rebuild(void)
+{
+	aTKline *tk;
+	int  index;
+
+	tkl_index_clear();
+	for (index = 0; index < TKLISTLEN; index++)
+	{
+		/* oldest first, so the sequence numbers come out right */
+		for (tk = tklines[index]; tk && tk->next; tk = tk->next)
+			;
+		for (; tk; tk = tk->prev)
+			tkl_index_add(tk);
+	}
+}
+
+struct tkl_lookup {
+	aClient *cptr;
+	int (*matchfn)(aTKline *, aClient *, char *, char *, char *);
+	char *cname, *chost, *cip;
+	aTKline *best;
+	int  bestidx;
+};
+
+/* Remembers 'lp' if it matches and comes before what we have so far */
+static int tkl_find_consider(void *item, void *arg)
+{
+	aTKline *lp = (aTKline *)item;
+	struct tkl_lookup *l = (struct tkl_lookup *)arg;
+	int  index;
+
+	if (!l->matchfn(lp, l->cptr, l->cname, l->chost, l->cip))
+		return 0;
+	index = tkl_hash(tkl_typetochar(lp->type));
+	if ((index < l->bestidx) || ((index == l->bestidx) && (lp->seq > l->best->seq)))
+	{
+		l->best = lp;
+		l->bestidx = index;
+	}
+	return 0;
+}
+
+static void tkl_find_tree(TklNode *node, u_char *key, int maxbits, struct tkl_lookup *l)
+{
+	aTKline *lp;
+
+	for (; node && (tkl_keycmp(node->key, key, node->bits) == node->bits);
+	    node = node->child[KEYBIT(key, node->bits)])
+	{
+		for (lp = node->tkls; lp; lp = lp->inext)
+			tkl_find_consider(lp, l);
+		if (node->bits == maxbits)
+			break;
+	}
+}
+
+/*
+ * Finds the first entry in tklines[first..last] that matchfn() accepts,
+ * in the same order as walking tklines[] would: lowest bucket first,
+ * newest first within a bucket. matchfn() should only accept the types
+ * that hash into those buckets.
+ */
+static aTKline *tkl_find_match(aClient *cptr, int first, int last,
+    int (*matchfn)(aTKline *, aClient *, char *, char *, char *),
+    char *cname, char *chost, char *cip)
+{
+	struct tkl_lookup l;
+	aTKline *lp;
+	int  index;
+#ifdef INET6
+	u_char *cp = (u_char *)cptr->ip.s6_addr;
+#endif
+
+	l.cptr = cptr;
+	l.matchfn = matchfn;
+	l.cname = cname;
+	l.chost = chost;
+	l.cip = cip;
+	l.best = NULL;
+	l.bestidx = TKLISTLEN;
+#ifdef INET6
+	tkl_find_tree(tkl_iptree[TKLTREE_V6], cp, 128, &l);
+	if (!cp[0] && !cp[1] && !cp[2] && !cp[3] && !cp[4] && !cp[5] && !cp[6] && !cp[7] &&
+	    !cp[8] && !cp[9] && (cp[10] == 0xff) && (cp[11] == 0xff))
+		tkl_find_tree(tkl_iptree[TKLTREE_V4], cp + 12, 32, &l);
+#else
+	tkl_find_tree(tkl_iptree[TKLTREE_V4], (u_char *)&cptr->ip.s_addr, 32, &l);
+#endif
+	if (chost)
+		hosttrie_find(&tkl_hosttrie, chost, tkl_find_consider, &l);
+	if (cip && (!chost || strcmp(chost, cip)))
+		hosttrie_find(&tkl_hosttrie, cip, tkl_find_consider, &l);
+
+	/* The rest only as far as it could still come before 'best' */
+	for (index = first; (index <= last) && (index <= l.bestidx); index++)
+		for (lp = tkl_hostlist[index]; lp; lp = lp->inext)
+		{
+			if (l.best && (index == l.bestidx) && (lp->seq < l.best->seq))
+				break;
+			if (matchfn(lp, cptr, cname, chost, cip))
+				return lp;
+		}
+	return l.best;
+}
+
 /*
  *  type =  TKL_*
  *	usermask@hostmask
@@ -1006,6 +1301,9 @@ aTKline *_tkl_add_line(int type, char *usermask, char *hostmask, char *reason, c
 	}
 	index = tkl_hash(tkl_typetochar(type));
 	AddListItem(nl, tklines[index]);
+	tkl_index_add(nl);
+	if (type & TKL_SPAMF)
+		spamfilter_index_add(nl);
 
 	return nl;
 }
@@ -1025,11 +1323,10 @@ aTKline *_tkl_del_line(aTKline *tkl)
 			MyFree(p->setby);
 			if (p->type & TKL_SPAMF && p->ptr.spamf)
 			{
-				regfree(&p->ptr.spamf->expr);
-				if (p->ptr.spamf->tkl_reason)
-					MyFree(p->ptr.spamf->tkl_reason);
-				MyFree(p->ptr.spamf);
+				spamfilter_index_del(p);
+				unreal_freespamfilter(p->ptr.spamf);
 			}
+			tkl_index_del(p);
 			if ((p->type & TKL_KILL || p->type & TKL_ZAP || p->type & TKL_SHUN)
 			     && p->ptr.netmask)
 				MyFree(p->ptr.netmask);
@@ -1207,6 +1504,41 @@ EVENT(_tkl_check_expire)
 
 
 
+static int tkl_match_host(aTKline *lp, aClient *cptr, char *cname, char *chost, char *cip)
+{
+	/* If it's tangy and brown, you're in CIDR town! */
+	if (lp->ptr.netmask)
+		return match_ip(cptr->ip, NULL, NULL, lp->ptr.netmask) && !match(lp->usermask, cname);
+	if (match(lp->usermask, cname))
+		return 0;
+	return !match(lp->hostmask, chost) || !match(lp->hostmask, cip);
+}
+
+/* K/G/Z-lines matching a client, see _find_tkline_match() */
+static int tkl_match_ban(aTKline *lp, aClient *cptr, char *cname, char *chost, char *cip)
+{
+	if ((lp->type & TKL_SHUN) || (lp->type & TKL_SPAMF) || (lp->type & TKL_NICK))
+		return 0;
+	return tkl_match_host(lp, cptr, cname, chost, cip);
+}
+
+/* Shuns matching a client, see _find_shun() */
+static int tkl_match_shun(aTKline *lp, aClient *cptr, char *cname, char *chost, char *cip)
+{
+	if (!(lp->type & TKL_SHUN))
+		return 0;
+	return tkl_match_host(lp, cptr, cname, chost, cip);
+}
+
+/* Z-lines matching an IP, see _find_tkline_match_zap_ex() */
+static int tkl_match_zap(aTKline *lp, aClient *cptr, char *cname, char *chost, char *cip)
+{
+	if (!(lp->type & TKL_ZAP))
+		return 0;
+	return (lp->ptr.netmask && match_ip(cptr->ip, NULL, NULL, lp->ptr.netmask)) ||
+	    !match(lp->hostmask, cip);
+}
+
 /*
 	returns <0 if client exists (banned)
 	returns 1 if it is excepted
@@ -1218,11 +1550,9 @@ int  _find_tkline_match(aClient *cptr, int xx)
 	char *chost, *cname, *cip;
 	TS   nowtime;
 	char msge[1024];
-	int	points = 0;
 	ConfigItem_except *excepts;
 	char host[NICKLEN+USERLEN+HOSTLEN+6], host2[NICKLEN+USERLEN+HOSTLEN+6];
 	int match_type = 0;
-	int index;
 	Hook *tmphook;
 
 	if (IsServer(cptr) || IsMe(cptr))
@@ -1233,41 +1563,7 @@ int  _find_tkline_match(aClient *cptr, int xx)
 	cname = cptr->user ? cptr->user->username : "unknown";
 	cip = GetIP(cptr);
 
-	points = 0;
-	for (index = 0; index < TKLISTLEN; index++)
-	{
-		for (lp = tklines[index]; lp; lp = lp->next)
-		{
-			if ((lp->type & TKL_SHUN) || (lp->type & TKL_SPAMF) || (lp->type & TKL_NICK))
-				continue;
-
-			/* If it's tangy and brown, you're in CIDR town! */
-			if (lp->ptr.netmask)
-			{
-				if (match_ip(cptr->ip, NULL, NULL, lp->ptr.netmask) && 
-				    !match(lp->usermask, cname))
-				{
-					points = 1;
-					break;
-				}
-				continue;
-			}
-			if (!match(lp->usermask, cname) && !match(lp->hostmask, chost))
-			{
-				points = 1;
-				break;
-			}
-			if (!match(lp->usermask, cname) && !match(lp->hostmask, cip))
-			{
-				points = 1;
-				break;
-			}
-		}
-		if (points)
-			break;
-	}
-
-	if (points != 1)
+	if (!(lp = tkl_find_match(cptr, 0, TKLISTLEN - 1, tkl_match_ban, cname, chost, cip)))
 		return 1;
 	strcpy(host, make_user_host(cname, chost));
 	strcpy(host2, make_user_host(cname, cip));
@@ -1344,7 +1640,6 @@ int  _find_shun(aClient *cptr)
 	aTKline *lp;
 	char *chost, *cname, *cip;
 	TS   nowtime;
-	int	points = 0;
 	ConfigItem_except *excepts;
 	char host[NICKLEN+USERLEN+HOSTLEN+6], host2[NICKLEN+USERLEN+HOSTLEN+6];
 	int match_type = 0;
@@ -1361,40 +1656,7 @@ int  _find_shun(aClient *cptr)
 	cname = cptr->user ? cptr->user->username : "unknown";
 	cip = GetIP(cptr);
 
-	for (lp = tklines[tkl_hash('s')]; lp; lp = lp->next)
-	{
-		points = 0;
-		
-		if (!(lp->type & TKL_SHUN))
-			continue;
-
-		/* CIDR */
-		if (lp->ptr.netmask)
-		{
-			if (match_ip(cptr->ip, NULL, NULL, lp->ptr.netmask) && 
-			    !match(lp->usermask, cname))
-			{
-				points = 1;
-				break;
-			}
-			continue;
-		}
-
-		if (!match(lp->usermask, cname) && !match(lp->hostmask, chost))
-		{
-			points = 1;
-			break;
-		}
-		if (!match(lp->usermask, cname) && !match(lp->hostmask, cip))
-		{
-			points = 1;
-			break;
-		}
-		else
-			points = 0;
-	}
-
-	if (points != 1)
+	if (!(lp = tkl_find_match(cptr, tkl_hash('s'), tkl_hash('s'), tkl_match_shun, cname, chost, cip)))
 		return 1;
 	strcpy(host, make_user_host(cname, chost));
 	strcpy(host2, make_user_host(cname, cip));
@@ -1588,51 +1850,42 @@ int  _find_tkline_match_zap_ex(aClient *cptr, aTKline **rettk)
 	nowtime = TStime();
 	cip = GetIP(cptr);
 
-	for (lp = tklines[tkl_hash('z')]; lp; lp = lp->next)
-	{
-		if (lp->type & TKL_ZAP)
-		{
-			if ((lp->ptr.netmask && match_ip(cptr->ip, NULL, NULL, lp->ptr.netmask))
-			    || !match(lp->hostmask, cip))
-			{
+	if (!(lp = tkl_find_match(cptr, tkl_hash('z'), tkl_hash('z'), tkl_match_zap, NULL, NULL, cip)))
+		return -1;
 
-				for (excepts = conf_except; excepts; excepts = (ConfigItem_except *)excepts->next) {
-					/* This used to be:
-					 * if (excepts->flag.type != CONF_EXCEPT_TKL || excepts->type != lp->type)
-					 * It now checks for 'except ban', hope this is what most people want,
-					 * it is at least the same as in find_tkline_match, which is how it currently
-					 * is when a user is connected. -- Syzop/20081221
-					 */
-					if (excepts->flag.type != CONF_EXCEPT_BAN)
-						continue;
-					if (excepts->netmask)
-					{
-						if (match_ip(cptr->ip, NULL, NULL, excepts->netmask))
-							return -1;		
-					} else if (!match(excepts->mask, cip))
-						return -1;		
-				}
-				for (tmphook = Hooks[HOOKTYPE_TKL_EXCEPT]; tmphook; tmphook = tmphook->next)
-					if (tmphook->func.intfunc(cptr, lp) > 0)
-						return -1;
+	for (excepts = conf_except; excepts; excepts = (ConfigItem_except *)excepts->next) {
+		/* This used to be:
+		 * if (excepts->flag.type != CONF_EXCEPT_TKL || excepts->type != lp->type)
+		 * It now checks for 'except ban', hope this is what most people want,
+		 * it is at least the same as in find_tkline_match, which is how it currently
+		 * is when a user is connected. -- Syzop/20081221
+		 */
+		if (excepts->flag.type != CONF_EXCEPT_BAN)
+			continue;
+		if (excepts->netmask)
+		{
+			if (match_ip(cptr->ip, NULL, NULL, excepts->netmask))
+				return -1;		
+		} else if (!match(excepts->mask, cip))
+			return -1;		
+	}
+	for (tmphook = Hooks[HOOKTYPE_TKL_EXCEPT]; tmphook; tmphook = tmphook->next)
+		if (tmphook->func.intfunc(cptr, lp) > 0)
+			return -1;
 
-				ircstp->is_ref++;
-				ircsprintf(msge,
-				    "ERROR :Closing Link: [%s] Z:Lined (%s)\r\n",
+	ircstp->is_ref++;
+	ircsprintf(msge,
+	    "ERROR :Closing Link: [%s] Z:Lined (%s)\r\n",
 #ifndef INET6
-				    inetntoa((char *)&cptr->ip), lp->reason);
+	    inetntoa((char *)&cptr->ip), lp->reason);
 #else
-				    inet_ntop(AF_INET6, (char *)&cptr->ip,
-				    mydummy, MYDUMMY_SIZE), lp->reason);
+	    inet_ntop(AF_INET6, (char *)&cptr->ip,
+	    mydummy, MYDUMMY_SIZE), lp->reason);
 #endif
-				strlcpy(zlinebuf, msge, sizeof zlinebuf);
-				if (rettk)
-					*rettk = lp;
-				return (1);
-			}
-		}
-	}
-	return -1;
+	strlcpy(zlinebuf, msge, sizeof zlinebuf);
+	if (rettk)
+		*rettk = lp;
+	return (1);
 }
 
 int  _find_tkline_match_zap(aClient *cptr)
@@ -1705,6 +1958,22 @@ static void parse_tkl_para(char *para, TKLFlag *flag)
 	}
 }	
 
+/* Sends the hit and latency counters of a spamfilter, after its 229 line */
+static void tkl_stats_spamfilter(aClient *cptr, Spamfilter *sf)
+{
+#ifdef SPAMFILTER_DETECTSLOW
+	sendto_one(cptr, ":%s %d %s :- %ld evaluations, %ld hits, avg %ld ns, max %ld ns, "
+		"latency <1us:%ld <4us:%ld <16us:%ld <64us:%ld <256us:%ld <1ms:%ld <4ms:%ld more:%ld",
+		me.name, RPL_STATSDEBUG, cptr->name, sf->evals, sf->hits,
+		sf->evals ? (long)(sf->total_ns / sf->evals) : 0L, sf->max_ns,
+		sf->latency[0], sf->latency[1], sf->latency[2], sf->latency[3],
+		sf->latency[4], sf->latency[5], sf->latency[6], sf->latency[7]);
+#else
+	sendto_one(cptr, ":%s %d %s :- %ld evaluations, %ld hits",
+		me.name, RPL_STATSDEBUG, cptr->name, sf->evals, sf->hits);
+#endif
+}
+
 void _tkl_stats(aClient *cptr, int type, char *para)
 {
 	aTKline *tk;
@@ -1816,6 +2085,7 @@ void _tkl_stats(aClient *cptr, int type, char *para)
 				tk->ptr.spamf->tkl_duration, tk->ptr.spamf->tkl_reason,
 				tk->setby,
 				tk->reason);
+			tkl_stats_spamfilter(cptr, tk->ptr.spamf);
 		}
 		if (tk->type & TKL_NICK)
 			sendto_one(cptr, rpl_str(RPL_STATSQLINE), me.name,
@@ -2160,7 +2430,7 @@ int _m_tkl(aClient *cptr, aClient *sptr, int parc, char *parv[])
 			}
 		  }
 		  loop.do_bancheck = 1;
-		  /* Makes check_pings be run ^^  */
+		  /* Makes the ban check be run ^^  */
 		  if (type & TKL_GLOBAL)
 		  {
 		  	if ((parc == 11) && (type & TKL_SPAMF))
@@ -2477,6 +2747,32 @@ int ret;
 	return 0;
 }
 
+#ifdef SPAMFILTER_DETECTSLOW
+/** Returns the latency histogram bucket for a run that took 'ns' nanoseconds:
+ * 0 is below 1us, every next bucket is 4 times as wide, the last one
+ * takes everything from 4ms on.
+ */
+static int spamfilter_latency_bucket(long long ns)
+{
+	int i;
+
+	ns >>= 10; /* ~usec */
+	for (i = 0; ns && (i < SPAMF_LATENCY_BUCKETS - 1); i++)
+		ns >>= 2;
+	return i;
+}
+
+static void spamfilter_account(Spamfilter *sf, long long ns)
+{
+	if (ns < 0)
+		ns = 0;
+	sf->total_ns += ns;
+	if (ns > sf->max_ns)
+		sf->max_ns = (long)ns;
+	sf->latency[spamfilter_latency_bucket(ns)]++;
+}
+#endif
+
 /** dospamfilter: executes the spamfilter onto the string.
  * @param str		The text (eg msg text, notice text, part text, quit text, etc
  * @param type		The spamfilter type (SPAMF_*)
@@ -2492,12 +2788,13 @@ int ret;
  
 int _dospamfilter(aClient *sptr, char *str_in, int type, char *target, int flags, aTKline **rettk)
 {
-aTKline *tk;
+aTKline *tk, **list;
 char *str;
-int ret;
+int ret, i, num;
+unsigned int prefiltered = 0;
 #ifdef SPAMFILTER_DETECTSLOW
-struct rusage rnow, rprev;
-long ms_past;
+long long ns, cpu_ns = 0;
+long ms_past, ms_min = 0;
 #endif
 	if (rettk)
 		*rettk = NULL; /* initialize to NULL */
@@ -2513,26 +2810,51 @@ long ms_past;
 	if (!sptr->user || IsAnOper(sptr) || IsULine(sptr))
 		return 0;
 
-	for (tk = tklines[tkl_hash('F')]; tk; tk = tk->next)
-	{
-		if (!(tk->subtype & type))
-			continue;
-		if ((flags & SPAMFLAG_NOWARN) && (tk->ptr.spamf->action == BAN_ACT_WARN))
-			continue;
 #ifdef SPAMFILTER_DETECTSLOW
-		memset(&rnow, 0, sizeof(rnow));
-		memset(&rprev, 0, sizeof(rnow));
+	/* The lowest of the slowdetect limits that is on (0 if none is) */
+	if (SPAMFILTER_DETECTSLOW_WARN > 0)
+		ms_min = SPAMFILTER_DETECTSLOW_WARN;
+	if ((SPAMFILTER_DETECTSLOW_FATAL > 0) && (!ms_min || (SPAMFILTER_DETECTSLOW_FATAL < ms_min)))
+		ms_min = SPAMFILTER_DETECTSLOW_FATAL;
+#endif
 
-		getrusage(RUSAGE_SELF, &rprev);
+	/* Only the filters for this target type (and action, see SPAMFLAG_NOWARN) */
+	list = spamfilter_getlist(type, flags, &num);
+	for (i = 0; i < num; i++)
+	{
+		tk = list[i];
+		/* Only run the regex if the text has what it can't match without */
+		if (tk->ptr.spamf->literals)
+		{
+			if (!prefiltered)
+				prefiltered = spamfilter_prefilter(str, type);
+			if (tk->ptr.spamf->hit != prefiltered)
+				continue;
+		}
+#ifdef SPAMFILTER_DETECTSLOW
+		if (ms_min)
+			cpu_ns = get_cputime_ns();
+		ns = get_monotime_ns();
 #endif
 
 		ret = regexec(&tk->ptr.spamf->expr, str, 0, NULL, 0);
+		tk->ptr.spamf->evals++;
+		if (!ret)
+			tk->ptr.spamf->hits++;
 
 #ifdef SPAMFILTER_DETECTSLOW
-		getrusage(RUSAGE_SELF, &rnow);
-		
-		ms_past = ((rnow.ru_utime.tv_sec - rprev.ru_utime.tv_sec) * 1000) +
-		          ((rnow.ru_utime.tv_usec - rprev.ru_utime.tv_usec) / 1000);
+		ns = get_monotime_ns() - ns;
+		spamfilter_account(tk->ptr.spamf, ns);
+		/* The statistics are in wall clock time, but the limits are
+		 * about the CPU time the regex used: time spent not running
+		 * (an overloaded host, a VM stall) must not get a spamfilter
+		 * removed. That can't be more than the wall clock time, so
+		 * only look at it if that reached a limit.
+		 */
+		if (ms_min && (ns / 1000000 > ms_min))
+			ms_past = (long)((get_cputime_ns() - cpu_ns) / 1000000);
+		else
+			ms_past = 0;
 
 		if ((SPAMFILTER_DETECTSLOW_FATAL > 0) && (ms_past > SPAMFILTER_DETECTSLOW_FATAL))
 		{
@@ -60,7 +60,7 @@ ModuleHeader MOD_HEADER(m_topic)
 
 DLLFUNC int MOD_INIT(m_topic)(ModuleInfo *modinfo)
 {
-	add_Command(MSG_TOPIC, TOK_TOPIC, m_topic, 4);
+	add_CommandX(MSG_TOPIC, TOK_TOPIC, m_topic, 4, M_USER|M_SERVER|M_BACKUPBUF);
 	MARK_AS_OFFICIAL_MODULE(modinfo);
 	return MOD_SUCCESS;
 }
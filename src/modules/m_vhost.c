@@ -184,6 +184,7 @@ int  m_vhost(aClient *cptr, aClient *sptr, int parc, char *parv[])
 		}
 		sptr->umodes |= UMODE_HIDE;
 		sptr->umodes |= UMODE_SETHOST;
+		UserIdentityChanged(sptr);
 		sendto_serv_butone_token(cptr, sptr->name,
 			MSG_SETHOST, TOK_SETHOST,
 			"%s", sptr->user->virthost);
@@ -31,6 +31,25 @@ ID_Notes("2.12 1/30/94");
 aCommand	*CommandHash[256]; /* one per letter */
 aCommand	*TokenHash[256]; 
 
+/*
+ * Command dispatch table. CommandHash[] and TokenHash[] above are just
+ * the list of what is there, lookups go through this table instead.
+ * Commands (case insensitive) and tokens (case sensitive) are all put
+ * in it by their upper-cased name, using "hash and displace": the hash
+ * picks a bucket, the displacement of that bucket picks the slot, and
+ * these are chosen so that no two names end up in the same slot. A
+ * lookup is one probe and one compare. Only names that are the same
+ * when upper-cased (tokens like "b" and "B") share a slot, through
+ * ->hnext, newest first. After a command is added or deleted the table
+ * is rebuilt by the next find_Command().
+ */
+static aCommand **cmdtab = NULL;
+static unsigned int *cmddisp = NULL;
+static unsigned int cmdtab_size = 0, cmddisp_size = 0, cmdhash_seed = 0;
+static int cmdhash_dirty = 0;
+
+#define CMDSLOT(h, d)	((((h) >> 16) + (d) * (((h) >> 8) | 1)) & (cmdtab_size - 1))
+
 /*
 ** dopacket
 **	cptr - pointer to client structure for which the buffer data
@@ -45,38 +64,44 @@ aCommand	*TokenHash[256];
 */
 void    add_CommandX(char *cmd, char *token, int (*func)(), unsigned char parameters, int flags) ;
 
-int  dopacket(aClient *cptr, char *buffer, int length)
+static void count_received(aClient *cptr, int length)
 {
-	char *ch1;
-	char *ch2;
 	aClient *acpt = cptr->listener;
-#ifdef ZIP_LINKS
-	int zipped = 0;
-	int done_unzip = 0;
-#endif
 
-	me.receiveB += length;	/* Update bytes received */
-	cptr->receiveB += length;
-	if (cptr->receiveB > 1023)
+	me.conn->receiveB += length;	/* Update bytes received */
+	cptr->conn->receiveB += length;
+	if (cptr->conn->receiveB > 1023)
 	{
-		cptr->receiveK += (cptr->receiveB >> 10);
-		cptr->receiveB &= 0x03ff;	/* 2^10 = 1024, 3ff = 1023 */
+		cptr->conn->receiveK += (cptr->conn->receiveB >> 10);
+		cptr->conn->receiveB &= 0x03ff;	/* 2^10 = 1024, 3ff = 1023 */
 	}
 	if (acpt != &me)
 	{
-		acpt->receiveB += length;
-		if (acpt->receiveB > 1023)
+		acpt->conn->receiveB += length;
+		if (acpt->conn->receiveB > 1023)
 		{
-			acpt->receiveK += (acpt->receiveB >> 10);
-			acpt->receiveB &= 0x03ff;
+			acpt->conn->receiveK += (acpt->conn->receiveB >> 10);
+			acpt->conn->receiveB &= 0x03ff;
 		}
 	}
-	if (me.receiveB > 1023)
+	if (me.conn->receiveB > 1023)
 	{
-		me.receiveK += (me.receiveB >> 10);
-		me.receiveB &= 0x03ff;
+		me.conn->receiveK += (me.conn->receiveB >> 10);
+		me.conn->receiveB &= 0x03ff;
 	}
-	ch1 = cptr->buffer + cptr->count;
+}
+
+int  dopacket(aClient *cptr, char *buffer, int length)
+{
+	char *ch1;
+	char *ch2;
+#ifdef ZIP_LINKS
+	int zipped = 0;
+	int done_unzip = 0;
+#endif
+
+	count_received(cptr, length);
+	ch1 = cptr->conn->buffer + cptr->conn->count;
 	ch2 = buffer;
 #ifdef ZIP_LINKS
 	if (IsZipStart(cptr))
@@ -112,9 +137,8 @@ int  dopacket(aClient *cptr, char *buffer, int length)
 	do
 	{
 #endif
-		while (--length >= 0)
+		while (length > 0)
 		{
-			char g = (*ch1 = *ch2++);
 			/*
 			 * Yuck.  Stuck.  To make sure we stay backward compatible,
 			 * we must assume that either CR or LF terminates the message
@@ -122,65 +146,72 @@ int  dopacket(aClient *cptr, char *buffer, int length)
 			 * of messages, backward compatibility is lost and major
 			 * problems will arise. - Avalon
 			 */
-			if (g < '\16' && (g == '\n' || g == '\r'))
-			{
-				if (ch1 == cptr->buffer)
-					continue;	/* Skip extra LF/CR's */
-				*ch1 = '\0';
-				me.receiveM += 1;	/* Update messages received */
-				cptr->receiveM += 1;
-				if (cptr->listener != &me)
-					cptr->listener->receiveM += 1;
-				cptr->count = 0;	/* ...just in case parse returns with
-							   ** FLUSH_BUFFER without removing the
-							   ** structure pointed by cptr... --msa
-							 */
-				if (parse(cptr, cptr->buffer, ch1) ==
-				    FLUSH_BUFFER)
-					/*
-					   ** FLUSH_BUFFER means actually that cptr
-					   ** structure *does* not exist anymore!!! --msa
-					 */
-					return FLUSH_BUFFER;
+			char *eol = find_eol(ch2, length);
+			int  n = eol ? eol - ch2 : length;
+			int  room = cptr->conn->buffer + sizeof(cptr->conn->buffer) - 1 - ch1;
+
+			/* There is always room for the null, the rest is cut off */
+			memcpy(ch1, ch2, MIN(n, room));
+			ch1 += MIN(n, room);
+			ch2 += n;
+			length -= n;
+			if (!eol)
+				break;
+			ch2++;
+			length--;
+			if (ch1 == cptr->conn->buffer)
+				continue;	/* Skip extra LF/CR's */
+			*ch1 = '\0';
+			me.conn->receiveM += 1;	/* Update messages received */
+			cptr->conn->receiveM += 1;
+			if (cptr->listener != &me)
+				cptr->listener->conn->receiveM += 1;
+			cptr->conn->count = 0;	/* ...just in case parse returns with
+						   ** FLUSH_BUFFER without removing the
+						   ** structure pointed by cptr... --msa
+						 */
+			if (parse(cptr, cptr->conn->buffer, ch1) ==
+			    FLUSH_BUFFER)
 				/*
-				 ** Socket is dead so exit (which always returns with
-				 ** FLUSH_BUFFER here).  - avalon
+				   ** FLUSH_BUFFER means actually that cptr
+				   ** structure *does* not exist anymore!!! --msa
 				 */
-				if (cptr->flags & FLAGS_DEADSOCKET)
-					return exit_client(cptr, cptr, &me,
-					    cptr->error_str ? cptr->error_str : "Dead socket");
+				return FLUSH_BUFFER;
+			/*
+			 ** Socket is dead so exit (which always returns with
+			 ** FLUSH_BUFFER here).  - avalon
+			 */
+			if (cptr->flags & FLAGS_DEADSOCKET)
+				return exit_client(cptr, cptr, &me,
+				    cptr->conn->error_str ? cptr->conn->error_str : "Dead socket");
 #ifdef ZIP_LINKS
-				if ((IsZipped(cptr)) && (zipped == 0) && (length > 0))
+			if ((IsZipped(cptr)) && (zipped == 0) && (length > 0))
+			{
+				/*
+				** beginning of server connection, the buffer
+				** contained PASS/CAPAB/SERVER and is now
+				** zipped!
+				** Ignore the '\n' that should be here.
+				*/
+				/* Checked RFC1950: \r or \n can't start a
+				** zlib stream  -orabidoo
+				*/
+				zipped = length;
+				if (zipped > 0 && (*ch2 == '\n' || *ch2 == '\r'))
 				{
-					/*
-					** beginning of server connection, the buffer
-					** contained PASS/CAPAB/SERVER and is now
-					** zipped!
-					** Ignore the '\n' that should be here.
-					*/
-					/* Checked RFC1950: \r or \n can't start a
-					** zlib stream  -orabidoo
-					*/
-					zipped = length;
-					if (zipped > 0 && (*ch2 == '\n' || *ch2 == '\r'))
-					{
-						ch2++;
-						zipped--;
-					}
-					cptr->zip->first = 0;
-					ch2 = unzip_packet(cptr, ch2, &zipped);
-					length = zipped;
-					zipped = 1;
-					if (length == -1)
-						return exit_client(cptr, cptr, &me,
-							"fatal error in unzip_packet(2)");
+					ch2++;
+					zipped--;
 				}
-#endif
-				ch1 = cptr->buffer;
+				cptr->zip->first = 0;
+				ch2 = unzip_packet(cptr, ch2, &zipped);
+				length = zipped;
+				zipped = 1;
+				if (length == -1)
+					return exit_client(cptr, cptr, &me,
+						"fatal error in unzip_packet(2)");
 			}
-			else if (ch1 <
-			    cptr->buffer + (sizeof(cptr->buffer) - 1))
-				ch1++;	/* There is always room for the null */
+#endif
+			ch1 = cptr->conn->buffer;
 		}
 #ifdef ZIP_LINKS
 		 /* Now see if anything is left uncompressed in the input
@@ -206,10 +237,252 @@ int  dopacket(aClient *cptr, char *buffer, int length)
 
 	} while(!done_unzip);
 #endif
-	cptr->count = ch1 - cptr->buffer;
+	cptr->conn->count = ch1 - cptr->conn->buffer;
+	return 0;
+}
+
+/*
+** doline
+**	Parse a single line straight from the receive buffer, without
+**	copying it to cptr->buffer first like dopacket() does.
+**	buffer - start of the line
+**	bufend - the CR or LF that ended it, overwritten with a NUL
+**	length - number of bytes used up (for the statistics)
+**
+**	Lines longer than what dopacket() would allow are cut off at
+**	the same length. The caller should use dopacket() instead if
+**	cptr->count says there is a partial line in cptr->buffer.
+*/
+int  doline(aClient *cptr, char *buffer, char *bufend, int length)
+{
+	count_received(cptr, length);
+	if (bufend - buffer > sizeof(cptr->conn->buffer) - 1)
+		bufend = buffer + sizeof(cptr->conn->buffer) - 1;
+	*bufend = '\0';
+	me.conn->receiveM += 1;	/* Update messages received */
+	cptr->conn->receiveM += 1;
+	if (cptr->listener != &me)
+		cptr->listener->conn->receiveM += 1;
+	if (parse(cptr, buffer, bufend) == FLUSH_BUFFER)
+		return FLUSH_BUFFER;
+	if (cptr->flags & FLAGS_DEADSOCKET)
+		return exit_client(cptr, cptr, &me,
+		    cptr->conn->error_str ? cptr->conn->error_str : "Dead socket");
 	return 0;
 }
 
+static inline unsigned int cmd_hash(char *s)
+{
+	unsigned int h = 2166136261U ^ cmdhash_seed;
+
+	for (; *s; s++)
+		h = (h ^ toupper(*s)) * 16777619;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	return h;
+}
+
+typedef struct {
+	aCommand *cmd;
+	unsigned int hash;
+} CmdHashEntry;
+
+/*
+ * Try to place the 'n' names in 'e' with the current seed and table
+ * size. They are sorted on bucket into 'sorted' first, then buckets are
+ * done biggest first: for each we look for the first displacement that
+ * puts all its names in free slots.
+ */
+static int cmdhash_place(CmdHashEntry *e, CmdHashEntry *sorted, int n, int *start)
+{
+	int  i, j, b, size, maxsize = 0;
+	unsigned int d, slot;
+
+	bzero(cmdtab, sizeof(aCommand *) * cmdtab_size);
+	bzero(start, sizeof(int) * (cmddisp_size + 1));
+	for (i = 0; i < n; i++)
+		start[(e[i].hash & (cmddisp_size - 1)) + 1]++;
+	for (b = 0; b < cmddisp_size; b++)
+	{
+		if (start[b + 1] > maxsize)
+			maxsize = start[b + 1];
+		start[b + 1] += start[b];
+	}
+	for (i = 0; i < n; i++)
+		sorted[start[e[i].hash & (cmddisp_size - 1)]++] = e[i];
+	for (b = cmddisp_size; b > 0; b--)
+		start[b] = start[b - 1];
+	start[0] = 0;
+	/* bucket b is now sorted[start[b]] .. sorted[start[b+1]-1] */
+	for (size = maxsize; size > 0; size--)
+		for (b = 0; b < cmddisp_size; b++)
+		{
+			if (start[b + 1] - start[b] != size)
+				continue;
+			for (d = 0; d < cmdtab_size; d++)
+			{
+				for (i = start[b]; i < start[b + 1]; i++)
+				{
+					slot = CMDSLOT(sorted[i].hash, d);
+					if (cmdtab[slot] && stricmp(cmdtab[slot]->cmd, sorted[i].cmd->cmd))
+						break;
+					sorted[i].cmd->hnext = cmdtab[slot];
+					cmdtab[slot] = sorted[i].cmd;
+				}
+				if (i == start[b + 1])
+					break;
+				/* no good, take them out again */
+				for (j = i - 1; j >= start[b]; j--)
+				{
+					slot = CMDSLOT(sorted[j].hash, d);
+					cmdtab[slot] = cmdtab[slot]->hnext;
+				}
+			}
+			if (d == cmdtab_size)
+				return 0;
+			cmddisp[b] = d;
+		}
+	return 1;
+}
+
+static void cmdhash_rebuild(void)
+{
+	CmdHashEntry *e, *sorted;
+	int  *start;
+	int  i, k, n = 0, tries;
+	unsigned int size = 16;
+	aCommand *p;
+
+	for (i = 0; i < 256; i++)
+	{
+		for (p = CommandHash[i]; p; p = p->next)
+			n++;
+		for (p = TokenHash[i]; p; p = p->next)
+			n++;
+	}
+	while (size < 2 * n)
+		size <<= 1;
+	e = (CmdHashEntry *)MyMalloc(sizeof(CmdHashEntry) * (n ? n : 1));
+	sorted = (CmdHashEntry *)MyMalloc(sizeof(CmdHashEntry) * (n ? n : 1));
+	for (;;)
+	{
+		if (size != cmdtab_size)
+		{
+			if (cmdtab)
+				MyFree(cmdtab);
+			if (cmddisp)
+				MyFree(cmddisp);
+			cmdtab_size = size;
+			cmddisp_size = size / 4;
+			cmdtab = (aCommand **)MyMalloc(sizeof(aCommand *) * cmdtab_size);
+			cmddisp = (unsigned int *)MyMalloc(sizeof(unsigned int) * cmddisp_size);
+		}
+		start = (int *)MyMalloc(sizeof(int) * (cmddisp_size + 1));
+		for (tries = 0; tries < 16; tries++)
+		{
+			/*
+			 * Filled in back to front: cmdhash_place() pushes
+			 * each name on the front of its slot, so this way
+			 * a slot ends up newest first, like the lists are
+			 * (a module overriding a command must still win).
+			 */
+			k = n;
+			for (i = 0; i < 256; i++)
+			{
+				for (p = CommandHash[i]; p; p = p->next)
+				{
+					e[--k].cmd = p;
+					e[k].hash = cmd_hash(p->cmd);
+				}
+				for (p = TokenHash[i]; p; p = p->next)
+				{
+					e[--k].cmd = p;
+					e[k].hash = cmd_hash(p->cmd);
+				}
+			}
+			if (cmdhash_place(e, sorted, n, start))
+				break;
+			cmdhash_seed = cmdhash_seed * 1103515245 + 12345;
+		}
+		MyFree(start);
+		if (tries < 16)
+			break;
+		size <<= 1;	/* very unlikely */
+	}
+	MyFree(sorted);
+	MyFree(e);
+	cmdhash_dirty = 0;
+}
+
+/*
+ * Called after a command or token was added or deleted. The table is
+ * only rebuilt by the next find_Command(), so that registering a few
+ * hundred commands at boot or module (re)load does not rebuild it
+ * every time.
+ */
+void	cmdhash_changed(void)
+{
+	cmdhash_dirty = 1;
+}
+
+static inline int cmd_flags_ok(aCommand *p, int flags)
+{
+	if ((flags & M_UNREGISTERED) && !(p->flags & M_UNREGISTERED))
+		return 0;
+	if ((flags & M_SHUN) && !(p->flags & M_SHUN))
+		return 0;
+	if ((flags & M_VIRUS) && !(p->flags & M_VIRUS))
+		return 0;
+	if ((flags & M_ALIAS) && !(p->flags & M_ALIAS))
+		return 0;
+	return 1;
+}
+
+/*
+ * Look up a command (token == 0) or token (token == 1) that may be
+ * used with 'flags', see find_Command().
+ * While the table is out of date (a module adding its commands, for
+ * example) this walks CommandHash[]/TokenHash[] instead, only
+ * find_Command() rebuilds it.
+ */
+static inline aCommand *cmdhash_find(char *cmd, int token, int flags)
+{
+	aCommand *p;
+	unsigned int h;
+
+	if (cmdhash_dirty)
+	{
+		if (!token)
+		{
+			for (p = CommandHash[toupper(*cmd)]; p; p = p->next)
+				if (cmd_flags_ok(p, flags) && !stricmp(p->cmd, cmd))
+					return p;
+			return NULL;
+		}
+		for (p = TokenHash[*cmd]; p; p = p->next)
+			if (cmd_flags_ok(p, flags) && !strcmp(p->cmd, cmd))
+				return p;
+		return NULL;
+	}
+	if (!cmdtab)
+		return NULL;
+	h = cmd_hash(cmd);
+	p = cmdtab[CMDSLOT(h, cmddisp[h & (cmddisp_size - 1)])];
+	if (!p || stricmp(p->cmd, cmd))
+		return NULL;
+	for (; p; p = p->hnext)
+	{
+		if (p->token != token)
+			continue;
+		if (token && strcmp(p->cmd, cmd))
+			continue;
+		if (cmd_flags_ok(p, flags))
+			return p;
+	}
+	return NULL;
+}
+
 void	init_CommandHash(void)
 {
 #ifdef DEVELOP_DEBUG
@@ -220,6 +493,7 @@ void	init_CommandHash(void)
 	
 	bzero(CommandHash, sizeof(CommandHash));
 	bzero(TokenHash, sizeof(TokenHash));
+	cmdhash_changed();
 	add_CommandX(MSG_ERROR, TOK_ERROR, m_error, MAXPARA, M_UNREGISTERED|M_SERVER);
 	add_CommandX(MSG_VERSION, TOK_VERSION, m_version, MAXPARA, M_UNREGISTERED|M_USER|M_SERVER);
 	add_Command(MSG_SUMMON, NULL, m_summon, 1);
@@ -267,12 +541,14 @@ aCommand *add_Command_backend(char *cmd, int (*func)(), unsigned char parameters
 	newcmd->parameters = (parameters > MAXPARA) ? MAXPARA : parameters;
 	newcmd->func = func;
 	newcmd->flags = flags;
+	newcmd->token = token ? 1 : 0;
 	
 	/* Add in hash with hash value = first byte */
 	if (!token)
 		AddListItem(newcmd, CommandHash[toupper(*cmd)]);
 	else
 		AddListItem(newcmd, TokenHash[*cmd]);
+	cmdhash_changed();
 	return newcmd;
 }
 
@@ -355,45 +631,19 @@ int del_Command(char *cmd, char *token, int (*func)())
 			MyFree(p);
 		}
 	}
+	cmdhash_changed();
 	return i;	
 
 }
 
 static inline aCommand *find_Token(char *cmd, int flags)
 {
-	aCommand *p;
-
-	for (p = TokenHash[*cmd]; p; p = p->next) {
-		if ((flags & M_UNREGISTERED) && !(p->flags & M_UNREGISTERED))
-			continue;
-		if ((flags & M_SHUN) && !(p->flags & M_SHUN))
-			continue;
-		if ((flags & M_VIRUS) && !(p->flags & M_VIRUS))
-			continue;
-		if ((flags & M_ALIAS) && !(p->flags & M_ALIAS))
-			continue;
-		if (!strcmp(p->cmd, cmd))
-			return p;
-	}
-	return NULL;
+	return cmdhash_find(cmd, 1, flags);
 }
 
 static inline aCommand *find_Cmd(char *cmd, int flags)
 {
-	aCommand *p;
-	for (p = CommandHash[toupper(*cmd)]; p; p = p->next) {
-		if ((flags & M_UNREGISTERED) && !(p->flags & M_UNREGISTERED))
-			continue;
-		if ((flags & M_SHUN) && !(p->flags & M_SHUN))
-			continue;
-		if ((flags & M_VIRUS) && !(p->flags & M_VIRUS))
-			continue;
-		if ((flags & M_ALIAS) && !(p->flags & M_ALIAS))
-			continue;
-		if (!stricmp(p->cmd, cmd))
-			return p;
-	}
-	return NULL;
+	return cmdhash_find(cmd, 0, flags);
 }
 
 inline aCommand *find_Command(char *cmd, short token, int flags)
@@ -402,6 +652,9 @@ inline aCommand *find_Command(char *cmd, short token, int flags)
 	
 	Debug((DEBUG_NOTICE, "FindCommand %s", cmd));
 
+	if (cmdhash_dirty)
+		cmdhash_rebuild();
+
 	if (token)
 	{
 		if (strlen(cmd) < 3)
@@ -421,16 +674,9 @@ aCommand *find_Command_simple(char *cmd)
 {
 	aCommand	*p;
 	
-	for (p = CommandHash[toupper(*cmd)]; p; p = p->next) {
-		if (!stricmp(p->cmd, cmd))
-				return (p);
-	}
-
-	for (p = TokenHash[*cmd]; p; p = p->next) {
-		if (!strcmp(p->cmd, cmd))
-				return p;
-	}
-	return NULL;
+	if ((p = find_Cmd(cmd, 0)))
+		return p;
+	return find_Token(cmd, 0);
 }
 
 /** Calls the specified command.
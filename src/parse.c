@@ -36,7 +36,14 @@ ID_Copyright
 ID_Notes("2.33 1/30/94");
 #undef RAWDEBUG
 
+/*
+ * The line being parsed, as it came in. Only filled in for commands
+ * with M_BACKUPBUF, unless ALWAYS_BACKUPBUF (crash reports, debugging).
+ */
 char backupbuf[8192];
+#if defined(DEBUGMODE) || defined(DEVELOP) || defined(_WIN32)
+#define ALWAYS_BACKUPBUF
+#endif
 
 #define MSGTAB
 #include "msg.h"
@@ -51,6 +58,7 @@ char backupbuf[8192];
  */
 extern int lifesux;
 static char *para[MAXPARA + 2];
+static int paralen[MAXPARA + 2];
 
 static char sender[HOSTLEN + 1];
 static int cancel_clients(aClient *, aClient *, char *);
@@ -202,7 +210,7 @@ int  parse(aClient *cptr, char *buffer, char *bufend)
 	if (IsDead(cptr))
 		return 0;
 
-	if ((cptr->receiveK >= UNKNOWN_FLOOD_AMOUNT) && IsUnknown(cptr))
+	if ((cptr->conn->receiveK >= UNKNOWN_FLOOD_AMOUNT) && IsUnknown(cptr))
 	{
 		sendto_snomask(SNO_FLOOD, "Flood from unknown connection %s detected",
 			cptr->sockhost);
@@ -210,9 +218,11 @@ int  parse(aClient *cptr, char *buffer, char *bufend)
 		return FLUSH_BUFFER;
 	}
 
-	/* this call is a bit obsolete? - takes up CPU */
+#ifdef ALWAYS_BACKUPBUF
+	strlcpy(backupbuf, buffer, sizeof(backupbuf));
+#else
 	backupbuf[0] = '\0';
-	strcpy(backupbuf, buffer);
+#endif
 	s = sender;
 	*s = '\0';
 	for (ch = buffer; *ch == ' '; ch++)
@@ -383,6 +393,17 @@ int  parse(aClient *cptr, char *buffer, char *bufend)
 		if ((flags & M_SERVER) && !(cmptr->flags & M_SERVER))
 			return -1;
 		}
+#ifndef ALWAYS_BACKUPBUF
+		if (cmptr->flags & M_BACKUPBUF)
+		{
+			/* the NUL after the command name was a space */
+			int n = MIN(bufend - buffer, sizeof(backupbuf) - 1);
+			memcpy(backupbuf, buffer, n);
+			backupbuf[n] = '\0';
+			if (s && (s - 1 - buffer < n))
+				backupbuf[s - 1 - buffer] = ' ';
+		}
+#endif
 		paramcount = cmptr->parameters;
 		cmptr->bytes += bytes;
 		if (!(cmptr->flags & M_NOLAG))
@@ -426,13 +447,18 @@ int  parse(aClient *cptr, char *buffer, char *bufend)
 				   ** include blanks also.
 				 */
 				para[++i] = s + 1;
+				paralen[i] = -1;	/* see parv_len() */
 				break;
 			}
 			para[++i] = s;
 			if (i >= paramcount)
+			{
+				paralen[i] = -1;
 				break;
+			}
 			for (; *s != ' ' && *s; s++)
 				;
+			paralen[i] = s - para[i];
 		}
 	}
 	para[++i] = NULL;
@@ -476,6 +502,25 @@ int  parse(aClient *cptr, char *buffer, char *bufend)
 #endif
 }
 
+/*
+ * Length of parv[i], without a strlen() if this is the parv[] that
+ * parse() just built (and the command hasn't changed parv[i] since).
+ * The last parameter (the one that runs to the end of the line) is
+ * only measured the first time it is asked for: the line may have a
+ * NUL byte in it, so the end of the line is not always the end of the
+ * string, and most commands never need the length anyway.
+ */
+int  parv_len(char *parv[], int i)
+{
+	if ((parv == para) && parv[i])
+	{
+		if (paralen[i] < 0)
+			paralen[i] = strlen(parv[i]);
+		return paralen[i];
+	}
+	return strlen(parv[i]);
+}
+
 static int cancel_clients(aClient *cptr, aClient *sptr, char *cmd)
 {
 	/*
@@ -84,6 +84,16 @@ static DNSCache *cache_hashtbl[DNS_HASH_SIZE]; /**< Hash table of cache */
 
 static unsigned int unrealdns_num_cache = 0; /**< # of cache entries in memory */
 
+#ifdef USE_EPOLL
+/** Called by c-ares whenever it opens, closes or changes interest in
+ * one of its sockets, so we can keep the epoll set up to date.
+ */
+static void unrealdns_sock_state_cb(void *data, ares_socket_t fd, int readable, int writable)
+{
+	ioevent_resolver(fd, (readable ? IOEVENT_READ : 0) | (writable ? IOEVENT_WRITE : 0));
+}
+#endif
+
 void init_resolver(int firsttime)
 {
 struct ares_options options;
@@ -111,6 +121,10 @@ int optmask;
 	 */
 	options.lookups = "b";
 	optmask |= ARES_OPT_LOOKUPS;
+#endif
+#ifdef USE_EPOLL
+	options.sock_state_cb = unrealdns_sock_state_cb;
+	optmask |= ARES_OPT_SOCK_STATE_CB;
 #endif
 	n = ares_init_options(&resolver_channel, &options, optmask);
 	if (n != ARES_SUCCESS)
@@ -141,6 +155,21 @@ int optmask;
 	}
 }
 
+/** Returns how long (in msec) we may sleep before c-ares wants to
+ * retransmit or time out a query, but never more than 'maxdelay'.
+ */
+long unrealdns_timeout(long maxdelay)
+{
+struct timeval maxtv, tv, *tvp;
+
+	if (!requests)
+		return maxdelay; /* nothing pending */
+	maxtv.tv_sec = maxdelay / 1000;
+	maxtv.tv_usec = (maxdelay % 1000) * 1000;
+	tvp = ares_timeout(resolver_channel, &maxtv, &tv);
+	return (tvp->tv_sec * 1000) + ((tvp->tv_usec + 999) / 1000);
+}
+
 void reinit_resolver(aClient *sptr)
 {
 #ifdef CHROOTDIR
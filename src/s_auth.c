@@ -44,15 +44,19 @@ static char sccsid[] = "@(#)s_auth.c	1.18 4/18/94 (C) 1992 Darren Reed";
 #include "proto.h"
 #include <string.h>
 
+#ifdef USE_EPOLL
+extern fdlist auth_fdlist;
+#endif
+
 void ident_failed(aClient *cptr)
 {
 	Debug((DEBUG_NOTICE, "ident_failed() for %x", cptr));
 	ircstp->is_abad++;
-	if (cptr->authfd != -1)
+	if (cptr->conn->authfd != -1)
 	{
-		CLOSE_SOCK(cptr->authfd);
+		CLOSE_SOCK(cptr->conn->authfd);
 		--OpenFiles;
-		cptr->authfd = -1;
+		cptr->conn->authfd = -1;
 	}
 	cptr->flags &= ~(FLAGS_WRAUTH | FLAGS_AUTH);
 	if (!DoingDNS(cptr))
@@ -81,7 +85,7 @@ void start_auth(aClient *cptr)
 	}
 	Debug((DEBUG_NOTICE, "start_auth(%x) slot=%d, fd=%d, status=%d",
 	    cptr, cptr->slot, cptr->fd, cptr->status));
-	if ((cptr->authfd = socket(AFINET, SOCK_STREAM, 0)) == -1)
+	if ((cptr->conn->authfd = socket(AFINET, SOCK_STREAM, 0)) == -1)
 	{
 		Debug((DEBUG_ERROR, "Unable to create auth socket for %s:%s",
 		    get_client_name(cptr, TRUE), strerror(get_sockerr(cptr))));
@@ -91,16 +95,16 @@ void start_auth(aClient *cptr)
     if (++OpenFiles >= (MAXCONNECTIONS - 2))
 	{
 		sendto_ops("Can't allocate fd, too many connections.");
-		CLOSE_SOCK(cptr->authfd);
+		CLOSE_SOCK(cptr->conn->authfd);
 		--OpenFiles;
-		cptr->authfd = -1;
+		cptr->conn->authfd = -1;
 		return;
 	}
 
 	if (SHOWCONNECTINFO && !cptr->serv && !IsServersOnlyListener(cptr->listener))
 		sendto_one(cptr, "%s", REPORT_DO_ID);
 
-	set_non_blocking(cptr->authfd, cptr);
+	set_non_blocking(cptr->conn->authfd, cptr);
 
 	/* Bind to the IP the user got in */
 	memset(&sock, 0, sizeof(sock));
@@ -114,7 +118,7 @@ void start_auth(aClient *cptr)
 #endif
 		sock.SIN_PORT = 0;
 		sock.SIN_FAMILY = AFINET;	/* redundant? */
-		(void)bind(cptr->authfd, (struct SOCKADDR *)&sock, sizeof(sock));
+		(void)bind(cptr->conn->authfd, (struct SOCKADDR *)&sock, sizeof(sock));
 	}
 
 	bcopy((char *)&cptr->ip, (char *)&sock.SIN_ADDR,
@@ -123,12 +127,17 @@ void start_auth(aClient *cptr)
 	sock.SIN_PORT = htons(113);
 	sock.SIN_FAMILY = AFINET;
 
-	if (connect(cptr->authfd, (struct sockaddr *)&sock, sizeof(sock)) == -1 && !(ERRNO == P_EWORKING))
+	if (connect(cptr->conn->authfd, (struct sockaddr *)&sock, sizeof(sock)) == -1 && !(ERRNO == P_EWORKING))
 	{
 		ident_failed(cptr);
 		return;
 	}
 	cptr->flags |= (FLAGS_WRAUTH | FLAGS_AUTH);
+	ioevent_add(cptr->conn->authfd, cptr->slot, IOEVENT_READ|IOEVENT_WRITE);
+#ifdef USE_EPOLL
+	/* So read_message() can time out the request */
+	addto_fdlist(cptr->slot, &auth_fdlist);
+#endif
 	return;
 }
 
@@ -162,7 +171,7 @@ void send_authports(aClient *cptr)
 
 	Debug((DEBUG_SEND, "sending [%s] to auth port %s.113",
 	    authbuf, inetntoa((char *)&them.SIN_ADDR)));
-	if (WRITE_SOCK(cptr->authfd, authbuf, strlen(authbuf)) != strlen(authbuf))
+	if (WRITE_SOCK(cptr->conn->authfd, authbuf, strlen(authbuf)) != strlen(authbuf))
 	{
 		if (ERRNO == P_EAGAIN)
 			return; /* Not connected yet, try again later */
@@ -197,21 +206,21 @@ void read_authports(aClient *cptr)
 	 * Oh. this is needed because an authd reply may come back in more
 	 * than 1 read! -avalon
 	 */
-	  if ((len = READ_SOCK(cptr->authfd, cptr->buffer + cptr->count,
-		  sizeof(cptr->buffer) - 1 - cptr->count)) >= 0)
+	  if ((len = READ_SOCK(cptr->conn->authfd, cptr->conn->buffer + cptr->conn->count,
+		  sizeof(cptr->conn->buffer) - 1 - cptr->conn->count)) >= 0)
 	{
-		cptr->count += len;
-		cptr->buffer[cptr->count] = '\0';
+		cptr->conn->count += len;
+		cptr->conn->buffer[cptr->conn->count] = '\0';
 	}
 
 	cptr->lasttime = TStime();
-	if ((len > 0) && (cptr->count != (sizeof(cptr->buffer) - 1)) &&
-	    (sscanf(cptr->buffer, "%hd , %hd : USERID : %*[^:]: %10s",
+	if ((len > 0) && (cptr->conn->count != (sizeof(cptr->conn->buffer) - 1)) &&
+	    (sscanf(cptr->conn->buffer, "%hd , %hd : USERID : %*[^:]: %10s",
 	    &remp, &locp, ruser) == 3))
 	{
-		s = rindex(cptr->buffer, ':');
+		s = rindex(cptr->conn->buffer, ':');
 		*s++ = '\0';
-		for (t = (rindex(cptr->buffer, ':') + 1); *t; t++)
+		for (t = (rindex(cptr->conn->buffer, ':') + 1); *t; t++)
 			if (!isspace(*t))
 				break;
 		strncpyzt(system, t, sizeof(system));
@@ -224,16 +233,16 @@ void read_authports(aClient *cptr)
 	}
 	else if (len != 0)
 	{
-		if (!index(cptr->buffer, '\n') && !index(cptr->buffer, '\r'))
+		if (!index(cptr->conn->buffer, '\n') && !index(cptr->conn->buffer, '\r'))
 			return;
 		Debug((DEBUG_ERROR, "local %d remote %d", locp, remp));
 		Debug((DEBUG_ERROR, "bad auth reply in [%s]", cptr->buffer));
 		*ruser = '\0';
 	}
-    CLOSE_SOCK(cptr->authfd);
+    CLOSE_SOCK(cptr->conn->authfd);
     --OpenFiles;
-    cptr->authfd = -1;
-	cptr->count = 0;
+    cptr->conn->authfd = -1;
+	cptr->conn->count = 0;
 	ClearAuth(cptr);
 	if (!DoingDNS(cptr))
 		SetAccess(cptr);
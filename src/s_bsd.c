@@ -39,6 +39,9 @@ static char sccsid[] =
 Computing Center and Jarkko Oikarinen";
 #endif
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	/* for accept4() */
+#endif
 #ifdef _WIN32
 #include <WinSock2.h>
 #endif
@@ -73,7 +76,32 @@ Computing Center and Jarkko Oikarinen";
 #include  "fdlist.h"
 #endif
 
-#ifdef USE_POLL
+#if defined(__linux__) && defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+/* accept4() gives us a non-blocking socket straight away */
+#define USE_ACCEPT4
+#endif
+#ifdef __linux__
+#include <netinet/tcp.h>	/* TCP_INFO */
+#endif
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+
+#define EPOLL_MAXEVENTS	512
+
+static int epoll_fd = -1;
+static struct epoll_event epoll_events[EPOLL_MAXEVENTS];
+static int epollfd_to_client[MAXCONNECTIONS]; /* fd -> slot in local[] (or IOEVENT_RESOLVER) */
+static unsigned char epollfd_events[MAXCONNECTIONS]; /* IOEVENT_* currently registered for this fd */
+/* Clients (by slot) that still have something in their recvQ (fake lag)
+ * and must be looked at on the next pass even if their socket is idle.
+ */
+static int recvq_pending[2][MAXCONNECTIONS];
+static int recvq_pending_count[2];
+static int recvq_pending_cur = 0;
+static unsigned int io_serial = 0;
+static unsigned int slot_serial[MAXCONNECTIONS];
+fdlist auth_fdlist; /* clients waiting on an ident reply, for the timeouts */
+#elif defined(USE_POLL)
 # ifndef _WIN32
 #  include <sys/poll.h>
 #  include <poll.h>
@@ -129,6 +157,13 @@ char zlinebuf[BUFSIZE];
 extern char *version;
 extern ircstats IRCstats;
 MODVAR TS last_allinuse = 0;
+/* Accept statistics, for /STATS P */
+MODVAR int accept_rate = 0;		/* connections accepted during the last full second */
+MODVAR int accept_rate_peak = 0;
+MODVAR long accept_capped = 0;		/* # of times ACCEPTS_PER_LOOP was reached */
+static int accept_count = 0;
+static TS accept_sec = 0;
+static int accept_budget = ACCEPTS_PER_LOOP;
 
 #ifndef NO_FDLIST
 extern fdlist default_fdlist;
@@ -160,7 +195,7 @@ extern void url_do_transfers_async(void);
 # endif
 #endif
 
-#ifdef USE_POLL
+#if defined(USE_POLL) && !defined(USE_EPOLL)
 static void reset_pollfd()
 {
 	int i;
@@ -211,7 +246,156 @@ int v;
 #define get_client_by_pollfd(x) pollfd_to_client[x]
 #endif /* DEBUGMODE */
 
-#endif /* USE_POLL */
+#endif /* USE_POLL && !USE_EPOLL */
+
+/*
+ * Event backend.
+ * With select() and poll() read_message() builds the list of sockets to
+ * watch from scratch on every pass, so all of the ioevent_*() calls below
+ * are no-ops there. With epoll the interest list lives in the kernel and
+ * has to be kept up to date: new sockets are registered with ioevent_add()
+ * and ioevent_update() is called whenever something happened that may
+ * change what we want to hear about a client (its sendQ, recvQ, DNS/ident
+ * state, etc). Sockets are removed from the epoll set automatically when
+ * they are closed.
+ */
+
+/** Change the events we wait for on 'fd' (owned by local[slot]) to 'events'.
+ * Does nothing if that is what is registered already.
+ */
+void ioevent_set(int fd, int slot, int events)
+{
+#ifdef USE_EPOLL
+	struct epoll_event ev;
+	int op, old;
+
+	if ((fd < 0) || (fd >= MAXCONNECTIONS))
+	{
+		ircd_log(LOG_ERROR, "[BUG] ioevent_set() called for fd %d, range is 0..%d",
+			fd, MAXCONNECTIONS);
+		return;
+	}
+	epollfd_to_client[fd] = slot;
+	old = epollfd_events[fd];
+	if (old == events)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	if (events & IOEVENT_READ)
+		ev.events |= EPOLLIN;
+	if (events & IOEVENT_WRITE)
+		ev.events |= EPOLLOUT;
+	ev.data.fd = fd;
+
+	/* Not waiting for anything means not being in the set at all,
+	 * otherwise we would still be woken up for errors and hangups.
+	 */
+	if (!old)
+		op = EPOLL_CTL_ADD;
+	else if (!events)
+		op = EPOLL_CTL_DEL;
+	else
+		op = EPOLL_CTL_MOD;
+
+	if (epoll_ctl(epoll_fd, op, fd, &ev) < 0)
+	{
+		if ((op == EPOLL_CTL_ADD) && (errno == EEXIST))
+			op = EPOLL_CTL_MOD;
+		else if ((op == EPOLL_CTL_MOD) && (errno == ENOENT))
+			op = EPOLL_CTL_ADD;
+		else
+			op = -1;
+		if ((op == -1) || (epoll_ctl(epoll_fd, op, fd, &ev) < 0))
+		{
+			if (events) /* DEL after close() is fine */
+				ircd_log(LOG_ERROR, "epoll_ctl() failed for fd %d: %s", fd, STRERROR(ERRNO));
+		}
+	}
+	epollfd_events[fd] = events;
+#endif
+}
+
+/** Register a new socket 'fd', owned by local[slot], with the event backend.
+ * Any state left behind by a previous (closed) socket with the same fd
+ * number is forgotten.
+ */
+void ioevent_add(int fd, int slot, int events)
+{
+#ifdef USE_EPOLL
+	if ((fd >= 0) && (fd < MAXCONNECTIONS))
+		epollfd_events[fd] = 0;
+#endif
+	ioevent_set(fd, slot, events);
+}
+
+/** Recalculate which events we want for the socket(s) of local client 'cptr'.
+ * This mirrors what read_message() selects on in the select()/poll() case.
+ */
+void ioevent_update(aClient *cptr)
+{
+#ifdef USE_EPOLL
+	int events = 0;
+
+	if ((cptr->fd < 0) || (cptr->slot < 0) || IsLog(cptr))
+		return;
+
+	if (cptr->conn->authfd >= 0)
+		ioevent_set(cptr->conn->authfd, cptr->slot,
+			(cptr->flags & FLAGS_WRAUTH) ? (IOEVENT_READ|IOEVENT_WRITE) : IOEVENT_READ);
+
+	if (!DoingDNS(cptr) && !DoingAuth(cptr))
+	{
+		if (IsMe(cptr))
+		{
+			if (IsListening(cptr))
+				events |= IOEVENT_READ;
+		}
+		else if (DBufLength(&cptr->recvQ) < 4088)
+			events |= IOEVENT_READ;
+		if (DBufLength(&cptr->sendQ) || IsConnecting(cptr) ||
+		    (DoList(cptr) && IsSendable(cptr))
+#ifdef ZIP_LINKS
+		    || ((IsZipped(cptr)) && (cptr->zip->outcount > 0))
+#endif
+		    )
+			events |= IOEVENT_WRITE;
+	}
+	ioevent_set(cptr->fd, cptr->slot, events);
+#endif
+}
+
+/** Called (through c-ares) when the resolver opens, closes or changes
+ * interest in one of its sockets.
+ */
+void ioevent_resolver(int fd, int events)
+{
+#ifdef USE_EPOLL
+	if ((fd >= 0) && (fd < MAXCONNECTIONS) && (epollfd_to_client[fd] != IOEVENT_RESOLVER))
+		ioevent_add(fd, IOEVENT_RESOLVER, events); /* new socket */
+	else
+		ioevent_set(fd, IOEVENT_RESOLVER, events);
+#endif
+}
+
+#ifdef USE_EPOLL
+static void ioevent_init(void)
+{
+	int i;
+
+	if ((epoll_fd = epoll_create(MAXCONNECTIONS)) < 0)
+	{
+		fprintf(stderr, "ERROR: epoll_create() failed: %s\n", strerror(errno));
+		fprintf(stderr, "Either use a newer kernel or undefine USE_EPOLL in include/config.h\n");
+		exit(-1);
+	}
+	for (i = 0; i < MAXCONNECTIONS; i++)
+		epollfd_to_client[i] = -1;
+	memset(epollfd_events, 0, sizeof(epollfd_events));
+	memset(slot_serial, 0, sizeof(slot_serial));
+	recvq_pending_count[0] = recvq_pending_count[1] = 0;
+	init_fdlist(&auth_fdlist);
+}
+#endif
 
 void start_of_normal_client_handshake(aClient *acptr);
 void proceed_normal_client_handshake(aClient *acptr, struct hostent *he);
@@ -233,6 +417,7 @@ void add_local_client(aClient* cptr)
 	local[cptr->slot] = cptr;
 	if (i > LastSlot)
 		LastSlot = i;
+	set_ping_timer(cptr, TStime() + 1);
 }
 
 void remove_local_client(aClient* cptr)
@@ -245,7 +430,13 @@ void remove_local_client(aClient* cptr)
 		return;
 	}
 
-#ifdef USE_POLL
+#ifdef USE_EPOLL
+	if ((cptr->fd >= 0) && (cptr->fd < MAXCONNECTIONS) && (epollfd_to_client[cptr->fd] == cptr->slot))
+		epollfd_to_client[cptr->fd] = -1;
+	if ((cptr->conn->authfd >= 0) && (cptr->conn->authfd < MAXCONNECTIONS) && (epollfd_to_client[cptr->conn->authfd] == cptr->slot))
+		epollfd_to_client[cptr->conn->authfd] = -1;
+	delfrom_fdlist(cptr->slot, &auth_fdlist);
+#elif defined(USE_POLL)
 	/* Using the pollfd_to_client array directly here, as we do proper bounds checks ! */
 	if ((cptr->fd >= 0) && (cptr->fd < MAXCLIENTS) && (pollfd_to_client[cptr->fd] == cptr->slot))
 		pollfd_to_client[cptr->fd] = -1;
@@ -257,6 +448,7 @@ void remove_local_client(aClient* cptr)
 	 */
 	local[cptr->slot] = NULL;
 	cptr->slot = -1;
+	timer_del(&cptr->pingtimer);
 	while (!local[LastSlot])
 		LastSlot--;
 }
@@ -274,10 +466,10 @@ void close_connections(void)
         CLOSE_SOCK(cptr->fd);
         cptr->fd = -2;
       }
-      if (cptr->authfd >= 0)
+      if (cptr->conn->authfd >= 0)
       {
-        CLOSE_SOCK(cptr->authfd);
-        cptr->authfd = -1;
+        CLOSE_SOCK(cptr->conn->authfd);
+        cptr->conn->authfd = -1;
       }
     }
   }
@@ -468,6 +660,14 @@ int  inetport(aClient *cptr, char *name, int port)
 		return -1;
 	}
 	set_sock_opts(cptr->fd, cptr);
+#ifdef SO_REUSEPORT
+	if (cptr->umodes & LISTENER_REUSEPORT)
+	{
+		int opt = 1;
+		if (setsockopt(cptr->fd, SOL_SOCKET, SO_REUSEPORT, (OPT_TYPE *)&opt, sizeof(opt)) < 0)
+			report_error("setsockopt(SO_REUSEPORT) %s:%s", cptr);
+	}
+#endif
 	/*
 	 * Bind a port to listen for new connections if port is non-null,
 	 * else assume it is already open and try get something from it.
@@ -534,37 +734,85 @@ int  inetport(aClient *cptr, char *name, int port)
 	cptr->port = (int)ntohs(server.SIN_PORT);
 	(void)listen(cptr->fd, LISTEN_SIZE);
 	add_local_client(cptr);
+	ioevent_add(cptr->fd, cptr->slot, IOEVENT_READ);
 	return 0;
 }
 
+/*
+ * add_listener2
+ *
+ * Open the socket(s) for a listen block. With listen::sockets > 1 we open
+ * that many SO_REUSEPORT sockets on the same ip:port and let the kernel
+ * spread new connections over them, each with its own accept queue.
+ * conf->listener points to the first one, the others can be found through
+ * their ->class like any listener. Returns -1 if not even one could be
+ * bound.
+ */
 int add_listener2(ConfigItem_listen *conf)
 {
 	aClient *cptr;
+	int  i, n = 1;
 
-	cptr = make_client(NULL, NULL);
-	cptr->flags = FLAGS_LISTEN;
-	cptr->listener = cptr;
-	cptr->from = cptr;
-	SetMe(cptr);
-	strncpyzt(cptr->name, conf->ip, sizeof(cptr->name));
-	if (inetport(cptr, conf->ip, conf->port))
-		cptr->fd = -2;
-	cptr->class = (ConfigItem_class *)conf;
-	cptr->umodes = conf->options ? conf->options : LISTENER_NORMAL;
-	if (cptr->fd >= 0)
-	{	
+#ifdef SO_REUSEPORT
+	if (conf->sockets > 1)
+		n = MIN(conf->sockets, MAXLISTENSOCKETS);
+#endif
+	for (i = 0; i < n; i++)
+	{
+		cptr = make_client(NULL, NULL);
+		cptr->flags = FLAGS_LISTEN;
+		cptr->listener = cptr;
+		cptr->from = cptr;
+		SetMe(cptr);
+		strncpyzt(cptr->name, conf->ip, sizeof(cptr->name));
+		if (n > 1)
+			cptr->umodes = LISTENER_REUSEPORT;
+		if (inetport(cptr, conf->ip, conf->port))
+			cptr->fd = -2;
+		cptr->class = (ConfigItem_class *)conf;
+		cptr->umodes = (conf->options ? conf->options : LISTENER_NORMAL) |
+			((n > 1) ? LISTENER_REUSEPORT : 0);
+		if (cptr->fd < 0)
+		{
+			free_client(cptr);
+			if (i == 0)
+				return -1;
+			ircd_log(LOG_ERROR, "Could only open %d of %d sockets for %s:%i",
+				i, n, conf->ip, conf->port);
+			break;
+		}
 		cptr->umodes |= LISTENER_BOUND;
 		conf->options |= LISTENER_BOUND;
-		conf->listener = cptr;
+		if (i == 0)
+			conf->listener = cptr;
 		set_non_blocking(cptr->fd, cptr);
-		return 1;
 	}
-	else
+	return 1;
+}
+
+/*
+ * listener_backlog
+ *
+ * Returns the number of connections waiting in the accept queue of
+ * listener 'cptr' and the size of that queue in *max, or -1 if the
+ * OS can't tell us.
+ */
+int  listener_backlog(aClient *cptr, int *max)
+{
+#if defined(__linux__) && defined(TCP_INFO)
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+
+	if ((cptr->fd >= 0) &&
+	    !getsockopt(cptr->fd, IPPROTO_TCP, TCP_INFO, &ti, &len))
 	{
-		free_client(cptr);
-		return -1;
+		/* for listening sockets these are the queue length and limit */
+		*max = ti.tcpi_sacked;
+		return ti.tcpi_unacked;
 	}
-
+#endif
+	*max = 0;
+	return -1;
 }
 
 /*
@@ -744,6 +992,11 @@ openlog("ircd", LOG_PID | LOG_NDELAY, LOG_DAEMON); /* reopened now */
 
 #endif /*_WIN32*/
 
+#ifdef USE_EPOLL
+	/* (after the mass close() above, and before the resolver needs it) */
+	ioevent_init();
+#endif
+
 #ifndef CHROOTDIR
 	init_resolver(1);
 #endif
@@ -816,10 +1069,10 @@ static int check_init(aClient *cptr, char *sockn, size_t size)
 	if (inet_netof(sk.SIN_ADDR) == IN_LOOPBACKNET)
 #endif
 	{
-		if (cptr->hostp)
+		if (cptr->conn->hostp)
 		{
-			unreal_free_hostent(cptr->hostp);
-			cptr->hostp = NULL;
+			unreal_free_hostent(cptr->conn->hostp);
+			cptr->conn->hostp = NULL;
 		}
 		strncpyzt(sockn, "localhost", HOSTLEN);
 	}
@@ -850,7 +1103,7 @@ int  check_client(aClient *cptr, char *username)
 	if (check_init(cptr, sockname, sizeof(sockname)))
 		return -2;
 
-	hp = cptr->hostp;
+	hp = cptr->conn->hostp;
 	/*
 	 * Verify that the host to ip mapping is correct both ways and that
 	 * the ip#(s) for the socket is listed for the host.
@@ -956,10 +1209,10 @@ void close_connection(aClient *cptr)
 	if (IsServer(cptr))
 	{
 		ircstp->is_sv++;
-		ircstp->is_sbs += cptr->sendB;
-		ircstp->is_sbr += cptr->receiveB;
-		ircstp->is_sks += cptr->sendK;
-		ircstp->is_skr += cptr->receiveK;
+		ircstp->is_sbs += cptr->conn->sendB;
+		ircstp->is_sbr += cptr->conn->receiveB;
+		ircstp->is_sks += cptr->conn->sendK;
+		ircstp->is_skr += cptr->conn->receiveK;
 		ircstp->is_sti += TStime() - cptr->firsttime;
 		if (ircstp->is_sbs > 1023)
 		{
@@ -975,10 +1228,10 @@ void close_connection(aClient *cptr)
 	else if (IsClient(cptr))
 	{
 		ircstp->is_cl++;
-		ircstp->is_cbs += cptr->sendB;
-		ircstp->is_cbr += cptr->receiveB;
-		ircstp->is_cks += cptr->sendK;
-		ircstp->is_ckr += cptr->receiveK;
+		ircstp->is_cbs += cptr->conn->sendB;
+		ircstp->is_cbr += cptr->conn->receiveB;
+		ircstp->is_cks += cptr->conn->sendK;
+		ircstp->is_ckr += cptr->conn->receiveK;
 		ircstp->is_cti += TStime() - cptr->firsttime;
 		if (ircstp->is_cbs > 1023)
 		{
@@ -1025,10 +1278,10 @@ void close_connection(aClient *cptr)
 			nextconnect = aconf->hold;
 	}
 
-	if (cptr->authfd >= 0)
+	if (cptr->conn->authfd >= 0)
 	{
-		CLOSE_SOCK(cptr->authfd);
-		cptr->authfd = -1;
+		CLOSE_SOCK(cptr->conn->authfd);
+		cptr->conn->authfd = -1;
 		--OpenFiles;
 	}
 
@@ -1161,21 +1414,23 @@ void set_sock_opts(int fd, aClient *cptr)
 #endif
 #if defined(IP_OPTIONS) && defined(IPPROTO_IP) && !defined(_WIN32) && !defined(INET6)
 	{
-		char *s = readbuf, *t = readbuf + sizeof(readbuf) / 2;
+		/* not readbuf, this can be called from within parse() */
+		char optbuf[READBUF_SIZE];
+		char *s = optbuf, *t = optbuf + sizeof(optbuf) / 2;
 
-		opt = sizeof(readbuf) / 8;
+		opt = sizeof(optbuf) / 8;
 		if (getsockopt(fd, IPPROTO_IP, IP_OPTIONS, (OPT_TYPE *)t, &opt) < 0)
 		{
 		    if (ERRNO != P_ECONNRESET) /* FreeBSD can generate this -- Syzop */
 		        report_error("getsockopt(IP_OPTIONS) %s:%s", cptr);
 		}
-		else if (opt > 0 && opt != sizeof(readbuf) / 8)
+		else if (opt > 0 && opt != sizeof(optbuf) / 8)
 		{
-			for (*readbuf = '\0'; opt > 0; opt--, s += 3)
+			for (*optbuf = '\0'; opt > 0; opt--, s += 3)
 				(void)ircsprintf(s, "%2.2x:", *t++);
 			*s = '\0';
 			sendto_realops("Connection %s using IP opts: (%s)",
-			    get_client_name(cptr, TRUE), readbuf);
+			    get_client_name(cptr, TRUE), optbuf);
 		}
 		if (setsockopt(fd, IPPROTO_IP, IP_OPTIONS, (OPT_TYPE *)NULL,
 		    0) < 0)
@@ -1300,7 +1555,7 @@ void set_non_blocking(int fd, aClient *cptr)
  * The client is added to the linked list of clients but isnt added to any
  * hash tables yuet since it doesnt have a name.
  */
-aClient *add_connection(aClient *cptr, int fd)
+aClient *add_connection(aClient *cptr, int fd, struct SOCKADDR_IN *peer)
 {
 	aClient *acptr;
 	ConfigItem_ban *bconf;
@@ -1322,7 +1577,10 @@ aClient *add_connection(aClient *cptr, int fd)
 		struct SOCKADDR_IN addr;
 		int  len = sizeof(struct SOCKADDR_IN);
 
-		if (getpeername(fd, (struct SOCKADDR *)&addr, &len) == -1)
+		/* accept() already told us who it is, usually */
+		if (peer)
+			addr = *peer;
+		else if (getpeername(fd, (struct SOCKADDR *)&addr, &len) == -1)
 		{
 			/* On Linux 2.4 and FreeBSD the socket may just have been disconnected
 			 * so it's not a serious error and can happen quite frequently -- Syzop
@@ -1415,6 +1673,7 @@ add_con_refuse:
 
 	acptr->fd = fd;
     add_local_client(acptr);
+	ioevent_add(acptr->fd, acptr->slot, 0);
 	acptr->listener = cptr;
 	if (!acptr->listener->class)
 	{
@@ -1425,7 +1684,9 @@ add_con_refuse:
 		((ConfigItem_listen *) acptr->listener->class)->clients++;
 	}
 	add_client_to_list(acptr);
+#ifndef USE_ACCEPT4
 	set_non_blocking(acptr->fd, acptr);
+#endif
 	set_sock_opts(acptr->fd, acptr);
 	IRCstats.unknown++;
 #ifdef USE_SSL
@@ -1451,6 +1712,7 @@ add_con_refuse:
 	else
 #endif
 		start_of_normal_client_handshake(acptr);
+	ioevent_update(acptr);
 	return acptr;
 }
 
@@ -1472,7 +1734,7 @@ struct hostent *he;
 		he = unrealdns_doclient(acptr);
 		dns_special_flag = 0;
 
-		if (acptr->hostp)
+		if (acptr->conn->hostp)
 			goto doauth; /* Race condition detected, DNS has been done, continue with auth */
 
 		if (!he)
@@ -1481,7 +1743,7 @@ struct hostent *he;
 			SetDNS(acptr);
 		} else {
 			/* Host was in our cache */
-			acptr->hostp = he;
+			acptr->conn->hostp = he;
 			if (SHOWCONNECTINFO && !acptr->serv && !IsServersOnlyListener(acptr->listener))
 				sendto_one(acptr, "%s", REPORT_FIN_DNSC);
 		}
@@ -1494,12 +1756,83 @@ doauth:
 void proceed_normal_client_handshake(aClient *acptr, struct hostent *he)
 {
 	ClearDNS(acptr);
-	acptr->hostp = he;
+	acptr->conn->hostp = he;
 	if (SHOWCONNECTINFO && !acptr->serv && !IsServersOnlyListener(acptr->listener))
-		sendto_one(acptr, "%s", acptr->hostp ? REPORT_FIN_DNS : REPORT_FAIL_DNS);
+		sendto_one(acptr, "%s", acptr->conn->hostp ? REPORT_FIN_DNS : REPORT_FAIL_DNS);
 	
 	if (!dns_special_flag && !DoingAuth(acptr))
 		SetAccess(acptr);
+	ioevent_update(acptr);
+}
+
+/*
+** read_lines
+**
+** Frame the 'length' bytes at 'buffer' into lines and parse them right
+** where they are. Stops early for fake lag, whatever is left over (that,
+** or an incomplete line) goes on the recvQ. Used for client connections.
+*/
+static int read_lines(aClient *cptr, char *buffer, int length)
+{
+	char *end = buffer + length, *eol;
+	time_t now = TStime();
+	int  done;
+#ifdef USE_SSL
+	int  ssl = cptr->flags & FLAGS_SSL;
+#endif
+
+	while (buffer < end)
+	{
+		/*
+		   ** If it has become registered as a Server then
+		   ** skip the per-message parsing below.
+		 */
+		if (IsServer(cptr))
+		{
+			if ((done = dopacket(cptr, buffer, end - buffer)))
+				return done;
+			return 1;
+		}
+		if ((cptr->status >= STAT_UNKNOWN) && (cptr->since - now >= 10))
+			break;
+		if (!(eol = find_eol(buffer, end - buffer)))
+		{
+			/*
+			   ** A *long* message without any CR or LF: hand
+			   ** (at most) the first 511 bytes to dopacket() and
+			   ** throw away the rest, just like the recvQ path does.
+			   ** Never more than there is, what follows in readbuf
+			   ** is stale.
+			 */
+			if (end - buffer >= 510)
+			{
+				if ((done = dopacket(cptr, buffer, MIN(511, end - buffer))))
+					return done;
+				return 1;
+			}
+			cptr->flags |= FLAGS_NONL;
+			break;
+		}
+		if (cptr->conn->count)
+			done = dopacket(cptr, buffer, eol - buffer + 1);
+		else if (eol == buffer)
+		{
+			buffer++;	/* Skip extra LF/CR's */
+			continue;
+		}
+		else
+			done = doline(cptr, buffer, eol, eol - buffer + 1);
+		if (done)
+			return done;
+		buffer = eol + 1;
+#ifdef USE_SSL
+		if ((cptr->flags & FLAGS_SSL) != ssl)
+			return 1;	/* STARTTLS, the rest was plaintext */
+#endif
+	}
+	if ((buffer < end) && !dbuf_put(&cptr->recvQ, buffer, end - buffer))
+		return exit_client(cptr, cptr, cptr, "dbuf_put fail");
+	return 1;
 }
 
 /*
@@ -1513,23 +1846,33 @@ void proceed_normal_client_handshake(aClient *acptr, struct hostent *he)
 ** however we still check if we need to dequeue anything from the recvQ.
 ** This is necessary, since we may have put something on the recvQ due
 ** to fake lag. -- Syzop
+** For clients, whatever is on the recvQ is normally moved in front of
+** the new data in readbuf, so lines can be parsed in place by read_lines()
+** instead of being copied in and out of the recvQ. Only a fake lag
+** backlog too big for that goes the old dbuf_getmsg() way.
 */
 
 static int read_packet(aClient *cptr, int doread)
 {
-	int  dolen = 0, length = 0, done;
+	int  dolen = 0, length = 0, done, pre = 0;
 	time_t now = TStime();
-	
-	if (doread && !(IsPerson(cptr) && DBufLength(&cptr->recvQ) > 6090))
+	int  client = !(IsServer(cptr) || IsConnecting(cptr) || IsHandshake(cptr));
+
+	if (doread && IsPerson(cptr) && DBufLength(&cptr->recvQ) > 6090)
+		doread = 0;
+	if (client && DBufLength(&cptr->recvQ) &&
+	    (DBufLength(&cptr->recvQ) <= sizeof(readbuf) - (doread ? BUFSIZE : 0)))
+		pre = dbuf_get(&cptr->recvQ, readbuf, sizeof(readbuf));
+	if (doread)
 	{
 		Hook *h;
 		SET_ERRNO(0);
 #ifdef USE_SSL
 		if (cptr->flags & FLAGS_SSL)
-	    		length = ircd_SSL_read(cptr, readbuf, sizeof(readbuf));
+	    		length = ircd_SSL_read(cptr, readbuf + pre, sizeof(readbuf) - pre);
 		else
 #endif
-			length = recv(cptr->fd, readbuf, sizeof(readbuf), 0);
+			length = recv(cptr->fd, readbuf + pre, sizeof(readbuf) - pre, 0);
 		cptr->lasttime = now;
 		if (cptr->lasttime > cptr->since)
 			cptr->since = cptr->lasttime;
@@ -1538,21 +1881,29 @@ static int read_packet(aClient *cptr, int doread)
 		 * If not ready, fake it so it isnt closed
 		 */
 		if (length < 0 && ERRNO == P_EWOULDBLOCK)
-		    return 1;
-		if (length <= 0)
+		{
+			if (!pre)
+				return 1;
+			length = 0;
+		}
+		else if (length <= 0)
 			return length;
-		for (h = Hooks[HOOKTYPE_RAWPACKET_IN]; h; h = h->next)
+		for (h = Hooks[HOOKTYPE_RAWPACKET_IN]; length && h; h = h->next)
 		{
-			int v = (*(h->func.intfunc))(cptr, readbuf, length);
+			int v = (*(h->func.intfunc))(cptr, readbuf + pre, length);
 			if (v <= 0)
+			{
+				if (pre && (v == 0))
+					(void)dbuf_put(&cptr->recvQ, readbuf, pre);
 				return v;
+			}
 		}
 	}
 	/*
 	   ** For server connections, we process as many as we can without
 	   ** worrying about the time of day or anything :)
 	 */
-	if (IsServer(cptr) || IsConnecting(cptr) || IsHandshake(cptr))
+	if (!client)
 	{
 		if (length > 0)
 			if ((done = dopacket(cptr, readbuf, length)))
@@ -1560,25 +1911,29 @@ static int read_packet(aClient *cptr, int doread)
 	}
 	else
 	{
-		/*
-		   ** Before we even think of parsing what we just read, stick
-		   ** it on the end of the receive queue and do it when its
-		   ** turn comes around.
-		 */
-		if (length && !dbuf_put(&cptr->recvQ, readbuf, length))
-			return exit_client(cptr, cptr, cptr, "dbuf_put fail");
-
-		if (IsPerson(cptr) && DBufLength(&cptr->recvQ) > get_recvq(cptr))
+		length += pre;
+		if (IsPerson(cptr) &&
+		    (DBufLength(&cptr->recvQ) + length > get_recvq(cptr)))
 		{
 			sendto_snomask(SNO_FLOOD,
 			    "*** Flood -- %s!%s@%s (%d) exceeds %d recvQ",
 			    cptr->name[0] ? cptr->name : "*",
 			    cptr->user ? cptr->user->username : "*",
 			    cptr->user ? cptr->user->realhost : "*",
-			    DBufLength(&cptr->recvQ), get_recvq(cptr));
+			    DBufLength(&cptr->recvQ) + length, get_recvq(cptr));
 			return exit_client(cptr, cptr, cptr, "Excess Flood");
 		}
 
+		if (!DBufLength(&cptr->recvQ))
+			return read_lines(cptr, readbuf, length);
+
+		/*
+		   ** A big backlog: stick the new data on the end of the
+		   ** receive queue and do it when its turn comes around.
+		 */
+		if (length && !dbuf_put(&cptr->recvQ, readbuf, length))
+			return exit_client(cptr, cptr, cptr, "dbuf_put fail");
+
 		while (DBufLength(&cptr->recvQ) && !NoNewLine(cptr) &&
 		    ((cptr->status < STAT_UNKNOWN) || (cptr->since - now < 10)))
 		{
@@ -1629,16 +1984,410 @@ static int read_packet(aClient *cptr, int doread)
 	return 1;
 }
 
+/*
+ * accept_connections
+ *
+ * Accept new connections on the listener 'cptr' until its queue is empty
+ * or ACCEPTS_PER_LOOP connections have been accepted during this pass of
+ * the main loop. Whatever is left is picked up on the next pass, the
+ * listener will still be readable then.
+ */
+static void accept_connections(aClient *cptr)
+{
+	int  fd;
+	struct SOCKADDR_IN addr;
+	socklen_t addrlen;
+
+	cptr->lasttime = TStime();
+	if (accept_sec != cptr->lasttime)
+	{
+		accept_rate = (accept_sec == cptr->lasttime - 1) ? accept_count : 0;
+		if (accept_rate > accept_rate_peak)
+			accept_rate_peak = accept_rate;
+		accept_count = 0;
+		accept_sec = cptr->lasttime;
+	}
+	/*
+	   ** There may be many reasons for error return, but
+	   ** in otherwise correctly working environment the
+	   ** probable cause is running out of file descriptors
+	   ** (EMFILE, ENFILE or others?). The man pages for
+	   ** accept don't seem to list these as possible,
+	   ** although it's obvious that it may happen here.
+	   ** Thus no specific errors are tested at this
+	   ** point, just assume that connections cannot
+	   ** be accepted until some old is closed first.
+	 *
+	 */
+	for (;;)
+	{
+		if (accept_budget <= 0)
+		{
+			accept_capped++;
+			break;
+		}
+		addrlen = sizeof(addr);
+#ifdef USE_ACCEPT4
+		fd = accept4(cptr->fd, (struct SOCKADDR *)&addr, &addrlen, SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
+		fd = accept(cptr->fd, (struct SOCKADDR *)&addr, &addrlen);
+#endif
+		if (fd < 0)
+		{
+			if ((ERRNO != P_EWOULDBLOCK) && (ERRNO != P_ECONNABORTED))
+				report_baderror("Cannot accept connections %s:%s", cptr);
+			break;
+		}
+		accept_budget--;
+		accept_count++;
+		ircstp->is_ac++;
+		/* We now check:
+		 *  1.  The number of open files, which is the limit imposed by the
+		 *      user during ./Config (MAXCONNECTIONS minus a few).
+		 *  2a) When using select(): 
+		 *      If the fd number exceeds FD_SETSIZE, which is not
+		 *      permitted as otherwise FD_SET() and FD_CLR() will fail
+		 *      in read_message()
+		 *      Note that the value of FD_SETSIZE may be (much) higher than
+		 *      MAXCLIENTS/MAXCONNECTIONS. They are not necessarily the same!
+		 *      FIXME: Figure out why I need a FD_SETSIZE-4 here? still have crashes with -1.
+		 *  2b) When using poll() or epoll():
+		 *      Similar to 2a, check if fd is within 0..MAXCLIENTS bounds, because we
+		 *      use pollfd_to_client[] (or epollfd_to_client[]) to map fd's to client slots.
+		 */
+		if ((++OpenFiles >= MAXCLIENTS) ||
+#ifdef USE_POLL
+		    (fd >= MAXCLIENTS))
+#else
+		    (fd > FD_SETSIZE-4))
+#endif
+		{
+			ircstp->is_ref++;
+			if (last_allinuse < TStime() - 15)
+			{
+				sendto_realops("All connections in use. (%s)",
+				    get_client_name(cptr, TRUE));
+				last_allinuse = TStime();
+			}
+#ifndef INET6
+			(void)send(fd,
+			    "ERROR :All connections in use\r\n", 31, 0);
+#else
+			(void)sendto(fd,
+			    "ERROR :All connections in use\r\n",
+			    31, 0, 0, 0);
+#endif
+			CLOSE_SOCK(fd);
+			--OpenFiles;
+			break;
+		}
+		/*
+		 * Use of add_connection (which never fails :) meLazy
+		 */
+		(void)add_connection(cptr, fd, &addr);
+	}
+	if (!cptr->listener)
+		cptr->listener = &me;
+}
+
+/*
+ * process_client_io
+ *
+ * Handle a (non-listener) local connection after the event loop told us
+ * we can write to it (dowrite) and/or there is something to read (doread).
+ * Even if neither is set, anything left in the recvQ is processed.
+ * Returns FLUSH_BUFFER if the client is gone, 0 otherwise.
+ */
+static int process_client_io(aClient *cptr, int doread, int dowrite)
+{
+	int  length, sockerr;
+
+	if (dowrite)
+	{
+		int  write_err = 0;
+		/*
+		   ** ...room for writing, empty some queue then...
+		 */
+		ClearBlocked(cptr);
+		if (IsConnecting(cptr)) {
+#ifdef USE_SSL
+			if ((cptr->serv) && (cptr->serv->conf->options & CONNECT_SSL))
+			{
+				Debug((DEBUG_DEBUG, "ircd_SSL_client_handshake(%s)", cptr->name));
+				write_err = ircd_SSL_client_handshake(cptr);
+			}
+			else
+#endif
+				write_err = completed_connection(cptr);
+		}
+		if (!write_err)
+		{
+			if (DoList(cptr) && IsSendable(cptr))
+				send_list(cptr, 32);
+			(void)send_queued(cptr);
+		}
+
+		if (IsDead(cptr) || write_err)
+		{
+deadsocket:
+			(void)exit_client(cptr, cptr, &me,
+			    ((sockerr = get_sockerr(cptr))
+			    ? STRERROR(sockerr) : "Client exited"));
+			return FLUSH_BUFFER;
+		}
+	}
+	length = 1;	/* for fall through case */
+
+	if (doread)
+		length = read_packet(cptr, 1);
+	/* If we don't have anything to read and we have any recvQ, then
+	 * read_packet must still be called, but this time with the 2nd parameter
+	 * being 0 (=don't read). This is so we check if anything needs to
+	 * be dequeued from the receive queue (due to fake lag). -- Syzop
+	 */
+	else if (DBufLength(&cptr->recvQ) > 0)
+		length = read_packet(cptr, 0);
+
+#ifdef USE_SSL
+	if ((length != FLUSH_BUFFER) && (cptr->ssl != NULL) && 
+		IsSSLHandshake(cptr) && doread)
+	{
+		if (!SSL_is_init_finished(cptr->ssl))
+		{
+			if (IsDead(cptr) ||
+			    (IsSSLAcceptHandshake(cptr) || IsSSLStartTLSHandshake(cptr)) ? !ircd_SSL_accept(cptr, cptr->fd) : ircd_SSL_connect(cptr) < 0)
+			{
+				length = -1;
+			}
+			/* if (IsSSLStartTLSHandshake(cptr))
+				length = read_packet(cptr, &read_set); */
+		}
+		if (SSL_is_init_finished(cptr->ssl))
+		{
+			if (IsSSLAcceptHandshake(cptr))
+			{
+				Debug((DEBUG_ERROR, "ssl: start_of_normal_client_handshake(%s)", cptr->sockhost));
+				start_of_normal_client_handshake(cptr);
+			}
+			else if (IsSSLConnectHandshake(cptr))
+			{
+				Debug((DEBUG_ERROR, "ssl: completed_connection", cptr->name));
+				completed_connection(cptr);
+			} else if (IsSSLStartTLSHandshake(cptr))
+			{
+				SetUnknown(cptr);
+				/* STARTTLS is now complete. We could send something, but I don't know why... */
+			}
+
+		}
+	}
+#endif
+	if (length > 0)
+		flush_connections(cptr);
+	if ((length != FLUSH_BUFFER) && IsDead(cptr))
+		goto deadsocket;
+	if ((length > 0) && (cptr->fd >= 0) && !doread)
+		return 0;
+	readcalls++;
+	if (length > 0)
+		return 0;
+
+	/*
+	   ** ...hmm, with non-blocking sockets we might get
+	   ** here from quite valid reasons, although.. why
+	   ** would select report "data available" when there
+	   ** wasn't... so, this must be an error anyway...  --msa
+	   ** actually, EOF occurs when read() returns 0 and
+	   ** in due course, select() returns that fd as ready
+	   ** for reading even though it ends up being an EOF. -avalon
+	 */
+	Debug((DEBUG_ERROR, "READ ERROR: fd=%d, errno=%d, length=%d",
+		length == FLUSH_BUFFER ? -2 : cptr->fd, ERRNO, length));
+	/*
+	   ** NOTE: if length == -2 then cptr has already been freed!
+	 */
+	if (length != -2 && (IsServer(cptr) || IsHandshake(cptr)))
+	{
+		if (length == 0)
+		{
+			sendto_locfailops
+			    ("Server %s closed the connection",
+			    get_client_name(cptr, FALSE));
+			sendto_serv_butone(&me,
+			    ":%s GLOBOPS :Server %s closed the connection",
+			    me.name, get_client_name(cptr, FALSE));
+		}
+		else
+			report_baderror("Lost connection to %s:%s", cptr);
+	}
+	if (length != FLUSH_BUFFER)
+		(void)exit_client(cptr, cptr, &me,
+		    ((sockerr = get_sockerr(cptr))
+		    ? STRERROR(sockerr) : "Client exited"));
+	return FLUSH_BUFFER;
+}
+
 /*
  * Check all connections for new connections and input data that is to be
  * processed. Also check for connections with data queued and whether we can
- * write it out.
+ * write it out. Waits at most 'delay' msec for something to happen.
  */
 
+#ifdef USE_EPOLL
+/* epoll version: the kernel keeps our interest list (see ioevent_update())
+ * and only gives back the sockets that are ready. The fdlist argument is
+ * ignored, since there is no point in doing separate passes anymore.
+ */
+#ifdef NO_FDLIST
+int  read_message(long delay)
+#else
+int  read_message(long delay, fdlist *listp)
+#endif
+{
+	aClient *cptr;
+	int  nfds, res, fd, v, i, j, s;
+	unsigned int ev;
+	int  doread, dowrite;
+	int  *pending, npending, *next;
+
+#ifdef USE_LIBCURL
+	url_do_transfers_async();
+#endif
+	accept_budget = ACCEPTS_PER_LOOP;
+
+	/* Time out ident requests. Walk backwards, delfrom_fdlist()
+	 * moves the last entry into the slot being deleted.
+	 */
+	for (j = auth_fdlist.last_entry; j > 0; j--)
+	{
+		i = auth_fdlist.entry[j];
+		if (!(cptr = local[i]) || !DoingAuth(cptr))
+		{
+			delfrom_fdlist(i, &auth_fdlist);
+			continue;
+		}
+		s = TStime() - cptr->firsttime;
+		/* Maybe they should be timed out. -- Syzop. */
+		if ( ((s > IDENT_CONNECT_TIMEOUT) && (cptr->flags & FLAGS_WRAUTH)) ||
+		     (s > IDENT_READ_TIMEOUT))
+		{
+			Debug((DEBUG_NOTICE, "ident timed out (cptr %x, %d sec)", cptr, s));
+			ident_failed(cptr);
+			delfrom_fdlist(i, &auth_fdlist);
+			ioevent_update(cptr);
+		}
+	}
+
+	/* Anything queued since the last pass (eg: by events) */
+	flush_connections(&me);
+
+	pending = recvq_pending[recvq_pending_cur];
+	npending = recvq_pending_count[recvq_pending_cur];
+	recvq_pending_cur = !recvq_pending_cur;
+	next = recvq_pending[recvq_pending_cur];
+	recvq_pending_count[recvq_pending_cur] = 0;
+	if (npending && delay > 2000)
+		delay = 1000;
+
+	for (res = 0;;)
+	{
+		nfds = epoll_wait(epoll_fd, epoll_events, EPOLL_MAXEVENTS, delay);
+		if (nfds == -1 && ERRNO == P_EINTR)
+		{
+			/* don't lose track of the fake lag ones */
+			memcpy(next, pending, npending * sizeof(int));
+			recvq_pending_count[recvq_pending_cur] = npending;
+			return -1;
+		}
+		else if (nfds >= 0)
+			break;
+		report_baderror("epoll_wait %s:%s", &me);
+		res++;
+		if (res > 5)
+			restart("too many epoll_wait errors");
+		sleep(10);
+	}
+
+	/* Ensure that ares processing gets called at least once every loop,
+	 * so it can handle timeouts. -- Syzop
+	 */
+	ares_process_fd(resolver_channel, ARES_SOCKET_BAD, ARES_SOCKET_BAD);
+
+	io_serial++;
+	for (i = 0; i < nfds; i++)
+	{
+		fd = epoll_events[i].data.fd;
+		ev = epoll_events[i].events;
+		v = epollfd_to_client[fd];
+		if (v == IOEVENT_RESOLVER)
+		{
+			ares_process_fd(resolver_channel,
+				(ev & (EPOLLIN|EPOLLERR|EPOLLHUP)) ? fd : ARES_SOCKET_BAD,
+				(ev & EPOLLOUT) ? fd : ARES_SOCKET_BAD);
+			continue;
+		}
+		/* The fd may have been closed (and even reused) by the time
+		 * we get to it, so check it still belongs to this client.
+		 */
+		if ((v < 0) || !(cptr = local[v]))
+			continue;
+		if (fd == cptr->conn->authfd)
+		{
+			if ((ev & (EPOLLOUT|EPOLLERR|EPOLLHUP)) && (cptr->flags & FLAGS_WRAUTH))
+				send_authports(cptr);
+			if ((cptr->conn->authfd >= 0) && (ev & (EPOLLIN|EPOLLERR|EPOLLHUP)))
+				read_authports(cptr);
+			/* Error or hangup without a (complete) reply */
+			if ((cptr->conn->authfd >= 0) && (ev & (EPOLLERR|EPOLLHUP)))
+				ident_failed(cptr);
+			ioevent_update(cptr);
+			continue;
+		}
+		if (fd != cptr->fd)
+			continue;
+		if (IsMe(cptr))
+		{
+			if (IsListening(cptr))
+				accept_connections(cptr);
+			continue;
+		}
+		/* Errors and hangups are reported regardless of what we asked for,
+		 * let the normal read/write code find out what happened.
+		 */
+		doread = (ev & EPOLLIN) ||
+			((ev & (EPOLLERR|EPOLLHUP)) && (epollfd_events[fd] & IOEVENT_READ));
+		dowrite = (ev & EPOLLOUT) ||
+			((ev & (EPOLLERR|EPOLLHUP)) && !(epollfd_events[fd] & IOEVENT_READ));
+		slot_serial[v] = io_serial;
+		if (process_client_io(cptr, doread, dowrite) == FLUSH_BUFFER)
+			continue;
+		if (DBufLength(&cptr->recvQ) > 0)
+			next[recvq_pending_count[recvq_pending_cur]++] = v;
+		ioevent_update(cptr);
+	}
+
+	/* Clients with a non-empty recvQ from the previous pass that weren't
+	 * handled above.
+	 */
+	for (i = 0; i < npending; i++)
+	{
+		v = pending[i];
+		if (!(cptr = local[v]) || (slot_serial[v] == io_serial) || IsMe(cptr) || IsLog(cptr))
+			continue;
+		slot_serial[v] = io_serial;
+		if (process_client_io(cptr, 0, 0) == FLUSH_BUFFER)
+			continue;
+		if (DBufLength(&cptr->recvQ) > 0)
+			next[recvq_pending_count[recvq_pending_cur]++] = v;
+		ioevent_update(cptr);
+	}
+	return 0;
+}
+#else
 #ifdef NO_FDLIST
-int  read_message(time_t delay)
+int  read_message(long delay)
 #else
-int  read_message(time_t delay, fdlist *listp)
+int  read_message(long delay, fdlist *listp)
 #endif
 {
 /* 
@@ -1659,12 +2408,11 @@ int  read_message(time_t delay, fdlist *listp)
 	fd_set read_set, write_set, excpt_set;
 #endif
 	int  j,k, v;
-	time_t delay2 = delay, now;
-	int  res, length, fd, i;
+	long delay2 = delay;
+	time_t now;
+	int  res, i;
 	int  auth = 0;
 
-	int  sockerr;
-
 #ifndef NO_FDLIST
 	/* if it is called with NULL we check all active fd's */
 	if (!listp)
@@ -1675,6 +2423,7 @@ int  read_message(time_t delay, fdlist *listp)
 #endif
 
 	now = TStime();
+	accept_budget = ACCEPTS_PER_LOOP;
 	for (res = 0;;)
 	{
 		FD_ZERO(&read_set);
@@ -1761,8 +2510,8 @@ int  read_message(time_t delay, fdlist *listp)
 			}
 			else if (!IsMe(cptr))
 			{
-				if (DBufLength(&cptr->recvQ) && delay2 > 2)
-					delay2 = 1;
+				if (DBufLength(&cptr->recvQ) && delay2 > 2000)
+					delay2 = 1000;
 				if ((cptr->fd >= 0) && (DBufLength(&cptr->recvQ) < 4088))
 				{
 #ifdef USE_POLL
@@ -1824,10 +2573,10 @@ int  read_message(time_t delay, fdlist *listp)
 		}
 
 #ifdef USE_POLL
-		nfds = poll(pollfds, pollfd_count, MIN(delay, delay2) * 1000);
+		nfds = poll(pollfds, pollfd_count, MIN(delay, delay2));
 #else /* USE_POLL */
-		wait.tv_sec = MIN(delay, delay2);
-		wait.tv_usec = 0;
+		wait.tv_sec = MIN(delay, delay2) / 1000;
+		wait.tv_usec = (MIN(delay, delay2) % 1000) * 1000;
 #ifdef	HPUX
 		nfds = select(MAXCONNECTIONS, (int *)&read_set, (int *)&write_set,
 		    0, &wait);
@@ -1987,79 +2736,8 @@ int  read_message(time_t delay, fdlist *listp)
 			FD_CLR(cptr->fd, &read_set);
 #endif
 			nfds--;
-			cptr->lasttime = TStime();
-			/*
-			   ** There may be many reasons for error return, but
-			   ** in otherwise correctly working environment the
-			   ** probable cause is running out of file descriptors
-			   ** (EMFILE, ENFILE or others?). The man pages for
-			   ** accept don't seem to list these as possible,
-			   ** although it's obvious that it may happen here.
-			   ** Thus no specific errors are tested at this
-			   ** point, just assume that connections cannot
-			   ** be accepted until some old is closed first.
-			 *
-			 */
-			for (k = 0; k < LISTEN_SIZE; k++)
-{			{
-			if ((fd = accept(cptr->fd, NULL, NULL)) < 0)
-			{
-		        if ((ERRNO != P_EWOULDBLOCK) && (ERRNO != P_ECONNABORTED))
-					report_baderror("Cannot accept connections %s:%s", cptr);
-				break;
-			}
-			ircstp->is_ac++;
-			/* We now check:
-			 *  1.  The number of open files, which is the limit imposed by the
-			 *      user during ./Config (MAXCONNECTIONS minus a few).
-			 *  2a) When using select(): 
-			 *      If the fd number exceeds FD_SETSIZE, which is not
-			 *      permitted as otherwise FD_SET() and FD_CLR() will fail
-			 *      in read_message()
-			 *      Note that the value of FD_SETSIZE may be (much) higher than
-			 *      MAXCLIENTS/MAXCONNECTIONS. They are not necessarily the same!
-			 *      FIXME: Figure out why I need a FD_SETSIZE-4 here? still have crashes with -1.
-			 *  2b) When using poll():
-			 *      Similar to 2a, check if fd is within 0..MAXCLIENTS bounds, because we
-			 *      use pollfd_to_client[] to map fd's to client slots.
- 			 */
-			if ((++OpenFiles >= MAXCLIENTS) ||
-#ifdef USE_POLL
-			    (fd >= MAXCLIENTS))
-#else
- 			    (fd > FD_SETSIZE-4))
-#endif
-			{
-				ircstp->is_ref++;
-				if (last_allinuse < TStime() - 15)
-				{
-					sendto_realops("All connections in use. (%s)",
-					    get_client_name(cptr, TRUE));
-					last_allinuse = TStime();
-				}
-#ifndef INET6
-				(void)send(fd,
-				    "ERROR :All connections in use\r\n", 31, 0);
-#else
-				(void)sendto(fd,
-				    "ERROR :All connections in use\r\n",
-				    31, 0, 0, 0);
-#endif
-				CLOSE_SOCK(fd);
-				--OpenFiles;
-				break;
-                          }
-			  /*
-			  * Use of add_connection (which never fails :) meLazy
-			  */
-			  (void)add_connection(cptr, fd);
-			  }
-			 }
-			   nextping = TStime();
-			   if (!cptr->listener)
-				cptr->listener = &me;
-		        
-                      }
+			accept_connections(cptr);
+		}
 	}
 
 #ifdef USE_POLL
@@ -2085,159 +2763,14 @@ int  read_message(time_t delay, fdlist *listp)
 			continue;
 
 #ifdef USE_POLL
-		if (pfd->revents & POLLOUT)
+		(void)process_client_io(cptr, pfd->revents & POLLIN, pfd->revents & POLLOUT);
 #else
-		if (FD_ISSET(cptr->fd, &write_set))
+		(void)process_client_io(cptr, FD_ISSET(cptr->fd, &read_set), FD_ISSET(cptr->fd, &write_set));
 #endif
-		{
-			int  write_err = 0;
-			/*
-			   ** ...room for writing, empty some queue then...
-			 */
-			ClearBlocked(cptr);
-			if (IsConnecting(cptr)) {
-#ifdef USE_SSL
-				if ((cptr->serv) && (cptr->serv->conf->options & CONNECT_SSL))
-				{
-					Debug((DEBUG_DEBUG, "ircd_SSL_client_handshake(%s)", cptr->name));
-					write_err = ircd_SSL_client_handshake(cptr);
-				}
-				else
-#endif
-					write_err = completed_connection(cptr);
-			}
-			if (!write_err)
-			{
-				if (DoList(cptr) && IsSendable(cptr))
-					send_list(cptr, 32);
-				(void)send_queued(cptr);
-			}
-
-			if (IsDead(cptr) || write_err)
-			{
-deadsocket:
-#ifdef USE_POLL
-				if (pfd->revents & POLLIN)
-					--nfds;
-#else
-				if (FD_ISSET(cptr->fd, &read_set))
-				{
-					nfds--;
-					FD_CLR(cptr->fd, &read_set);
-				}
-#endif
-				(void)exit_client(cptr, cptr, &me,
-				    ((sockerr = get_sockerr(cptr))
-				    ? STRERROR(sockerr) : "Client exited"));
-				continue;
-			}
-		}
-		length = 1;	/* for fall through case */
-
-#ifdef USE_POLL
-		if (pfd->revents & POLLIN)
-#else
-		if (FD_ISSET(cptr->fd, &read_set))
-#endif
-			length = read_packet(cptr, 1);
-		/* If we don't have anything to read and we have any recvQ, then
-		 * read_packet must still be called, but this time with the 2nd parameter
-		 * being 0 (=don't read). This is so we check if anything needs to
-		 * be dequeued from the receive queue (due to fake lag). -- Syzop
-		 */
-		else if (DBufLength(&cptr->recvQ) > 0)
-			length = read_packet(cptr, 0);
-
-#ifdef USE_SSL
-		if ((length != FLUSH_BUFFER) && (cptr->ssl != NULL) && 
-			IsSSLHandshake(cptr) &&
-#ifdef USE_POLL
-			pfd->revents & POLLIN)
-#else
-			FD_ISSET(cptr->fd, &read_set))
-#endif
-		{
-			if (!SSL_is_init_finished(cptr->ssl))
-			{
-				if (IsDead(cptr) ||
-				    (IsSSLAcceptHandshake(cptr) || IsSSLStartTLSHandshake(cptr)) ? !ircd_SSL_accept(cptr, cptr->fd) : ircd_SSL_connect(cptr) < 0)
-				{
-					length = -1;
-				}
-				/* if (IsSSLStartTLSHandshake(cptr))
-					length = read_packet(cptr, &read_set); */
-			}
-			if (SSL_is_init_finished(cptr->ssl))
-			{
-				if (IsSSLAcceptHandshake(cptr))
-				{
-					Debug((DEBUG_ERROR, "ssl: start_of_normal_client_handshake(%s)", cptr->sockhost));
-					start_of_normal_client_handshake(cptr);
-				}
-				else if (IsSSLConnectHandshake(cptr))
-				{
-					Debug((DEBUG_ERROR, "ssl: completed_connection", cptr->name));
-					completed_connection(cptr);
-				} else if (IsSSLStartTLSHandshake(cptr))
-				{
-					SetUnknown(cptr);
-					/* STARTTLS is now complete. We could send something, but I don't know why... */
-				}
-
-			}
-		}
-#endif
-		if (length > 0)
-			flush_connections(cptr);
-		if ((length != FLUSH_BUFFER) && IsDead(cptr))
-			goto deadsocket;
-		if ((length > 0) && (cptr->fd >= 0))
-#ifdef USE_POLL
-			if (!(pfd->revents & POLLIN))
-#else
-			if (!FD_ISSET(cptr->fd, &read_set))
-#endif
-				continue;
-		nfds--;
-		readcalls++;
-		if (length > 0)
-			continue;
-
-		/*
-		   ** ...hmm, with non-blocking sockets we might get
-		   ** here from quite valid reasons, although.. why
-		   ** would select report "data available" when there
-		   ** wasn't... so, this must be an error anyway...  --msa
-		   ** actually, EOF occurs when read() returns 0 and
-		   ** in due course, select() returns that fd as ready
-		   ** for reading even though it ends up being an EOF. -avalon
-		 */
-		Debug((DEBUG_ERROR, "READ ERROR: fd=%d, errno=%d, length=%d",
-			length == FLUSH_BUFFER ? -2 : cptr->fd, ERRNO, length));
-		/*
-		   ** NOTE: if length == -2 then cptr has already been freed!
-		 */
-		if (length != -2 && (IsServer(cptr) || IsHandshake(cptr)))
-		{
-			if (length == 0)
-			{
-				sendto_locfailops
-				    ("Server %s closed the connection",
-				    get_client_name(cptr, FALSE));
-				sendto_serv_butone(&me,
-				    ":%s GLOBOPS :Server %s closed the connection",
-				    me.name, get_client_name(cptr, FALSE));
-			}
-			else
-				report_baderror("Lost connection to %s:%s", cptr);
-		}
-		if (length != FLUSH_BUFFER)
-			(void)exit_client(cptr, cptr, &me,
-			    ((sockerr = get_sockerr(cptr))
-			    ? STRERROR(sockerr) : "Client exited"));
 	}
 	return 0;
 }
+#endif /* USE_EPOLL */
 
 /*
  * connect_server
@@ -2288,7 +2821,7 @@ int  connect_server(ConfigItem_link *aconf, aClient *by, struct hostent *hp)
 		}
 	}
 	cptr = make_client(NULL, NULL);
-	cptr->hostp = hp;
+	cptr->conn->hostp = hp;
 	/*
 	 * Copy these in so we have something for error detection.
 	 */
@@ -2367,10 +2900,10 @@ int  connect_server(ConfigItem_link *aconf, aClient *by, struct hostent *hp)
 	cptr->listener = &me;
 	SetConnecting(cptr);
 	SetOutgoing(cptr);
+	ioevent_add(cptr->fd, cptr->slot, IOEVENT_READ|IOEVENT_WRITE);
 	IRCstats.unknown++;
 	get_sockhost(cptr, aconf->hostname);
 	add_client_to_list(cptr);
-	nextping = TStime();
 	return 0;
 }
 
@@ -2439,7 +2972,7 @@ static struct SOCKADDR *connect_inet(ConfigItem_link *aconf, aClient *cptr, int
 	if (aconf->ipnum.S_ADDR == -1)
 #endif
 	{
-		hp = cptr->hostp;
+		hp = cptr->conn->hostp;
 		if (!hp)
 		{
 			Debug((DEBUG_FATAL, "%s: unknown host", aconf->hostname));
@@ -375,6 +375,8 @@ ConfigItem_vhost	*conf_vhost = NULL;
 ConfigItem_link		*conf_link = NULL;
 ConfigItem_cgiirc	*conf_cgiirc = NULL;
 ConfigItem_ban		*conf_ban = NULL;
+static aHostTrie	ban_hosttrie;
+static unsigned int	ban_seq = 0;
 ConfigItem_deny_dcc     *conf_deny_dcc = NULL;
 ConfigItem_deny_channel *conf_deny_channel = NULL;
 ConfigItem_allow_channel *conf_allow_channel = NULL;
@@ -389,6 +391,11 @@ ConfigItem_help		*conf_help = NULL;
 ConfigItem_badword	*conf_badword_channel = NULL;
 ConfigItem_badword      *conf_badword_message = NULL;
 ConfigItem_badword	*conf_badword_quit = NULL;
+#ifdef FAST_BADWORD_REPLACE
+/* All 'fast' badwords of all three lists, see stripbadwords() */
+aACMatcher		badword_matcher;
+static unsigned int	badword_seq = 0;
+#endif
 #endif
 ConfigItem_offchans	*conf_offchans = NULL;
 
@@ -1728,6 +1735,7 @@ void config_setdefaultsettings(aConfiguration *i)
 	i->new_linking_protocol = 1;
 	i->uhnames = 1;
 	i->ping_cookie = 1;
+	i->buffer_pool = BUFFERPOOL;
 #ifdef INET6
 	i->default_ipv6_clone_mask = 64;
 #endif /* INET6 */
@@ -2236,6 +2244,7 @@ void	config_rehash()
 		next = (ListStruct *)ban_ptr->next;
 		if (ban_ptr->flag.type2 == CONF_BAN_TYPE_CONF || ban_ptr->flag.type2 == CONF_BAN_TYPE_TEMPORARY)
 		{
+			hosttrie_del(&ban_hosttrie, &ban_ptr->hostidx);
 			ircfree(ban_ptr->mask);
 			ircfree(ban_ptr->reason);
 			if (ban_ptr->netmask)
@@ -2319,6 +2328,9 @@ void	config_rehash()
 		DelListItem(badword_ptr, conf_badword_quit);
 		MyFree(badword_ptr);
 	}
+#ifdef FAST_BADWORD_REPLACE
+	ac_free(&badword_matcher);
+#endif
 #endif
 	/* Clean up local spamfilter entries... */
 	for (tk = tklines[tkl_hash('f')]; tk; tk = tk_next)
@@ -2930,22 +2942,66 @@ ConfigItem_cgiirc *e;
 	return NULL;
 }
 
+struct ban_hostmatch {
+	char *uhost;
+	short type, type2;
+	ConfigItem_ban *first;
+};
+
+/* Keeps the first (newest) user ban in ban_hosttrie that matches */
+static int ban_hosttrie_match(void *item, void *arg)
+{
+	ConfigItem_ban *ban = (ConfigItem_ban *)item;
+	struct ban_hostmatch *bm = (struct ban_hostmatch *)arg;
+
+	if ((ban->flag.type != bm->type) || ((bm->type2 >= 0) && (ban->flag.type2 != bm->type2)))
+		return 0;
+	if (bm->first && (bm->first->seq > ban->seq))
+		return 0;
+	if (!match(ban->mask, bm->uhost))
+		bm->first = ban;
+	return 0;
+}
+
+/*
+ * User bans on a host name or *.suffix are in ban_hosttrie, this returns
+ * the one that comes first in conf_ban and matches 'uhost' (user@host).
+ * The callers skip all the other ones in there.
+ */
+static ConfigItem_ban *Find_ban_host(char *uhost, short type, short type2)
+{
+	struct ban_hostmatch bm;
+	char *host;
+
+	if ((type != CONF_BAN_USER) || !(host = strchr(uhost, '@')))
+		return NULL;
+	bm.uhost = uhost;
+	bm.type = type;
+	bm.type2 = type2;
+	bm.first = NULL;
+	hosttrie_find(&ban_hosttrie, host + 1, ban_hosttrie_match, &bm);
+	return bm.first;
+}
+
 ConfigItem_ban 	*Find_ban(aClient *sptr, char *host, short type)
 {
-	ConfigItem_ban *ban;
+	ConfigItem_ban *ban, *hostban;
 
 	/* Check for an except ONLY if we find a ban, makes it
 	 * faster since most users will not have a ban so excepts
 	 * don't need to be searched -- codemastr
 	 */
 
+	hostban = Find_ban_host(host, type, -1);
 	for (ban = conf_ban; ban; ban = (ConfigItem_ban *) ban->next)
 	{
 		if (ban->flag.type == type)
 		{
+			if (ban->hostidx.node && (ban != hostban))
+				continue;
 			if (sptr)
 			{
-				if (match_ip(sptr->ip, host, ban->mask, ban->netmask))
+				if ((ban == hostban) || match_ip(sptr->ip, host, ban->mask, ban->netmask))
 				{
 					/* Person got a exception */
 					if ((type == CONF_BAN_USER || type == CONF_BAN_IP)
@@ -2954,7 +3010,7 @@ ConfigItem_ban 	*Find_ban(aClient *sptr, char *host, short type)
 					return ban;
 				}
 			}
-			else if (!match(ban->mask, host)) /* We don't worry about exceptions */
+			else if ((ban == hostban) || !match(ban->mask, host)) /* We don't worry about exceptions */
 				return ban;
 		}
 	}
@@ -2963,27 +3019,30 @@ ConfigItem_ban 	*Find_ban(aClient *sptr, char *host, short type)
 
 ConfigItem_ban 	*Find_banEx(aClient *sptr, char *host, short type, short type2)
 {
-	ConfigItem_ban *ban;
+	ConfigItem_ban *ban, *hostban;
 
 	/* Check for an except ONLY if we find a ban, makes it
 	 * faster since most users will not have a ban so excepts
 	 * don't need to be searched -- codemastr
 	 */
 
+	hostban = Find_ban_host(host, type, type2);
 	for (ban = conf_ban; ban; ban = (ConfigItem_ban *) ban->next)
 	{
 		if ((ban->flag.type == type) && (ban->flag.type2 == type2))
 		{
+			if (ban->hostidx.node && (ban != hostban))
+				continue;
 			if (sptr)
 			{
-				if (match_ip(sptr->ip, host, ban->mask, ban->netmask)) {
+				if ((ban == hostban) || match_ip(sptr->ip, host, ban->mask, ban->netmask)) {
 					/* Person got a exception */
 					if (Find_except(sptr, host, type))
 						return NULL;
 					return ban;
 				}
 			}
-			else if (!match(ban->mask, host)) /* We don't worry about exceptions */
+			else if ((ban == hostban) || !match(ban->mask, host)) /* We don't worry about exceptions */
 				return ban;
 		}
 	}
@@ -3005,7 +3064,7 @@ int	AllowClient(aClient *cptr, struct hostent *hp, char *sockhost, char *usernam
 	{
 		if (!aconf->hostname || !aconf->ip)
 			goto attach;
-		if (aconf->auth && !cptr->passwd && aconf->flags.nopasscont)
+		if (aconf->auth && !cptr->conn->passwd && aconf->flags.nopasscont)
 			continue;
 		if (aconf->flags.ssl && !IsSecure(cptr))
 			continue;
@@ -3106,16 +3165,16 @@ int	AllowClient(aClient *cptr, struct hostent *hp, char *sockhost, char *usernam
 					}
 				}
 		}
-		if ((i = Auth_Check(cptr, aconf->auth, cptr->passwd)) == -1)
+		if ((i = Auth_Check(cptr, aconf->auth, cptr->conn->passwd)) == -1)
 		{
 			exit_client(cptr, cptr, &me,
 				"Password mismatch");
 			return -5;
 		}
-		if ((i == 2) && (cptr->passwd))
+		if ((i == 2) && (cptr->conn->passwd))
 		{
-			MyFree(cptr->passwd);
-			cptr->passwd = NULL;
+			MyFree(cptr->conn->passwd);
+			cptr->conn->passwd = NULL;
 		}
 		if (!((aconf->class->clients + 1) > aconf->class->maxclients))
 		{
@@ -4655,6 +4714,7 @@ int	_conf_listen(ConfigFile *conf, ConfigEntry *ce)
 	char	    *port;
 	int	    start, end, iport, isnew;
 	int tmpflags =0;
+	int sockets = 0;
 
 	strcpy(copy, ce->ce_vardata);
 	/* Seriously cheap hack to make listen <port> work -Stskeeps */
@@ -4687,6 +4747,10 @@ int	_conf_listen(ConfigFile *conf, ConfigEntry *ce)
 					tmpflags |= ofp->flag;
 			}
 		}
+#ifdef SO_REUSEPORT
+		else if (!strcmp(cep->ce_varname, "sockets"))
+			sockets = atoi(cep->ce_vardata);
+#endif
 	}
 #ifndef USE_SSL
 	tmpflags &= ~LISTENER_SSL;
@@ -4706,6 +4770,8 @@ int	_conf_listen(ConfigFile *conf, ConfigEntry *ce)
 			tmpflags |= LISTENER_BOUND;
 
 		listen->options = tmpflags;
+		/* only takes effect when the port is (re)bound */
+		listen->sockets = sockets;
 		if (isnew)
 			AddListItem(listen, conf_listen);
 		listen->flag.temporary = 0;
@@ -4846,6 +4912,31 @@ int	_test_listen(ConfigFile *conf, ConfigEntry *ce)
 #endif
 			}
 		}
+		else if (!strcmp(cep->ce_varname, "sockets"))
+		{
+			int v;
+			if (!cep->ce_vardata)
+			{
+				config_error_empty(cep->ce_fileptr->cf_filename, cep->ce_varlinenum,
+					"listen", "sockets");
+				errors++;
+				continue;
+			}
+			v = atoi(cep->ce_vardata);
+			if ((v < 1) || (v > MAXLISTENSOCKETS))
+			{
+				config_error("%s:%i: listen::sockets must be between 1 and %d",
+					cep->ce_fileptr->cf_filename, cep->ce_varlinenum, MAXLISTENSOCKETS);
+				errors++;
+				continue;
+			}
+#ifndef SO_REUSEPORT
+			if (v > 1)
+				config_warn("%s:%i: listen::sockets is not supported on this OS (no SO_REUSEPORT), "
+				            "only one socket will be used",
+				            cep->ce_fileptr->cf_filename, cep->ce_varlinenum);
+#endif
+		}
 		else
 		{
 			config_error_unknown(cep->ce_fileptr->cf_filename, cep->ce_varlinenum,
@@ -5911,6 +6002,17 @@ static ConfigItem_badword *copy_badword_struct(ConfigItem_badword *ca, int regex
 	return x;
 }
 
+/* Adds a 'fast' badword to badword_matcher, noting which list it is on */
+static void badword_index(ConfigItem_badword *ca, int where)
+{
+#ifdef FAST_BADWORD_REPLACE
+	ca->where = where;
+	ca->seq = ++badword_seq;
+	if (ca->type & BADW_TYPE_FAST)
+		ac_add(&badword_matcher, ca->word, strlen(ca->word), ca);
+#endif
+}
+
 int     _conf_badword(ConfigFile *conf, ConfigEntry *ce)
 {
 	ConfigEntry *cep, *word = NULL;
@@ -6009,16 +6111,31 @@ int     _conf_badword(ConfigFile *conf, ConfigEntry *ce)
 	regcomp(&ca->expr, ca->word, regflags);
 #endif
 	if (!strcmp(ce->ce_vardata, "channel"))
+	{
 		AddListItem(ca, conf_badword_channel);
+		badword_index(ca, BADW_WHERE_CHANNEL);
+	}
 	else if (!strcmp(ce->ce_vardata, "message"))
+	{
 		AddListItem(ca, conf_badword_message);
+		badword_index(ca, BADW_WHERE_MESSAGE);
+	}
 	else if (!strcmp(ce->ce_vardata, "quit"))
+	{
 		AddListItem(ca, conf_badword_quit);
+		badword_index(ca, BADW_WHERE_QUIT);
+	}
 	else if (!strcmp(ce->ce_vardata, "all"))
 	{
+		ConfigItem_badword *x;
 		AddListItem(ca, conf_badword_channel);
-		AddListItem(copy_badword_struct(ca,regex,regflags), conf_badword_message);
-		AddListItem(copy_badword_struct(ca,regex,regflags), conf_badword_quit);
+		badword_index(ca, BADW_WHERE_CHANNEL);
+		x = copy_badword_struct(ca,regex,regflags);
+		AddListItem(x, conf_badword_message);
+		badword_index(x, BADW_WHERE_MESSAGE);
+		x = copy_badword_struct(ca,regex,regflags);
+		AddListItem(x, conf_badword_quit);
+		badword_index(x, BADW_WHERE_QUIT);
 	}
 	return 1;
 }
@@ -6191,6 +6308,7 @@ int _conf_spamfilter(ConfigFile *conf, ConfigEntry *ce)
 		nl->ptr.spamf->tkl_duration = (SPAMFILTER_BAN_TIME ? SPAMFILTER_BAN_TIME : 86400);
 		
 	AddListItem(nl, tklines[tkl_hash('f')]);
+	spamfilter_index_add(nl);
 	return 1;
 }
 
@@ -7182,6 +7300,13 @@ int     _conf_ban(ConfigFile *conf, ConfigEntry *ce)
 			ca ->action = banact_stringtoval(cep->ce_vardata);
 	}
 	AddListItem(ca, conf_ban);
+	ca->seq = ++ban_seq;
+	if ((ca->flag.type == CONF_BAN_USER) && !ca->netmask && ca->mask)
+	{
+		char *host = strchr(ca->mask, '@');
+		if (host)
+			hosttrie_add(&ban_hosttrie, &ca->hostidx, host + 1, ca);
+	}
 	return 0;
 }
 
@@ -7388,6 +7513,9 @@ int	_conf_set(ConfigFile *conf, ConfigEntry *ce)
 		else if (!strcmp(cep->ce_varname, "uhnames")) {
 			tempiConf.uhnames = config_checkval(cep->ce_vardata, CFG_YESNO);
 		}
+		else if (!strcmp(cep->ce_varname, "buffer-pool")) {
+			tempiConf.buffer_pool = config_checkval(cep->ce_vardata, CFG_SIZE);
+		}
 		else if (!strcmp(cep->ce_varname, "allow-userhost-change")) {
 			if (!stricmp(cep->ce_vardata, "always"))
 				tempiConf.userhost_allowed = UHALLOW_ALWAYS;
@@ -7989,6 +8117,20 @@ int	_test_set(ConfigFile *conf, ConfigEntry *ce)
 			CheckNull(cep);
 			CheckDuplicate(cep, uhnames, "uhnames");
 		}
+		else if (!strcmp(cep->ce_varname, "buffer-pool")) {
+			long l;
+
+			CheckNull(cep);
+			CheckDuplicate(cep, buffer_pool, "buffer-pool");
+			l = config_checkval(cep->ce_vardata, CFG_SIZE);
+			if (l < MAXSENDQLENGTH)
+			{
+				config_error("%s:%i: set::buffer-pool: must be at least %ld bytes (MAXSENDQLENGTH)",
+					cep->ce_fileptr->cf_filename, cep->ce_varlinenum,
+					(long)MAXSENDQLENGTH);
+				errors++;
+			}
+		}
 		else if (!strcmp(cep->ce_varname, "channel-command-prefix")) {
 			CheckNull(cep);
 			CheckDuplicate(cep, channel_command_prefix, "channel-command-prefix");
@@ -8934,11 +9076,18 @@ void	run_configuration(void)
 		}
 		else
 		{
-			if (listenptr->listener)
+			int i;
+			aClient *acptr;
+
+			/* all sockets of it, see add_listener2() */
+			for (i = 0; i <= LastSlot; i++)
 			{
-				listenptr->listener->umodes = 
-					(listenptr->options & ~LISTENER_BOUND) ? listenptr->options : LISTENER_NORMAL;
-				listenptr->listener->umodes |= LISTENER_BOUND;
+				if (!(acptr = local[i]) || !IsMe(acptr) || !IsListening(acptr) ||
+				    (acptr->class != (ConfigItem_class *)listenptr))
+					continue;
+				acptr->umodes = (acptr->umodes & LISTENER_REUSEPORT) |
+					((listenptr->options & ~LISTENER_BOUND) ? listenptr->options : LISTENER_NORMAL);
+				acptr->umodes |= LISTENER_BOUND;
 			}
 		}
 	}
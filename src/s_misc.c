@@ -383,12 +383,12 @@ char *get_client_host(aClient *cptr)
 
 	if (!MyConnect(cptr))
 		return cptr->name;
-	if (!cptr->hostp)
+	if (!cptr->conn->hostp)
 		return get_client_name(cptr, FALSE);
 	(void)ircsprintf(nbuf, "%s[%-.*s@%-.*s]",
 	    cptr->name, USERLEN,
   	    (!(cptr->flags & FLAGS_GOTID)) ? "" : cptr->username,
-	    HOSTLEN, cptr->hostp->h_name);
+	    HOSTLEN, cptr->conn->hostp->h_name);
 	return nbuf;
 }
 
@@ -941,6 +941,183 @@ Ilovegotos:
 
 #define SPF_REGEX_FLAGS (REG_ICASE|REG_EXTENDED|REG_NOSUB)
 
+/* Shortest literal worth using as a prefilter, see spamfilter_literals() */
+#define SPAMF_MINLITERAL	3
+
+/* A list of spamfilters, newest first like in tklines[] */
+typedef struct {
+	aTKline **tk;
+	int  num, max;
+} SpamfList;
+
+/*
+ * The spamfilters of each target type (SPAMF_*), so a message only sees
+ * the filters that apply to it. 'nowarn' has the same filters without
+ * the ones with action 'warn', for SPAMFLAG_NOWARN. 'prefilter' holds
+ * just the literals of these filters, see spamfilter_prefilter().
+ */
+static struct {
+	SpamfList all, nowarn;
+	aACMatcher prefilter;
+} spamf_bytype[SPAMF_TYPES];
+static unsigned int spamf_prefilter_gen = 0;
+
+/* Skips the (...) group or [...] bracket expression at 'p', NULL if it doesn't end */
+static char *spamfilter_skipatom(char *p)
+{
+	int  depth = 0;
+
+	do
+	{
+		if (*p == '\\')
+		{
+			if (!*++p)
+				return NULL;
+		}
+		else if (*p == '[')
+		{
+			p++;
+			if (*p == '^')
+				p++;
+			if (*p == ']')
+				p++;
+			for (; *p && (*p != ']'); p++)
+				if ((*p == '[') && ((p[1] == ':') || (p[1] == '.') || (p[1] == '=')))
+				{
+					char *e = strchr(p + 2, p[1]);
+					if (!e || (e[1] != ']'))
+						return NULL;
+					p = e + 1;
+				}
+			if (!*p)
+				return NULL;
+		}
+		else if (*p == '(')
+			depth++;
+		else if (*p == ')')
+			depth--;
+		if (!*p)
+			return NULL;
+		p++;
+	} while (depth > 0);
+	return p;
+}
+
+/*
+ * Works out which plain strings a spamfilter regex can't match without:
+ * for each top level alternative the longest run of ordinary characters
+ * outside groups, classes and optional parts. Returns them as a list of
+ * strings (lower case, the filters are REG_ICASE) ending with an empty
+ * one, or NULL if some alternative has no such run of SPAMF_MINLITERAL
+ * characters, the regex then always has to be run.
+ */
+static char *spamfilter_literals(char *re)
+{
+	char *p = re, *out, *o, *cur, *best, c;
+	int  curlen, bestlen, literal;
+
+	out = o = MyMalloc(strlen(re) + 2);
+	cur = MyMalloc(strlen(re) + 1);
+	best = MyMalloc(strlen(re) + 1);
+	for (;;)
+	{
+		curlen = bestlen = 0;
+		while (*p && (*p != '|'))
+		{
+			literal = 0;
+			c = *p;
+			switch (c)
+			{
+				case '\\':
+					c = p[1];
+					if (!c)
+						goto fail;
+					p += 2;
+					if ((c == 'x') && (*p == '{'))
+					{
+						if (!(p = strchr(p, '}')))
+							goto fail;
+						p++;
+					}
+					else if (c == 'x')
+					{
+						if (isxdigit(*p))
+							p++;
+						if (isxdigit(*p))
+							p++;
+					}
+					else if (!isalnum(c) && (c != '<') && (c != '>') && !(c & 0x80))
+						literal = 1;
+					break;
+				case '[':
+				case '(':
+					if (!(p = spamfilter_skipatom(p)))
+						goto fail;
+					break;
+				case ')':
+					goto fail;
+				case '{':
+					if (!(p = strchr(p, '}')))
+						goto fail;
+					p++;
+					break;
+				case '.':
+				case '^':
+				case '$':
+				case '*':
+				case '+':
+				case '?':
+					p++;
+					break;
+				default:
+					literal = !(c & 0x80);
+					p++;
+					break;
+			}
+			/* a quantifier makes it optional, or repeats it (+) */
+			if (literal && (*p != '*') && (*p != '?') && (*p != '{'))
+				cur[curlen++] = tolower(c);
+			if (!literal || (*p == '*') || (*p == '?') || (*p == '{') || (*p == '+'))
+			{
+				if (curlen > bestlen)
+				{
+					bcopy(cur, best, curlen);
+					bestlen = curlen;
+				}
+				curlen = 0;
+			}
+			while ((*p == '*') || (*p == '+') || (*p == '?') || (*p == '{'))
+			{
+				if ((*p == '{') && !(p = strchr(p, '}')))
+					goto fail;
+				p++;
+			}
+		}
+		if (curlen > bestlen)
+		{
+			bcopy(cur, best, curlen);
+			bestlen = curlen;
+		}
+		if (bestlen < SPAMF_MINLITERAL)
+			goto fail;
+		bcopy(best, o, bestlen);
+		o += bestlen;
+		*o++ = '\0';
+		if (!*p)
+			break;
+		p++;	/* '|' */
+	}
+	*o = '\0';
+	MyFree(cur);
+	MyFree(best);
+	return out;
+fail:
+	MyFree(out);
+	MyFree(cur);
+	MyFree(best);
+	return NULL;
+}
+
 /** Allocates a new Spamfilter entry and compiles/fills in the info.
  * NOTE: originally I wanted to integrate both badwords and spamfilter
  * into one function, but that was quickly getting ugly :(.
@@ -950,9 +1127,138 @@ Spamfilter *unreal_buildspamfilter(char *s)
 Spamfilter *e = MyMallocEx(sizeof(Spamfilter));
 
 	regcomp(&e->expr, s, SPF_REGEX_FLAGS);
+	e->literals = spamfilter_literals(s);
 	return e;
 }
 
+/** Frees a Spamfilter entry allocated by unreal_buildspamfilter() */
+void unreal_freespamfilter(Spamfilter *e)
+{
+	if (e->literals)
+		MyFree(e->literals);
+	regfree(&e->expr);
+	if (e->tkl_reason)
+		MyFree(e->tkl_reason);
+	MyFree(e);
+}
+
+/* Returns the spamf_bytype[] index of target type 'type', -1 if none */
+static int spamfilter_typeindex(int type)
+{
+int i;
+
+	for (i = 0; i < SPAMF_TYPES; i++)
+		if (type & (1 << i))
+			return i;
+	return -1;
+}
+
+static void spamflist_add(SpamfList *l, aTKline *tk)
+{
+	if (l->num == l->max)
+	{
+		l->max = l->max ? l->max * 2 : 8;
+		l->tk = (aTKline **)MyRealloc(l->tk, sizeof(aTKline *) * l->max);
+	}
+	memmove(&l->tk[1], &l->tk[0], sizeof(aTKline *) * l->num);
+	l->tk[0] = tk;
+	l->num++;
+}
+
+static void spamflist_del(SpamfList *l, aTKline *tk)
+{
+int i;
+
+	for (i = 0; i < l->num; i++)
+		if (l->tk[i] == tk)
+		{
+			l->num--;
+			memmove(&l->tk[i], &l->tk[i + 1], sizeof(aTKline *) * (l->num - i));
+			return;
+		}
+}
+
+/** Adds spamfilter 'tk' to the lists of its target types. Call this
+ * after it has been added to tklines[], with its action filled in.
+ */
+void spamfilter_index_add(aTKline *tk)
+{
+Spamfilter *e = tk->ptr.spamf;
+char *l;
+int i;
+
+	for (i = 0; i < SPAMF_TYPES; i++)
+	{
+		if (!(tk->subtype & (1 << i)))
+			continue;
+		spamflist_add(&spamf_bytype[i].all, tk);
+		if (e->action != BAN_ACT_WARN)
+			spamflist_add(&spamf_bytype[i].nowarn, tk);
+		if (e->literals)
+			for (l = e->literals; *l; l += strlen(l) + 1)
+				ac_add(&spamf_bytype[i].prefilter, l, strlen(l), e);
+	}
+}
+
+/** Removes what spamfilter_index_add() added, before 'tk' is freed */
+void spamfilter_index_del(aTKline *tk)
+{
+Spamfilter *e = tk->ptr.spamf;
+char *l;
+int i;
+
+	for (i = 0; i < SPAMF_TYPES; i++)
+	{
+		if (!(tk->subtype & (1 << i)))
+			continue;
+		spamflist_del(&spamf_bytype[i].all, tk);
+		spamflist_del(&spamf_bytype[i].nowarn, tk);
+		if (e->literals)
+			for (l = e->literals; *l; l += strlen(l) + 1)
+				ac_del(&spamf_bytype[i].prefilter, l, strlen(l), e);
+	}
+}
+
+/** Returns the spamfilters for target type 'type' (one SPAMF_*), newest
+ * first, and their number in 'num'. With SPAMFLAG_NOWARN in 'flags' the
+ * ones with action 'warn' are left out.
+ */
+aTKline **spamfilter_getlist(int type, int flags, int *num)
+{
+SpamfList *l;
+int i;
+
+	if ((i = spamfilter_typeindex(type)) < 0)
+	{
+		*num = 0;
+		return NULL;
+	}
+	l = (flags & SPAMFLAG_NOWARN) ? &spamf_bytype[i].nowarn : &spamf_bytype[i].all;
+	*num = l->num;
+	return l->tk;
+}
+
+static int spamfilter_prefilter_hit(void *data, int start, int end, void *arg)
+{
+	((Spamfilter *)data)->hit = *(unsigned int *)arg;
+	return 0;
+}
+
+/** Scans 'str' once for the literals of the spamfilters of target type
+ * 'type'. Afterwards the filters with e->literals whose e->hit isn't the
+ * returned value can't match 'str' and don't need regexec().
+ */
+unsigned int spamfilter_prefilter(char *str, int type)
+{
+int i;
+
+	if (!++spamf_prefilter_gen)
+		spamf_prefilter_gen++;
+	if ((i = spamfilter_typeindex(type)) >= 0)
+		ac_scan(&spamf_bytype[i].prefilter, str, -1, spamfilter_prefilter_hit, &spamf_prefilter_gen);
+	return spamf_prefilter_gen;
+}
+
 
 /*|| BAN ACTION ROUTINES FOLLOW ||*/
 
@@ -1136,6 +1442,7 @@ char *getcloak(aClient *sptr)
 	{
 		/* need to calculate (first-time) */
 		make_virthost(sptr, sptr->user->realhost, sptr->user->cloakedhost, 0);
+		UserIdentityChanged(sptr);
 	}
 
 	return sptr->user->cloakedhost;
@@ -87,6 +87,7 @@ void iNAH_host(aClient *sptr, char *host)
 		sendto_serv_butone_token(&me, sptr->name, MSG_SETHOST,
 		    TOK_SETHOST, "%s", sptr->user->virthost);
 	sptr->umodes |= UMODE_SETHOST;
+	UserIdentityChanged(sptr);
 	
 	if (UHOST_ALLOWED == UHALLOW_REJOIN)
 		rejoin_dojoinandmode(sptr, did_parts);
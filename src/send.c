@@ -42,6 +42,7 @@ static char sccsid[] =
 
 void vsendto_one(aClient *to, char *pattern, va_list vl);
 void sendbufto_one(aClient *to, char *msg, unsigned int quick);
+void sendbufto_one_shared(aClient *to, char *msg, unsigned int len, dbufshared **blk);
 int vmakebuf_local_withprefix(char *buf, struct Client *from, const char *pattern, va_list vl);
 
 #define ADD_CRLF(buf, len) { if (len > 510) len = 510; \
@@ -74,6 +75,15 @@ void vsendto_prefix_one(struct Client *to, struct Client *from,
 
 MODVAR int  sentalong_marker;
 MODVAR int  sendanyways = 0;
+
+#ifdef USE_EPOLL
+/* Slots that had something queued since the last flush_connections(&me),
+ * so we don't have to walk all of local[] to find them.
+ */
+static int flush_slots[MAXCONNECTIONS];
+static char flush_queued[MAXCONNECTIONS];
+static int flush_count = 0;
+#endif
 /*
 ** dead_link
 **	An error has been detected. The link *must* be closed,
@@ -88,6 +98,7 @@ static int dead_link(aClient *to, char *notice)
 {
 	
 	to->flags |= FLAGS_DEADSOCKET;
+	set_ping_timer(to, 0);	/* exit it from the main loop */
 	/*
 	 * If because of BUFFERPOOL problem then clean dbuf's now so that
 	 * notices don't hurt operators below.
@@ -99,10 +110,52 @@ static int dead_link(aClient *to, char *notice)
 		(void)sendto_failops_whoare_opers("Closing link: %s - %s",
 			notice, get_client_name(to, FALSE));
 	Debug((DEBUG_ERROR, "dead_link: %s - %s", notice, get_client_name(to, FALSE)));
-	to->error_str = strdup(notice);
+	to->conn->error_str = strdup(notice);
 	return -1;
 }
 
+/*
+** sendq_shed
+**	The dbuf's need 'need' more bytes but that goes over
+**	set::buffer-pool. Drop the local users (and unregistered
+**	connections) with the biggest sendQ's until it fits. Servers are
+**	not dropped, a netsplit would only make things worse.
+**	'keep' is the dbuf our caller is adding to, it can't be cleared
+**	from under it: if its client is the next one to go we return 0
+**	and the allocation fails, which drops that client instead.
+**	Returns 1 if there is room now.
+*/
+int  sendq_shed(dbuf *keep, u_int need)
+{
+	aClient *acptr, *victim;
+	int  i, n = 0, ret = 1;
+
+	while (dbufmem + need > BUFFER_POOL)
+	{
+		victim = NULL;
+		for (i = LastSlot; i >= 0; i--)
+			if ((acptr = local[i]) && (IsPerson(acptr) || IsUnknown(acptr)) &&
+			    !IsDead(acptr) &&
+			    (!victim || (DBufLength(&acptr->sendQ) > DBufLength(&victim->sendQ))))
+				victim = acptr;
+		if (!victim || !DBufLength(&victim->sendQ))
+		{
+			ret = 0;
+			break;
+		}
+		n++;
+		if ((&victim->sendQ == keep) || (&victim->recvQ == keep))
+		{
+			ret = 0;
+			break;
+		}
+		dead_link(victim, "Max SendQ exceeded");
+	}
+	if (n)
+		ircsprintf(trouble_info, "buffer pool full, dropped %d client(s) with the biggest sendQ (see set::buffer-pool)", n);
+	return ret;
+}
+
 /*
 ** flush_connections
 **	Used to empty all output buffers for all connections. Should only
@@ -119,6 +172,24 @@ void flush_connections(aClient* cptr)
 
 	if (&me == cptr)
 	{
+#ifdef USE_EPOLL
+		/* (send_queued() may queue new data to others, eg: opers
+		 *  getting a 'Closing link' notice, so don't cache flush_count)
+		 */
+		for (i = 0; i < flush_count; i++)
+		{
+			flush_queued[flush_slots[i]] = 0;
+			if ((acptr = local[flush_slots[i]]) && (acptr->fd >= 0)
+			    && !(acptr->flags & FLAGS_BLOCKED) && !IsDead(acptr)
+			    && ((DBufLength(&acptr->sendQ) > 0)
+#ifdef ZIP_LINKS
+				|| (IsZipped(acptr) && acptr->zip->outcount)
+#endif /* ZIP_LINKS */
+				) )
+				send_queued(acptr);
+		}
+		flush_count = 0;
+#else
 		for (i = LastSlot; i >= 0; i--)
 			if ((acptr = local[i]) && !(acptr->flags & FLAGS_BLOCKED)
 			    && ((DBufLength(&acptr->sendQ) > 0)
@@ -127,6 +198,7 @@ void flush_connections(aClient* cptr)
 #endif /* ZIP_LINKS */
 				) )
 				send_queued(acptr);
+#endif
 	}
 	else if (cptr->fd >= 0 && !(cptr->flags & FLAGS_BLOCKED)
 	    && ((DBufLength(&cptr->sendQ) > 0)
@@ -162,6 +234,10 @@ int  send_queued(aClient *to)
 {
 	char *msg;
 	int  len, rlen;
+#ifndef _WIN32
+	struct iovec iov[DBUF_IOV_MAX];
+	int  iovcnt;
+#endif
 #ifdef ZIP_LINKS
 	int more = 0;
 #endif
@@ -200,9 +276,16 @@ int  send_queued(aClient *to)
 #endif
 	while (DBufLength(&to->sendQ) > 0)
 	{
+#ifndef _WIN32
+		/* Hand as much of the sendQ as we can to a single writev() */
+		iovcnt = dbuf_mapv(&to->sendQ, iov, DBUF_IOV_MAX, &len);
+		/* Returns always len > 0 */
+		if ((rlen = deliver_itv(to, iov, iovcnt)) < 0)
+#else
 		msg = dbuf_map(&to->sendQ, &len);
 		/* Returns always len > 0 */
 		if ((rlen = deliver_it(to, msg, len)) < 0)
+#endif
 		{
 			char buf[256];
 			snprintf(buf, 256, "Write error: %s", STRERROR(ERRNO));
@@ -233,7 +316,10 @@ int  send_queued(aClient *to)
 #endif
 	}
 
-	return (IsDead(to)) ? -1 : 0;
+	if (IsDead(to))
+		return -1;
+	ioevent_update(to);
+	return 0;
 }
 
 /*
@@ -254,6 +340,59 @@ void vsendto_one(aClient *to, char *pattern, va_list vl)
 }
 
 
+/*
+ * sendq_full
+ * Checks if the sendQ of 'to' is over its limit, if so the client is
+ * marked dead and 1 is returned.
+ */
+static int sendq_full(aClient *to)
+{
+	if (DBufLength(&to->sendQ) > get_sendq(to))
+	{
+		if (IsServer(to))
+			sendto_ops("Max SendQ limit exceeded for %s: %u > %d",
+			    get_client_name(to, FALSE), DBufLength(&to->sendQ),
+			    get_sendq(to));
+		dead_link(to, "Max SendQ exceeded");
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * sendq_added
+ * Called after a message has been added to the sendQ of 'to'.
+ */
+static void sendq_added(aClient *to)
+{
+#ifdef USE_EPOLL
+	if ((to->slot >= 0) && !flush_queued[to->slot])
+	{
+		flush_queued[to->slot] = 1;
+		flush_slots[flush_count++] = to->slot;
+	}
+#endif
+	/*
+	 * Update statistics. The following is slightly incorrect
+	 * because it counts messages even if queued, but bytes
+	 * only really sent. Queued bytes get updated in SendQueued.
+	 */
+	to->sendM += 1;
+	me.sendM += 1;
+	if (to->listener != &me)
+		to->listener->sendM += 1;
+	/*
+	 * This little bit is to stop the sendQ from growing too large when
+	 * there is no need for it to. Thus we call send_queued() every time
+	 * 2k has been added to the queue since the last non-fatal write.
+	 * Also stops us from deliberately building a large sendQ and then
+	 * trying to flood that link with data (possible during the net
+	 * relinking done by servers with a large load).
+	 */
+	if (DBufLength(&to->sendQ) / 1024 > to->lastsq)
+		send_queued(to);
+}
+
 /* sendbufto_one:
  * to: the client to which the buffer should be send
  * msg: the message
@@ -324,15 +463,8 @@ void sendbufto_one(aClient *to, char *msg, unsigned int quick)
 		(*(h->func.intfunc))(&me, to, &msg, &len);
 		if(!msg) return;
 	}
-	if (DBufLength(&to->sendQ) > get_sendq(to))
-	{
-		if (IsServer(to))
-			sendto_ops("Max SendQ limit exceeded for %s: %u > %d",
-			    get_client_name(to, FALSE), DBufLength(&to->sendQ),
-			    get_sendq(to));
-		dead_link(to, "Max SendQ exceeded");
+	if (sendq_full(to))
 		return;
-	}
 
 #ifdef ZIP_LINKS
 	/*
@@ -352,25 +484,47 @@ void sendbufto_one(aClient *to, char *msg, unsigned int quick)
 		dead_link(to, "Buffer allocation error");
 		return;
 	}
-	/*
-	 * Update statistics. The following is slightly incorrect
-	 * because it counts messages even if queued, but bytes
-	 * only really sent. Queued bytes get updated in SendQueued.
-	 */
-	to->sendM += 1;
-	me.sendM += 1;
-	if (to->listener != &me)
-		to->listener->sendM += 1;
-	/*
-	 * This little bit is to stop the sendQ from growing too large when
-	 * there is no need for it to. Thus we call send_queued() every time
-	 * 2k has been added to the queue since the last non-fatal write.
-	 * Also stops us from deliberately building a large sendQ and then
-	 * trying to flood that link with data (possible during the net
-	 * relinking done by servers with a large load).
-	 */
-	if (DBufLength(&to->sendQ) / 1024 > to->lastsq)
-		send_queued(to);
+	sendq_added(to);
+}
+
+/* sendbufto_one_shared:
+ * Same as sendbufto_one(to, msg, len) with 'len' being the 'quick' length,
+ * but meant for sending the very same line to a lot of local clients
+ * (eg: all local members of a channel). The line is copied only once, into
+ * a shared block which is then linked into the sendQ of each recipient.
+ * '*blk' must be NULL on the first call, the caller has to call
+ * dbuf_shared_release(*blk) once done (if it's not NULL).
+ */
+void sendbufto_one_shared(aClient *to, char *msg, unsigned int len, dbufshared **blk)
+{
+	if (to->from)
+		to = to->from;
+	/* Anything special: let sendbufto_one() deal with it */
+	if (IsMe(to) || Hooks[HOOKTYPE_PACKET]
+#ifdef ZIP_LINKS
+	    || IsZipped(to)
+#endif
+	    )
+	{
+		sendbufto_one(to, msg, len);
+		return;
+	}
+	Debug((DEBUG_ERROR, "Sending [%s] to %s", msg, to->name));
+	if (IsDead(to) || (to->fd < 0))
+		return;
+	if (sendq_full(to))
+		return;
+	if (!*blk && !(*blk = dbuf_shared_new(msg, len)))
+	{
+		sendbufto_one(to, msg, len);
+		return;
+	}
+	if (!dbuf_put_shared(&to->sendQ, *blk))
+	{
+		dead_link(to, "Buffer allocation error");
+		return;
+	}
+	sendq_added(to);
 }
 
 void sendto_channel_butone(aClient *one, aClient *from, aChannel *chptr,
@@ -379,31 +533,47 @@ void sendto_channel_butone(aClient *one, aClient *from, aChannel *chptr,
 	va_list vl;
 	Member *lp;
 	aClient *acptr;
-	int  i;
-
-	va_start(vl, pattern);
+	int  i, len = 0;
+	char buf[2048];
+	dbufshared *blk = NULL;
 
-	++sentalong_marker;
-	for (lp = chptr->members; lp; lp = lp->next)
+	for (lp = chptr->lmembers; lp; lp = lp->lnext)
 	{
 		acptr = lp->cptr;
 		/* skip the one and deaf clients (unless sendanyways is set) */
-		if (acptr->from == one || (IsDeaf(acptr) && !(sendanyways == 1)))
+		if (acptr == one || (IsDeaf(acptr) && !(sendanyways == 1)))
 			continue;
-		if (MyConnect(acptr))	/* (It is always a client) */
-			vsendto_prefix_one(acptr, from, pattern, vl);
-		else if (sentalong[(i = acptr->from->slot)] != sentalong_marker)
+		/* Same line for all local clients, build it only once */
+		if (!len)
 		{
-			sentalong[i] = sentalong_marker;
-			/*
-			 * Burst messages comes here..
-			 */
 			va_start(vl, pattern);
-			vsendto_prefix_one(acptr, from, pattern, vl);
+			len = vmakebuf_local_withprefix(buf, from, pattern, vl);
 			va_end(vl);
 		}
+		sendbufto_one_shared(acptr, buf, len, &blk);
 	}
-	va_end(vl);
+	if (blk)
+		dbuf_shared_release(blk);
+
+	/* And once to each server link that has members behind it */
+	len = 0;
+	blk = NULL;
+	for (i = 0; i < chptr->nlinks; i++)
+	{
+		acptr = chptr->links[i].cptr;
+		if (acptr == one)
+			continue;
+		if (!len)
+		{
+			va_start(vl, pattern);
+			len = ircvsprintf(buf, pattern, vl) - buf;
+			va_end(vl);
+			ADD_CRLF(buf, len);
+		}
+		sendbufto_one_shared(acptr, buf, len, &blk);
+	}
+	if (blk)
+		dbuf_shared_release(blk);
 }
 
 void sendto_channelprefix_butone(aClient *one, aClient *from, aChannel *chptr,
@@ -413,9 +583,9 @@ void sendto_channelprefix_butone(aClient *one, aClient *from, aChannel *chptr,
 	va_list vl;
 	Member *lp;
 	aClient *acptr;
-	int  i;
-
-	va_start(vl, pattern);
+	int  i, len = 0;
+	char buf[2048];
+	dbufshared *blk = NULL;
 
 	++sentalong_marker;
 	for (lp = chptr->members; lp; lp = lp->next)
@@ -447,9 +617,13 @@ void sendto_channelprefix_butone(aClient *one, aClient *from, aChannel *chptr,
 				if (!IsSecure(acptr))
 					continue;
 #endif
-			va_start(vl, pattern);
-			vsendto_prefix_one(acptr, from, pattern, vl);
-			va_end(vl);
+			if (!len)
+			{
+				va_start(vl, pattern);
+				len = vmakebuf_local_withprefix(buf, from, pattern, vl);
+				va_end(vl);
+			}
+			sendbufto_one_shared(acptr, buf, len, &blk);
 			sentalong[i] = sentalong_marker;
 		}
 		else
@@ -469,15 +643,45 @@ void sendto_channelprefix_butone(aClient *one, aClient *from, aChannel *chptr,
 				sentalong[i] = sentalong_marker;
 			}
 		}
-		va_end(vl);
 	}
-	va_end(vl);
+	if (blk)
+		dbuf_shared_release(blk);
 	return;
 }
 
+/*
+ * Append the 'textlen' bytes of 'text' at 'p' in 'buf', as far as they
+ * fit in a line (ADD_CRLF() would cut them off there anyway), and
+ * return the length of what is in 'buf' now.
+ */
+static unsigned int add_text(char *buf, char *p, char *text, int textlen)
+{
+	int  n = MIN(textlen, 510 - (int)(p - buf));
+
+	if (n > 0)
+	{
+		memcpy(p, text, n);
+		p += n;
+	}
+	return (unsigned int)(p - buf);
+}
+
 void sendto_channelprefix_butone_tok(aClient *one, aClient *from, aChannel *chptr,
 	int	prefix,
     char *cmd, char *tok, char *nick, char *text, char do_send_check)
+{
+	sendto_channelprefix_butone_tok_len(one, from, chptr, prefix, cmd, tok,
+	    nick, text, strlen(text), do_send_check);
+}
+
+/*
+ * Same, but for a 'text' of which the length is already known (like
+ * from parv_len()), so it is copied into each of the lines instead of
+ * being formatted into them with "%s".
+ */
+void sendto_channelprefix_butone_tok_len(aClient *one, aClient *from, aChannel *chptr,
+	int	prefix,
+    char *cmd, char *tok, char *nick, char *text, int textlen, char do_send_check)
 {
 	Member *lp;
 	aClient *acptr;
@@ -485,24 +689,25 @@ void sendto_channelprefix_butone_tok(aClient *one, aClient *from, aChannel *chpt
 	char is_ctcp = 0;
 	unsigned int tlen, clen, xlen, wlen = 0;
 	char *p;
+	dbufshared *xblk = NULL, *wblk = NULL;
 
 	/* For servers with token capability */
-	p = ircsprintf(tcmd, ":%s %s %s :%s", from->name, tok, nick, text);
-	tlen = (int)(p - tcmd);
+	p = ircsprintf(tcmd, ":%s %s %s :", from->name, tok, nick);
+	tlen = add_text(tcmd, p, text, textlen);
 	ADD_CRLF(tcmd, tlen);
 
 	/* For dumb servers without tokens */
-	p = ircsprintf(ccmd, ":%s %s %s :%s", from->name, cmd, nick, text);
-	clen = (int)(p - ccmd);
+	p = ircsprintf(ccmd, ":%s %s %s :", from->name, cmd, nick);
+	clen = add_text(ccmd, p, text, textlen);
 	ADD_CRLF(ccmd, clen);
 
 	/* For our users... */
 	if (IsPerson(from))
-		p = ircsprintf(xcmd, ":%s!%s@%s %s %s :%s",
-			from->name, from->user->username, GetHost(from), cmd, nick, text);
+		p = ircsprintf(xcmd, ":%s!%s@%s %s %s :",
+			from->name, from->user->username, GetHost(from), cmd, nick);
 	else
-		p = ircsprintf(xcmd, ":%s %s %s :%s", from->name, cmd, nick, text);
-	xlen = (int)(p - xcmd);
+		p = ircsprintf(xcmd, ":%s %s %s :", from->name, cmd, nick);
+	xlen = add_text(xcmd, p, text, textlen);
 	ADD_CRLF(xcmd, xlen);
 
 	/* For our webtv friends... */
@@ -510,11 +715,11 @@ void sendto_channelprefix_butone_tok(aClient *one, aClient *from, aChannel *chpt
 	{
 		char *chan = strchr(nick, '#'); /* impossible to become NULL? */
 		if (IsPerson(from))
-			p = ircsprintf(wcmd, ":%s!%s@%s %s %s :%s",
-				from->name, from->user->username, GetHost(from), MSG_PRIVATE, chan, text);
+			p = ircsprintf(wcmd, ":%s!%s@%s %s %s :",
+				from->name, from->user->username, GetHost(from), MSG_PRIVATE, chan);
 		else
-			p = ircsprintf(wcmd, ":%s %s %s :%s", from->name, MSG_PRIVATE, chan, text);
-		wlen = (int)(p - wcmd);
+			p = ircsprintf(wcmd, ":%s %s %s :", from->name, MSG_PRIVATE, chan);
+		wlen = add_text(wcmd, p, text, textlen);
 		ADD_CRLF(wcmd, wlen);
 	}
 
@@ -555,9 +760,9 @@ void sendto_channelprefix_butone_tok(aClient *one, aClient *from, aChannel *chpt
 				continue;
 
 			if (IsWebTV(acptr) && wlen)
-				sendbufto_one(acptr, wcmd, wlen);
+				sendbufto_one_shared(acptr, wcmd, wlen, &wblk);
 			else
-				sendbufto_one(acptr, xcmd, xlen);
+				sendbufto_one_shared(acptr, xcmd, xlen, &xblk);
 			sentalong[i] = sentalong_marker;
 		}
 		else
@@ -574,6 +779,10 @@ void sendto_channelprefix_butone_tok(aClient *one, aClient *from, aChannel *chpt
 			}
 		}
 	}
+	if (xblk)
+		dbuf_shared_release(xblk);
+	if (wblk)
+		dbuf_shared_release(wblk);
 	return;
 }
 
@@ -656,6 +865,92 @@ void sendto_chanops_butone(aClient *one, aChannel *chptr, char *pattern, ...)
 	va_end(vl);
 }
 
+/*
+ * Server broadcasts. The same line can go out in up to four forms: with
+ * the token or the full command, and with a NS "@numeric" or a ":name"
+ * prefix. Each form is built only once, when the first link that wants
+ * it comes along, and is then shared by all links that get that form
+ * (see sendbufto_one_shared()), instead of being formatted again for
+ * every link.
+ */
+#define SV_TOKEN	0x1
+#define SV_NS		0x2
+
+static struct {
+	char buf[2048 + HOSTLEN + 64];
+	int  len;	/* 0 = not built yet */
+	dbufshared *blk;
+} servvar[4];
+
+static void servvar_begin(void)
+{
+	int  i;
+
+	for (i = 0; i < 4; i++)
+	{
+		servvar[i].len = 0;
+		servvar[i].blk = NULL;
+	}
+}
+
+static void servvar_end(void)
+{
+	int  i;
+
+	for (i = 0; i < 4; i++)
+		if (servvar[i].blk)
+		{
+			dbuf_shared_release(servvar[i].blk);
+			servvar[i].blk = NULL;
+		}
+}
+
+/* Finish form 'v' that was just put in servvar[v].buf and ends at 'p' */
+static void servvar_done(int v, char *p)
+{
+	int  len = p - servvar[v].buf;
+
+	if (!len || (servvar[v].buf[len - 1] != '\n'))
+		ADD_CRLF(servvar[v].buf, len);
+	servvar[v].len = len;
+}
+
+static void servvar_send(aClient *cptr, int v)
+{
+	sendbufto_one_shared(cptr, servvar[v].buf, servvar[v].len, &servvar[v].blk);
+}
+
+/* Send "<prefix> <command or token> <args>" to server link 'cptr' */
+static void servvar_send_cmd(aClient *cptr, char *prefix, char *pref,
+    char *command, char *token, char *args)
+{
+	int  v = 0;
+
+	if (IsToken(cptr))
+		v |= SV_TOKEN;
+	if (SupportNS(cptr) && pref[0])
+		v |= SV_NS;
+	if (!servvar[v].len)
+		servvar_done(v, ircsprintf(servvar[v].buf, "%c%s %s %s",
+		    (v & SV_NS) ? '@' : ':', (v & SV_NS) ? pref : prefix,
+		    (v & SV_TOKEN) ? token : command, args));
+	servvar_send(cptr, v);
+}
+
+/* NS numeric of server 'prefix' in 'pref', or "" */
+static void servvar_pref(char *pref, char *prefix)
+{
+	aClient *acptr;
+
+	pref[0] = '\0';
+	if (strchr(prefix, '.'))
+	{
+		acptr = (aClient *) find_server_quick(prefix);
+		if (acptr && acptr->serv && acptr->serv->numeric)
+			strcpy(pref, base64enc(acptr->serv->numeric));
+	}
+}
+
 /*
  * sendto_server_butone
  *
@@ -670,7 +965,7 @@ void sendto_serv_butone(aClient *one, char *pattern, ...)
 	int  j;
 #endif
 
-	va_start(vl, pattern);
+	servvar_begin();
 #ifdef NO_FDLIST
 	for (i = 0; i <= LastSlot; i++)
 #else
@@ -679,15 +974,19 @@ void sendto_serv_butone(aClient *one, char *pattern, ...)
 	{
 		if (!(cptr = local[i]) || (one && cptr == one->from))
 			continue;
-		va_start(vl, pattern);
-
 #ifdef NO_FDLIST
-		if (IsServer(cptr))
+		if (!IsServer(cptr))
+			continue;
 #endif
-			vsendto_one(cptr, pattern, vl);
-		va_end(vl);
+		if (!servvar[0].len)
+		{
+			va_start(vl, pattern);
+			servvar_done(0, ircvsprintf(servvar[0].buf, pattern, vl));
+			va_end(vl);
+		}
+		servvar_send(cptr, 0);
 	}
-	va_end(vl);
+	servvar_end();
 	return;
 }
 
@@ -704,31 +1003,18 @@ void sendto_serv_butone_token(aClient *one, char *prefix, char *command,
 	va_list vl;
 	int  i;
 	aClient *cptr;
-	aClient *acptr;
 #ifndef NO_FDLIST
 	int  j;
 #endif
 	static char buff[2048];
 	static char pref[100];
-	va_start(vl, pattern);
 
-	pref[0] = '\0';
-	if (strchr(prefix, '.'))
-	{
-		acptr = (aClient *) find_server_quick(prefix);
-		if (acptr->serv->numeric)
-		{
-			strcpy(pref, base64enc(acptr->serv->numeric));
-		}
-	}
-	strcpy(tcmd, token);
-	strcpy(ccmd, command);
-	strcat(tcmd, " ");
-	strcat(ccmd, " ");
+	servvar_pref(pref, prefix);
+	va_start(vl, pattern);
 	ircvsprintf(buff, pattern, vl);
-	strcat(tcmd, buff);
-	strcat(ccmd, buff);
+	va_end(vl);
 
+	servvar_begin();
 #ifdef NO_FDLIST
 	for (i = 0; i <= LastSlot; i++)
 #else
@@ -740,34 +1026,9 @@ void sendto_serv_butone_token(aClient *one, char *prefix, char *command,
 #ifdef NO_FDLIST
 		if (IsServer(cptr))
 #endif
-			if (IsToken(cptr))
-			{
-				if (SupportNS(cptr) && pref[0])
-				{
-					sendto_one(cptr, "@%s %s",
-						pref, tcmd);
-				}
-					else
-				{
-					sendto_one(cptr, ":%s %s",
-						prefix, tcmd);
-				}
-			}
-			else
-			{
-				if (SupportNS(cptr) && pref[0])
-				{
-					sendto_one(cptr, "@%s %s",
-						pref, ccmd);
-				}
-				else
-				{
-					sendto_one(cptr, ":%s %s", prefix,
-					    ccmd);
-				}
-			}
+			servvar_send_cmd(cptr, prefix, pref, command, token, buff);
 	}
-	va_end(vl);
+	servvar_end();
 	return;
 }
 
@@ -784,36 +1045,18 @@ void sendto_serv_butone_token_opt(aClient *one, int opt, char *prefix, char *com
 	va_list vl;
 	int  i;
 	aClient *cptr;
-	aClient *acptr;
 #ifndef NO_FDLIST
 	int  j;
 #endif
-	static char tcmd[2048];
-	static char ccmd[2048];
 	static char buff[2048];
 	static char pref[100];
 
+	servvar_pref(pref, prefix);
 	va_start(vl, pattern);
-
-	pref[0] = '\0';
-	if (strchr(prefix, '.'))
-	{
-		acptr = (aClient *) find_server_quick(prefix);
-		if (acptr && acptr->serv)
-			if (acptr->serv->numeric)
-			{
-				strcpy(pref, base64enc(acptr->serv->numeric));
-			}
-	}
-
-	strcpy(tcmd, token);
-	strcpy(ccmd, command);
-	strcat(tcmd, " ");
-	strcat(ccmd, " ");
 	ircvsprintf(buff, pattern, vl);
-	strcat(tcmd, buff);
-	strcat(ccmd, buff);
+	va_end(vl);
 
+	servvar_begin();
 #ifdef NO_FDLIST
 	for (i = 0; i <= LastSlot; i++)
 #else
@@ -823,7 +1066,8 @@ void sendto_serv_butone_token_opt(aClient *one, int opt, char *prefix, char *com
 		if (!(cptr = local[i]) || (one && cptr == one->from))
 			continue;
 #ifdef NO_FDLIST
-		if (IsServer(cptr))
+		if (!IsServer(cptr))
+			continue;
 #endif
 
 		if ((opt & OPT_NOT_SJOIN) && SupportSJOIN(cptr))
@@ -863,37 +1107,46 @@ void sendto_serv_butone_token_opt(aClient *one, int opt, char *prefix, char *com
 		if ((opt & OPT_NOT_NICKIP) && (cptr->proto & PROTO_NICKIP))
 			continue;
 
-		if (IsToken(cptr))
-		{
-			if (SupportNS(cptr) && pref[0])
-			{
-				sendto_one(cptr, "@%s %s",
-					pref, tcmd);
-			}
-				else
-			{
-				sendto_one(cptr, ":%s %s",
-					prefix, tcmd);
-			}
-		}
-		else
-		{
-			if (SupportNS(cptr) && pref[0])
-			{
-				sendto_one(cptr, "@%s %s",
-					pref, ccmd);
-			}
-			else
-			{
-				sendto_one(cptr, ":%s %s", prefix,
-				    ccmd);
-			}
-		}
+		servvar_send_cmd(cptr, prefix, pref, command, token, buff);
 	}
-	va_end(vl);
+	servvar_end();
 	return;
 }
 
+/*
+ * Send 'pattern' to all servers except 'one' for which 'cond' is true,
+ * formatting it only once. Used by the functions below.
+ */
+#ifdef NO_FDLIST
+#define SERV_BROADCAST(cond) \
+	for (i = 0; i <= LastSlot; i++) \
+	{ \
+		if (!(cptr = local[i]) || (one && cptr == one->from) || !IsServer(cptr) || !(cond)) \
+			continue; \
+		if (!servvar[0].len) \
+		{ \
+			va_start(vl, pattern); \
+			servvar_done(0, ircvsprintf(servvar[0].buf, pattern, vl)); \
+			va_end(vl); \
+		} \
+		servvar_send(cptr, 0); \
+	}
+#else
+#define SERV_BROADCAST(cond) \
+	for (i = serv_fdlist.entry[j = 1]; j <= serv_fdlist.last_entry; i = serv_fdlist.entry[++j]) \
+	{ \
+		if (!(cptr = local[i]) || (one && cptr == one->from) || !(cond)) \
+			continue; \
+		if (!servvar[0].len) \
+		{ \
+			va_start(vl, pattern); \
+			servvar_done(0, ircvsprintf(servvar[0].buf, pattern, vl)); \
+			va_end(vl); \
+		} \
+		servvar_send(cptr, 0); \
+	}
+#endif
+
 /*
  * sendto_serv_butone_quit
  *
@@ -908,27 +1161,10 @@ void sendto_serv_butone_quit(aClient *one, char *pattern, ...)
 #ifndef NO_FDLIST
 	int  j;
 #endif
-	va_start(vl, pattern);
-
-#ifdef NO_FDLIST
-	for (i = 0; i <= LastSlot; i++)
-#else
-	for (i = serv_fdlist.entry[j = 1]; j <= serv_fdlist.last_entry; i = serv_fdlist.entry[++j])
-#endif
-	{
-		if (!(cptr = local[i]) || (one && cptr == one->from))
-			continue;
-		va_start(vl, pattern);
 
-#ifdef NO_FDLIST
-		if (IsServer(cptr) && !DontSendQuit(cptr))
-#else
-		if (!DontSendQuit(cptr))
-#endif
-			vsendto_one(cptr, pattern, vl);
-		va_end(vl);
-	}
-	va_end(vl);
+	servvar_begin();
+	SERV_BROADCAST(!DontSendQuit(cptr));
+	servvar_end();
 	return;
 }
 
@@ -946,26 +1182,10 @@ void sendto_serv_butone_sjoin(aClient *one, char *pattern, ...)
 #ifndef NO_FDLIST
 	int  j;
 #endif
-	va_start(vl, pattern);
-#ifdef NO_FDLIST
-	for (i = 0; i <= LastSlot; i++)
-#else
-	for (i = serv_fdlist.entry[j = 1]; j <= serv_fdlist.last_entry; i = serv_fdlist.entry[++j])
-#endif
-	{
-		if (!(cptr = local[i]) || (one && cptr == one->from))
-			continue;
-		va_start(vl, pattern);
 
-#ifdef NO_FDLIST
-		if (IsServer(cptr) && !SupportSJOIN(cptr))
-#else
-		if (!SupportSJOIN(cptr))
-#endif
-			vsendto_one(cptr, pattern, vl);
-		va_end(vl);
-	}
-	va_end(vl);
+	servvar_begin();
+	SERV_BROADCAST(!SupportSJOIN(cptr));
+	servvar_end();
 	return;
 }
 
@@ -983,27 +1203,10 @@ void sendto_serv_sjoin(aClient *one, char *pattern, ...)
 #ifndef NO_FDLIST
 	int  j;
 #endif
-	va_start(vl, pattern);
 
-#ifdef NO_FDLIST
-	for (i = 0; i <= LastSlot; i++)
-#else
-	for (i = serv_fdlist.entry[j = 1]; j <= serv_fdlist.last_entry; i = serv_fdlist.entry[++j])
-#endif
-	{
-		if (!(cptr = local[i]) || (one && cptr == one->from))
-			continue;
-		va_start(vl, pattern);
-
-#ifdef NO_FDLIST
-		if (IsServer(cptr) && SupportSJOIN(cptr))
-#else
-		if (SupportSJOIN(cptr))
-#endif
-			vsendto_one(cptr, pattern, vl);
-		va_end(vl);
-	}
-	va_end(vl);
+	servvar_begin();
+	SERV_BROADCAST(SupportSJOIN(cptr));
+	servvar_end();
 	return;
 }
 
@@ -1021,27 +1224,10 @@ void sendto_serv_butone_nickv2(aClient *one, char *pattern, ...)
 #ifndef NO_FDLIST
 	int  j;
 #endif
-	va_start(vl, pattern);
 
-#ifdef NO_FDLIST
-	for (i = 0; i <= LastSlot; i++)
-#else
-	for (i = serv_fdlist.entry[j = 1]; j <= serv_fdlist.last_entry; i = serv_fdlist.entry[++j])
-#endif
-	{
-		if (!(cptr = local[i]) || (one && cptr == one->from))
-			continue;
-		va_start(vl, pattern);
-
-#ifdef NO_FDLIST
-		if (IsServer(cptr) && !SupportNICKv2(cptr))
-#else
-		if (!SupportNICKv2(cptr))
-#endif
-			vsendto_one(cptr, pattern, vl);
-		va_end(vl);
-	}
-	va_end(vl);
+	servvar_begin();
+	SERV_BROADCAST(!SupportNICKv2(cptr));
+	servvar_end();
 	return;
 }
 
@@ -1059,27 +1245,10 @@ void sendto_serv_nickv2(aClient *one, char *pattern, ...)
 #ifndef NO_FDLIST
 	int  j;
 #endif
-	va_start(vl, pattern);
-
-#ifdef NO_FDLIST
-	for (i = 0; i <= LastSlot; i++)
-#else
-	for (i = serv_fdlist.entry[j = 1]; j <= serv_fdlist.last_entry; i = serv_fdlist.entry[++j])
-#endif
-	{
-		if (!(cptr = local[i]) || (one && cptr == one->from))
-			continue;
-		va_start(vl, pattern);
 
-#ifdef NO_FDLIST
-		if (IsServer(cptr) && SupportNICKv2(cptr))
-#else
-		if (SupportNICKv2(cptr))
-#endif
-			vsendto_one(cptr, pattern, vl);
-		va_end(vl);
-	}
-	va_end(vl);
+	servvar_begin();
+	SERV_BROADCAST(SupportNICKv2(cptr));
+	servvar_end();
 	return;
 }
 
@@ -1094,13 +1263,13 @@ void sendto_serv_nickv2_token(aClient *one, char *pattern, char *tokpattern,
     ...)
 {
 	va_list vl;
-	int  i;
+	int  i, v;
 	aClient *cptr;
 #ifndef NO_FDLIST
 	int  j;
 #endif
-	va_start(vl, tokpattern);
 
+	servvar_begin();
 #ifdef NO_FDLIST
 	for (i = 0; i <= LastSlot; i++)
 #else
@@ -1109,24 +1278,22 @@ void sendto_serv_nickv2_token(aClient *one, char *pattern, char *tokpattern,
 	{
 		if (!(cptr = local[i]) || (one && cptr == one->from))
 			continue;
-		va_start(vl, tokpattern);
-
-#ifdef NO_FDLIST
-		if (IsServer(cptr) && SupportNICKv2(cptr) && !IsToken(cptr))
-#else
-		if (SupportNICKv2(cptr) && !IsToken(cptr))
-#endif
-			vsendto_one(cptr, pattern, vl);
-		else
 #ifdef NO_FDLIST
-		if (IsServer(cptr) && SupportNICKv2(cptr) && IsToken(cptr))
-#else
-		if (SupportNICKv2(cptr) && IsToken(cptr))
+		if (!IsServer(cptr))
+			continue;
 #endif
-			vsendto_one(cptr, tokpattern, vl);
-		va_end(vl);
+		if (!SupportNICKv2(cptr))
+			continue;
+		v = IsToken(cptr) ? SV_TOKEN : 0;
+		if (!servvar[v].len)
+		{
+			va_start(vl, tokpattern);
+			servvar_done(v, ircvsprintf(servvar[v].buf, v ? tokpattern : pattern, vl));
+			va_end(vl);
+		}
+		servvar_send(cptr, v);
 	}
-	va_end(vl);
+	servvar_end();
 	return;
 }
 
@@ -1144,6 +1311,7 @@ void sendto_common_channels(aClient *user, char *pattern, ...)
 	Member *users;
 	aClient *cptr;
 	int sendlen;
+	dbufshared *blk = NULL;
 
 	/* We now create the buffer _before_ we send it to the clients. -- Syzop */
 	*sendbuf = '\0';
@@ -1156,21 +1324,23 @@ void sendto_common_channels(aClient *user, char *pattern, ...)
 		sentalong[user->slot] = sentalong_marker;
 	if (user->user)
 		for (channels = user->user->channel; channels; channels = channels->next)
-			for (users = channels->chptr->members; users; users = users->next)
+			for (users = channels->chptr->lmembers; users; users = users->lnext)
 			{
 				cptr = users->cptr;
-				if (!MyConnect(cptr) || (cptr->slot < 0) || (sentalong[cptr->slot] == sentalong_marker))
+				if ((cptr->slot < 0) || (sentalong[cptr->slot] == sentalong_marker))
 					continue;
 				if ((channels->chptr->mode.mode & MODE_AUDITORIUM) &&
 				    !(is_chanownprotop(user, channels->chptr) || is_chanownprotop(cptr, channels->chptr)))
 					continue;
 				sentalong[cptr->slot] = sentalong_marker;
-				sendbufto_one(cptr, sendbuf, sendlen);
+				sendbufto_one_shared(cptr, sendbuf, sendlen, &blk);
 			}
 
 	if (MyConnect(user))
-		sendbufto_one(user, sendbuf, sendlen);
+		sendbufto_one_shared(user, sendbuf, sendlen, &blk);
 
+	if (blk)
+		dbuf_shared_release(blk);
 	return;
 }
 
@@ -1188,6 +1358,7 @@ void sendto_common_channels_local_butone(aClient *user, int cap, char *pattern,
 	Member *users;
 	aClient *cptr;
 	int sendlen;
+	dbufshared *blk = NULL;
 
 	/* We now create the buffer _before_ we send it to the clients. -- Syzop */
 	*sendbuf = '\0';
@@ -1201,20 +1372,22 @@ void sendto_common_channels_local_butone(aClient *user, int cap, char *pattern,
 	if (user->user)
 	{
 		for (channels = user->user->channel; channels; channels = channels->next)
-			for (users = channels->chptr->members; users; users = users->next)
+			for (users = channels->chptr->lmembers; users; users = users->lnext)
 			{
 				cptr = users->cptr;
-				if (!MyConnect(cptr) || (cptr->slot < 0) || (sentalong[cptr->slot] == sentalong_marker) ||
+				if ((cptr->slot < 0) || (sentalong[cptr->slot] == sentalong_marker) ||
 				    !CHECKPROTO(cptr, cap))
 					continue;
 				if ((channels->chptr->mode.mode & MODE_AUDITORIUM) &&
 				    !(is_chanownprotop(user, channels->chptr) || is_chanownprotop(cptr, channels->chptr)))
 					continue;
 				sentalong[cptr->slot] = sentalong_marker;
-				sendbufto_one(cptr, sendbuf, sendlen);
+				sendbufto_one_shared(cptr, sendbuf, sendlen, &blk);
 			}
 	}
 
+	if (blk)
+		dbuf_shared_release(blk);
 	return;
 }
 
@@ -1229,8 +1402,8 @@ void sendto_channel_butserv(aChannel *chptr, aClient *from, char *pattern, ...)
 {
 	va_list vl;
 	Member *lp;
-	aClient *acptr;
 	int sendlen;
+	dbufshared *blk = NULL;
 
 	/* We now create the buffer _before_ we send it to the clients. Rather than
 	 * rebuilding the buffer 1000 times for a 1000 local-users channel. -- Syzop
@@ -1240,10 +1413,11 @@ void sendto_channel_butserv(aChannel *chptr, aClient *from, char *pattern, ...)
 	sendlen = vmakebuf_local_withprefix(sendbuf, from, pattern, vl);
 	va_end(vl);
 
-	for (lp = chptr->members; lp; lp = lp->next)
-		if (MyConnect(acptr = lp->cptr))
-			sendbufto_one(acptr, sendbuf, sendlen);
+	for (lp = chptr->lmembers; lp; lp = lp->lnext)
+		sendbufto_one_shared(lp->cptr, sendbuf, sendlen, &blk);
 
+	if (blk)
+		dbuf_shared_release(blk);
 	return;
 }
 
@@ -1252,19 +1426,24 @@ void sendto_channel_butserv_butone(aChannel *chptr, aClient *from, aClient *one,
 	va_list vl;
 	Member *lp;
 	aClient *acptr;
+	int sendlen = 0;
+	dbufshared *blk = NULL;
 
-	for (va_start(vl, pattern), lp = chptr->members; lp; lp = lp->next)
+	for (lp = chptr->lmembers; lp; lp = lp->lnext)
 	{
-		if (lp->cptr == one)
+		if ((acptr = lp->cptr) == one)
 			continue;
-		if (MyConnect(acptr = lp->cptr))
+		/* Build the buffer once, on the first local member */
+		if (!sendlen)
 		{
 			va_start(vl, pattern);
-			vsendto_prefix_one(acptr, from, pattern, vl);
+			sendlen = vmakebuf_local_withprefix(sendbuf, from, pattern, vl);
 			va_end(vl);
 		}
+		sendbufto_one_shared(acptr, sendbuf, sendlen, &blk);
 	}
-	va_end(vl);
+	if (blk)
+		dbuf_shared_release(blk);
 	return;
 }
 
@@ -34,6 +34,8 @@ extern int errno;		/* ...seems that errno.h doesn't define this everywhere */
 #ifdef DEBUGMODE
 int  writecalls = 0, writeb[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 #endif
+
+static int deliver_it_done(aClient *cptr, int retval);
 	
 
 /*
@@ -61,7 +63,6 @@ int  writecalls = 0, writeb[10] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 int  deliver_it(aClient *cptr, char *str, int len)
 {
 	int  retval;
-	aClient *acpt = cptr->listener;
 
 #ifdef	DEBUGMODE
 	writecalls++;
@@ -90,6 +91,19 @@ int  deliver_it(aClient *cptr, char *str, int len)
 	else
 #endif
 		retval = send(cptr->fd, str, len, 0);
+#endif
+	return deliver_it_done(cptr, retval);
+}
+
+/*
+** deliver_it_done
+**	Common tail of deliver_it() and deliver_itv(): map "would block"
+**	to 0 bytes written and update the statistics.
+*/
+static int deliver_it_done(aClient *cptr, int retval)
+{
+	aClient *acpt = cptr->listener;
+
 	/*
 	   ** Convert WOULDBLOCK to a return of "0 bytes moved". This
 	   ** should occur only if socket was non-blocking. Note, that
@@ -114,7 +128,6 @@ int  deliver_it(aClient *cptr, char *str, int len)
 			ClearBlocked(cptr);
 		}
 
-#endif
 #ifdef DEBUGMODE
 	if (retval < 0)
 	{
@@ -143,31 +156,103 @@ int  deliver_it(aClient *cptr, char *str, int len)
 #endif
 	if (retval > 0)
 	{
-		cptr->sendB += retval;
-		me.sendB += retval;
-		if (cptr->sendB > 1023)
+		cptr->conn->sendB += retval;
+		me.conn->sendB += retval;
+		if (cptr->conn->sendB > 1023)
 		{
-			cptr->sendK += (cptr->sendB >> 10);
-			cptr->sendB &= 0x03ff;	/* 2^10 = 1024, 3ff = 1023 */
+			cptr->conn->sendK += (cptr->conn->sendB >> 10);
+			cptr->conn->sendB &= 0x03ff;	/* 2^10 = 1024, 3ff = 1023 */
 		}
 		if (acpt != &me)
 		{
-			acpt->sendB += retval;
-			if (acpt->sendB > 1023)
+			acpt->conn->sendB += retval;
+			if (acpt->conn->sendB > 1023)
 			{
-				acpt->sendK += (acpt->sendB >> 10);
-				acpt->sendB &= 0x03ff;
+				acpt->conn->sendK += (acpt->conn->sendB >> 10);
+				acpt->conn->sendB &= 0x03ff;
 			}
 		}
-		if (me.sendB > 1023)
+		if (me.conn->sendB > 1023)
 		{
-			me.sendK += (me.sendB >> 10);
-			me.sendB &= 0x03ff;
+			me.conn->sendK += (me.conn->sendB >> 10);
+			me.conn->sendB &= 0x03ff;
 		}
 	}
 	return (retval);
 }
 
+#ifndef _WIN32
+/*
+** deliver_itv
+**	Same as deliver_it(), but writes the data described by an
+**	iovec array (see dbuf_mapv()) with a single writev() call.
+**	SSL has no such thing, so for SSL connections the data is
+**	gathered into record sized chunks for SSL_write() instead of
+**	doing one (small) SSL record per dbuf buffer.
+*/
+int  deliver_itv(aClient *cptr, struct iovec *iov, int iovcnt)
+{
+	int  retval;
+#ifdef USE_SSL
+	static char sslbuf[16384];	/* max. SSL record size */
+	int  i, off, len, chunk, n;
+#endif
+
+	if (iovcnt == 1)
+		return deliver_it(cptr, iov[0].iov_base, iov[0].iov_len);
+#ifdef	DEBUGMODE
+	writecalls++;
+#endif
+	if (IsDead(cptr) || (!IsServer(cptr) && !IsPerson(cptr)
+	    && !IsHandshake(cptr) 
+#ifdef USE_SSL
+	    && !IsSSLHandshake(cptr)
+#endif 
+	    && !IsUnknown(cptr)))
+	{
+		sendto_ops
+		    ("* * * DEBUG ERROR * * * !!! Calling deliver_itv() for %s, status %d %s",
+		    cptr->name, cptr->status, IsDead(cptr) ? "DEAD" : "");
+		return -1;
+	}
+
+#ifdef USE_SSL
+	if (cptr->flags & FLAGS_SSL)
+	{
+		/* Write it out one full SSL record at a time */
+		retval = 0;
+		for (i = 0, off = 0; i < iovcnt;)
+		{
+			for (len = 0; (i < iovcnt) && (len < sizeof(sslbuf));)
+			{
+				chunk = MIN(iov[i].iov_len - off, sizeof(sslbuf) - len);
+				memcpy(sslbuf + len, (char *)iov[i].iov_base + off, chunk);
+				len += chunk;
+				off += chunk;
+				if (off == iov[i].iov_len)
+				{
+					i++;
+					off = 0;
+				}
+			}
+			if ((n = ircd_SSL_write(cptr, sslbuf, len)) <= 0)
+			{
+				if (retval == 0)
+					retval = n; /* nothing written at all */
+				break;
+			}
+			retval += n;
+			if (n < len)
+				break;
+		}
+	}
+	else
+#endif
+		retval = writev(cptr->fd, iov, iovcnt);
+	return deliver_it_done(cptr, retval);
+}
+#endif
+
 char	*Inet_si2pB(struct SOCKADDR_IN *sin, char *buf, int sz)
 {
 #ifdef INET6
@@ -204,6 +204,8 @@ SSL_CTX *ctx_server;
 	SSL_CTX_set_verify(ctx_server, SSL_VERIFY_PEER|SSL_VERIFY_CLIENT_ONCE
 			| (iConf.ssl_options & SSLFLAG_FAILIFNOCERT ? SSL_VERIFY_FAIL_IF_NO_PEER_CERT : 0), ssl_verify_callback);
 	SSL_CTX_set_session_cache_mode(ctx_server, SSL_SESS_CACHE_OFF);
+	/* deliver_itv() may retry a write from a different buffer */
+	SSL_CTX_set_mode(ctx_server, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 
 	if (SSL_CTX_use_certificate_chain_file(ctx_server, SSL_SERVER_CERT_PEM) <= 0)
 	{
@@ -256,6 +258,7 @@ SSL_CTX *ctx_client;
 	}
 	SSL_CTX_set_default_passwd_cb(ctx_client, ssl_pem_passwd_cb);
 	SSL_CTX_set_session_cache_mode(ctx_client, SSL_SESS_CACHE_OFF);
+	SSL_CTX_set_mode(ctx_client, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 	if (SSL_CTX_use_certificate_file(ctx_client, SSL_SERVER_CERT_PEM, SSL_FILETYPE_PEM) <= 0)
 	{
 		mylog("Failed to load SSL certificate %s (client)", SSL_SERVER_CERT_PEM);
@@ -667,6 +670,7 @@ static int fatal_ssl_error(int ssl_error, int where, int my_errno, aClient *sptr
      * IRC protocol wasn`t SSL enabled .. --vejeta
      */
     sptr->flags |= FLAGS_DEADSOCKET;
+    set_ping_timer(sptr, 0);
     sendto_snomask(SNO_JUNK, "Exiting ssl client %s: %s: %s",
     	get_client_name(sptr, TRUE), ssl_func, ssl_errstr);
 	